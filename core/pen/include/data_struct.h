@@ -73,6 +73,21 @@ static void* stb__sbgrowf(void* arr, int increment, int itemsize)
 
 namespace pen
 {
+    // pad hot atomics onto their own cache line to avoid false sharing between producer and consumer
+    static const u32 k_cache_line_size = 64;
+
+    // what a producer does when a bounded container is full
+    namespace e_full_policy
+    {
+        enum full_policy_t
+        {
+            wait, // yield the thread until space is available
+            spin, // busy wait until space is available, for short waits on latency sensitive threads
+            fail  // return false and drop the item, so the caller can decide
+        };
+    }
+    typedef e_full_policy::full_policy_t full_policy;
+
     // lightweight stack - single threaded
     template <typename T>
     struct stack
@@ -87,24 +102,65 @@ namespace pen
     };
 
     // lockless single producer single consumer - thread safe ring buffer
+    // the item returned by get remains owned by the consumer until the next call to get, so it cannot be overwritten.
+    // when full, put follows the full_policy passed to create.
     template <typename T>
     struct ring_buffer
     {
-        T* data = nullptr;
+        T*          data = nullptr;
+        u32         _capacity;
+        full_policy _policy;
+        bool        _pending; // consumer side, get_pos is still in use
 
+        u8    _pad0[k_cache_line_size];
         a_u32 get_pos;
+        u8    _pad1[k_cache_line_size - sizeof(a_u32)];
         a_u32 put_pos;
-        a_u32 _capacity;
+        u8    _pad2[k_cache_line_size - sizeof(a_u32)];
 
         ring_buffer();
         ~ring_buffer();
 
-        void create(u32 capacity);
-        void put(const T& item);
+        void create(u32 capacity, full_policy policy = e_full_policy::wait);
+        bool put(const T& item);
+        u32  put_batch(const T* items, u32 count);
         T*   get();
+        u32  get_batch(T* items, u32 max_count);
         T*   check();
     };
 
+    // lockless multiple producer multiple consumer - bounded queue, capacity must be a power of 2.
+    // each cell has a sequence number so producers and consumers only contend on the cell they are claiming.
+    template <typename T>
+    struct mpmc_queue
+    {
+        struct cell
+        {
+            a_size_t sequence;
+            T        item;
+        };
+
+        cell*       _cells = nullptr;
+        size_t      _mask = 0;
+        full_policy _policy;
+
+        u8       _pad0[k_cache_line_size];
+        a_size_t _put_pos;
+        u8       _pad1[k_cache_line_size - sizeof(a_size_t)];
+        a_size_t _get_pos;
+        u8       _pad2[k_cache_line_size - sizeof(a_size_t)];
+
+        ~mpmc_queue();
+
+        void create(u32 capacity, full_policy policy = e_full_policy::wait);
+        bool try_put(const T& item);
+        bool try_get(T& item);
+        bool put(const T& item);
+        u32  put_batch(const T* items, u32 count);
+        u32  get_batch(T* items, u32 max_count);
+        bool empty();
+    };
+
     // lockless single producer multiple consumer - thread safe resource pool which will grow to accomodate contents
     template <typename T>
     struct res_pool
@@ -162,6 +218,26 @@ namespace pen
         void grow(size_t size);
     };
 
+    // lockless single producer single consumer triple buffer. the producer never writes the buffer the consumer
+    // acquired last, so the consumer may keep reading it until it calls acquire again
+    template <typename T>
+    struct triple_buffer
+    {
+        static const u32 k_fresh = 1 << 31;
+
+        T     _data[3];
+        u32   _bb;     // producer only
+        u32   _fb;     // consumer only
+        a_u32 _latest; // last published buffer, with k_fresh set until the consumer takes it
+
+        triple_buffer();
+
+        T&       backbuffer();
+        const T& frontbuffer();
+        const T& acquire();
+        void     publish();
+    };
+
     // multiple producer, multiple consumer buffer - partially lock-free but will lock when re-sizing.
     template <typename T>
     struct mpmc_stretchy_buffer
@@ -219,12 +295,29 @@ namespace pen
         return pos;
     }
 
+    // wait for space in a full container, returns false if the policy is to fail
+    pen_inline bool full_policy_wait(full_policy policy)
+    {
+        switch (policy)
+        {
+            case e_full_policy::wait:
+                pen::thread_sleep_ms(0);
+                return true;
+            case e_full_policy::spin:
+                return true;
+            default:
+                return false;
+        }
+    }
+
     template <typename T>
     pen_inline ring_buffer<T>::ring_buffer()
     {
         get_pos = 0;
         put_pos = 0;
         _capacity = 0;
+        _policy = e_full_policy::wait;
+        _pending = false;
     }
 
     template <typename T>
@@ -234,44 +327,236 @@ namespace pen
     }
 
     template <typename T>
-    inline void ring_buffer<T>::create(u32 capacity)
+    inline void ring_buffer<T>::create(u32 capacity, full_policy policy)
     {
         get_pos = 0;
         put_pos = 0;
-        _capacity = capacity;
+        _pending = false;
+        _policy = policy;
+
+        // one slot is always left empty to tell full from empty
+        _capacity = capacity + 1;
 
-        data = (T*)pen::memory_alloc(sizeof(T) * _capacity.load());
-        memset(data, 0x0, sizeof(T) * _capacity.load());
+        data = (T*)pen::memory_alloc(sizeof(T) * _capacity);
+        memset((void*)data, 0x0, sizeof(T) * _capacity);
     }
 
     template <typename T>
-    pen_inline void ring_buffer<T>::put(const T& item)
+    pen_inline bool ring_buffer<T>::put(const T& item)
     {
-        data[put_pos] = item;
-        put_pos = (put_pos + 1) % _capacity;
+        u32 pp = put_pos;
+        u32 np = (pp + 1) % _capacity;
+
+        while (np == get_pos)
+            if (!full_policy_wait(_policy))
+                return false;
+
+        data[pp] = item;
+        put_pos = np;
+        return true;
+    }
+
+    template <typename T>
+    inline u32 ring_buffer<T>::put_batch(const T* items, u32 count)
+    {
+        u32 written = 0;
+        while (written < count)
+        {
+            u32 pp = put_pos;
+            u32 space = (get_pos + _capacity - pp - 1) % _capacity;
+            if (space == 0)
+            {
+                if (!full_policy_wait(_policy))
+                    break;
+
+                continue;
+            }
+
+            // publish as many as fit in one go
+            u32 num = min<u32>(space, count - written);
+            for (u32 i = 0; i < num; ++i)
+                data[(pp + i) % _capacity] = items[written + i];
+
+            put_pos = (pp + num) % _capacity;
+            written += num;
+        }
+
+        return written;
     }
 
     template <typename T>
     pen_inline T* ring_buffer<T>::get()
     {
+        // release the item handed out by the previous get
         u32 gp = get_pos;
+        if (_pending)
+        {
+            gp = (gp + 1) % _capacity;
+            get_pos = gp;
+            _pending = false;
+        }
+
         if (gp == put_pos)
             return nullptr;
 
-        get_pos = (get_pos + 1) % _capacity;
-
+        _pending = true;
         return &data[gp];
     }
-    
+
+    template <typename T>
+    inline u32 ring_buffer<T>::get_batch(T* items, u32 max_count)
+    {
+        u32 gp = get_pos;
+        if (_pending)
+        {
+            gp = (gp + 1) % _capacity;
+            _pending = false;
+        }
+
+        u32 available = (put_pos + _capacity - gp) % _capacity;
+        u32 num = min<u32>(available, max_count);
+        for (u32 i = 0; i < num; ++i)
+            items[i] = data[(gp + i) % _capacity];
+
+        get_pos = (gp + num) % _capacity;
+        return num;
+    }
+
     template <typename T>
     pen_inline T* ring_buffer<T>::check()
     {
         u32 gp = get_pos;
+        if (_pending)
+            gp = (gp + 1) % _capacity;
+
         if (gp == put_pos)
             return nullptr;
+
         return &data[gp];
     }
 
+    template <typename T>
+    inline mpmc_queue<T>::~mpmc_queue()
+    {
+        pen::memory_free(_cells);
+    }
+
+    template <typename T>
+    inline void mpmc_queue<T>::create(u32 capacity, full_policy policy)
+    {
+        PEN_ASSERT(capacity >= 2 && (capacity & (capacity - 1)) == 0);
+
+        // items are always written before they are read, only the sequence numbers need initialising
+        _cells = (cell*)pen::memory_alloc(sizeof(cell) * capacity);
+        for (u32 i = 0; i < capacity; ++i)
+            _cells[i].sequence = i;
+
+        _mask = capacity - 1;
+        _policy = policy;
+        _put_pos = 0;
+        _get_pos = 0;
+    }
+
+    template <typename T>
+    inline bool mpmc_queue<T>::try_put(const T& item)
+    {
+        size_t pos = _put_pos.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            cell*  c = &_cells[pos & _mask];
+            size_t seq = c->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+            if (diff == 0)
+            {
+                // cell is free, claim it
+                if (_put_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    c->item = item;
+                    c->sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                // full
+                return false;
+            }
+            else
+            {
+                pos = _put_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    template <typename T>
+    inline bool mpmc_queue<T>::try_get(T& item)
+    {
+        size_t pos = _get_pos.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            cell*  c = &_cells[pos & _mask];
+            size_t seq = c->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+
+            if (diff == 0)
+            {
+                // cell has been written, claim it
+                if (_get_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    item = c->item;
+                    c->sequence.store(pos + _mask + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                // empty
+                return false;
+            }
+            else
+            {
+                pos = _get_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    template <typename T>
+    pen_inline bool mpmc_queue<T>::put(const T& item)
+    {
+        while (!try_put(item))
+            if (!full_policy_wait(_policy))
+                return false;
+
+        return true;
+    }
+
+    template <typename T>
+    inline u32 mpmc_queue<T>::put_batch(const T* items, u32 count)
+    {
+        for (u32 i = 0; i < count; ++i)
+            if (!put(items[i]))
+                return i;
+
+        return count;
+    }
+
+    template <typename T>
+    inline u32 mpmc_queue<T>::get_batch(T* items, u32 max_count)
+    {
+        u32 num = 0;
+        while (num < max_count && try_get(items[num]))
+            ++num;
+
+        return num;
+    }
+
+    template <typename T>
+    pen_inline bool mpmc_queue<T>::empty()
+    {
+        return _get_pos.load() == _put_pos.load();
+    }
+
     template <typename T>
     pen_inline res_pool<T>::res_pool()
     {
@@ -303,7 +588,7 @@ namespace pen
             _resources = (T*)pen::memory_realloc(_resources, new_cap * sizeof(T));
 
             size_t existing_offset = _capacity * sizeof(T);
-            memset(((u8*)_resources) + existing_offset, 0x0, sizeof(T) * _capacity);
+            memset(((u8*)_resources) + existing_offset, 0x0, sizeof(T) * (new_cap - _capacity));
 
             _capacity = new_cap;
         }
@@ -356,6 +641,42 @@ namespace pen
         _swaps++;
     }
 
+    template <typename T>
+    pen_inline triple_buffer<T>::triple_buffer()
+    {
+        _bb = 0;
+        _latest = 1;
+        _fb = 2;
+    }
+
+    template <typename T>
+    pen_inline T& triple_buffer<T>::backbuffer()
+    {
+        return _data[_bb];
+    }
+
+    template <typename T>
+    pen_inline const T& triple_buffer<T>::frontbuffer()
+    {
+        return _data[_fb];
+    }
+
+    template <typename T>
+    pen_inline const T& triple_buffer<T>::acquire()
+    {
+        // hand the held buffer back only when there is a newer one to take in its place
+        if (_latest.load() & k_fresh)
+            _fb = _latest.exchange(_fb) & ~k_fresh;
+
+        return _data[_fb];
+    }
+
+    template <typename T>
+    pen_inline void triple_buffer<T>::publish()
+    {
+        _bb = _latest.exchange(_bb | k_fresh) & ~k_fresh;
+    }
+
     template <typename T, size_t N>
     pen_inline multi_array_buffer<T, N>::multi_array_buffer()
     {
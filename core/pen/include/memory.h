@@ -4,7 +4,7 @@
 
 // Minimalist memory api wrapping up malloc and free.
 // It provides some very minor portability solutions between win32 and osx and linux.
-// Mostly it is here to intercept allocs, so at a later date custom allocation or tracking schemes could be used.
+// Allocs are intercepted to track usage per subsystem, and to pool small allocations.
 
 #pragma once
 
@@ -32,54 +32,76 @@
 
 namespace pen
 {
+    // Allocations are tagged by subsystem so live bytes and counts can be tracked at runtime.
+    // Unless a tag is passed explicitly the calling thread's current tag is used, so long lived threads can set their
+    // tag once on entry. Small allocations are served from size class pools with a per thread cache.
+    // All memory must be returned with memory_free, it cannot be mixed with malloc / free.
+
+    namespace e_mem_tag
+    {
+        enum mem_tag_t
+        {
+            general,
+            renderer,
+            ecs,
+            physics,
+            json,
+            loader,
+            audio,
+            COUNT
+        };
+    }
+    typedef e_mem_tag::mem_tag_t mem_tag;
+
+    struct memory_stats
+    {
+        size_t live_bytes;
+        size_t live_count;
+        size_t total_count;
+        size_t peak_bytes;
+    };
+
     // Functions
 
     void* memory_alloc(size_t size_bytes);
+    void* memory_alloc(size_t size_bytes, mem_tag tag);
+    void* memory_calloc(size_t count, size_t size_bytes);
     void* memory_alloc_align(size_t size_bytes, size_t alignment);
     void* memory_realloc(void* mem, size_t size_bytes);
     void  memory_free(void* mem);
     void  memory_free_align(void* mem);
     void  memory_zero(void* dest, size_t size_bytes);
 
-    // Implementation
+    // Tags and stats
 
-    inline void* memory_alloc(size_t size_bytes)
-    {
-        return malloc(size_bytes);
-    }
+    void      memory_set_thread_tag(mem_tag tag);
+    mem_tag   memory_get_thread_tag();
+    const c8* memory_get_tag_name(mem_tag tag);
+    void      memory_get_stats(mem_tag tag, memory_stats& stats);
 
-    inline void* memory_calloc(size_t count, size_t size_bytes)
+    // Sets the calling thread's tag for the duration of a scope
+    struct memory_tag_scope
     {
-        return calloc(count, size_bytes);
-    }
+        mem_tag prev;
 
-    inline void* memory_realloc(void* mem, size_t size_bytes)
-    {
-        return realloc(mem, size_bytes);
-    }
+        memory_tag_scope(mem_tag tag)
+        {
+            prev = memory_get_thread_tag();
+            memory_set_thread_tag(tag);
+        }
 
-    inline void memory_free(void* mem)
-    {
-        free(mem);
-    }
+        ~memory_tag_scope()
+        {
+            memory_set_thread_tag(prev);
+        }
+    };
+
+    // Implementation
 
     inline void memory_zero(void* dest, size_t size_bytes)
     {
         memset(dest, 0x00, size_bytes);
     }
-
-    inline void* memory_alloc_align(size_t size_bytes, size_t alignment)
-    {
-        void* mem;
-        PEN_MEM_ALIGN_ALLOC(mem, alignment, size_bytes);
-
-        return mem;
-    }
-
-    inline void memory_free_align(void* mem)
-    {
-        PEN_MEM_ALIGN_FREE(mem);
-    }
 } // namespace pen
 
 // And override global new and delete
@@ -26,10 +26,11 @@ namespace pen
 
     // Implementation
 
+    // the result is owned by the caller and must be released with memory_free
     inline c8* sub_string(const c8* src, u32 length)
     {
         u32 padded_length = length + 1;
-        c8* new_string = (c8*)malloc(padded_length);
+        c8* new_string = (c8*)memory_alloc(padded_length);
         memcpy(new_string, src, length);
         new_string[length] = '\0';
 
@@ -0,0 +1,57 @@
+// profiler.h
+// Copyright 2014 - 2019 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+// Low overhead hierarchical cpu profiler, always compiled in and toggled at runtime.
+// Each thread writes completed scopes into its own ring buffer which only it writes, so recording is lock-free.
+// Scopes are tagged with the renderer frame index they began in, so a frame can be lined up across threads.
+// Recorded scopes can be read back from any thread while recording, or exported as chrome trace json which can be
+// opened in chrome://tracing or perfetto.
+
+#pragma once
+
+#include "pen.h"
+
+namespace pen
+{
+    struct profile_event
+    {
+        const c8* name;
+        f64       start_us;
+        f64       end_us;
+        u64       frame;
+        u32       depth;
+    };
+
+    static const u64 k_profile_all_frames = (u64)-1;
+
+    // Recording
+    void profiler_enable(bool enable);
+    bool profiler_is_enabled();
+    void profiler_begin(const c8* name); // name is not copied, it must outlive the recorded events
+    void profiler_end();
+
+    // Reading
+    u32       profiler_get_num_threads();
+    const c8* profiler_get_thread_name(u32 thread);
+    u32       profiler_get_events(u32 thread, u64 frame, profile_event* events, u32 max_events);
+    bool      profiler_export_chrome_trace(const c8* filename);
+
+    class profile_scope
+    {
+      public:
+        profile_scope(const c8* name)
+        {
+            profiler_begin(name);
+        }
+
+        ~profile_scope()
+        {
+            profiler_end();
+        }
+    };
+} // namespace pen
+
+#define PEN_PROFILE_CONCAT_(A, B) A##B
+#define PEN_PROFILE_CONCAT(A, B) PEN_PROFILE_CONCAT_(A, B)
+#define PEN_PROFILE_SCOPE(name) pen::profile_scope PEN_PROFILE_CONCAT(_profile_scope_, __LINE__)(name)
@@ -312,6 +312,27 @@ namespace pen
         void (*call_back_function)(void*, u32, u32, u32);
     };
 
+    // counted as commands are executed on the render thread, so they are the same for every backend
+    struct renderer_frame_stats
+    {
+        u32 draw_calls;
+        u32 instances;
+        u32 dispatches;
+        u32 state_changes; // shaders, buffers, textures, targets, viewports and pipeline state bound
+        u32 resources_created;
+        u32 resources_released;
+        u64 bytes_uploaded; // buffer updates and initial buffer and texture data
+    };
+
+    // cmd stream cost of the last presented frame, fixed_bytes is what the same cmds cost before they were packed
+    struct renderer_cmd_stats
+    {
+        u32 cmds;
+        u32 bytes;
+        u32 fixed_bytes;
+        f32 consume_ms; // render thread time spent consuming cmds
+    };
+
     enum e_texture_bind_flags
     {
         TEXTURE_BIND_NO_FLAGS = 0,
@@ -375,6 +396,7 @@ namespace pen
     void        renderer_test_enable();
     
     // public-api will buffer all commands for dispatch on dedicated thread
+    // create functions return versioned handles, a handle used after its release is ignored or asserts in debug
     void        renderer_new_frame();
     void        renderer_set_current_ctx(render_ctx ctx);
     render_ctx  renderer_get_main_context();
@@ -437,6 +459,20 @@ namespace pen
     void        renderer_consume_cmd_buffer();
     void        renderer_update_queries();
     void        renderer_get_present_time(f32& cpu_ms, f32& gpu_ms);
+    void        renderer_get_cmd_stats(renderer_cmd_stats& stats);
+    void        renderer_get_frame_stats(renderer_frame_stats& stats); // stats for the last presented frame
+
+    // command lists allow renderer_* calls to be recorded concurrently from job threads, they can be created from any
+    // thread and are reused every frame. begin binds a list to the calling thread, all commands issued on that thread
+    // are recorded into it until end. lists are appended to the main command buffer in the order passed to submit,
+    // which must be called from the thread which owns the main command buffer. resources can be created while
+    // recording a list, the handle is valid immediately but the resource only exists once the list is submitted.
+    // a list must be submitted in the same frame it was begun in, before renderer_present. release must happen on the
+    // owning thread.
+    u32         renderer_create_cmd_list();
+    void        renderer_begin_cmd_list(u32 list);
+    void        renderer_end_cmd_list();
+    void        renderer_submit_cmd_lists(const u32* lists, u32 num_lists);
  
     namespace direct
     {
@@ -3,33 +3,60 @@
 // License: https://github.com/polymonster/pmtech/blob/master/license.md
 
 // Simple slot resource api can be used to allocate an array slot to a generic opaque resource via a handle.
-// Implements a free list so getting a new resource slot is an o(1) operation.
-// will grow to accomodate more items
+// Implements a lock-free free list so getting a new resource slot is an o(1) operation from any thread.
+// Slots live in fixed size pages which are never moved, so it will grow to accomodate more items while other
+// threads are allocating, freeing or validating.
+// Each slot has a generation which is bumped when it is freed, a versioned handle combines the slot index and
+// generation so a stale handle can be detected in o(1) after its slot has been reused.
+// Resources which are destroyed later can retire their handle first, it stops validating straight away while the slot
+// stays out of the free list until it is freed.
+// With PEN_SLOT_RESOURCES_DEBUG enabled (on by default in debug builds) double frees and use of freed slots assert.
 
 #pragma once
 
+#include "console.h"
+#include "memory.h"
 #include "pen.h"
 
+#ifndef PEN_SLOT_RESOURCES_DEBUG
+#ifdef NDEBUG
+#define PEN_SLOT_RESOURCES_DEBUG 0
+#else
+#define PEN_SLOT_RESOURCES_DEBUG 1
+#endif
+#endif
+
 namespace pen
 {
     enum e_resource_flags
     {
         RESOURCE_FREE = 1,
-        RESOURCE_USED = 1 << 1
+        RESOURCE_USED = 1 << 1,
+        RESOURCE_RETIRED = 1 << 2 // handle invalidated, slot waiting to be freed
+    };
+
+    enum slot_resource_constants
+    {
+        k_slot_page_size = 1024,
+        k_slot_max_pages = 4096,
+        k_slot_index_bits = 24,
+        k_slot_index_mask = (1 << k_slot_index_bits) - 1,
+        k_slot_generation_mask = 0xff
     };
 
     struct free_slot_list
     {
-        u32             index;
-        free_slot_list* next;
-        u32             flags;
+        a_u32 next;
+        a_u32 generation;
+        a_u32 flags;
     };
 
     struct slot_resources
     {
-        free_slot_list* slots;
-        free_slot_list* head;
-        u32             _capacity;
+        free_slot_list*  pages[k_slot_max_pages];
+        a_u64            head;       // low 32 bits index of first free slot (0 = none), high 32 bits aba tag
+        a_u32            _capacity;
+        std::atomic_flag grow_lock = ATOMIC_FLAG_INIT;
     };
 
     // Function decl
@@ -37,83 +64,185 @@ namespace pen
     void slot_resources_init(slot_resources* resources, u32 num);
     u32  slot_resources_get_next(slot_resources* resources);
     bool slot_resources_free(slot_resources* resources, const u32 slot);
+    bool slot_resources_is_used(slot_resources* resources, const u32 slot);
+
+    // versioned handles, 24 bit slot index and 8 bit generation
+    u32  slot_resources_get_handle(slot_resources* resources, const u32 slot);
+    u32  slot_resources_handle_slot(const u32 handle);
+    bool slot_resources_validate(slot_resources* resources, const u32 handle);
+    bool slot_resources_retire(slot_resources* resources, const u32 handle);
 
     // Implementation
-    inline void slot_resources_grow(slot_resources* resources)
+    pen_inline free_slot_list& slot_resources_get_slot(slot_resources* resources, u32 slot)
     {
-        u32 cur_cap = resources->_capacity;
-        u32 new_cap = resources->_capacity * 2;
+        return resources->pages[slot / k_slot_page_size][slot % k_slot_page_size];
+    }
 
-        resources->slots = (free_slot_list*)pen::memory_realloc(resources->slots, sizeof(free_slot_list) * new_cap);
+    inline void slot_resources_push_chain(slot_resources* resources, u32 first, u32 last)
+    {
+        u64 h = resources->head.load();
+        for (;;)
+        {
+            slot_resources_get_slot(resources, last).next = (u32)h;
+
+            u64 nh = ((h >> 32) + 1) << 32 | first;
+            if (resources->head.compare_exchange_weak(h, nh))
+                break;
+        }
+    }
 
-        // init free list
-        for (s32 i = new_cap - 1; i > cur_cap; --i)
+    inline void slot_resources_alloc_page(slot_resources* resources, u32 page)
+    {
+        PEN_ASSERT(page < k_slot_max_pages);
+
+        u32             first = page * k_slot_page_size;
+        free_slot_list* slots = (free_slot_list*)pen::memory_alloc(sizeof(free_slot_list) * k_slot_page_size);
+        for (u32 i = 0; i < k_slot_page_size; ++i)
         {
-            resources->slots[i].index = i;
+            slots[i].next = first + i + 1;
+            slots[i].generation = 0;
+            slots[i].flags = RESOURCE_FREE;
+        }
+
+        resources->pages[page] = slots;
+    }
 
-            if (i >= new_cap - 1)
-                resources->slots[i].next = nullptr;
-            else
-                resources->slots[i].next = resources->head;
+    inline void slot_resources_grow(slot_resources* resources)
+    {
+        while (resources->grow_lock.test_and_set(std::memory_order_acquire))
+            ;
 
-            resources->head = &resources->slots[i];
+        // another thread may have grown while we waited
+        if ((u32)resources->head.load() == 0)
+        {
+            u32 cur_cap = resources->_capacity;
+            slot_resources_alloc_page(resources, cur_cap / k_slot_page_size);
 
-            resources->slots[i].flags |= RESOURCE_FREE;
+            resources->_capacity = cur_cap + k_slot_page_size;
+            slot_resources_push_chain(resources, cur_cap, cur_cap + k_slot_page_size - 1);
         }
 
-        resources->_capacity = new_cap;
+        resources->grow_lock.clear(std::memory_order_release);
     }
 
     inline void slot_resources_init(slot_resources* resources, u32 num)
     {
-        //resources->slots = new free_slot_list[num];
-        resources->_capacity = num;
-        resources->slots = (free_slot_list*)pen::memory_alloc(sizeof(slot_resources) * num);
+        memset(resources->pages, 0x0, sizeof(resources->pages));
+        resources->grow_lock.clear();
+
+        u32 num_pages = max<u32>((num + k_slot_page_size - 1) / k_slot_page_size, 1);
+        for (u32 i = 0; i < num_pages; ++i)
+            slot_resources_alloc_page(resources, i);
+
+        resources->_capacity = num_pages * k_slot_page_size;
+        slot_resources_get_slot(resources, resources->_capacity - 1).next = 0;
 
         // 0 is reserved as null slot
-        for (s32 i = num - 1; i > 0; --i)
+        resources->head = 1;
+    }
+
+    inline u32 slot_resources_get_next(slot_resources* resources)
+    {
+        u64 h = resources->head.load();
+        for (;;)
         {
-            resources->slots[i].index = i;
+            u32 r = (u32)h;
+            if (r == 0)
+            {
+                slot_resources_grow(resources);
+                h = resources->head.load();
+                continue;
+            }
+
+            u32 next = slot_resources_get_slot(resources, r).next;
+            u64 nh = ((h >> 32) + 1) << 32 | next;
+            if (resources->head.compare_exchange_weak(h, nh))
+            {
+                free_slot_list& s = slot_resources_get_slot(resources, r);
+                s.flags = RESOURCE_USED;
+                return r;
+            }
+        }
+    }
 
-            if (i >= num - 1)
-                resources->slots[i].next = nullptr;
-            else
-                resources->slots[i].next = resources->head;
+    inline bool slot_resources_free(slot_resources* resources, const u32 slot)
+    {
+        if (slot == 0 || slot >= resources->_capacity)
+            return false;
 
-            resources->head = &resources->slots[i];
+        free_slot_list& s = slot_resources_get_slot(resources, slot);
 
-            resources->slots[i].flags |= RESOURCE_FREE;
+        // retired slots had their handles invalidated already
+        u32 expected = RESOURCE_RETIRED;
+        if (!s.flags.compare_exchange_strong(expected, RESOURCE_FREE))
+        {
+            // avoid double free
+            expected = RESOURCE_USED;
+            if (!s.flags.compare_exchange_strong(expected, RESOURCE_FREE))
+            {
+#if PEN_SLOT_RESOURCES_DEBUG
+                PEN_ASSERT_MSG(0, "slot resource double free");
+#endif
+                return false;
+            }
+
+            // invalidate any outstanding handles
+            s.generation++;
         }
+
+        slot_resources_push_chain(resources, slot, slot);
+
+        return true;
     }
 
-    inline u32 slot_resources_get_next(slot_resources* resources)
+    inline bool slot_resources_is_used(slot_resources* resources, const u32 slot)
     {
-        if (!resources->head)
-            slot_resources_grow(resources);
+        if (slot == 0 || slot >= resources->_capacity)
+            return false;
 
-        u32 r = resources->head->index;
-        resources->head->flags &= ~RESOURCE_FREE;
-        resources->head->flags |= RESOURCE_USED;
+        return slot_resources_get_slot(resources, slot).flags == RESOURCE_USED;
+    }
 
-        resources->head = resources->head->next;
+    inline u32 slot_resources_get_handle(slot_resources* resources, const u32 slot)
+    {
+        PEN_ASSERT(slot <= k_slot_index_mask);
 
-        return r;
+        u32 gen = slot_resources_get_slot(resources, slot).generation & k_slot_generation_mask;
+        return gen << k_slot_index_bits | slot;
     }
 
-    inline bool slot_resources_free(slot_resources* resources, const u32 slot)
+    inline u32 slot_resources_handle_slot(const u32 handle)
+    {
+        return handle & k_slot_index_mask;
+    }
+
+    inline bool slot_resources_validate(slot_resources* resources, const u32 handle)
+    {
+        u32 slot = slot_resources_handle_slot(handle);
+        if (!slot_resources_is_used(resources, slot))
+            return false;
+
+        return slot_resources_get_handle(resources, slot) == handle;
+    }
+
+    // only one caller can retire a handle, the generation is bumped before the slot is marked so the handle stops
+    // validating for everyone else first
+    inline bool slot_resources_retire(slot_resources* resources, const u32 handle)
     {
-        if (slot == 0)
+        u32 slot = slot_resources_handle_slot(handle);
+        if (!slot_resources_is_used(resources, slot))
             return false;
 
-        // avoid double free
-        if (resources->slots[slot].flags & RESOURCE_FREE)
+        free_slot_list& s = slot_resources_get_slot(resources, slot);
+
+        u32 gen = s.generation;
+        if (((gen & k_slot_generation_mask) << k_slot_index_bits | slot) != handle)
             return false;
 
-        // mark free and add to free list
-        resources->slots[slot].flags |= RESOURCE_FREE;
-        resources->slots[slot].next = resources->head;
-        resources->head = &resources->slots[slot];
+        if (!s.generation.compare_exchange_strong(gen, gen + 1))
+            return false;
 
+        s.flags = RESOURCE_RETIRED;
         return true;
     }
 } // namespace pen
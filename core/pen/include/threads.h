@@ -3,7 +3,9 @@
 // License: https://github.com/polymonster/pmtech/blob/master/license.md
 
 // Minimalist cross platform thread wrapper api.
-// Includes functions to create jobs, threads, mutex and semaphore.
+// Includes functions to create jobs, threads, mutex, semaphore and event.
+// Also includes a work stealing task scheduler, which runs short lived tasks on a pool of worker threads
+// sized to the hardware thread count.
 
 #pragma once
 
@@ -14,9 +16,13 @@ namespace pen
     struct thread;
     struct mutex;
     struct semaphore;
+    struct event;
 
     typedef void (*completion_callback)(void*);
     typedef void* (*dispatch_thread)(void*);
+    typedef void (*task_func)(void* user_data);
+    typedef void (*parallel_for_func)(u32 start, u32 end, void* user_data);
+    typedef u32 task_handle;
 
     // A Job is just a thread with some user data, a callback
     // and some syncronisation semaphores
@@ -28,6 +34,7 @@ namespace pen
         semaphore*          p_sem_continue = nullptr;
         semaphore*          p_sem_exit = nullptr;
         semaphore*          p_sem_terminated = nullptr;
+        event*              p_wake = nullptr; // notified with consume and exit so the job thread can block
         completion_callback p_completion_callback = nullptr;
 
         f32 thread_time;
@@ -50,6 +57,15 @@ namespace pen
     }
     typedef e_thread_start_flags::thread_start_flags_t thread_start_flags;
 
+    struct thread_timing
+    {
+        const c8* name;
+        f64       total_ms; // since thread_set_name was called
+        f64       idle_ms;  // blocked in event_wait or semaphore_wait
+    };
+
+    static const u32 k_wait_infinite = 0xffffffff;
+
     struct default_thread_info
     {
         u32   flags;
@@ -59,9 +75,14 @@ namespace pen
     };
 
     // Threads
-    thread* thread_create(dispatch_thread thread_func, u32 stack_size, void* thread_params, thread_start_flags flags);
-    void    thread_sleep_ms(u32 milliseconds);
-    void    thread_sleep_us(u32 microseconds);
+    thread*   thread_create(dispatch_thread thread_func, u32 stack_size, void* thread_params, thread_start_flags flags);
+    void      thread_sleep_ms(u32 milliseconds);
+    void      thread_sleep_us(u32 microseconds);
+    u32       thread_get_hardware_concurrency();
+    void      thread_set_name(const c8* name); // starts tracking busy and idle time for the calling thread
+    const c8* thread_get_name();               // null if the calling thread has not been named
+    u32       thread_get_timings(thread_timing* timings, u32 max_timings);
+    void      _thread_add_idle_time(f64 us);
 
     // Jobs
     void jobs_create_default(const default_thread_info& info);
@@ -69,6 +90,23 @@ namespace pen
     job* jobs_create_job(dispatch_thread thread_func, u32 stack_size, void* user_data, thread_start_flags flags,
                          completion_callback cb = nullptr);
 
+    // Tasks
+    // Tasks are created unsubmitted so children and dependencies can be added before calling jobs_submit_task.
+    // A parent task completes only once all of its children have completed.
+    // A task with dependencies is not scheduled until all of its dependencies have completed (continuations).
+    // Waiting on a task from any thread will help execute pending tasks instead of blocking.
+    u32         jobs_get_num_workers();
+    task_handle jobs_create_task(task_func func, void* user_data);
+    task_handle jobs_create_child_task(task_handle parent, task_func func, void* user_data);
+    void        jobs_add_dependency(task_handle task, task_handle dependency);
+    void        jobs_submit_task(task_handle task);
+    task_handle jobs_run_task(task_func func, void* user_data); // create and submit in one call
+    bool        jobs_is_task_complete(task_handle task);
+    void        jobs_wait_task(task_handle task);
+
+    // Splits [0, count) into batches of batch_size (0 = auto) and blocks until all batches have been processed.
+    void jobs_parallel_for(u32 count, u32 batch_size, parallel_for_func func, void* user_data);
+
     // Mutex
     mutex* mutex_create();
     void   mutex_destroy(mutex* p_mutex);
@@ -83,4 +121,12 @@ namespace pen
     bool       semaphore_wait(semaphore* p_semaphore);
     void       semaphore_post(semaphore* p_semaphore, u32 count);
 
+    // Event
+    // Auto reset event to block a thread until it has work. a notify before the wait is not lost and multiple
+    // notifies before a wait only wake it once. notify is cheap when nothing is waiting, wait returns false on timeout.
+    event* event_create();
+    void   event_destroy(event* p_event);
+    void   event_notify(event* p_event);
+    bool   event_wait(event* p_event, u32 timeout_ms = k_wait_infinite);
+
 } // namespace pen
@@ -133,8 +133,9 @@ namespace pen
     void input_add_unicode_input(const c8* utf8)
     {
         if (s_unicode_ring.data == nullptr)
-            s_unicode_ring.create(128);
+            s_unicode_ring.create(128, e_full_policy::fail);
 
+        // called from the os message thread, drop input rather than stall if the game isn't consuming it
         s_unicode_ring.put(Str(utf8));
     }
 
@@ -2,32 +2,108 @@
 // Copyright 2014 - 2019 Alex Dixon.
 // License: https://github.com/polymonster/pmtech/blob/master/license.md
 
+#include "data_struct.h"
+#include "profiler.h"
 #include "renderer.h"
 #include "threads.h"
+#include "timer.h"
 
 namespace pen
 {
-#define MAX_THREADS 8
+    // busy and idle time for named threads, records are never removed so they can be read from any thread
 
-    static job s_jt[MAX_THREADS];
-    static u32 s_num_active_threads = 0;
+    namespace
+    {
+        enum thread_timing_constants
+        {
+            k_max_timed_threads = 64
+        };
 
-    pen::job* jobs_create_job(dispatch_thread thread_func, u32 stack_size, void* user_data, thread_start_flags flags,
-                              completion_callback cb)
+        struct thread_time_record
+        {
+            std::atomic<const c8*> name; // null until the record is initialised
+            f64                    start_us;
+            a_u64                  idle_us;
+        };
+
+        thread_time_record s_thread_times[k_max_timed_threads];
+        a_u32              s_num_thread_times = {0};
+
+        thread_local thread_time_record* t_thread_time = nullptr;
+    } // namespace
+
+    void thread_set_name(const c8* name)
     {
-        if (s_num_active_threads >= MAX_THREADS)
+        if (!t_thread_time)
         {
+            u32 i = s_num_thread_times.fetch_add(1);
+            if (i >= k_max_timed_threads)
+                return;
+
+            t_thread_time = &s_thread_times[i];
+            t_thread_time->start_us = get_time_us();
+            t_thread_time->idle_us = 0;
+        }
+
+        t_thread_time->name = name;
+    }
+
+    const c8* thread_get_name()
+    {
+        if (!t_thread_time)
             return nullptr;
+
+        return t_thread_time->name;
+    }
+
+    void _thread_add_idle_time(f64 us)
+    {
+        if (t_thread_time)
+            t_thread_time->idle_us += (u64)us;
+    }
+
+    u32 thread_get_timings(thread_timing* timings, u32 max_timings)
+    {
+        f64 now = get_time_us();
+        u32 num = min<u32>(s_num_thread_times, k_max_timed_threads);
+
+        u32 count = 0;
+        for (u32 i = 0; i < num && count < max_timings; ++i)
+        {
+            const c8* name = s_thread_times[i].name;
+            if (!name)
+                continue;
+
+            timings[count].name = name;
+            timings[count].total_ms = (now - s_thread_times[i].start_us) / 1000.0;
+            timings[count].idle_ms = (f64)s_thread_times[i].idle_us / 1000.0;
+            ++count;
         }
 
+        return count;
+    }
+
+    // long lived jobs, each has its own dedicated thread
+
+    static job** s_jobs = nullptr;
+    static u32   s_num_active_threads = 0;
+
+    pen::job* jobs_create_job(dispatch_thread thread_func, u32 stack_size, void* user_data, thread_start_flags flags,
+                              completion_callback cb)
+    {
         job_thread_params params;
 
-        job* jt = &s_jt[s_num_active_threads++];
+        // jobs are allocated individually so the pointers handed out remain valid as the table grows
+        if (s_num_active_threads >= (u32)sb_count(s_jobs))
+            sb_push(s_jobs, new job());
+
+        job* jt = s_jobs[s_num_active_threads++];
 
         jt->p_sem_continue = semaphore_create(0, 1);
         jt->p_sem_consume = semaphore_create(0, 1);
         jt->p_sem_exit = semaphore_create(0, 1);
         jt->p_sem_terminated = semaphore_create(0, 1);
+        jt->p_wake = event_create();
         jt->p_completion_callback = cb;
 
         params.user_data = user_data;
@@ -41,8 +117,477 @@ namespace pen
         return jt;
     }
 
+    // tasks, short lived units of work executed by a pool of worker threads
+
+    namespace
+    {
+        enum task_constants
+        {
+            k_max_tasks = 4096, // must be power of 2
+            k_max_continuations = 15,
+            k_task_stack_size = 1024 * 1024,
+            k_spin_count = 64
+        };
+
+        struct task
+        {
+            task_func         func;
+            parallel_for_func range_func;
+            void*             user_data;
+            u32               range_start;
+            u32               range_end;
+            task*             parent;
+            a_u32             handle;
+            a_u32             unfinished;   // self + incomplete children
+            a_u32             dependencies; // incomplete dependencies + 1 until submitted
+            a_u32             lock;
+            a_u8              sealed;    // no more continuations can be added
+            a_u8              submitted; // cleared on creation, until then nothing can run it
+            a_u8              complete;  // slot can be re-used
+            u32               num_continuations;
+            task*             continuations[k_max_continuations];
+        };
+
+        // chase-lev work stealing deque, the owning worker pushes and pops from the bottom, others steal from the top
+        struct task_deque
+        {
+            std::atomic<task*> tasks[k_max_tasks];
+            std::atomic<s64>   top;
+            std::atomic<s64>   bottom;
+
+            void push(task* t)
+            {
+                s64 b = bottom.load(std::memory_order_relaxed);
+                PEN_ASSERT(b - top.load(std::memory_order_acquire) < k_max_tasks);
+
+                tasks[b & (k_max_tasks - 1)].store(t, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_release);
+                bottom.store(b + 1, std::memory_order_relaxed);
+            }
+
+            task* pop()
+            {
+                s64 b = bottom.load(std::memory_order_relaxed) - 1;
+                bottom.store(b, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                s64 t = top.load(std::memory_order_relaxed);
+
+                if (t > b)
+                {
+                    // empty
+                    bottom.store(b + 1, std::memory_order_relaxed);
+                    return nullptr;
+                }
+
+                task* item = tasks[b & (k_max_tasks - 1)].load(std::memory_order_relaxed);
+                if (t == b)
+                {
+                    // last item, race against stealers
+                    if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                        item = nullptr;
+
+                    bottom.store(b + 1, std::memory_order_relaxed);
+                }
+
+                return item;
+            }
+
+            task* steal()
+            {
+                s64 t = top.load(std::memory_order_acquire);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                s64 b = bottom.load(std::memory_order_acquire);
+
+                if (t >= b)
+                    return nullptr;
+
+                task* item = tasks[t & (k_max_tasks - 1)].load(std::memory_order_relaxed);
+                if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                    return nullptr;
+
+                return item;
+            }
+        };
+
+        struct worker_params
+        {
+            u32 index;
+        };
+
+        task              s_tasks[k_max_tasks];
+        a_u32             s_task_counter = {k_max_tasks}; // start at generation 1, so no valid handle is 0
+        task_deque*       s_deques = nullptr;
+        worker_params*    s_worker_params = nullptr;
+        u32               s_num_workers = 0;
+        mpmc_queue<task*> s_queue; // tasks submitted from threads which are not workers (user, render, physics...)
+        semaphore*        s_wake_sem = nullptr;
+        a_u32             s_sleeping = {0};
+        a_u32             s_running_workers = {0};
+        a_u8              s_exit_workers = {0};
+
+        thread_local s32 t_worker_index = -1;
+    } // namespace
+
+    static void task_lock(task* t)
+    {
+        u32 expected = 0;
+        while (!t->lock.compare_exchange_weak(expected, 1, std::memory_order_acquire))
+            expected = 0;
+    }
+
+    static void task_unlock(task* t)
+    {
+        t->lock.store(0, std::memory_order_release);
+    }
+
+    static task* task_from_handle(task_handle h)
+    {
+        task* t = &s_tasks[h & (k_max_tasks - 1)];
+        if (t->handle.load() != h)
+            return nullptr;
+
+        return t;
+    }
+
+    static void queue_push(task* t)
+    {
+        if (t_worker_index >= 0)
+        {
+            s_deques[t_worker_index].push(t);
+        }
+        else
+        {
+            s_queue.put(t);
+        }
+
+        // wake a sleeping worker
+        if (s_sleeping.load() > 0)
+            semaphore_post(s_wake_sem, 1);
+    }
+
+    static task* queue_pop()
+    {
+        task* t = nullptr;
+        if (!s_queue.try_get(t))
+            return nullptr;
+
+        return t;
+    }
+
+    static task* get_task()
+    {
+        // own deque first (lifo for cache locality)
+        if (t_worker_index >= 0)
+        {
+            task* t = s_deques[t_worker_index].pop();
+            if (t)
+                return t;
+        }
+
+        // shared queue
+        task* t = queue_pop();
+        if (t)
+            return t;
+
+        // steal from another worker
+        u32 start = t_worker_index >= 0 ? t_worker_index + 1 : 0;
+        for (u32 i = 0; i < s_num_workers; ++i)
+        {
+            u32 victim = (start + i) % s_num_workers;
+            if ((s32)victim == t_worker_index)
+                continue;
+
+            t = s_deques[victim].steal();
+            if (t)
+                return t;
+        }
+
+        return nullptr;
+    }
+
+    static void finish_task(task* t)
+    {
+        if (t->unfinished.fetch_sub(1) != 1)
+            return;
+
+        // all children are done, seal continuations so no more can be added
+        task_lock(t);
+        t->sealed = 1;
+        u32   num_continuations = t->num_continuations;
+        task* continuations[k_max_continuations];
+        memcpy(continuations, t->continuations, sizeof(task*) * num_continuations);
+        task_unlock(t);
+
+        if (t->parent)
+            finish_task(t->parent);
+
+        for (u32 i = 0; i < num_continuations; ++i)
+            if (continuations[i]->dependencies.fetch_sub(1) == 1)
+                queue_push(continuations[i]);
+
+        // last thing we touch, after this the slot may be re-used
+        t->complete = 1;
+    }
+
+    static void execute_task(task* t)
+    {
+        PEN_PROFILE_SCOPE(t->range_func ? "parallel_for" : "task");
+
+        if (t->func)
+            t->func(t->user_data);
+
+        if (t->range_func)
+            t->range_func(t->range_start, t->range_end, t->user_data);
+
+        finish_task(t);
+    }
+
+    static task_handle alloc_task(task* parent, task_func func, void* user_data)
+    {
+        task_handle h = s_task_counter.fetch_add(1);
+
+        // handle 0 is reserved so it can be used as null by callers
+        if (h == 0)
+            h = s_task_counter.fetch_add(1);
+
+        task* t = &s_tasks[h & (k_max_tasks - 1)];
+
+        // the pool has wrapped around onto a task which is still in flight, help out until it completes.
+        // a task which has not been submitted can never complete, so waiting on it would hang forever
+        if (t->handle.load() != 0)
+        {
+            if (!t->complete.load() && !t->submitted.load())
+            {
+                PEN_LOG("[error] jobs : task pool exhausted, more than %i tasks were created before being submitted\n",
+                        k_max_tasks);
+                PEN_ASSERT(0);
+                abort();
+            }
+
+            while (!t->complete.load())
+            {
+                task* pending = get_task();
+                if (pending)
+                    execute_task(pending);
+                else
+                    thread_sleep_ms(0);
+            }
+        }
+
+        t->func = func;
+        t->range_func = nullptr;
+        t->user_data = user_data;
+        t->range_start = 0;
+        t->range_end = 0;
+        t->parent = parent;
+        t->unfinished = 1;
+        t->dependencies = 1;
+        t->lock = 0;
+        t->sealed = 0;
+        t->submitted = 0;
+        t->complete = 0;
+        t->num_continuations = 0;
+        t->handle = h;
+
+        if (parent)
+            parent->unfinished.fetch_add(1);
+
+        return h;
+    }
+
+    static void* worker_thread(void* params)
+    {
+        worker_params* wp = (worker_params*)params;
+        t_worker_index = (s32)wp->index;
+        thread_set_name("worker");
+
+        for (;;)
+        {
+            if (s_exit_workers.load())
+                break;
+
+            task* t = nullptr;
+            for (u32 i = 0; i < k_spin_count && !t; ++i)
+                t = get_task();
+
+            if (t)
+            {
+                execute_task(t);
+                continue;
+            }
+
+            // go to sleep, check again after advertising we are sleeping to avoid a missed wake
+            s_sleeping.fetch_add(1);
+
+            t = get_task();
+            if (t)
+            {
+                s_sleeping.fetch_sub(1);
+                execute_task(t);
+                continue;
+            }
+
+            semaphore_wait(s_wake_sem);
+            s_sleeping.fetch_sub(1);
+        }
+
+        s_running_workers.fetch_sub(1);
+        return PEN_THREAD_OK;
+    }
+
+    static void jobs_create_workers()
+    {
+        s_queue.create(k_max_tasks);
+        s_wake_sem = semaphore_create(0, k_max_tasks);
+
+        // leave a hardware thread for the main thread, which the render thread runs on
+        u32 hw = thread_get_hardware_concurrency();
+        s_num_workers = hw > 1 ? hw - 1 : 1;
+
+        s_deques = new task_deque[s_num_workers];
+        s_worker_params = new worker_params[s_num_workers];
+
+        for (u32 i = 0; i < s_num_workers; ++i)
+        {
+            s_deques[i].top = 0;
+            s_deques[i].bottom = 0;
+            s_worker_params[i].index = i;
+        }
+
+        s_running_workers = s_num_workers;
+        for (u32 i = 0; i < s_num_workers; ++i)
+            thread_create(worker_thread, k_task_stack_size, &s_worker_params[i], e_thread_start_flags::detached);
+    }
+
+    static bool jobs_terminate_workers()
+    {
+        if (!s_exit_workers.load())
+        {
+            s_exit_workers = 1;
+            for (u32 i = 0; i < s_num_workers; ++i)
+                semaphore_post(s_wake_sem, 1);
+        }
+
+        return s_running_workers.load() == 0;
+    }
+
+    u32 jobs_get_num_workers()
+    {
+        return s_num_workers;
+    }
+
+    task_handle jobs_create_task(task_func func, void* user_data)
+    {
+        return alloc_task(nullptr, func, user_data);
+    }
+
+    task_handle jobs_create_child_task(task_handle parent, task_func func, void* user_data)
+    {
+        task* p = task_from_handle(parent);
+        PEN_ASSERT(p && !p->sealed);
+
+        return alloc_task(p, func, user_data);
+    }
+
+    void jobs_add_dependency(task_handle h, task_handle dependency)
+    {
+        task* t = task_from_handle(h);
+        task* d = task_from_handle(dependency);
+        PEN_ASSERT(t);
+
+        // dependency has already completed and its slot been re-used
+        if (!d)
+            return;
+
+        task_lock(d);
+        if (!d->sealed)
+        {
+            PEN_ASSERT(d->num_continuations < k_max_continuations);
+            t->dependencies.fetch_add(1);
+            d->continuations[d->num_continuations++] = t;
+        }
+        task_unlock(d);
+    }
+
+    void jobs_submit_task(task_handle h)
+    {
+        task* t = task_from_handle(h);
+        PEN_ASSERT(t);
+
+        t->submitted = 1;
+
+        // release the submission reference, tasks waiting on dependencies are pushed when the last one completes
+        if (t->dependencies.fetch_sub(1) == 1)
+            queue_push(t);
+    }
+
+    task_handle jobs_run_task(task_func func, void* user_data)
+    {
+        task_handle h = jobs_create_task(func, user_data);
+        jobs_submit_task(h);
+        return h;
+    }
+
+    bool jobs_is_task_complete(task_handle h)
+    {
+        task* t = task_from_handle(h);
+        if (!t)
+            return true;
+
+        return t->complete.load();
+    }
+
+    void jobs_wait_task(task_handle h)
+    {
+        while (!jobs_is_task_complete(h))
+        {
+            task* t = get_task();
+            if (t)
+                execute_task(t);
+            else
+                thread_sleep_ms(0);
+        }
+    }
+
+    void jobs_parallel_for(u32 count, u32 batch_size, parallel_for_func func, void* user_data)
+    {
+        if (count == 0)
+            return;
+
+        // no workers, or not enough work to make it worth going wide
+        if (s_num_workers == 0 || count <= batch_size)
+        {
+            func(0, count, user_data);
+            return;
+        }
+
+        if (batch_size == 0)
+            batch_size = max<u32>(count / (s_num_workers * 4), 1);
+
+        // keep the number of batches well inside the task pool
+        static const u32 max_batches = k_max_tasks / 4;
+        batch_size = max<u32>(batch_size, (count + max_batches - 1) / max_batches);
+
+        task_handle root = jobs_create_task(nullptr, nullptr);
+        for (u32 start = 0; start < count; start += batch_size)
+        {
+            task_handle h = jobs_create_child_task(root, nullptr, user_data);
+
+            task* t = task_from_handle(h);
+            t->range_func = func;
+            t->range_start = start;
+            t->range_end = min<u32>(start + batch_size, count);
+
+            jobs_submit_task(h);
+        }
+
+        jobs_submit_task(root);
+        jobs_wait_task(root);
+    }
+
     void jobs_create_default(const pen::default_thread_info& info)
     {
+        jobs_create_workers();
         jobs_create_job(&pen::user_entry, 1024 * 1024, info.user_thread_params, pen::e_thread_start_flags::detached);
     }
 
@@ -51,8 +596,9 @@ namespace pen
         // remove threads in reverse order
         for (s32 i = s_num_active_threads - 1; i > 0; --i)
         {
-            pen::semaphore_post(s_jt[i].p_sem_exit, 1);
-            if (pen::semaphore_try_wait(s_jt[i].p_sem_terminated))
+            pen::semaphore_post(s_jobs[i]->p_sem_exit, 1);
+            pen::event_notify(s_jobs[i]->p_wake);
+            if (pen::semaphore_try_wait(s_jobs[i]->p_sem_terminated))
             {
                 s_num_active_threads--;
             }
@@ -62,6 +608,7 @@ namespace pen
             }
         }
 
-        return true;
+        // workers go last because the job threads may still be waiting on tasks
+        return jobs_terminate_workers();
     }
 } // namespace pen
@@ -1,7 +1,9 @@
 // os.cpp
 // Copyright 2014 - 2019 Alex Dixon.
 // License: https://github.com/polymonster/pmtech/blob/master/license.md
+#ifndef PEN_RENDERER_NULL
 #include "GL/glew.h"
+#endif
 
 #include "console.h"
 #include "hash.h"
@@ -21,9 +23,12 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#ifndef PEN_RENDERER_NULL
 #include <GL/glx.h>
 #include <GL/glxext.h>
+#endif
 #include <X11/Xlib.h>
+#include <X11/Xutil.h>
 
 using namespace pen;
 
@@ -31,6 +36,10 @@ using namespace pen;
 window_creation_params pen_window;
 pen::user_info         pen_user_info;
 
+Display* _display;
+Window   _window;
+
+#ifndef PEN_RENDERER_NULL
 // glx / gl stuff
 #define GLX_CONTEXT_MAJOR_VERSION_ARB 0x2091
 #define GLX_CONTEXT_MINOR_VERSION_ARB 0x2092
@@ -48,8 +57,6 @@ static int visual_attribs[] = {GLX_X_RENDERABLE, True, GLX_DRAWABLE_TYPE, GLX_WI
                                None};
 
 GLXContext _gl_context = 0;
-Display*   _display;
-Window     _window;
 
 // externs for the gl implementation
 void pen_make_gl_context_current()
@@ -61,6 +68,7 @@ void pen_gl_swap_buffers()
 {
     glXSwapBuffers(_display, _window);
 }
+#endif
 
 namespace
 {
@@ -89,6 +97,17 @@ namespace
         return 0;
     }
 
+#ifdef PEN_RENDERER_NULL
+    // the null renderer needs no window or gpu context, the render thread consumes commands without presenting
+    int pen_run_headless()
+    {
+        renderer_init(nullptr, true, s_creation_params.max_renderer_commands);
+
+        pen::jobs_terminate_all();
+
+        return s_error_code;
+    }
+#else
     int pen_run_windowed()
     {
         Visual*              visual;
@@ -230,6 +249,7 @@ namespace
 
         return s_error_code;
     }
+#endif
 
     int pen_run_console_app()
     {
@@ -519,7 +539,11 @@ int main(int argc, char* argv[])
 
     if (pc.flags & e_pen_create_flags::renderer)
     {
+#ifdef PEN_RENDERER_NULL
+        pen_run_headless();
+#else
         pen_run_windowed();
+#endif
     }
     else
     {
@@ -36,15 +36,16 @@ namespace pen
 
     u64 get_absolute_time()
     {
-        static struct timeval tv;
-        gettimeofday(&tv, nullptr);
-        return (tv.tv_sec * 1000 * 1000) + (tv.tv_usec);
+        // called from any thread, monotonic with ns resolution for the profiler
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (u64)ts.tv_sec * 1000 * 1000 * 1000 + (u64)ts.tv_nsec;
     }
 
     void timer_system_intialise()
     {
-        ticks_to_ns = 1000.0;
-        ticks_to_us = 1;
+        ticks_to_ns = 1.0;
+        ticks_to_us = ticks_to_ns / 1000.0;
         ticks_to_ms = ticks_to_us / 1000.0;
     }
 
@@ -4,10 +4,343 @@
 
 #include "memory.h"
 
-// C++ standard says these must be in cpp file and not inline in header ;_;
+#ifndef PEN_MEMORY_POOLS
+#define PEN_MEMORY_POOLS 1
+#endif
 
 using namespace pen;
 
+namespace
+{
+    // every allocation is prefixed with a header so free can find the tag, size and where the block came from.
+    // the header keeps user memory 16 byte aligned, as malloc would.
+    struct alloc_header
+    {
+        size_t size;
+        u16    tag;
+        u8     size_class;
+        u8     padding;
+        u32    offset; // from the start of the underlying block to the user pointer
+    };
+    static_assert(sizeof(alloc_header) == 16, "alloc_header must preserve 16 byte alignment");
+
+    enum memory_constants
+    {
+        k_header_size = sizeof(alloc_header),
+        k_num_size_classes = 5,
+        k_no_size_class = 0xff,
+        k_pool_chunk_size = 64 * 1024,
+        k_cache_batch = 32,
+        k_cache_max = k_cache_batch * 2
+    };
+
+    // size classes are for the user size, blocks also contain the header
+    const size_t k_size_classes[k_num_size_classes] = {16, 32, 64, 128, 256};
+
+    const c8* k_tag_names[e_mem_tag::COUNT] = {"general", "renderer", "ecs", "physics", "json", "loader", "audio"};
+
+    // these are all zero initialised statics, operator new can be called before any constructors have run
+    a_size_t s_live_bytes[e_mem_tag::COUNT];
+    a_size_t s_live_count[e_mem_tag::COUNT];
+    a_size_t s_total_count[e_mem_tag::COUNT];
+    a_size_t s_peak_bytes[e_mem_tag::COUNT];
+
+    thread_local mem_tag t_tag = e_mem_tag::general;
+
+    struct pool_block
+    {
+        pool_block* next;
+    };
+
+    // shared pool per size class, threads take and return blocks in batches so the lock is rarely contended
+    struct size_class_pool
+    {
+        std::atomic_flag lock = ATOMIC_FLAG_INIT;
+        pool_block*      free_list = nullptr;
+        u8*              chunk = nullptr;
+        size_t           chunk_remaining = 0;
+    };
+    size_class_pool s_pools[k_num_size_classes];
+
+    struct thread_cache
+    {
+        pool_block* head[k_num_size_classes];
+        u32         count[k_num_size_classes];
+    };
+    thread_local thread_cache t_cache;
+
+    inline u8 get_size_class(size_t size)
+    {
+#if PEN_MEMORY_POOLS
+        for (u32 i = 0; i < k_num_size_classes; ++i)
+            if (size <= k_size_classes[i])
+                return (u8)i;
+#endif
+        return k_no_size_class;
+    }
+
+    inline void pool_lock(size_class_pool& pool)
+    {
+        while (pool.lock.test_and_set(std::memory_order_acquire))
+            ;
+    }
+
+    inline void pool_unlock(size_class_pool& pool)
+    {
+        pool.lock.clear(std::memory_order_release);
+    }
+
+    void cache_refill(u8 size_class)
+    {
+        size_class_pool& pool = s_pools[size_class];
+        size_t           block_size = k_size_classes[size_class] + k_header_size;
+
+        pool_lock(pool);
+
+        for (u32 i = 0; i < k_cache_batch; ++i)
+        {
+            pool_block* block = pool.free_list;
+            if (block)
+            {
+                pool.free_list = block->next;
+            }
+            else
+            {
+                // chunks are never returned to the system, they are recycled through the free lists
+                if (pool.chunk_remaining < block_size)
+                {
+                    pool.chunk = (u8*)malloc(k_pool_chunk_size);
+                    pool.chunk_remaining = k_pool_chunk_size;
+                }
+
+                block = (pool_block*)pool.chunk;
+                pool.chunk += block_size;
+                pool.chunk_remaining -= block_size;
+            }
+
+            block->next = t_cache.head[size_class];
+            t_cache.head[size_class] = block;
+            t_cache.count[size_class]++;
+        }
+
+        pool_unlock(pool);
+    }
+
+    void cache_release(u8 size_class)
+    {
+        size_class_pool& pool = s_pools[size_class];
+
+        pool_lock(pool);
+
+        for (u32 i = 0; i < k_cache_batch; ++i)
+        {
+            pool_block* block = t_cache.head[size_class];
+            t_cache.head[size_class] = block->next;
+            t_cache.count[size_class]--;
+
+            block->next = pool.free_list;
+            pool.free_list = block;
+        }
+
+        pool_unlock(pool);
+    }
+
+    inline void track_alloc(u16 tag, size_t size)
+    {
+        size_t live = s_live_bytes[tag].fetch_add(size) + size;
+        s_live_count[tag]++;
+        s_total_count[tag]++;
+
+        // peak is approximate under contention, but never lower than a value live_bytes has held
+        size_t peak = s_peak_bytes[tag];
+        while (live > peak && !s_peak_bytes[tag].compare_exchange_weak(peak, live))
+            ;
+    }
+
+    inline void track_free(u16 tag, size_t size)
+    {
+        s_live_bytes[tag] -= size;
+        s_live_count[tag]--;
+    }
+
+    inline alloc_header* get_header(void* mem)
+    {
+        return (alloc_header*)((u8*)mem - k_header_size);
+    }
+
+    void* alloc_internal(size_t size, mem_tag tag)
+    {
+        u8 size_class = get_size_class(size);
+
+        u8* block = nullptr;
+        if (size_class != k_no_size_class)
+        {
+            if (!t_cache.head[size_class])
+                cache_refill(size_class);
+
+            pool_block* pb = t_cache.head[size_class];
+            t_cache.head[size_class] = pb->next;
+            t_cache.count[size_class]--;
+
+            block = (u8*)pb;
+        }
+        else
+        {
+            block = (u8*)malloc(size + k_header_size);
+            if (!block)
+                return nullptr;
+        }
+
+        alloc_header* h = (alloc_header*)block;
+        h->size = size;
+        h->tag = (u16)tag;
+        h->size_class = size_class;
+        h->offset = k_header_size;
+
+        track_alloc(h->tag, size);
+
+        return block + k_header_size;
+    }
+} // namespace
+
+namespace pen
+{
+    void* memory_alloc(size_t size_bytes)
+    {
+        return alloc_internal(size_bytes, t_tag);
+    }
+
+    void* memory_alloc(size_t size_bytes, mem_tag tag)
+    {
+        return alloc_internal(size_bytes, tag);
+    }
+
+    void* memory_calloc(size_t count, size_t size_bytes)
+    {
+        size_t size = count * size_bytes;
+
+        void* mem = alloc_internal(size, t_tag);
+        if (mem)
+            memset(mem, 0x0, size);
+
+        return mem;
+    }
+
+    void* memory_alloc_align(size_t size_bytes, size_t alignment)
+    {
+        if (alignment <= k_header_size)
+            return alloc_internal(size_bytes, t_tag);
+
+        // over allocate so there is room for the header before the aligned address
+        u8* block = (u8*)malloc(size_bytes + alignment + k_header_size);
+        if (!block)
+            return nullptr;
+
+        uintptr_t user = ((uintptr_t)block + k_header_size + alignment - 1) & ~(uintptr_t)(alignment - 1);
+
+        alloc_header* h = get_header((void*)user);
+        h->size = size_bytes;
+        h->tag = (u16)t_tag;
+        h->size_class = k_no_size_class;
+        h->offset = (u32)(user - (uintptr_t)block);
+
+        track_alloc(h->tag, size_bytes);
+
+        return (void*)user;
+    }
+
+    void memory_free(void* mem)
+    {
+        if (!mem)
+            return;
+
+        alloc_header* h = get_header(mem);
+        track_free(h->tag, h->size);
+
+        u8 size_class = h->size_class;
+        if (size_class != k_no_size_class)
+        {
+            // blocks go back to the freeing thread's cache, which may not be the thread which allocated them
+            pool_block* pb = (pool_block*)h;
+            pb->next = t_cache.head[size_class];
+            t_cache.head[size_class] = pb;
+            t_cache.count[size_class]++;
+
+            if (t_cache.count[size_class] > k_cache_max)
+                cache_release(size_class);
+
+            return;
+        }
+
+        free((u8*)mem - h->offset);
+    }
+
+    void memory_free_align(void* mem)
+    {
+        memory_free(mem);
+    }
+
+    void* memory_realloc(void* mem, size_t size_bytes)
+    {
+        if (!mem)
+            return alloc_internal(size_bytes, t_tag);
+
+        alloc_header* h = get_header(mem);
+
+        // pooled and aligned blocks cannot be grown in place by the system
+        if (h->size_class != k_no_size_class || h->offset != k_header_size)
+        {
+            void* new_mem = alloc_internal(size_bytes, (mem_tag)h->tag);
+            if (new_mem)
+                memcpy(new_mem, mem, min<size_t>(h->size, size_bytes));
+
+            memory_free(mem);
+            return new_mem;
+        }
+
+        u16    tag = h->tag;
+        size_t old_size = h->size;
+
+        u8* block = (u8*)realloc(h, size_bytes + k_header_size);
+        if (!block)
+            return nullptr;
+
+        h = (alloc_header*)block;
+        h->size = size_bytes;
+
+        track_free(tag, old_size);
+        track_alloc(tag, size_bytes);
+        s_total_count[tag]--;
+
+        return block + k_header_size;
+    }
+
+    void memory_set_thread_tag(mem_tag tag)
+    {
+        t_tag = tag;
+    }
+
+    mem_tag memory_get_thread_tag()
+    {
+        return t_tag;
+    }
+
+    const c8* memory_get_tag_name(mem_tag tag)
+    {
+        return k_tag_names[tag];
+    }
+
+    void memory_get_stats(mem_tag tag, memory_stats& stats)
+    {
+        stats.live_bytes = s_live_bytes[tag];
+        stats.live_count = s_live_count[tag];
+        stats.total_count = s_total_count[tag];
+        stats.peak_bytes = s_peak_bytes[tag];
+    }
+} // namespace pen
+
+// C++ standard says these must be in cpp file and not inline in header ;_;
+
 void* operator new(std::size_t n, const std::nothrow_t& nothrow_value) THROW_NO_EXCEPT
 {
     return memory_alloc(n);
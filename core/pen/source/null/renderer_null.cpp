@@ -0,0 +1,595 @@
+// renderer_null.cpp
+// Copyright 2014 - 2019 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+// Headless renderer which executes no gpu work, build with --renderer=null.
+// The full command stream is still consumed on the render thread, resources are tracked by type so that invalid,
+// stale or mismatched handles are reported as they are used, which makes it useful for cpu side benchmarking and ci.
+
+#include "console.h"
+#include "data_struct.h"
+#include "memory.h"
+#include "renderer.h"
+#include "renderer_shared.h"
+
+#include <string.h>
+
+using namespace pen;
+
+namespace
+{
+    namespace e_null_res
+    {
+        enum null_res_t
+        {
+            none = 0,
+            clear_state = 1 << 0,
+            shader = 1 << 1,
+            input_layout = 1 << 2,
+            program = 1 << 3,
+            buffer = 1 << 4,
+            texture = 1 << 5,
+            sampler = 1 << 6,
+            raster_state = 1 << 7,
+            blend_state = 1 << 8,
+            depth_stencil_state = 1 << 9,
+            render_target = 1 << 10
+        };
+    }
+    typedef e_null_res::null_res_t null_res;
+
+    struct null_resource
+    {
+        u32 type;
+        u32 size; // bytes, for buffers and textures
+    };
+
+    static const u32 k_max_logged_errors = 64;
+
+    res_pool<null_resource> _res_pool;
+    u32                     s_validation_errors = 0;
+    u32                     s_bound_index_buffer = 0;
+
+    const c8* res_name(u32 type)
+    {
+        switch (type)
+        {
+            case e_null_res::none:
+                return "none";
+            case e_null_res::clear_state:
+                return "clear state";
+            case e_null_res::shader:
+                return "shader";
+            case e_null_res::input_layout:
+                return "input layout";
+            case e_null_res::program:
+                return "program";
+            case e_null_res::buffer:
+                return "buffer";
+            case e_null_res::texture:
+                return "texture";
+            case e_null_res::sampler:
+                return "sampler";
+            case e_null_res::raster_state:
+                return "raster state";
+            case e_null_res::blend_state:
+                return "blend state";
+            case e_null_res::depth_stencil_state:
+                return "depth stencil state";
+            case e_null_res::render_target:
+                return "render target";
+        }
+        return "unknown";
+    }
+
+    // keep counting but stop logging, so a bad handle bound every frame does not flood the console
+    bool log_error()
+    {
+        return s_validation_errors++ < k_max_logged_errors;
+    }
+
+    void validation_error(const c8* call, u32 handle, u32 expected)
+    {
+        if (!log_error())
+            return;
+
+        c8 expected_names[256] = {0};
+        for (u32 b = 0; b < 32; ++b)
+        {
+            if (!(expected & 1u << b))
+                continue;
+
+            if (expected_names[0])
+                strcat(expected_names, " or ");
+            strcat(expected_names, res_name(1u << b));
+        }
+
+        u32 actual = handle < _res_pool._capacity ? _res_pool[handle].type : (u32)e_null_res::none;
+        PEN_LOG("[null renderer] %s: handle %u is a %s, expected %s", call, handle, res_name(actual),
+                expected_names[0] ? expected_names : res_name(expected));
+    }
+
+    // 0 and invalid handles are used to unbind, anything else must be alive and one of the expected types
+    bool validate(const c8* call, u32 handle, u32 expected_types)
+    {
+        if (handle == 0 || !is_valid(handle))
+            return true;
+
+        if (handle < _res_pool._capacity && (_res_pool[handle].type & expected_types))
+            return true;
+
+        validation_error(call, handle, expected_types);
+        return false;
+    }
+
+    void create(const c8* call, u32 resource_slot, null_res type, u32 size = 0)
+    {
+        _res_pool.grow(resource_slot);
+
+        null_resource& res = _res_pool[resource_slot];
+        if (res.type != e_null_res::none)
+            validation_error(call, resource_slot, e_null_res::none);
+
+        res.type = type;
+        res.size = size;
+    }
+
+    void release(const c8* call, u32 handle, u32 expected_types)
+    {
+        if (!validate(call, handle, expected_types))
+            return;
+
+        if (handle < _res_pool._capacity)
+            _res_pool[handle] = {e_null_res::none, 0};
+    }
+
+    void validate_draw_indexed(const c8* call)
+    {
+        if (s_bound_index_buffer == 0 && log_error())
+            PEN_LOG("[null renderer] %s: no index buffer is bound", call);
+    }
+} // namespace
+
+namespace pen
+{
+    a_u64 g_gpu_total;
+
+    static renderer_info s_renderer_info;
+    const renderer_info& renderer_get_info()
+    {
+        s_renderer_info.api_version = "null";
+        s_renderer_info.shader_version = "none";
+        s_renderer_info.renderer = "null";
+        s_renderer_info.vendor = "none";
+        s_renderer_info.renderer_cmd = "-renderer null";
+
+        // report everything as supported so the same code paths run as on real hardware
+        s_renderer_info.caps = PEN_CAPS_TEXTURE_MULTISAMPLE | PEN_CAPS_DEPTH_CLAMP | PEN_CAPS_GPU_TIMER | PEN_CAPS_COMPUTE |
+                               PEN_CAPS_TEX_FORMAT_BC1 | PEN_CAPS_TEX_FORMAT_BC2 | PEN_CAPS_TEX_FORMAT_BC3 |
+                               PEN_CAPS_TEX_FORMAT_BC4 | PEN_CAPS_TEX_FORMAT_BC5;
+
+        return s_renderer_info;
+    }
+
+    const c8* renderer_get_shader_platform()
+    {
+        // shaders are never compiled, but pmfx still needs to find its info and technique data on disk
+        return "glsl";
+    }
+
+    bool renderer_viewport_vup()
+    {
+        return false;
+    }
+
+    bool renderer_depth_0_to_1()
+    {
+        return false;
+    }
+
+    namespace direct
+    {
+        u32 renderer_initialise(void* params, u32 bb_res, u32 bb_depth_res)
+        {
+            PEN_UNUSED(params);
+
+            _res_pool.init(4096);
+
+            create("renderer_initialise", bb_res, e_null_res::render_target);
+            create("renderer_initialise", bb_depth_res, e_null_res::render_target);
+
+            return 0;
+        }
+
+        void renderer_shutdown()
+        {
+            u32 live[32] = {0};
+            for (u32 i = 0; i < _res_pool._capacity; ++i)
+            {
+                u32 type = _res_pool[i].type;
+                for (u32 b = 0; type && b < 32; ++b)
+                    if (type == 1u << b)
+                        live[b]++;
+            }
+
+            for (u32 b = 0; b < 32; ++b)
+                if (live[b])
+                    PEN_LOG("[null renderer] %u %s(s) alive at shutdown", live[b], res_name(1u << b));
+
+            if (s_validation_errors)
+                PEN_LOG("[null renderer] %u validation errors", s_validation_errors);
+        }
+
+        void renderer_sync()
+        {
+            // unused on this platform
+        }
+
+        void renderer_new_frame()
+        {
+            _renderer_new_frame();
+        }
+
+        void renderer_end_frame()
+        {
+            _renderer_end_frame();
+        }
+
+        void renderer_retain()
+        {
+            // unused on this platform
+        }
+
+        void renderer_create_clear_state(const clear_state& cs, u32 resource_slot)
+        {
+            PEN_UNUSED(cs);
+
+            create("renderer_create_clear_state", resource_slot, e_null_res::clear_state);
+        }
+
+        void renderer_clear(u32 clear_state_index, u32 colour_slice, u32 depth_slice)
+        {
+            PEN_UNUSED(colour_slice);
+            PEN_UNUSED(depth_slice);
+
+            validate("renderer_clear", clear_state_index, e_null_res::clear_state);
+        }
+
+        void renderer_clear_texture(u32 clear_state_index, u32 texture)
+        {
+            validate("renderer_clear_texture", clear_state_index, e_null_res::clear_state);
+            validate("renderer_clear_texture", texture, e_null_res::texture | e_null_res::render_target);
+        }
+
+        void renderer_load_shader(const pen::shader_load_params& params, u32 resource_slot)
+        {
+            create("renderer_load_shader", resource_slot, e_null_res::shader, params.byte_code_size);
+        }
+
+        void renderer_set_shader(u32 shader_index, u32 shader_type)
+        {
+            PEN_UNUSED(shader_type);
+
+            validate("renderer_set_shader", shader_index, e_null_res::shader | e_null_res::program);
+        }
+
+        void renderer_create_input_layout(const input_layout_creation_params& params, u32 resource_slot)
+        {
+            PEN_UNUSED(params);
+
+            create("renderer_create_input_layout", resource_slot, e_null_res::input_layout);
+        }
+
+        void renderer_set_input_layout(u32 layout_index)
+        {
+            validate("renderer_set_input_layout", layout_index, e_null_res::input_layout);
+        }
+
+        void renderer_link_shader_program(const shader_link_params& params, u32 resource_slot)
+        {
+            validate("renderer_link_shader_program", params.vertex_shader, e_null_res::shader);
+            validate("renderer_link_shader_program", params.pixel_shader, e_null_res::shader);
+            validate("renderer_link_shader_program", params.compute_shader, e_null_res::shader);
+            validate("renderer_link_shader_program", params.stream_out_shader, e_null_res::shader);
+
+            create("renderer_link_shader_program", resource_slot, e_null_res::program);
+        }
+
+        void renderer_create_buffer(const buffer_creation_params& params, u32 resource_slot)
+        {
+            create("renderer_create_buffer", resource_slot, e_null_res::buffer, params.buffer_size);
+        }
+
+        void renderer_set_vertex_buffers(u32* buffer_indices, u32 num_buffers, u32 start_slot, const u32* strides,
+                                         const u32* offsets)
+        {
+            PEN_UNUSED(start_slot);
+            PEN_UNUSED(strides);
+            PEN_UNUSED(offsets);
+
+            for (u32 i = 0; i < num_buffers; ++i)
+                validate("renderer_set_vertex_buffers", buffer_indices[i], e_null_res::buffer);
+        }
+
+        void renderer_set_index_buffer(u32 buffer_index, u32 format, u32 offset)
+        {
+            PEN_UNUSED(format);
+            PEN_UNUSED(offset);
+
+            validate("renderer_set_index_buffer", buffer_index, e_null_res::buffer);
+            s_bound_index_buffer = buffer_index;
+        }
+
+        void renderer_set_constant_buffer(u32 buffer_index, u32 resource_slot, u32 flags)
+        {
+            PEN_UNUSED(resource_slot);
+            PEN_UNUSED(flags);
+
+            validate("renderer_set_constant_buffer", buffer_index, e_null_res::buffer);
+        }
+
+        void renderer_set_structured_buffer(u32 buffer_index, u32 resource_slot, u32 flags)
+        {
+            PEN_UNUSED(resource_slot);
+            PEN_UNUSED(flags);
+
+            validate("renderer_set_structured_buffer", buffer_index, e_null_res::buffer);
+        }
+
+        void renderer_update_buffer(u32 buffer_index, const void* data, u32 data_size, u32 offset)
+        {
+            PEN_UNUSED(data);
+
+            if (!validate("renderer_update_buffer", buffer_index, e_null_res::buffer))
+                return;
+
+            u32 size = _res_pool[buffer_index].size;
+            if (offset + data_size > size && log_error())
+                PEN_LOG("[null renderer] renderer_update_buffer: %u bytes at offset %u overflows buffer %u of %u bytes",
+                        data_size, offset, buffer_index, size);
+        }
+
+        void renderer_create_texture(const texture_creation_params& tcp, u32 resource_slot)
+        {
+            create("renderer_create_texture", resource_slot, e_null_res::texture, tcp.data_size);
+        }
+
+        void renderer_create_sampler(const sampler_creation_params& scp, u32 resource_slot)
+        {
+            PEN_UNUSED(scp);
+
+            create("renderer_create_sampler", resource_slot, e_null_res::sampler);
+        }
+
+        void renderer_set_texture(u32 texture_index, u32 sampler_index, u32 resource_slot, u32 bind_flags)
+        {
+            PEN_UNUSED(resource_slot);
+            PEN_UNUSED(bind_flags);
+
+            validate("renderer_set_texture", texture_index, e_null_res::texture | e_null_res::render_target);
+            validate("renderer_set_texture", sampler_index, e_null_res::sampler);
+        }
+
+        void renderer_create_rasterizer_state(const rasteriser_state_creation_params& rscp, u32 resource_slot)
+        {
+            PEN_UNUSED(rscp);
+
+            create("renderer_create_rasterizer_state", resource_slot, e_null_res::raster_state);
+        }
+
+        void renderer_set_rasterizer_state(u32 rasterizer_state_index)
+        {
+            validate("renderer_set_rasterizer_state", rasterizer_state_index, e_null_res::raster_state);
+        }
+
+        void renderer_set_viewport(const viewport& vp)
+        {
+            PEN_UNUSED(vp);
+        }
+
+        void renderer_set_scissor_rect(const rect& r)
+        {
+            PEN_UNUSED(r);
+        }
+
+        void renderer_create_blend_state(const blend_creation_params& bcp, u32 resource_slot)
+        {
+            PEN_UNUSED(bcp);
+
+            create("renderer_create_blend_state", resource_slot, e_null_res::blend_state);
+        }
+
+        void renderer_set_blend_state(u32 blend_state_index)
+        {
+            validate("renderer_set_blend_state", blend_state_index, e_null_res::blend_state);
+        }
+
+        void renderer_create_depth_stencil_state(const depth_stencil_creation_params& dscp, u32 resource_slot)
+        {
+            PEN_UNUSED(dscp);
+
+            create("renderer_create_depth_stencil_state", resource_slot, e_null_res::depth_stencil_state);
+        }
+
+        void renderer_set_depth_stencil_state(u32 depth_stencil_state)
+        {
+            validate("renderer_set_depth_stencil_state", depth_stencil_state, e_null_res::depth_stencil_state);
+        }
+
+        void renderer_set_stencil_ref(u8 ref)
+        {
+            PEN_UNUSED(ref);
+        }
+
+        void renderer_draw(u32 vertex_count, u32 start_vertex, u32 primitive_topology)
+        {
+            PEN_UNUSED(vertex_count);
+            PEN_UNUSED(start_vertex);
+            PEN_UNUSED(primitive_topology);
+        }
+
+        void renderer_draw_indexed(u32 index_count, u32 start_index, u32 base_vertex, u32 primitive_topology)
+        {
+            PEN_UNUSED(index_count);
+            PEN_UNUSED(start_index);
+            PEN_UNUSED(base_vertex);
+            PEN_UNUSED(primitive_topology);
+
+            validate_draw_indexed("renderer_draw_indexed");
+        }
+
+        void renderer_draw_indexed_instanced(u32 instance_count, u32 start_instance, u32 index_count, u32 start_index,
+                                             u32 base_vertex, u32 primitive_topology)
+        {
+            PEN_UNUSED(instance_count);
+            PEN_UNUSED(start_instance);
+            PEN_UNUSED(index_count);
+            PEN_UNUSED(start_index);
+            PEN_UNUSED(base_vertex);
+            PEN_UNUSED(primitive_topology);
+
+            validate_draw_indexed("renderer_draw_indexed_instanced");
+        }
+
+        void renderer_draw_auto()
+        {
+        }
+
+        void renderer_dispatch_compute(uint3 grid, uint3 num_threads)
+        {
+            PEN_UNUSED(grid);
+            PEN_UNUSED(num_threads);
+        }
+
+        void renderer_create_render_target(const texture_creation_params& tcp, u32 resource_slot, bool track)
+        {
+            create("renderer_create_render_target", resource_slot, e_null_res::render_target);
+
+            if (track)
+                _renderer_track_managed_render_target(tcp, resource_slot);
+        }
+
+        void renderer_set_targets(const u32* const colour_targets, u32 num_colour_targets, u32 depth_target,
+                                  u32 colour_slice, u32 depth_slice)
+        {
+            PEN_UNUSED(colour_slice);
+            PEN_UNUSED(depth_slice);
+
+            for (u32 i = 0; i < num_colour_targets; ++i)
+                validate("renderer_set_targets", colour_targets[i], e_null_res::render_target | e_null_res::texture);
+
+            validate("renderer_set_targets", depth_target, e_null_res::render_target | e_null_res::texture);
+        }
+
+        void renderer_set_resolve_targets(u32 colour_target, u32 depth_target)
+        {
+            validate("renderer_set_resolve_targets", colour_target, e_null_res::render_target);
+            validate("renderer_set_resolve_targets", depth_target, e_null_res::render_target);
+        }
+
+        void renderer_set_stream_out_target(u32 buffer_index)
+        {
+            validate("renderer_set_stream_out_target", buffer_index, e_null_res::buffer);
+        }
+
+        void renderer_resolve_target(u32 target, e_msaa_resolve_type type, resolve_resources res)
+        {
+            PEN_UNUSED(type);
+            PEN_UNUSED(res);
+
+            validate("renderer_resolve_target", target, e_null_res::render_target | e_null_res::texture);
+        }
+
+        void renderer_read_back_resource(const resource_read_back_params& rrbp)
+        {
+            validate("renderer_read_back_resource", rrbp.resource_index,
+                     e_null_res::render_target | e_null_res::texture | e_null_res::buffer);
+
+            // there is nothing to read back, but callers may be waiting on the callback
+            void* data = memory_alloc(rrbp.data_size);
+            memset(data, 0x0, rrbp.data_size);
+
+            rrbp.call_back_function(data, rrbp.row_pitch, rrbp.depth_pitch, rrbp.block_size);
+
+            memory_free(data);
+        }
+
+        void renderer_present()
+        {
+        }
+
+        void renderer_push_perf_marker(const c8* name)
+        {
+            PEN_UNUSED(name);
+        }
+
+        void renderer_pop_perf_marker()
+        {
+        }
+
+        void renderer_replace_resource(u32 dest, u32 src, e_renderer_resource type)
+        {
+            PEN_UNUSED(type);
+
+            // like the gpu backends, dest takes over the resource and src remains as an alias of it
+            _res_pool.grow(max<u32>(dest, src));
+            _res_pool[dest] = _res_pool[src];
+        }
+
+        void renderer_release_shader(u32 shader_index, u32 shader_type)
+        {
+            PEN_UNUSED(shader_type);
+
+            release("renderer_release_shader", shader_index, e_null_res::shader | e_null_res::program);
+        }
+
+        void renderer_release_clear_state(u32 clear_state)
+        {
+            release("renderer_release_clear_state", clear_state, e_null_res::clear_state);
+        }
+
+        void renderer_release_buffer(u32 buffer_index)
+        {
+            release("renderer_release_buffer", buffer_index, e_null_res::buffer);
+
+            if (s_bound_index_buffer == buffer_index)
+                s_bound_index_buffer = 0;
+        }
+
+        void renderer_release_texture(u32 texture_index)
+        {
+            release("renderer_release_texture", texture_index, e_null_res::texture);
+        }
+
+        void renderer_release_sampler(u32 sampler)
+        {
+            release("renderer_release_sampler", sampler, e_null_res::sampler);
+        }
+
+        void renderer_release_raster_state(u32 raster_state_index)
+        {
+            release("renderer_release_raster_state", raster_state_index, e_null_res::raster_state);
+        }
+
+        void renderer_release_blend_state(u32 blend_state)
+        {
+            release("renderer_release_blend_state", blend_state, e_null_res::blend_state);
+        }
+
+        void renderer_release_render_target(u32 render_target)
+        {
+            release("renderer_release_render_target", render_target, e_null_res::render_target);
+            _renderer_untrack_managed_render_target(render_target);
+        }
+
+        void renderer_release_input_layout(u32 input_layout)
+        {
+            release("renderer_release_input_layout", input_layout, e_null_res::input_layout);
+        }
+
+        void renderer_release_depth_stencil_state(u32 depth_stencil_state)
+        {
+            release("renderer_release_depth_stencil_state", depth_stencil_state, e_null_res::depth_stencil_state);
+        }
+    } // namespace direct
+} // namespace pen
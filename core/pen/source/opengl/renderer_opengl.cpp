@@ -604,7 +604,12 @@ namespace pen
             CHECK_CALL(glEndQuery(GL_TIME_ELAPSED));
         }
 
-        insert_marker(name);
+        // name points into the cmd stream, keep a copy until the results are gathered
+        u32 len = string_length(name) + 1;
+        c8* name_copy = (c8*)memory_alloc(len);
+        memcpy(name_copy, name, len);
+
+        insert_marker(name_copy);
 
         ++depth;
 #endif
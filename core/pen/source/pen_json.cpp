@@ -438,7 +438,7 @@ namespace pen
 
         if (err == PEN_ERR_OK)
         {
-            new_json.m_internal_object = (json_object*)memory_alloc(sizeof(json_object));
+            new_json.m_internal_object = (json_object*)memory_alloc(sizeof(json_object), e_mem_tag::json);
             new_json.m_internal_object->data = (c8*)data;
             new_json.m_internal_object->size = size;
             new_json.m_internal_object->name = nullptr;
@@ -453,7 +453,7 @@ namespace pen
     {
         json new_json;
 
-        new_json.m_internal_object = (json_object*)memory_alloc(sizeof(json_object));
+        new_json.m_internal_object = (json_object*)memory_alloc(sizeof(json_object), e_mem_tag::json);
 
         new_json.m_internal_object->data = pen::sub_string(json_str, pen::string_length(json_str));
 
@@ -594,7 +594,7 @@ namespace pen
     {
         json new_json;
 
-        new_json.m_internal_object = (json_object*)memory_alloc(sizeof(json_object));
+        new_json.m_internal_object = (json_object*)memory_alloc(sizeof(json_object), e_mem_tag::json);
 
         *new_json.m_internal_object = m_internal_object->get_object_by_name(name);
         return new_json;
@@ -604,7 +604,7 @@ namespace pen
     {
         json new_json;
 
-        new_json.m_internal_object = (json_object*)memory_alloc(sizeof(json_object));
+        new_json.m_internal_object = (json_object*)memory_alloc(sizeof(json_object), e_mem_tag::json);
 
         *new_json.m_internal_object = m_internal_object->get_object_by_index(index);
         return new_json;
@@ -627,7 +627,7 @@ namespace pen
         if (other.m_internal_object == nullptr)
             return;
 
-        dst->m_internal_object = (json_object*)memory_alloc(sizeof(json_object));
+        dst->m_internal_object = (json_object*)memory_alloc(sizeof(json_object), e_mem_tag::json);
 
         // shallow copy default copy ctor
         *dst->m_internal_object = *other.m_internal_object;
@@ -641,7 +641,7 @@ namespace pen
         {
             s32 data_size = string_length(other.m_internal_object->data);
 
-            dst->m_internal_object->data = (c8*)memory_alloc(data_size + 1);
+            dst->m_internal_object->data = (c8*)memory_alloc(data_size + 1, e_mem_tag::json);
             memcpy(dst->m_internal_object->data, other.m_internal_object->data, data_size);
             dst->m_internal_object->data[data_size] = '\0';
         }
@@ -650,7 +650,7 @@ namespace pen
         if (other.m_internal_object->name)
         {
             s32 name_size = string_length(other.m_internal_object->name);
-            m_internal_object->name = (c8*)memory_alloc(name_size + 1);
+            m_internal_object->name = (c8*)memory_alloc(name_size + 1, e_mem_tag::json);
             m_internal_object->name[name_size] = '\0';
 
             memcpy(m_internal_object->name, other.m_internal_object->name, name_size);
@@ -8,7 +8,9 @@
 #include "memory.h"
 #include "os.h"
 #include "pen_string.h"
+#include "timer.h"
 
+#include <errno.h>
 #include <fcntl.h>
 #include <pthread.h>
 #include <semaphore.h>
@@ -31,6 +33,14 @@ namespace pen
         sem_t* handle;
     };
 
+    struct event
+    {
+        pthread_mutex_t mutex;
+        pthread_cond_t  cond;
+        a_u32           state;   // 1 = signalled
+        a_u32           waiters; // notify only needs to take the lock when a thread may be blocked
+    };
+
     u32 semaphone_index = 0;
 
     pen::thread* thread_create(dispatch_thread thread_func, u32 stack_size, void* thread_params, thread_start_flags flags)
@@ -120,7 +130,9 @@ namespace pen
 
     bool semaphore_wait(semaphore* p_semaphore)
     {
+        f64 start = get_time_us();
         sem_wait(p_semaphore->handle);
+        _thread_add_idle_time(get_time_us() - start);
 
         return true;
     }
@@ -138,6 +150,81 @@ namespace pen
         sem_post(p_semaphore->handle);
     }
 
+    pen::event* event_create()
+    {
+        pen::event* new_event = (pen::event*)pen::memory_alloc(sizeof(pen::event));
+
+        pthread_mutex_init(&new_event->mutex, nullptr);
+        pthread_cond_init(&new_event->cond, nullptr);
+        new_event->state = 0;
+        new_event->waiters = 0;
+
+        return new_event;
+    }
+
+    void event_destroy(event* p_event)
+    {
+        pthread_cond_destroy(&p_event->cond);
+        pthread_mutex_destroy(&p_event->mutex);
+
+        pen::memory_free(p_event);
+    }
+
+    void event_notify(event* p_event)
+    {
+        // already signalled, or nobody to wake
+        if (p_event->state.exchange(1) == 1)
+            return;
+
+        if (p_event->waiters.load() == 0)
+            return;
+
+        pthread_mutex_lock(&p_event->mutex);
+        pthread_cond_signal(&p_event->cond);
+        pthread_mutex_unlock(&p_event->mutex);
+    }
+
+    bool event_wait(event* p_event, u32 timeout_ms)
+    {
+        if (p_event->state.exchange(0) == 1)
+            return true;
+
+        f64 start = get_time_us();
+
+        timespec deadline;
+        if (timeout_ms != k_wait_infinite)
+        {
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            u64 ns = (u64)deadline.tv_nsec + (u64)timeout_ms * 1000000;
+            deadline.tv_sec += ns / 1000000000;
+            deadline.tv_nsec = ns % 1000000000;
+        }
+
+        // waiters is incremented before checking state, so a notify either sees the waiter or the waiter sees the state
+        bool signalled = true;
+        p_event->waiters++;
+        pthread_mutex_lock(&p_event->mutex);
+
+        while (p_event->state.exchange(0) == 0)
+        {
+            if (timeout_ms == k_wait_infinite)
+            {
+                pthread_cond_wait(&p_event->cond, &p_event->mutex);
+            }
+            else if (pthread_cond_timedwait(&p_event->cond, &p_event->mutex, &deadline) == ETIMEDOUT)
+            {
+                signalled = p_event->state.exchange(0) == 1;
+                break;
+            }
+        }
+
+        pthread_mutex_unlock(&p_event->mutex);
+        p_event->waiters--;
+
+        _thread_add_idle_time(get_time_us() - start);
+        return signalled;
+    }
+
     void thread_sleep_ms(u32 milliseconds)
     {
         usleep(milliseconds * 1000);
@@ -147,4 +234,13 @@ namespace pen
     {
         usleep(microseconds);
     }
+
+    u32 thread_get_hardware_concurrency()
+    {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        if (n < 1)
+            return 1;
+
+        return (u32)n;
+    }
 } // namespace pen
@@ -0,0 +1,229 @@
+// profiler.cpp
+// Copyright 2014 - 2019 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+#include "profiler.h"
+#include "console.h"
+#include "memory.h"
+#include "renderer_shared.h"
+#include "threads.h"
+#include "timer.h"
+
+#include <stdio.h>
+
+using namespace pen;
+
+namespace
+{
+    enum profiler_constants
+    {
+        k_max_profile_threads = 64,
+        k_max_profile_events = 1 << 16, // per thread, must be power of 2
+        k_max_profile_depth = 64
+    };
+
+    struct open_scope
+    {
+        const c8* name;
+        f64       start_us;
+        u64       frame;
+        bool      recording;
+    };
+
+    // written by the owning thread only, readers check write_pos to discard events which may have been overwritten
+    struct profile_thread
+    {
+        std::atomic<const c8*> name;
+        profile_event*         events;
+        a_u64                  write_pos;
+        u32                    depth;
+        open_scope             stack[k_max_profile_depth];
+    };
+
+    std::atomic<profile_thread*> s_threads[k_max_profile_threads];
+    a_u32                        s_num_threads = {0};
+    a_u8                         s_enabled = {1};
+
+    thread_local profile_thread* t_thread = nullptr;
+
+    // handed to threads beyond k_max_profile_threads, they are never recorded and never write to it
+    profile_thread s_untracked_thread;
+
+    profile_thread* register_thread()
+    {
+        u32 i = s_num_threads.fetch_add(1);
+        if (i >= k_max_profile_threads)
+        {
+            if (i == k_max_profile_threads)
+                PEN_LOG("[profiler] more than %u threads, new threads will not be profiled\n", k_max_profile_threads);
+
+            return &s_untracked_thread;
+        }
+
+        profile_thread* pt = (profile_thread*)memory_calloc(1, sizeof(profile_thread));
+        pt->events = (profile_event*)memory_alloc(sizeof(profile_event) * k_max_profile_events);
+        pt->name = thread_get_name();
+        pt->write_pos = 0;
+
+        s_threads[i] = pt;
+        return pt;
+    }
+
+    profile_thread* get_thread(u32 thread)
+    {
+        if (thread >= min<u32>(s_num_threads, k_max_profile_threads))
+            return nullptr;
+
+        // may still be registering
+        return s_threads[thread].load();
+    }
+} // namespace
+
+namespace pen
+{
+    void profiler_enable(bool enable)
+    {
+        s_enabled = enable;
+    }
+
+    bool profiler_is_enabled()
+    {
+        return s_enabled;
+    }
+
+    void profiler_begin(const c8* name)
+    {
+        profile_thread* pt = t_thread;
+        if (!pt)
+        {
+            pt = register_thread();
+            t_thread = pt;
+        }
+
+        if (pt == &s_untracked_thread)
+            return;
+
+        u32 d = pt->depth++;
+        if (d >= k_max_profile_depth)
+            return;
+
+        // threads may be named after they start recording
+        if (d == 0)
+            pt->name = thread_get_name();
+
+        open_scope& s = pt->stack[d];
+        s.recording = s_enabled;
+        if (!s.recording)
+            return;
+
+        s.name = name;
+        s.frame = _renderer_frame_index();
+        s.start_us = get_time_us();
+    }
+
+    void profiler_end()
+    {
+        profile_thread* pt = t_thread;
+        if (pt == &s_untracked_thread)
+            return;
+
+        PEN_ASSERT(pt && pt->depth > 0);
+
+        u32 d = --pt->depth;
+        if (d >= k_max_profile_depth)
+            return;
+
+        open_scope& s = pt->stack[d];
+        if (!s.recording)
+            return;
+
+        u64            pos = pt->write_pos.load(std::memory_order_relaxed);
+        profile_event& e = pt->events[pos & (k_max_profile_events - 1)];
+        e.name = s.name;
+        e.start_us = s.start_us;
+        e.end_us = get_time_us();
+        e.frame = s.frame;
+        e.depth = d;
+
+        pt->write_pos.store(pos + 1, std::memory_order_release);
+    }
+
+    u32 profiler_get_num_threads()
+    {
+        return min<u32>(s_num_threads, k_max_profile_threads);
+    }
+
+    const c8* profiler_get_thread_name(u32 thread)
+    {
+        profile_thread* pt = get_thread(thread);
+        if (!pt || !pt->name.load())
+            return "unnamed";
+
+        return pt->name;
+    }
+
+    u32 profiler_get_events(u32 thread, u64 frame, profile_event* events, u32 max_events)
+    {
+        profile_thread* pt = get_thread(thread);
+        if (!pt)
+            return 0;
+
+        u64 end = pt->write_pos.load(std::memory_order_acquire);
+        u64 start = end > k_max_profile_events ? end - k_max_profile_events : 0;
+
+        u32 count = 0;
+        for (u64 i = start; i < end && count < max_events; ++i)
+        {
+            const profile_event& e = pt->events[i & (k_max_profile_events - 1)];
+            if (frame != k_profile_all_frames && e.frame != frame)
+                continue;
+
+            events[count] = e;
+
+            // the writer may have wrapped around onto this event while it was copied
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (pt->write_pos.load(std::memory_order_relaxed) - i >= k_max_profile_events)
+                continue;
+
+            ++count;
+        }
+
+        return count;
+    }
+
+    bool profiler_export_chrome_trace(const c8* filename)
+    {
+        FILE* fp = fopen(filename, "w");
+        if (!fp)
+            return false;
+
+        profile_event* events = (profile_event*)memory_alloc(sizeof(profile_event) * k_max_profile_events);
+
+        fprintf(fp, "{\"traceEvents\":[\n");
+
+        bool first = true;
+        u32  num_threads = profiler_get_num_threads();
+        for (u32 t = 0; t < num_threads; ++t)
+        {
+            fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                    first ? "" : ",\n", t, profiler_get_thread_name(t));
+            first = false;
+
+            u32 num_events = profiler_get_events(t, k_profile_all_frames, events, k_max_profile_events);
+            for (u32 i = 0; i < num_events; ++i)
+            {
+                const profile_event& e = events[i];
+                fprintf(fp,
+                        ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,"
+                        "\"args\":{\"frame\":%llu}}",
+                        e.name, t, e.start_us, e.end_us - e.start_us, (unsigned long long)e.frame);
+            }
+        }
+
+        fprintf(fp, "\n]}\n");
+        fclose(fp);
+
+        memory_free(events);
+        return true;
+    }
+} // namespace pen
@@ -11,6 +11,7 @@
 #include "os.h"
 #include "pen.h"
 #include "pen_string.h"
+#include "profiler.h"
 #include "renderer.h"
 #include "renderer_shared.h"
 #include "slot_resource.h"
@@ -111,14 +112,11 @@ namespace
         u32 texture_index;
     };
 
+    // buffer_indices, strides and offsets follow inline in the cmd stream
     struct set_vertex_buffer_cmd
     {
-        u32  buffer_index;
-        u32  start_slot;
-        u32* buffer_indices;
-        u32  num_buffers;
-        u32* strides;
-        u32* offsets;
+        u32 start_slot;
+        u32 num_buffers;
     };
 
     struct set_index_buffer_cmd
@@ -168,6 +166,7 @@ namespace
         u32 flags;
     };
 
+    // data follows inline in the cmd stream, unless it is too large and has been allocated from the frame arena
     struct update_buffer_cmd
     {
         u32   buffer_index;
@@ -195,11 +194,13 @@ namespace
         uint3 num_threads;
     };
 
+    // commands are packed into the cmd stream as the header followed by only the active union member and any
+    // inline payload, so small commands such as draws and state changes do not pay for the largest member.
     struct renderer_cmd
     {
-        u32 command_index;
+        u32 command_index : 8;
+        u32 cmd_size : 24; // header + payload + inline data, aligned to k_cmd_align
         u32 resource_slot;
-        u64 frame_index;
 
         union {
             u32                              command_data_index;
@@ -230,13 +231,249 @@ namespace
             msaa_resolve_params              resolve_params;
             replace_resource                 replace_resource_params;
             clear_state                      clear_state_params;
-            c8*                              name;
             compute_dispatch_params          cs_dispatch;
             u8                               stencil_ref;
         };
 
+        u64 frame_index; // only used by release_cmd_buffer, which is not packed
+
         renderer_cmd(){};
     };
+
+    static const u32 k_cmd_align = 8;
+    static const u32 k_cmd_header_size = 8;
+    static const u32 k_cmd_average_size = 32; // used to size the cmd stream from max_commands
+    static const u32 k_max_inline_size = 64 * 1024;
+    static const u32 k_os_update_interval_ms = 4; // how often an idle render thread wakes to pump the os
+
+    u32 cmd_payload_size(u32 command_index)
+    {
+        switch (command_index)
+        {
+            case CMD_CLEAR:
+            case CMD_CLEAR_TEXTURE:
+                return sizeof(renderer_cmd::clear);
+            case CMD_LOAD_SHADER:
+                return sizeof(renderer_cmd::shader_load);
+            case CMD_SET_SHADER:
+                return sizeof(renderer_cmd::set_shader);
+            case CMD_LINK_SHADER:
+                return sizeof(renderer_cmd::link_params);
+            case CMD_CREATE_INPUT_LAYOUT:
+                return sizeof(renderer_cmd::create_input_layout);
+            case CMD_SET_INPUT_LAYOUT:
+            case CMD_SET_RASTER_STATE:
+            case CMD_SET_BLEND_STATE:
+            case CMD_SET_DEPTH_STENCIL_STATE:
+            case CMD_SET_SO_TARGET:
+                return sizeof(renderer_cmd::command_data_index);
+            case CMD_CREATE_BUFFER:
+                return sizeof(renderer_cmd::create_buffer);
+            case CMD_SET_VERTEX_BUFFER:
+                return sizeof(renderer_cmd::set_vertex_buffer);
+            case CMD_SET_INDEX_BUFFER:
+                return sizeof(renderer_cmd::set_index_buffer);
+            case CMD_DRAW:
+                return sizeof(renderer_cmd::draw);
+            case CMD_DRAW_INDEXED:
+                return sizeof(renderer_cmd::draw_indexed);
+            case CMD_DRAW_INDEXED_INSTANCED:
+                return sizeof(renderer_cmd::draw_indexed_instanced);
+            case CMD_CREATE_TEXTURE:
+                return sizeof(renderer_cmd::create_texture);
+            case CMD_CREATE_SAMPLER:
+                return sizeof(renderer_cmd::create_sampler);
+            case CMD_SET_TEXTURE:
+                return sizeof(renderer_cmd::set_texture);
+            case CMD_CREATE_RASTER_STATE:
+                return sizeof(renderer_cmd::create_raster_state);
+            case CMD_SET_VIEWPORT:
+            case CMD_SET_VIEWPORT_RATIO:
+                return sizeof(renderer_cmd::set_viewport);
+            case CMD_SET_SCISSOR_RECT:
+            case CMD_SET_SCISSOR_RECT_RATIO:
+                return sizeof(renderer_cmd::set_rect);
+            case CMD_CREATE_BLEND_STATE:
+                return sizeof(renderer_cmd::create_blend_state);
+            case CMD_SET_CONSTANT_BUFFER:
+            case CMD_SET_STRUCTURED_BUFFER:
+                return sizeof(renderer_cmd::set_buffer);
+            case CMD_UPDATE_BUFFER:
+                return sizeof(renderer_cmd::update_buffer);
+            case CMD_CREATE_DEPTH_STENCIL_STATE:
+                return sizeof(renderer_cmd::p_create_depth_stencil_state);
+            case CMD_CREATE_RENDER_TARGET:
+                return sizeof(renderer_cmd::create_render_target);
+            case CMD_SET_TARGETS:
+                return sizeof(renderer_cmd::set_targets);
+            case CMD_RESOLVE_TARGET:
+                return sizeof(renderer_cmd::resolve_params);
+            case CMD_MAP_RESOURCE:
+                return sizeof(renderer_cmd::rrb_params);
+            case CMD_REPLACE_RESOURCE:
+                return sizeof(renderer_cmd::replace_resource_params);
+            case CMD_CREATE_CLEAR_STATE:
+                return sizeof(renderer_cmd::clear_state_params);
+            case CMD_DISPATCH_COMPUTE:
+                return sizeof(renderer_cmd::cs_dispatch);
+            case CMD_SET_STENCIL_REF:
+                return sizeof(renderer_cmd::stencil_ref);
+            default:
+                // no payload, name of perf markers is inline
+                return 0;
+        }
+    }
+
+    pen_inline const u8* cmd_inline_data(const renderer_cmd& cmd)
+    {
+        return (const u8*)&cmd + k_cmd_header_size + cmd_payload_size(cmd.command_index);
+    }
+
+    // single producer single consumer ring buffer of variable size, packed commands.
+    // the producer waits for the consumer when full, commands are only retired once they have been executed.
+    struct cmd_stream
+    {
+        u8*   data = nullptr;
+        u32   capacity = 0;
+        u8    _pad0[k_cache_line_size];
+        a_u32 get_pos = {0};
+        u8    _pad1[k_cache_line_size - sizeof(a_u32)];
+        a_u32 put_pos = {0};
+        u8    _pad2[k_cache_line_size - sizeof(a_u32)];
+
+        void create(u32 size)
+        {
+            capacity = size;
+            data = (u8*)memory_alloc(capacity, e_mem_tag::renderer);
+            memset(data, 0x0, capacity);
+        }
+
+        u8* alloc(u32 size)
+        {
+            PEN_ASSERT(size <= capacity / 4);
+
+            u32 pp = put_pos;
+            if (pp + size > capacity)
+            {
+                // not enough contiguous space at the end, wait until the consumer has read up to here and wrapped
+                // space is available at the front, then leave a CMD_NONE marker telling it to jump to the start.
+                for (;;)
+                {
+                    u32 gp = get_pos;
+                    if (gp <= pp && gp > size)
+                        break;
+                    thread_sleep_ms(0);
+                }
+
+                ((renderer_cmd*)(data + pp))->command_index = CMD_NONE;
+                put_pos = 0;
+                return data;
+            }
+
+            // the end of the write may never land on the read position, put == get means empty
+            for (;;)
+            {
+                u32 gp = get_pos;
+                u32 end = pp + size;
+                if (gp <= pp && (end < capacity || gp > 0))
+                    break;
+                if (gp > pp && end < gp)
+                    break;
+                thread_sleep_ms(0);
+            }
+
+            return data + pp;
+        }
+
+        void commit(u32 size)
+        {
+            u32 pp = put_pos + size;
+            put_pos = pp == capacity ? 0 : pp;
+        }
+
+        renderer_cmd* check()
+        {
+            for (;;)
+            {
+                u32 gp = get_pos;
+                if (gp == put_pos)
+                    return nullptr;
+
+                renderer_cmd* cmd = (renderer_cmd*)(data + gp);
+                if (cmd->command_index != CMD_NONE)
+                    return cmd;
+
+                get_pos = 0;
+            }
+        }
+
+        void retire(const renderer_cmd* cmd)
+        {
+            u32 gp = get_pos + cmd->cmd_size;
+            get_pos = gp == capacity ? 0 : gp;
+        }
+    };
+
+    // linear allocator for cmd payloads, multi buffered by frame. an arena is retired once the render thread has
+    // presented the frame which used it. allocations which do not fit fall back to the heap, and the arena grows to
+    // the peak usage when it is next reset, so in the steady state there is no heap traffic.
+    static const u32    k_num_frame_arenas = 3;
+    static const size_t k_frame_arena_align = 16;
+    static const size_t k_frame_arena_initial_size = 1024 * 1024;
+    static const size_t k_frame_arena_max_size = 32 * 1024 * 1024;
+
+    struct frame_arena
+    {
+        u8*         data = nullptr;
+        size_t      capacity = 0;
+        a_size_t    pos = {0};
+        void**      overflow = nullptr;
+        pen::mutex* overflow_mutex = nullptr;
+
+        void create(size_t size)
+        {
+            capacity = size;
+            data = (u8*)memory_alloc(capacity, e_mem_tag::renderer);
+            overflow_mutex = mutex_create();
+        }
+
+        void* alloc(size_t size)
+        {
+            size_t aligned_size = (size + k_frame_arena_align - 1) & ~(k_frame_arena_align - 1);
+            size_t offset = pos.fetch_add(aligned_size);
+
+            if (offset + aligned_size <= capacity)
+                return data + offset;
+
+            void* mem = memory_alloc(size, e_mem_tag::renderer);
+
+            mutex_lock(overflow_mutex);
+            sb_push(overflow, mem);
+            mutex_unlock(overflow_mutex);
+
+            return mem;
+        }
+
+        void reset()
+        {
+            size_t used = pos;
+            if (used > capacity && capacity < k_frame_arena_max_size)
+            {
+                capacity = min<size_t>(used, k_frame_arena_max_size);
+                memory_free(data);
+                data = (u8*)memory_alloc(capacity, e_mem_tag::renderer);
+            }
+
+            u32 num_overflow = sb_count(overflow);
+            for (u32 i = 0; i < num_overflow; ++i)
+                memory_free(overflow[i]);
+
+            if (overflow)
+                stb__sbn(overflow) = 0;
+
+            pos = 0;
+        }
+    };
         
     // front end render_ctx
     struct fe_render_ctx
@@ -246,15 +483,231 @@ namespace
         pen::resolve_resources    resolve_resources;
         pen::semaphore*           consume_semaphore = nullptr;
         pen::semaphore*           continue_semaphore = nullptr;
+        pen::event*               cmd_event = nullptr;   // notified when cmds are committed, wakes the render thread
+        pen::event*               frame_event = nullptr; // notified when the render thread completes a frame
         pen::slot_resources       renderer_slot_resources;
-        ring_buffer<renderer_cmd> cmd_buffer;
+        cmd_stream                cmd_buffer;
         ring_buffer<renderer_cmd> release_cmd_buffer;
+        renderer_cmd*             release_overflow = nullptr; // producer side, waiting for space in release_cmd_buffer
         u32*                      free_slots = nullptr;
         std::atomic<s32>          wait;
+        a_u32                     frame_cmd_bytes = {0};
+        a_u32                     frame_cmd_count = {0};
+        u32                       cmd_bytes = 0;
+        u32                       cmd_count = 0;
+        pen::timer*               consume_timer = nullptr;
+        f64                       frame_consume_time = 0.0;
+        f64                       consume_time = 0.0;
+        frame_arena               arenas[k_num_frame_arenas];
+        a_u64                     recorded_frames = {0};
+        a_u64                     presented_frames = {0};
+        renderer_frame_stats      frame_stats = {};
+        renderer_frame_stats      stats = {};
     };
     static fe_render_ctx* _ctx;
     static render_ctx     _main_ctx;
 
+    // command lists can be recorded from any thread, and are submitted into the main cmd_buffer in order
+    struct cmd_list
+    {
+        u8* stream = nullptr;
+        u64 frame = 0; // the frame the list is recorded in, its payloads are allocated from that frame's arena
+    };
+    static cmd_list**             s_cmd_lists = nullptr;
+    static pen::mutex*            s_cmd_list_mutex = nullptr; // lists can be created from any thread, guards the table
+    static thread_local cmd_list* t_cmd_list = nullptr;
+
+    cmd_list* get_cmd_list(u32 list)
+    {
+        mutex_lock(s_cmd_list_mutex);
+        PEN_ASSERT(list < (u32)sb_count(s_cmd_lists));
+        cmd_list* cl = s_cmd_lists[list];
+        mutex_unlock(s_cmd_list_mutex);
+
+        return cl;
+    }
+
+    void add_cmd(renderer_cmd& cmd, const void* inline_data = nullptr, u32 inline_size = 0)
+    {
+        u32 size = k_cmd_header_size + cmd_payload_size(cmd.command_index);
+        u32 aligned_size = (size + inline_size + k_cmd_align - 1) & ~(k_cmd_align - 1);
+        cmd.cmd_size = aligned_size;
+
+        u8* dst = nullptr;
+        if (t_cmd_list)
+            dst = sb_add(t_cmd_list->stream, aligned_size);
+        else
+            dst = _ctx->cmd_buffer.alloc(aligned_size);
+
+        memcpy(dst, &cmd, size);
+        if (inline_size)
+            memcpy(dst + size, inline_data, inline_size);
+
+        if (!t_cmd_list)
+        {
+            _ctx->cmd_buffer.commit(aligned_size);
+            _ctx->frame_cmd_bytes += aligned_size;
+            _ctx->frame_cmd_count++;
+            event_notify(_ctx->cmd_event);
+        }
+    }
+
+    // moves overflowed releases into the ring as the render thread frees space, oldest first
+    void flush_release_cmds()
+    {
+        u32 num = sb_count(_ctx->release_overflow);
+        if (num == 0)
+            return;
+
+        u32 written = _ctx->release_cmd_buffer.put_batch(_ctx->release_overflow, num);
+        if (written == 0)
+            return;
+
+        memmove(_ctx->release_overflow, _ctx->release_overflow + written, (num - written) * sizeof(renderer_cmd));
+        stb__sbn(_ctx->release_overflow) = num - written;
+    }
+
+    // releases are drained by the render thread only once frames complete, so the caller must never wait on them.
+    // when the ring is full they queue up on the producer side, which keeps them in frame order.
+    void add_release_cmd(const renderer_cmd& cmd)
+    {
+        if (cmd.resource_slot == 0)
+            return;
+
+        flush_release_cmds();
+
+        if (sb_count(_ctx->release_overflow) || !_ctx->release_cmd_buffer.put(cmd))
+            sb_push(_ctx->release_overflow, cmd);
+    }
+
+    // handles given to the caller are versioned, the render thread only sees slots.
+    // null and invalid handles pass through, in debug a stale handle asserts on use
+    pen_inline u32 get_slot(u32 handle)
+    {
+        if (handle == 0 || !is_valid(handle))
+            return handle;
+
+#if PEN_SLOT_RESOURCES_DEBUG
+        if (!slot_resources_validate(&_ctx->renderer_slot_resources, handle))
+        {
+            PEN_ASSERT_MSG(0, "renderer resource used after release");
+        }
+#endif
+        return slot_resources_handle_slot(handle);
+    }
+
+    pen_inline u32 get_handle(u32 slot)
+    {
+        return slot_resources_get_handle(&_ctx->renderer_slot_resources, slot);
+    }
+
+    // releases are always validated, a stale handle would otherwise free whichever resource now owns its slot.
+    // the handle is retired now rather than when the deferred free runs, so releasing it twice is caught here too
+    u32 get_release_slot(u32 handle)
+    {
+        if (slot_resources_retire(&_ctx->renderer_slot_resources, handle))
+            return slot_resources_handle_slot(handle);
+
+        if (handle != 0 && is_valid(handle))
+            PEN_LOG("[renderer] release of a stale handle %x was ignored\n", handle);
+
+        return 0;
+    }
+
+    // only the thread which owns the main cmd buffer allocates from the current frame, it is also the one which
+    // rotates the arenas in renderer_present. cmd lists use the arena of the frame they were begun in, which stays
+    // live as long as the list is submitted in that same frame
+    void* frame_alloc(size_t size)
+    {
+        u64 frame = t_cmd_list ? t_cmd_list->frame : (u64)_ctx->recorded_frames;
+        return _ctx->arenas[frame % k_num_frame_arenas].alloc(size);
+    }
+
+    void count_cmd(const renderer_cmd& cmd, renderer_frame_stats& fs)
+    {
+        switch (cmd.command_index)
+        {
+            case CMD_DRAW:
+            case CMD_DRAW_INDEXED:
+            case CMD_DRAW_AUTO:
+                fs.draw_calls++;
+                fs.instances++;
+                break;
+
+            case CMD_DRAW_INDEXED_INSTANCED:
+                fs.draw_calls++;
+                fs.instances += cmd.draw_indexed_instanced.instance_count;
+                break;
+
+            case CMD_DISPATCH_COMPUTE:
+                fs.dispatches++;
+                break;
+
+            case CMD_SET_SHADER:
+            case CMD_SET_INPUT_LAYOUT:
+            case CMD_SET_VERTEX_BUFFER:
+            case CMD_SET_INDEX_BUFFER:
+            case CMD_SET_TEXTURE:
+            case CMD_SET_RASTER_STATE:
+            case CMD_SET_VIEWPORT:
+            case CMD_SET_SCISSOR_RECT:
+            case CMD_SET_VIEWPORT_RATIO:
+            case CMD_SET_SCISSOR_RECT_RATIO:
+            case CMD_SET_BLEND_STATE:
+            case CMD_SET_CONSTANT_BUFFER:
+            case CMD_SET_STRUCTURED_BUFFER:
+            case CMD_SET_DEPTH_STENCIL_STATE:
+            case CMD_SET_TARGETS:
+            case CMD_SET_SO_TARGET:
+            case CMD_SET_STENCIL_REF:
+                fs.state_changes++;
+                break;
+
+            case CMD_UPDATE_BUFFER:
+                fs.bytes_uploaded += cmd.update_buffer.data_size;
+                break;
+
+            case CMD_CREATE_BUFFER:
+                fs.resources_created++;
+                if (cmd.create_buffer.data)
+                    fs.bytes_uploaded += cmd.create_buffer.buffer_size;
+                break;
+
+            case CMD_CREATE_TEXTURE:
+                fs.resources_created++;
+                if (cmd.create_texture.data)
+                    fs.bytes_uploaded += cmd.create_texture.data_size;
+                break;
+
+            case CMD_LOAD_SHADER:
+            case CMD_LINK_SHADER:
+            case CMD_CREATE_INPUT_LAYOUT:
+            case CMD_CREATE_SAMPLER:
+            case CMD_CREATE_RASTER_STATE:
+            case CMD_CREATE_BLEND_STATE:
+            case CMD_CREATE_DEPTH_STENCIL_STATE:
+            case CMD_CREATE_RENDER_TARGET:
+            case CMD_CREATE_CLEAR_STATE:
+            case CMD_CREATE_SO_SHADER:
+                fs.resources_created++;
+                break;
+
+            case CMD_RELEASE_SHADER:
+            case CMD_RELEASE_BUFFER:
+            case CMD_RELEASE_TEXTURE_2D:
+            case CMD_RELEASE_RASTER_STATE:
+            case CMD_RELEASE_BLEND_STATE:
+            case CMD_RELEASE_RENDER_TARGET:
+            case CMD_RELEASE_INPUT_LAYOUT:
+            case CMD_RELEASE_SAMPLER:
+            case CMD_RELEASE_PROGRAM:
+            case CMD_RELEASE_CLEAR_STATE:
+            case CMD_RELEASE_DEPTH_STENCIL_STATE:
+                fs.resources_released++;
+                break;
+        }
+    }
+
 } // namespace
 
 namespace pen
@@ -262,6 +715,20 @@ namespace pen
     void end_frame_internal();
     void new_frame_internal();
     
+    void renderer_get_cmd_stats(renderer_cmd_stats& stats)
+    {
+        // every cmd was copied whole before packing and renderer_cmd still holds the full union, so it is the baseline
+        stats.cmds = _ctx->cmd_count;
+        stats.bytes = _ctx->cmd_bytes;
+        stats.fixed_bytes = _ctx->cmd_count * (u32)sizeof(renderer_cmd);
+        stats.consume_ms = (f32)_ctx->consume_time;
+    }
+
+    void renderer_get_frame_stats(renderer_frame_stats& stats)
+    {
+        stats = _ctx->stats;
+    }
+
     void renderer_get_present_time(f32& cpu_ms, f32& gpu_ms)
     {
         extern a_u64 g_gpu_total;
@@ -272,6 +739,8 @@ namespace pen
     
     void exec_cmd(const renderer_cmd& cmd)
     {
+        count_cmd(cmd, _ctx->frame_stats);
+
         switch (cmd.command_index)
         {
             case CMD_NEW_FRAME:
@@ -284,16 +753,22 @@ namespace pen
                 direct::renderer_clear_texture(cmd.clear.clear_state, cmd.clear.texture_index);
                 break;
             case CMD_PRESENT:
+            {
+                PEN_PROFILE_SCOPE("renderer_present");
+                _ctx->consume_time = _ctx->frame_consume_time;
+                _ctx->frame_consume_time = 0.0;
+                _ctx->stats = _ctx->frame_stats;
+                _ctx->frame_stats = {};
                 direct::renderer_present();
+                _ctx->presented_frames++;
                 end_frame_internal();
                 _ctx->present_time = timer_elapsed_ms(_ctx->present_timer);
                 timer_start(_ctx->present_timer);
-                break;
+            }
+            break;
 
             case CMD_LOAD_SHADER:
                 direct::renderer_load_shader(cmd.shader_load, cmd.resource_slot);
-                memory_free(cmd.shader_load.byte_code);
-                memory_free(cmd.shader_load.so_decl_entries);
                 break;
 
             case CMD_SET_SHADER:
@@ -302,19 +777,10 @@ namespace pen
 
             case CMD_LINK_SHADER:
                 direct::renderer_link_shader_program(cmd.link_params, cmd.resource_slot);
-                for (u32 i = 0; i < cmd.link_params.num_constants; ++i)
-                    memory_free(cmd.link_params.constants[i].name);
-                memory_free(cmd.link_params.constants);
-                if (cmd.link_params.stream_out_names)
-                    for (u32 i = 0; i < cmd.link_params.num_stream_out_names; ++i)
-                        memory_free(cmd.link_params.stream_out_names[i]);
-                memory_free(cmd.link_params.stream_out_names);
                 break;
 
             case CMD_CREATE_INPUT_LAYOUT:
                 direct::renderer_create_input_layout(cmd.create_input_layout, cmd.resource_slot);
-                memory_free(cmd.create_input_layout.vs_byte_code);
-                memory_free(cmd.create_input_layout.input_layout);
                 break;
 
             case CMD_SET_INPUT_LAYOUT:
@@ -323,17 +789,18 @@ namespace pen
 
             case CMD_CREATE_BUFFER:
                 direct::renderer_create_buffer(cmd.create_buffer, cmd.resource_slot);
-                memory_free(cmd.create_buffer.data);
                 break;
 
             case CMD_SET_VERTEX_BUFFER:
-                direct::renderer_set_vertex_buffers(cmd.set_vertex_buffer.buffer_indices, cmd.set_vertex_buffer.num_buffers,
-                                                    cmd.set_vertex_buffer.start_slot, cmd.set_vertex_buffer.strides,
-                                                    cmd.set_vertex_buffer.offsets);
-                memory_free(cmd.set_vertex_buffer.buffer_indices);
-                memory_free(cmd.set_vertex_buffer.strides);
-                memory_free(cmd.set_vertex_buffer.offsets);
-                break;
+            {
+                u32  num_buffers = cmd.set_vertex_buffer.num_buffers;
+                u32* buffer_indices = (u32*)cmd_inline_data(cmd);
+                u32* strides = buffer_indices + num_buffers;
+                u32* offsets = strides + num_buffers;
+                direct::renderer_set_vertex_buffers(buffer_indices, num_buffers, cmd.set_vertex_buffer.start_slot, strides,
+                                                    offsets);
+            }
+            break;
 
             case CMD_SET_INDEX_BUFFER:
                 direct::renderer_set_index_buffer(cmd.set_index_buffer.buffer_index, cmd.set_index_buffer.format,
@@ -358,7 +825,6 @@ namespace pen
 
             case CMD_CREATE_TEXTURE:
                 direct::renderer_create_texture(cmd.create_texture, cmd.resource_slot);
-                memory_free(cmd.create_texture.data);
                 break;
 
             case CMD_CREATE_SAMPLER:
@@ -412,7 +878,6 @@ namespace pen
 
             case CMD_CREATE_BLEND_STATE:
                 direct::renderer_create_blend_state(cmd.create_blend_state, cmd.resource_slot);
-                memory_free(cmd.create_blend_state.render_targets);
                 break;
 
             case CMD_SET_BLEND_STATE:
@@ -430,14 +895,15 @@ namespace pen
                 break;
 
             case CMD_UPDATE_BUFFER:
-                direct::renderer_update_buffer(cmd.update_buffer.buffer_index, cmd.update_buffer.data,
-                                               cmd.update_buffer.data_size, cmd.update_buffer.offset);
-                memory_free(cmd.update_buffer.data);
-                break;
+            {
+                const void* data = cmd.update_buffer.data ? cmd.update_buffer.data : cmd_inline_data(cmd);
+                direct::renderer_update_buffer(cmd.update_buffer.buffer_index, data, cmd.update_buffer.data_size,
+                                               cmd.update_buffer.offset);
+            }
+            break;
 
             case CMD_CREATE_DEPTH_STENCIL_STATE:
                 direct::renderer_create_depth_stencil_state(*cmd.p_create_depth_stencil_state, cmd.resource_slot);
-                memory_free(cmd.p_create_depth_stencil_state);
                 break;
 
             case CMD_SET_DEPTH_STENCIL_STATE:
@@ -508,7 +974,7 @@ namespace pen
                 break;
 
             case CMD_PUSH_PERF_MARKER:
-                direct::renderer_push_perf_marker(cmd.name);
+                direct::renderer_push_perf_marker((const c8*)cmd_inline_data(cmd));
                 break;
 
             case CMD_POP_PERF_MARKER:
@@ -537,7 +1003,7 @@ namespace pen
     void renderer_consume_cmd_buffer()
     {
         while (_ctx->wait > 0)
-            pen::thread_sleep_ms(1);
+            event_wait(_ctx->frame_event);
 
         if (_ctx->consume_semaphore)
         {
@@ -591,6 +1057,7 @@ namespace pen
         direct::renderer_end_frame();
         semaphore_post(_ctx->continue_semaphore, 1);
         _ctx->wait--;
+        event_notify(_ctx->frame_event);
     }
 
     void renderer_wait_for_jobs()
@@ -600,18 +1067,39 @@ namespace pen
 
         for (;;)
         {
-            renderer_cmd* cmd = _ctx->cmd_buffer.get();
-            
+            timer_start(_ctx->consume_timer);
+
+            renderer_cmd* cmd = _ctx->cmd_buffer.check();
+
+            // nothing to do, block until cmds arrive but keep pumping the os for window messages and exit
+            if (!cmd)
+            {
+                event_wait(_ctx->cmd_event, k_os_update_interval_ms);
+                if (!pen::os_update())
+                    break;
+
+                continue;
+            }
+
+            profiler_begin("renderer_exec_cmds");
+
             while(cmd)
             {
+                // retire after executing, so the producer cannot write over the cmd while it is in use
+                bool present = cmd->command_index == CMD_PRESENT;
                 exec_cmd(*cmd);
+                _ctx->cmd_buffer.retire(cmd);
 
                 // break at present to re-call os update
-                if (cmd->command_index == CMD_PRESENT)
+                if (present)
                     break;
 
-                cmd = _ctx->cmd_buffer.get();
+                cmd = _ctx->cmd_buffer.check();
             }
+
+            profiler_end();
+
+            _ctx->frame_consume_time += timer_elapsed_ms(_ctx->consume_timer);
             
             if(!pen::os_update())
                 break;
@@ -623,18 +1111,24 @@ namespace pen
         // this function is invoked from mtk draw in view
         //if we start renderin  we need to wait for present to prevent command buffer being released before ending encoding
 
-        renderer_cmd* cmd = _ctx->cmd_buffer.get();
+        timer_start(_ctx->consume_timer);
+
+        renderer_cmd* cmd = _ctx->cmd_buffer.check();
         bool started = cmd;
         while(cmd)
         {
+            bool present = cmd->command_index == CMD_PRESENT;
             exec_cmd(*cmd);
+            _ctx->cmd_buffer.retire(cmd);
 
             // break at present to re-call os update
-            if (cmd->command_index == CMD_PRESENT)
+            if (present)
                 break;
                     
-            cmd = _ctx->cmd_buffer.get();
+            cmd = _ctx->cmd_buffer.check();
         }
+
+        _ctx->frame_consume_time += timer_elapsed_ms(_ctx->consume_timer);
         
         direct::renderer_retain();
         return started;
@@ -704,13 +1198,18 @@ namespace pen
     render_ctx renderer_create_context(u32 max_commands)
     {
         fe_render_ctx* new_ctx = new fe_render_ctx();
-        new_ctx->cmd_buffer.create(max_commands);
-        new_ctx->release_cmd_buffer.create(1024);
+        new_ctx->cmd_buffer.create(max_commands * k_cmd_average_size);
+        new_ctx->release_cmd_buffer.create(4096, e_full_policy::fail);
+        new_ctx->consume_timer = timer_create();
+        for (u32 i = 0; i < k_num_frame_arenas; ++i)
+            new_ctx->arenas[i].create(k_frame_arena_initial_size);
         new_ctx->present_timer = timer_create();
         timer_start(new_ctx->present_timer);
         new_ctx->present_time = 0.0f;
         new_ctx->consume_semaphore = semaphore_create(0, 1);
         new_ctx->continue_semaphore = semaphore_create(0, 1);
+        new_ctx->cmd_event = event_create();
+        new_ctx->frame_event = event_create();
         slot_resources_init(&new_ctx->renderer_slot_resources, 2048);
 
         return (render_ctx*)new_ctx;
@@ -718,6 +1217,12 @@ namespace pen
     
     void renderer_init(void* user_data, bool wait_for_jobs, u32 max_commands)
     {
+        // the render thread is dedicated, so everything it allocates belongs to the renderer
+        memory_set_thread_tag(e_mem_tag::renderer);
+        thread_set_name("render");
+
+        s_cmd_list_mutex = mutex_create();
+
         // create main render context and bind it
         _main_ctx = renderer_create_context(max_commands);
         _ctx = (fe_render_ctx*)_main_ctx;
@@ -776,7 +1281,7 @@ namespace pen
             output_file.appendf("../../test_results/%s.png", pen_window.window_title);
             stbi_write_png(output_file.c_str(), pen_window.width, pen_window.height, 4, ref_image, row_pitch);
 
-            free(file_data);
+            memory_free(file_data);
         }
         else
         {
@@ -853,6 +1358,72 @@ namespace pen
         return _main_ctx;
     }
     
+    //
+    // command lists
+    //
+
+    u32 renderer_create_cmd_list()
+    {
+        // lists are allocated individually so a recording thread can hold onto its pointer while the table grows
+        cmd_list* cl = new cmd_list();
+
+        mutex_lock(s_cmd_list_mutex);
+        sb_push(s_cmd_lists, cl);
+        u32 list = sb_count(s_cmd_lists) - 1;
+        mutex_unlock(s_cmd_list_mutex);
+
+        return list;
+    }
+
+    void renderer_begin_cmd_list(u32 list)
+    {
+        PEN_ASSERT(!t_cmd_list);
+
+        t_cmd_list = get_cmd_list(list);
+        t_cmd_list->frame = _ctx->recorded_frames;
+    }
+
+    void renderer_end_cmd_list()
+    {
+        t_cmd_list = nullptr;
+    }
+
+    void renderer_submit_cmd_lists(const u32* lists, u32 num_lists)
+    {
+        PEN_ASSERT(!t_cmd_list);
+
+        for (u32 i = 0; i < num_lists; ++i)
+        {
+            cmd_list* cl = get_cmd_list(lists[i]);
+
+            // the arena holding the list payloads may already have been reset if it was recorded in an earlier frame
+            if (sb_count(cl->stream) && cl->frame != _ctx->recorded_frames)
+            {
+                PEN_ASSERT_MSG(0, "cmd list must be submitted in the frame it was recorded in");
+            }
+
+            // cmds are copied individually because the cmd_buffer may need to wrap between any of them
+            u32 stream_size = sb_count(cl->stream);
+            for (u32 pos = 0; pos < stream_size;)
+            {
+                u32 cmd_size = ((renderer_cmd*)(cl->stream + pos))->cmd_size;
+
+                u8* dst = _ctx->cmd_buffer.alloc(cmd_size);
+                memcpy(dst, cl->stream + pos, cmd_size);
+                _ctx->cmd_buffer.commit(cmd_size);
+                event_notify(_ctx->cmd_event);
+
+                _ctx->frame_cmd_bytes += cmd_size;
+                _ctx->frame_cmd_count++;
+                pos += cmd_size;
+            }
+
+            // keep the memory around for the next frame, ownership of any cmd payloads has moved to the cmd_buffer
+            if (cl->stream)
+                stb__sbn(cl->stream) = 0;
+        }
+    }
+
     //
     // command buffer api
     //
@@ -861,7 +1432,7 @@ namespace pen
     {
         renderer_cmd cmd;
         cmd.command_index = CMD_NEW_FRAME;
-        _ctx->cmd_buffer.put(cmd);
+        add_cmd(cmd);
     }
 
     void renderer_update_queries()
@@ -869,7 +1440,7 @@ namespace pen
         renderer_cmd cmd;
 
         cmd.command_index = CMD_UPDATE_QUERIES;
-        _ctx->cmd_buffer.put(cmd);
+        add_cmd(cmd);
     }
 
     void renderer_clear(u32 clear_state_index, u32 array_index)
@@ -877,10 +1448,10 @@ namespace pen
         renderer_cmd cmd;
 
         cmd.command_index = CMD_CLEAR;
-        cmd.clear.clear_state = clear_state_index;
+        cmd.clear.clear_state = get_slot(clear_state_index);
         cmd.clear.array_index = array_index;
 
-        _ctx->cmd_buffer.put(cmd);
+        add_cmd(cmd);
     }
 
     void renderer_clear_texture(u32 clear_state_index, u32 texture)
@@ -888,10 +1459,10 @@ namespace pen
         renderer_cmd cmd;
 
         cmd.command_index = CMD_CLEAR_TEXTURE;
-        cmd.clear.clear_state = clear_state_index;
-        cmd.clear.texture_index = texture;
+        cmd.clear.clear_state = get_slot(clear_state_index);
+        cmd.clear.texture_index = get_slot(texture);
 
-        _ctx->cmd_buffer.put(cmd);
+        add_cmd(cmd);
     }
 
     void renderer_present()
@@ -900,7 +1471,23 @@ namespace pen
 
         cmd.command_index = CMD_PRESENT;
 
-        _ctx->cmd_buffer.put(cmd);
+        add_cmd(cmd);
+
+        _ctx->cmd_bytes = _ctx->frame_cmd_bytes;
+        _ctx->cmd_count = _ctx->frame_cmd_count;
+        _ctx->frame_cmd_bytes = 0;
+        _ctx->frame_cmd_count = 0;
+
+        flush_release_cmds();
+
+        // move onto the next arena, waiting for the render thread to finish with the frame which last used it.
+        // the arena is reset before the new frame is published so no allocation can land in it mid reset
+        u64 frame = _ctx->recorded_frames + 1;
+        while (_ctx->presented_frames + k_num_frame_arenas <= frame)
+            event_wait(_ctx->frame_event);
+
+        _ctx->arenas[frame % k_num_frame_arenas].reset();
+        _ctx->recorded_frames = frame;
     }
 
     u32 renderer_load_shader(const shader_load_params& params)
@@ -914,7 +1501,7 @@ namespace pen
 
         if (params.byte_code)
         {
-            cmd.shader_load.byte_code = memory_alloc(params.byte_code_size);
+            cmd.shader_load.byte_code = frame_alloc(params.byte_code_size);
             memcpy(cmd.shader_load.byte_code, params.byte_code, params.byte_code_size);
         }
 
@@ -924,7 +1511,7 @@ namespace pen
             cmd.shader_load.so_num_entries = params.so_num_entries;
 
             u32 entries_size = sizeof(stream_out_decl_entry) * params.so_num_entries;
-            cmd.shader_load.so_decl_entries = (stream_out_decl_entry*)memory_alloc(entries_size);
+            cmd.shader_load.so_decl_entries = (stream_out_decl_entry*)frame_alloc(entries_size);
 
             memcpy(cmd.shader_load.so_decl_entries, params.so_decl_entries, entries_size);
         }
@@ -932,9 +1519,9 @@ namespace pen
         u32 resource_slot = slot_resources_get_next(&_ctx->renderer_slot_resources);
         cmd.resource_slot = resource_slot;
 
-        _ctx->cmd_buffer.put(cmd);
+        add_cmd(cmd);
         
-        return resource_slot;
+        return get_handle(resource_slot);
     }
 
     u32 renderer_link_shader_program(const shader_link_params& params)
@@ -944,10 +1531,15 @@ namespace pen
         cmd.command_index = CMD_LINK_SHADER;
 
         cmd.link_params = params;
+        cmd.link_params.stream_out_shader = get_slot(params.stream_out_shader);
+        cmd.link_params.vertex_shader = get_slot(params.vertex_shader);
+        cmd.link_params.pixel_shader = get_slot(params.pixel_shader);
+        cmd.link_params.input_layout = get_slot(params.input_layout);
+        cmd.link_params.compute_shader = get_slot(params.compute_shader);
 
         u32 num = params.num_constants;
         u32 layout_size = sizeof(constant_layout_desc) * num;
-        cmd.link_params.constants = (constant_layout_desc*)memory_alloc(layout_size);
+        cmd.link_params.constants = (constant_layout_desc*)frame_alloc(layout_size);
 
         constant_layout_desc* c = cmd.link_params.constants;
         for (u32 i = 0; i < num; ++i)
@@ -956,7 +1548,7 @@ namespace pen
             c[i].type = params.constants[i].type;
 
             u32 len = string_length(params.constants[i].name);
-            c[i].name = (c8*)memory_alloc(len + 1);
+            c[i].name = (c8*)frame_alloc(len + 1);
 
             memcpy(c[i].name, params.constants[i].name, len);
             c[i].name[len] = '\0';
@@ -966,13 +1558,13 @@ namespace pen
         if (params.stream_out_shader != 0)
         {
             u32 num_so = params.num_stream_out_names;
-            cmd.link_params.stream_out_names = (c8**)memory_alloc(sizeof(c8*) * num_so);
+            cmd.link_params.stream_out_names = (c8**)frame_alloc(sizeof(c8*) * num_so);
 
             c8** so = cmd.link_params.stream_out_names;
             for (u32 i = 0; i < num_so; ++i)
             {
                 u32 len = string_length(params.stream_out_names[i]);
-                so[i] = (c8*)memory_alloc(len + 1);
+                so[i] = (c8*)frame_alloc(len + 1);
 
                 memcpy(so[i], params.stream_out_names[i], len);
                 so[i][len] = '\0';
@@ -982,9 +1574,9 @@ namespace pen
         u32 resource_slot = slot_resources_get_next(&_ctx->renderer_slot_resources);
         cmd.resource_slot = resource_slot;
 
-        _ctx->cmd_buffer.put(cmd);
+        add_cmd(cmd);
 
-        return resource_slot;
+        return get_handle(resource_slot);
     }
 
     void renderer_set_shader(u32 shader_index, u32 shader_type)
@@ -993,10 +1585,10 @@ namespace pen
 
         cmd.command_index = CMD_SET_SHADER;
 
-        cmd.set_shader.shader_index = shader_index;
+        cmd.set_shader.shader_index = get_slot(shader_index);
         cmd.set_shader.shader_type = shader_type;
 
-        _ctx->cmd_buffer.put(cmd);
+        add_cmd(cmd);
     }
 
     u32 renderer_create_input_layout(const input_layout_creation_params& params)
@@ -1010,30 +1602,30 @@ namespace pen
         cmd.create_input_layout.vs_byte_code_size = params.vs_byte_code_size;
 
         // copy buffer
-        cmd.create_input_layout.vs_byte_code = memory_alloc(params.vs_byte_code_size);
+        cmd.create_input_layout.vs_byte_code = frame_alloc(params.vs_byte_code_size);
         memcpy(cmd.create_input_layout.vs_byte_code, params.vs_byte_code, params.vs_byte_code_size);
 
         // copy array
         u32 input_layouts_size = sizeof(input_layout_desc) * params.num_elements;
-        cmd.create_input_layout.input_layout = (input_layout_desc*)memory_alloc(input_layouts_size);
+        cmd.create_input_layout.input_layout = (input_layout_desc*)frame_alloc(input_layouts_size);
 
         memcpy(cmd.create_input_layout.input_layout, params.input_layout, input_layouts_size);
 
         u32 resource_slot = slot_resources_get_next(&_ctx->renderer_slot_resources);
         cmd.resource_slot = resource_slot;
 
-        _ctx->cmd_buffer.put(cmd);
+        add_cmd(cmd);
 
-        return resource_slot;
+        return get_handle(resource_slot);
     }
 
     void renderer_set_input_layout(u32 layout_index)
     {
         renderer_cmd cmd;
         cmd.command_index = CMD_SET_INPUT_LAYOUT;
-        cmd.command_data_index = layout_index;
+        cmd.command_data_index = get_slot(layout_index);
 
-        _ctx->cmd_buffer.put(cmd);
+        add_cmd(cmd);
     }
 
     u32 renderer_create_buffer(const buffer_creation_params& params)
@@ -1047,16 +1639,16 @@ namespace pen
         if (params.data)
         {
             // make a copy of the buffers data
-            cmd.create_buffer.data = memory_alloc(params.buffer_size);
+            cmd.create_buffer.data = frame_alloc(params.buffer_size);
             memcpy(cmd.create_buffer.data, params.data, params.buffer_size);
         }
 
         u32 resource_slot = slot_resources_get_next(&_ctx->renderer_slot_resources);
         cmd.resource_slot = resource_slot;
 
-        _ctx->cmd_buffer.put(cmd);
+        add_cmd(cmd);
 
-        return resource_slot;
+        return get_handle(resource_slot);
     }
 
     void renderer_set_vertex_buffer(u32 buffer_index, u32 start_slot, u32 stride, u32 offset)
@@ -1074,18 +1666,18 @@ namespace pen
         cmd.set_vertex_buffer.start_slot = start_slot;
         cmd.set_vertex_buffer.num_buffers = num_buffers;
 
-        cmd.set_vertex_buffer.buffer_indices = (u32*)memory_alloc(sizeof(u32) * num_buffers);
-        cmd.set_vertex_buffer.strides = (u32*)memory_alloc(sizeof(u32) * num_buffers);
-        cmd.set_vertex_buffer.offsets = (u32*)memory_alloc(sizeof(u32) * num_buffers);
+        static const u32 k_max_vertex_buffers = 8;
+        PEN_ASSERT(num_buffers <= k_max_vertex_buffers);
 
+        u32 inline_data[k_max_vertex_buffers * 3];
         for (u32 i = 0; i < num_buffers; ++i)
         {
-            cmd.set_vertex_buffer.buffer_indices[i] = buffer_indices[i];
-            cmd.set_vertex_buffer.strides[i] = strides[i];
-            cmd.set_vertex_buffer.offsets[i] = offsets[i];
+            inline_data[i] = get_slot(buffer_indices[i]);
+            inline_data[num_buffers + i] = strides[i];
+            inline_data[num_buffers * 2 + i] = offsets[i];
         }
 
-        _ctx->cmd_buffer.put(cmd);
+        add_cmd(cmd, inline_data, sizeof(u32) * num_buffers * 3);
     }
 
     void renderer_set_index_buffer(u32 buffer_index, u32 format, u32 offset)
@@ -1093,11 +1685,11 @@ namespace pen
         renderer_cmd cmd;
 
         cmd.command_index = CMD_SET_INDEX_BUFFER;
-        cmd.set_index_buffer.buffer_index = buffer_index;
+        cmd.set_index_buffer.buffer_index = get_slot(buffer_index);
         cmd.set_index_buffer.format = format;
         cmd.set_index_buffer.offset = offset;
 
-        _ctx->cmd_buffer.put(cmd);
+        add_cmd(cmd);
     }
 
     void renderer_draw(u32 vertex_count, u32 start_vertex, u32 primitive_topology)
@@ -1109,7 +1701,7 @@ namespace pen
         cmd.draw.start_vertex = start_vertex;
         cmd.draw.primitive_topology = primitive_topology;
 
-        _ctx->cmd_buffer.put(cmd);
+        add_cmd(cmd);
     }
 
     void renderer_draw_indexed(u32 index_count, u32 start_index, u32 base_vertex, u32 primitive_topology)
@@ -1122,7 +1714,7 @@ namespace pen
         cmd.draw_indexed.base_vertex = base_vertex;
         cmd.draw_indexed.primitive_topology = primitive_topology;
 
-        _ctx->cmd_buffer.put(cmd);
+        add_cmd(cmd);
     }
 
     void renderer_draw_indexed_instanced(u32 instance_count, u32 start_instance, u32 index_count, u32 start_index,
@@ -1138,7 +1730,7 @@ namespace pen
         cmd.draw_indexed_instanced.base_vertex = base_vertex;
         cmd.draw_indexed_instanced.primitive_topology = primitive_topology;
 
-        _ctx->cmd_buffer.put(cmd);
+        add_cmd(cmd);
     }
 
     u32 renderer_create_render_target(const texture_creation_params& tcp)
@@ -1158,9 +1750,9 @@ namespace pen
         u32 resource_slot = slot_resources_get_next(&_ctx->renderer_slot_resources);
         cmd.resource_slot = resource_slot;
 
-        _ctx->cmd_buffer.put(cmd);
+        add_cmd(cmd);
 
-        return resource_slot;
+        return get_handle(resource_slot);
     }
 
     u32 renderer_create_texture(const texture_creation_params& tcp)
@@ -1183,23 +1775,20 @@ namespace pen
 
         memcpy(&cmd.create_texture, (void*)&tcp, sizeof(texture_creation_params));
 
-        cmd.create_texture.data = memory_alloc(tcp.data_size);
+        cmd.create_texture.data = nullptr;
 
         if (tcp.data)
         {
+            cmd.create_texture.data = frame_alloc(tcp.data_size);
             memcpy(cmd.create_texture.data, tcp.data, tcp.data_size);
         }
-        else
-        {
-            cmd.create_texture.data = nullptr;
-        }
 
         u32 resource_slot = slot_resources_get_next(&_ctx->renderer_slot_resources);
         cmd.resource_slot = resource_slot;
 
-        _ctx->cmd_buffer.put(cmd);
+        add_cmd(cmd);
 
-        return resource_slot;
+        return get_handle(resource_slot);
     }
 
     u32 renderer_create_sampler(const sampler_creation_params& scp)
@@ -1213,9 +1802,9 @@ namespace pen
         u32 resource_slot = slot_resources_get_next(&_ctx->renderer_slot_resources);
         cmd.resource_slot = resource_slot;
 
-        _ctx->cmd_buffer.put(cmd);
+        add_cmd(cmd);
 
-        return resource_slot;
+        return get_handle(resource_slot);
     }
 
     void renderer_set_texture(u32 texture_index, u32 sampler_index, u32 resource_slot, u32 bind_flags)
@@ -1224,12 +1813,12 @@ namespace pen
         
         cmd.command_index = CMD_SET_TEXTURE;
 
-        cmd.set_texture.texture_index = texture_index;
-        cmd.set_texture.sampler_index = sampler_index;
+        cmd.set_texture.texture_index = get_slot(texture_index);
+        cmd.set_texture.sampler_index = get_slot(sampler_index);
         cmd.set_texture.resource_slot = resource_slot;
         cmd.set_texture.bind_flags = bind_flags;
 
-        _ctx->cmd_buffer.put(cmd);
+        add_cmd(cmd);
     }
 
     u32 renderer_create_rasterizer_state(const rasteriser_state_creation_params& rscp)
@@ -1243,9 +1832,9 @@ namespace pen
         u32 resource_slot = slot_resources_get_next(&_ctx->renderer_slot_resources);
         cmd.resource_slot = resource_slot;
 
-        _ctx->cmd_buffer.put(cmd);
+        add_cmd(cmd);
 
-        return resource_slot;
+        return get_handle(resource_slot);
     }
 
     void renderer_set_rasterizer_state(u32 rasterizer_state_index)
@@ -1254,9 +1843,9 @@ namespace pen
 
         cmd.command_index = CMD_SET_RASTER_STATE;
 
-        cmd.command_data_index = rasterizer_state_index;
+        cmd.command_data_index = get_slot(rasterizer_state_index);
 
-        _ctx->cmd_buffer.put(cmd);
+        add_cmd(cmd);
     }
 
     void renderer_set_viewport(const viewport& vp)
@@ -1264,7 +1853,7 @@ namespace pen
         renderer_cmd cmd;
         cmd.command_index = CMD_SET_VIEWPORT;
         memcpy(&cmd.set_viewport, (void*)&vp, sizeof(viewport));
-        _ctx->cmd_buffer.put(cmd);
+        add_cmd(cmd);
     }
 
     void renderer_set_scissor_rect(const rect& r)
@@ -1272,7 +1861,7 @@ namespace pen
         renderer_cmd cmd;
         cmd.command_index = CMD_SET_SCISSOR_RECT;
         memcpy(&cmd.set_rect, (void*)&r, sizeof(rect));
-        _ctx->cmd_buffer.put(cmd);
+        add_cmd(cmd);
     }
 
     void renderer_set_viewport_ratio(const viewport& vp)
@@ -1280,7 +1869,7 @@ namespace pen
         renderer_cmd cmd;
         cmd.command_index = CMD_SET_VIEWPORT_RATIO;
         memcpy(&cmd.set_viewport, (void*)&vp, sizeof(viewport));
-        _ctx->cmd_buffer.put(cmd);
+        add_cmd(cmd);
     }
 
     void renderer_set_scissor_rect_ratio(const rect& r)
@@ -1288,7 +1877,7 @@ namespace pen
         renderer_cmd cmd;
         cmd.command_index = CMD_SET_SCISSOR_RECT_RATIO;
         memcpy(&cmd.set_rect, (void*)&r, sizeof(rect));
-        _ctx->cmd_buffer.put(cmd);
+        add_cmd(cmd);
     }
 
     u32 renderer_create_blend_state(const blend_creation_params& bcp)
@@ -1301,7 +1890,7 @@ namespace pen
 
         // alloc and copy the render targets blend modes. to save space in the cmd buffer
         u32   render_target_modes_size = sizeof(render_target_blend) * bcp.num_render_targets;
-        void* mem = memory_alloc(render_target_modes_size);
+        void* mem = frame_alloc(render_target_modes_size);
         cmd.create_blend_state.render_targets = (render_target_blend*)mem;
 
         memcpy(cmd.create_blend_state.render_targets, (void*)bcp.render_targets, render_target_modes_size);
@@ -1309,9 +1898,9 @@ namespace pen
         u32 resource_slot = slot_resources_get_next(&_ctx->renderer_slot_resources);
         cmd.resource_slot = resource_slot;
 
-        _ctx->cmd_buffer.put(cmd);
+        add_cmd(cmd);
 
-        return resource_slot;
+        return get_handle(resource_slot);
     }
 
     void renderer_set_blend_state(u32 blend_state_index)
@@ -1320,9 +1909,9 @@ namespace pen
 
         cmd.command_index = CMD_SET_BLEND_STATE;
 
-        cmd.command_data_index = blend_state_index;
+        cmd.command_data_index = get_slot(blend_state_index);
 
-        _ctx->cmd_buffer.put(cmd);
+        add_cmd(cmd);
     }
 
     void renderer_set_constant_buffer(u32 buffer_index, u32 resource_slot, u32 flags)
@@ -1331,11 +1920,11 @@ namespace pen
         
         cmd.command_index = CMD_SET_CONSTANT_BUFFER;
 
-        cmd.set_buffer.buffer_index = buffer_index;
+        cmd.set_buffer.buffer_index = get_slot(buffer_index);
         cmd.set_buffer.resource_slot = resource_slot;
         cmd.set_buffer.flags = flags;
 
-        _ctx->cmd_buffer.put(cmd);
+        add_cmd(cmd);
     }
 
     void renderer_set_structured_buffer(u32 buffer_index, u32 resource_slot, u32 flags)
@@ -1344,11 +1933,11 @@ namespace pen
 
         cmd.command_index = CMD_SET_STRUCTURED_BUFFER;
 
-        cmd.set_buffer.buffer_index = buffer_index;
+        cmd.set_buffer.buffer_index = get_slot(buffer_index);
         cmd.set_buffer.resource_slot = resource_slot;
         cmd.set_buffer.flags = flags;
 
-        _ctx->cmd_buffer.put(cmd);
+        add_cmd(cmd);
     }
 
     void renderer_update_buffer(u32 buffer_index, const void* data, u32 data_size, u32 offset)
@@ -1360,13 +1949,22 @@ namespace pen
 
         cmd.command_index = CMD_UPDATE_BUFFER;
 
-        cmd.update_buffer.buffer_index = buffer_index;
+        cmd.update_buffer.buffer_index = get_slot(buffer_index);
         cmd.update_buffer.data_size = data_size;
         cmd.update_buffer.offset = offset;
-        cmd.update_buffer.data = memory_alloc(data_size);
-        memcpy(cmd.update_buffer.data, data, data_size);
+        cmd.update_buffer.data = nullptr;
 
-        _ctx->cmd_buffer.put(cmd);
+        // large updates are too big to fit inline in the cmd stream, so they are carved from the frame arena
+        if (data_size > k_max_inline_size)
+        {
+            cmd.update_buffer.data = frame_alloc(data_size);
+            memcpy(cmd.update_buffer.data, data, data_size);
+
+            add_cmd(cmd);
+            return;
+        }
+
+        add_cmd(cmd, data, data_size);
     }
 
     u32 renderer_create_depth_stencil_state(const depth_stencil_creation_params& dscp)
@@ -1376,16 +1974,16 @@ namespace pen
         cmd.command_index = CMD_CREATE_DEPTH_STENCIL_STATE;
 
         cmd.p_create_depth_stencil_state =
-            (depth_stencil_creation_params*)memory_alloc(sizeof(depth_stencil_creation_params));
+            (depth_stencil_creation_params*)frame_alloc(sizeof(depth_stencil_creation_params));
 
         memcpy(cmd.p_create_depth_stencil_state, &dscp, sizeof(depth_stencil_creation_params));
 
         u32 resource_slot = slot_resources_get_next(&_ctx->renderer_slot_resources);
         cmd.resource_slot = resource_slot;
 
-        _ctx->cmd_buffer.put(cmd);
+        add_cmd(cmd);
 
-        return resource_slot;
+        return get_handle(resource_slot);
     }
 
     void renderer_set_depth_stencil_state(u32 depth_stencil_state)
@@ -1394,9 +1992,9 @@ namespace pen
 
         cmd.command_index = CMD_SET_DEPTH_STENCIL_STATE;
 
-        cmd.command_data_index = depth_stencil_state;
+        cmd.command_data_index = get_slot(depth_stencil_state);
 
-        _ctx->cmd_buffer.put(cmd);
+        add_cmd(cmd);
     }
 
     void renderer_set_targets(u32* colour_targets, u32 num_colour_targets, u32 depth_target, u32 array_index)
@@ -1405,11 +2003,13 @@ namespace pen
 
         cmd.command_index = CMD_SET_TARGETS;
         cmd.set_targets.num_colour = num_colour_targets;
-        memcpy(&cmd.set_targets.colour, colour_targets, num_colour_targets * sizeof(u32));
-        cmd.set_targets.depth = depth_target;
+        for (u32 i = 0; i < num_colour_targets; ++i)
+            cmd.set_targets.colour[i] = get_slot(colour_targets[i]);
+
+        cmd.set_targets.depth = get_slot(depth_target);
         cmd.set_targets.array_index = array_index;
 
-        _ctx->cmd_buffer.put(cmd);
+        add_cmd(cmd);
     }
 
     void renderer_set_targets(u32 colour_target, u32 depth_target)
@@ -1418,11 +2018,11 @@ namespace pen
 
         cmd.command_index = CMD_SET_TARGETS;
         cmd.set_targets.num_colour = is_valid(colour_target) ? 1 : 0;
-        cmd.set_targets.colour[0] = colour_target;
-        cmd.set_targets.depth = depth_target;
+        cmd.set_targets.colour[0] = get_slot(colour_target);
+        cmd.set_targets.depth = get_slot(depth_target);
         cmd.set_targets.array_index = 0;
 
-        _ctx->cmd_buffer.put(cmd);
+        add_cmd(cmd);
     }
     
     void renderer_release_shader(u32 shader_index, u32 shader_type)
@@ -1431,11 +2031,11 @@ namespace pen
 
         cmd.command_index = CMD_RELEASE_SHADER;
         cmd.frame_index = pen::_renderer_frame_index();
-        cmd.resource_slot = shader_index;
-        cmd.set_shader.shader_index = shader_index;
+        cmd.resource_slot = get_release_slot(shader_index);
+        cmd.set_shader.shader_index = cmd.resource_slot;
         cmd.set_shader.shader_type = shader_type;
 
-        _ctx->release_cmd_buffer.put(cmd);
+        add_release_cmd(cmd);
     }
 
     void renderer_release_buffer(u32 buffer_index)
@@ -1444,10 +2044,10 @@ namespace pen
 
         cmd.command_index = CMD_RELEASE_BUFFER;
         cmd.frame_index = pen::_renderer_frame_index();
-        cmd.resource_slot = buffer_index;
-        cmd.command_data_index = buffer_index;
+        cmd.resource_slot = get_release_slot(buffer_index);
+        cmd.command_data_index = cmd.resource_slot;
 
-        _ctx->release_cmd_buffer.put(cmd);
+        add_release_cmd(cmd);
     }
 
     void renderer_release_texture(u32 texture_index)
@@ -1455,11 +2055,11 @@ namespace pen
         renderer_cmd cmd;
 
         cmd.command_index = CMD_RELEASE_TEXTURE_2D;
-        cmd.resource_slot = texture_index;
-        cmd.command_data_index = texture_index;
+        cmd.resource_slot = get_release_slot(texture_index);
+        cmd.command_data_index = cmd.resource_slot;
         cmd.frame_index = pen::_renderer_frame_index();
 
-        _ctx->release_cmd_buffer.put(cmd);
+        add_release_cmd(cmd);
     }
 
     void renderer_release_blend_state(u32 blend_state)
@@ -1468,10 +2068,10 @@ namespace pen
 
         cmd.command_index = CMD_RELEASE_BLEND_STATE;
         cmd.frame_index = pen::_renderer_frame_index();
-        cmd.resource_slot = blend_state;
-        cmd.command_data_index = blend_state;
+        cmd.resource_slot = get_release_slot(blend_state);
+        cmd.command_data_index = cmd.resource_slot;
 
-        _ctx->release_cmd_buffer.put(cmd);
+        add_release_cmd(cmd);
     }
 
     void renderer_release_render_target(u32 render_target)
@@ -1480,10 +2080,10 @@ namespace pen
 
         cmd.command_index = CMD_RELEASE_RENDER_TARGET;
         cmd.frame_index = pen::_renderer_frame_index();
-        cmd.resource_slot = render_target;
-        cmd.command_data_index = render_target;
+        cmd.resource_slot = get_release_slot(render_target);
+        cmd.command_data_index = cmd.resource_slot;
 
-        _ctx->release_cmd_buffer.put(cmd);
+        add_release_cmd(cmd);
     }
 
     void renderer_release_clear_state(u32 clear_state)
@@ -1492,10 +2092,10 @@ namespace pen
 
         cmd.command_index = CMD_RELEASE_CLEAR_STATE;
         cmd.frame_index = pen::_renderer_frame_index();
-        cmd.resource_slot = clear_state;
-        cmd.command_data_index = clear_state;
+        cmd.resource_slot = get_release_slot(clear_state);
+        cmd.command_data_index = cmd.resource_slot;
 
-        _ctx->release_cmd_buffer.put(cmd);
+        add_release_cmd(cmd);
     }
 
     void renderer_release_input_layout(u32 input_layout)
@@ -1504,10 +2104,10 @@ namespace pen
 
         cmd.command_index = CMD_RELEASE_INPUT_LAYOUT;
         cmd.frame_index = pen::_renderer_frame_index();
-        cmd.resource_slot = input_layout;
-        cmd.command_data_index = input_layout;
+        cmd.resource_slot = get_release_slot(input_layout);
+        cmd.command_data_index = cmd.resource_slot;
 
-        _ctx->release_cmd_buffer.put(cmd);
+        add_release_cmd(cmd);
     }
 
     void renderer_release_sampler(u32 sampler)
@@ -1516,10 +2116,10 @@ namespace pen
 
         cmd.command_index = CMD_RELEASE_SAMPLER;
         cmd.frame_index = pen::_renderer_frame_index();
-        cmd.resource_slot = sampler;
-        cmd.command_data_index = sampler;
+        cmd.resource_slot = get_release_slot(sampler);
+        cmd.command_data_index = cmd.resource_slot;
 
-        _ctx->release_cmd_buffer.put(cmd);
+        add_release_cmd(cmd);
     }
 
     void renderer_release_depth_stencil_state(u32 depth_stencil_state)
@@ -1528,10 +2128,10 @@ namespace pen
 
         cmd.command_index = CMD_RELEASE_DEPTH_STENCIL_STATE;
         cmd.frame_index = pen::_renderer_frame_index();
-        cmd.resource_slot = depth_stencil_state;
-        cmd.command_data_index = depth_stencil_state;
+        cmd.resource_slot = get_release_slot(depth_stencil_state);
+        cmd.command_data_index = cmd.resource_slot;
 
-        _ctx->release_cmd_buffer.put(cmd);
+        add_release_cmd(cmd);
     }
     
     void renderer_release_raster_state(u32 raster_state_index)
@@ -1539,10 +2139,10 @@ namespace pen
         renderer_cmd cmd;
 
         cmd.command_index = CMD_RELEASE_RASTER_STATE;
-        cmd.resource_slot = raster_state_index;
-        cmd.command_data_index = raster_state_index;
+        cmd.resource_slot = get_release_slot(raster_state_index);
+        cmd.command_data_index = cmd.resource_slot;
 
-        _ctx->release_cmd_buffer.put(cmd);
+        add_release_cmd(cmd);
     }
 
     void renderer_set_stream_out_target(u32 buffer_index)
@@ -1550,9 +2150,9 @@ namespace pen
         renderer_cmd cmd;
 
         cmd.command_index = CMD_SET_SO_TARGET;
-        cmd.command_data_index = buffer_index;
+        cmd.command_data_index = get_slot(buffer_index);
         
-        _ctx->cmd_buffer.put(cmd);
+        add_cmd(cmd);
     }
 
     void renderer_resolve_target(u32 target, e_msaa_resolve_type type)
@@ -1561,10 +2161,10 @@ namespace pen
 
         cmd.command_index = CMD_RESOLVE_TARGET;
 
-        cmd.resolve_params.render_target = target;
+        cmd.resolve_params.render_target = get_slot(target);
         cmd.resolve_params.resolve_type = type;
 
-        _ctx->cmd_buffer.put(cmd);
+        add_cmd(cmd);
     }
 
     void renderer_draw_auto()
@@ -1573,7 +2173,7 @@ namespace pen
 
         cmd.command_index = CMD_DRAW_AUTO;
 
-        _ctx->cmd_buffer.put(cmd);
+        add_cmd(cmd);
     }
 
     void renderer_dispatch_compute(uint3 grid, uint3 num_threads)
@@ -1584,7 +2184,7 @@ namespace pen
         cmd.cs_dispatch.grid = grid;
         cmd.cs_dispatch.num_threads = num_threads;
 
-        _ctx->cmd_buffer.put(cmd);
+        add_cmd(cmd);
     }
 
     void renderer_read_back_resource(const resource_read_back_params& rrbp)
@@ -1594,8 +2194,9 @@ namespace pen
         cmd.command_index = CMD_MAP_RESOURCE;
 
         cmd.rrb_params = rrbp;
+        cmd.rrb_params.resource_index = get_slot(rrbp.resource_index);
 
-        _ctx->cmd_buffer.put(cmd);
+        add_cmd(cmd);
     }
 
     void renderer_replace_resource(u32 dest, u32 src, e_renderer_resource type)
@@ -1604,9 +2205,9 @@ namespace pen
 
         cmd.command_index = CMD_REPLACE_RESOURCE;
 
-        cmd.replace_resource_params = {dest, src, type};
+        cmd.replace_resource_params = {get_slot(dest), get_slot(src), type};
 
-        _ctx->cmd_buffer.put(cmd);
+        add_cmd(cmd);
     }
 
     u32 renderer_create_clear_state(const clear_state& cs)
@@ -1619,9 +2220,9 @@ namespace pen
         cmd.clear_state_params = cs;
         cmd.resource_slot = resource_slot;
 
-        _ctx->cmd_buffer.put(cmd);
+        add_cmd(cmd);
 
-        return resource_slot;
+        return get_handle(resource_slot);
     }
 
     void renderer_set_stencil_ref(u8 ref)
@@ -1631,7 +2232,7 @@ namespace pen
         cmd.command_index = CMD_SET_STENCIL_REF;
         cmd.stencil_ref = ref;
 
-        _ctx->cmd_buffer.put(cmd);
+        add_cmd(cmd);
     }
 
     void renderer_push_perf_marker(const c8* name)
@@ -1640,13 +2241,8 @@ namespace pen
 
         cmd.command_index = CMD_PUSH_PERF_MARKER;
 
-        // make copy of string to be able to use temporaries
-        u32 len = string_length(name);
-        cmd.name = (c8*)memory_alloc(len);
-        memcpy(cmd.name, name, len);
-        cmd.name[len] = '\0';
-
-        _ctx->cmd_buffer.put(cmd);
+        // copy string inline to be able to use temporaries
+        add_cmd(cmd, name, string_length(name) + 1);
     }
 
     void renderer_pop_perf_marker()
@@ -1655,6 +2251,6 @@ namespace pen
 
         cmd.command_index = CMD_POP_PERF_MARKER;
 
-        _ctx->cmd_buffer.put(cmd);
+        add_cmd(cmd);
     }
 }
@@ -197,7 +197,7 @@ namespace pen
         if (new_size > buf->_cpu_capacity)
         {
             // resize cpu
-            buf->_cpu_data = (u8*)realloc(buf->_cpu_data, new_size);
+            buf->_cpu_data = (u8*)pen::memory_realloc(buf->_cpu_data, new_size);
             buf->_cpu_capacity = new_size;
             memcpy(buf->_cpu_data + buf->_write_offset, data, size);
 
@@ -5,6 +5,7 @@
 #include "threads.h"
 #include "console.h"
 #include "memory.h"
+#include "timer.h"
 
 #include <Windows.h>
 
@@ -26,6 +27,11 @@ namespace pen
         HANDLE handle;
     } semaphore;
 
+    typedef struct event
+    {
+        HANDLE handle;
+    } event;
+
     pen::thread* thread_create(dispatch_thread thread_func, u32 stack_size, void* thread_params, thread_start_flags flags)
     {
         pen::thread* new_thread = (pen::thread*)pen::memory_alloc(sizeof(pen::thread));
@@ -90,7 +96,9 @@ namespace pen
 
     bool semaphore_wait(semaphore* p_semaphore)
     {
+        f64   start = get_time_us();
         DWORD res = WaitForSingleObject(p_semaphore->handle, INFINITE);
+        _thread_add_idle_time(get_time_us() - start);
 
         if (!res)
         {
@@ -117,6 +125,37 @@ namespace pen
         ReleaseSemaphore(p_semaphore->handle, count, NULL);
     }
 
+    pen::event* event_create()
+    {
+        pen::event* new_event = (pen::event*)pen::memory_alloc(sizeof(pen::event));
+
+        // auto reset, initially not signalled
+        new_event->handle = CreateEvent(NULL, FALSE, FALSE, NULL);
+
+        return new_event;
+    }
+
+    void event_destroy(event* p_event)
+    {
+        CloseHandle(p_event->handle);
+
+        pen::memory_free(p_event);
+    }
+
+    void event_notify(event* p_event)
+    {
+        SetEvent(p_event->handle);
+    }
+
+    bool event_wait(event* p_event, u32 timeout_ms)
+    {
+        f64   start = get_time_us();
+        DWORD res = WaitForSingleObject(p_event->handle, timeout_ms == k_wait_infinite ? INFINITE : timeout_ms);
+        _thread_add_idle_time(get_time_us() - start);
+
+        return res == WAIT_OBJECT_0;
+    }
+
     void thread_sleep_ms(u32 milliseconds)
     {
         Sleep(milliseconds);
@@ -127,4 +166,12 @@ namespace pen
         // windows cannot sleep micros
         PEN_ASSERT(0);
     }
+
+    u32 thread_get_hardware_concurrency()
+    {
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+
+        return (u32)info.dwNumberOfProcessors;
+    }
 } // namespace pen
@@ -66,6 +66,8 @@ project "put"
         "../../third_party/maths/*.h"
     }
     includedirs { "include" }
+    
+    defines { bullet_defines }
 	    
     configuration "Debug"
         defines { "DEBUG" }
@@ -7,6 +7,7 @@
 #include "data_struct.h"
 #include "memory.h"
 #include "pen_string.h"
+#include "profiler.h"
 #include "slot_resource.h"
 #include "threads.h"
 
@@ -83,6 +84,22 @@ namespace
 
 namespace put
 {
+    // handles given to the caller are versioned, the audio thread indexes resources by slot.
+    // null and invalid handles pass through, in debug a stale handle asserts on use
+    u32 audio_get_slot(u32 handle)
+    {
+        if (handle == 0 || !is_valid(handle))
+            return handle;
+
+#if PEN_SLOT_RESOURCES_DEBUG
+        if (!pen::slot_resources_validate(&_audio_slot_resources, handle))
+        {
+            PEN_ASSERT_MSG(0, "audio resource used after release");
+        }
+#endif
+        return pen::slot_resources_handle_slot(handle);
+    }
+
     void audio_exec_command(const audio_cmd& cmd)
     {
         switch (cmd.command_index)
@@ -148,17 +165,28 @@ namespace put
     void audio_consume_command_buffer()
     {
         pen::semaphore_post(_audio_job_thread_info->p_sem_consume, 1);
+        pen::event_notify(_audio_job_thread_info->p_wake);
         pen::semaphore_wait(_audio_job_thread_info->p_sem_continue);
     }
 
+    // the audio thread only drains after a consume, so when the buffer is full kick one instead of waiting
+    void put_cmd(const audio_cmd& ac)
+    {
+        while (!_cmd_buffer.put(ac))
+            audio_consume_command_buffer();
+    }
+
     void* audio_thread_function(void* params)
     {
         job_thread_params* job_params = (job_thread_params*)params;
         _audio_job_thread_info = job_params->job_info;
 
+        pen::memory_set_thread_tag(pen::e_mem_tag::audio);
+        pen::thread_set_name("audio");
+
         // create resource slots
         pen::slot_resources_init(&_audio_slot_resources, 128);
-        _cmd_buffer.create(1024);
+        _cmd_buffer.create(1024, pen::e_full_policy::fail);
 
         direct::audio_system_initialise();
 
@@ -167,10 +195,15 @@ namespace put
 
         for (;;)
         {
+            // sleep until there is a command buffer to consume or we are asked to exit
+            pen::event_wait(_audio_job_thread_info->p_wake);
+
             if (pen::semaphore_try_wait(_audio_job_thread_info->p_sem_consume))
             {
                 pen::semaphore_post(_audio_job_thread_info->p_sem_continue, 1);
 
+                PEN_PROFILE_SCOPE("audio_update");
+
                 audio_cmd* cmd = _cmd_buffer.get();
                 while (cmd)
                 {
@@ -180,10 +213,6 @@ namespace put
 
                 direct::audio_system_update();
             }
-            else
-            {
-                pen::thread_sleep_ms(1);
-            }
 
             if (pen::semaphore_try_wait(_audio_job_thread_info->p_sem_exit))
                 break;
@@ -212,7 +241,7 @@ namespace put
         // set command (create stream or sound)
         ac.command_index = command;
 
-        _cmd_buffer.put(ac);
+        put_cmd(ac);
     }
 
     u32 audio_create_stream(const c8* filename)
@@ -221,7 +250,7 @@ namespace put
 
         create_file_command(filename, e_cmd::create_stream, res);
 
-        return res;
+        return pen::slot_resources_get_handle(&_audio_slot_resources, res);
     }
 
     u32 audio_create_sound(const c8* filename)
@@ -230,7 +259,7 @@ namespace put
 
         create_file_command(filename, e_cmd::create_sound, res);
 
-        return res;
+        return pen::slot_resources_get_handle(&_audio_slot_resources, res);
     }
     
     u32  audio_create_sound(const pen::music_file& music)
@@ -243,9 +272,9 @@ namespace put
         ac.music = music;
         ac.resource_slot = res;
         
-        _cmd_buffer.put(ac);
+        put_cmd(ac);
         
-        return res;
+        return pen::slot_resources_get_handle(&_audio_slot_resources, res);
     }
 
     u32 audio_create_channel_group()
@@ -257,9 +286,9 @@ namespace put
         ac.command_index = e_cmd::create_group;
         ac.resource_slot = res;
 
-        _cmd_buffer.put(ac);
+        put_cmd(ac);
 
-        return res;
+        return pen::slot_resources_get_handle(&_audio_slot_resources, res);
     }
 
     u32 audio_create_channel_for_sound(const u32 sound_index)
@@ -274,12 +303,12 @@ namespace put
         audio_cmd ac;
 
         ac.command_index = e_cmd::create_channel_for_sound;
-        ac.resource_index = sound_index;
+        ac.resource_index = audio_get_slot(sound_index);
         ac.resource_slot = res;
 
-        _cmd_buffer.put(ac);
+        put_cmd(ac);
 
-        return res;
+        return pen::slot_resources_get_handle(&_audio_slot_resources, res);
     }
 
     void audio_channel_set_position(const u32 channel_index, const u32 position_ms)
@@ -287,10 +316,10 @@ namespace put
         audio_cmd ac;
 
         ac.command_index = e_cmd::channel_set_position;
-        ac.set_valuei.resource_index = channel_index;
+        ac.set_valuei.resource_index = audio_get_slot(channel_index);
         ac.set_valuei.value = position_ms;
 
-        _cmd_buffer.put(ac);
+        put_cmd(ac);
     }
 
     void audio_channel_set_frequency(const u32 channel_index, const f32 frequency)
@@ -298,10 +327,10 @@ namespace put
         audio_cmd ac;
 
         ac.command_index = e_cmd::channel_set_frequency;
-        ac.set_valuef.resource_index = channel_index;
+        ac.set_valuef.resource_index = audio_get_slot(channel_index);
         ac.set_valuef.value = frequency;
 
-        _cmd_buffer.put(ac);
+        put_cmd(ac);
     }
 
     void audio_group_set_pause(const u32 group_index, const bool val)
@@ -309,10 +338,10 @@ namespace put
         audio_cmd ac;
 
         ac.command_index = e_cmd::group_set_pause;
-        ac.set_valuei.resource_index = group_index;
+        ac.set_valuei.resource_index = audio_get_slot(group_index);
         ac.set_valuei.value = (s32)val;
 
-        _cmd_buffer.put(ac);
+        put_cmd(ac);
     }
 
     void audio_group_set_mute(const u32 group_index, const bool val)
@@ -320,10 +349,10 @@ namespace put
         audio_cmd ac;
 
         ac.command_index = e_cmd::group_set_mute;
-        ac.set_valuei.resource_index = group_index;
+        ac.set_valuei.resource_index = audio_get_slot(group_index);
         ac.set_valuei.value = (s32)val;
 
-        _cmd_buffer.put(ac);
+        put_cmd(ac);
     }
 
     void audio_group_set_pitch(const u32 group_index, const f32 pitch)
@@ -331,10 +360,10 @@ namespace put
         audio_cmd ac;
 
         ac.command_index = e_cmd::group_set_pitch;
-        ac.set_valuef.resource_index = group_index;
+        ac.set_valuef.resource_index = audio_get_slot(group_index);
         ac.set_valuef.value = pitch;
 
-        _cmd_buffer.put(ac);
+        put_cmd(ac);
     }
 
     void audio_group_set_volume(const u32 group_index, const f32 volume)
@@ -342,10 +371,10 @@ namespace put
         audio_cmd ac;
 
         ac.command_index = e_cmd::group_set_volume;
-        ac.set_valuef.resource_index = group_index;
+        ac.set_valuef.resource_index = audio_get_slot(group_index);
         ac.set_valuef.value = volume;
 
-        _cmd_buffer.put(ac);
+        put_cmd(ac);
     }
 
     void audio_add_channel_to_group(const u32 channel_index, const u32 group_index)
@@ -358,23 +387,28 @@ namespace put
         audio_cmd ac;
 
         ac.command_index = e_cmd::add_channel_to_group;
-        ac.set_valuei.resource_index = channel_index;
-        ac.set_valuei.value = group_index;
+        ac.set_valuei.resource_index = audio_get_slot(channel_index);
+        ac.set_valuei.value = audio_get_slot(group_index);
 
-        _cmd_buffer.put(ac);
+        put_cmd(ac);
     }
 
     void audio_release_resource(u32 index)
     {
-        if (!pen::slot_resources_free(&_audio_slot_resources, index))
+        // releases are always validated, a stale handle would otherwise free whichever resource now owns its slot
+        if (!pen::slot_resources_validate(&_audio_slot_resources, index))
+            return;
+
+        u32 slot = pen::slot_resources_handle_slot(index);
+        if (!pen::slot_resources_free(&_audio_slot_resources, slot))
             return;
 
         audio_cmd ac;
 
         ac.command_index = e_cmd::release_resource;
-        ac.resource_index = index;
+        ac.resource_index = slot;
 
-        _cmd_buffer.put(ac);
+        put_cmd(ac);
     }
 
     u32 audio_add_dsp_to_group(const u32 group_index, dsp_type type)
@@ -384,13 +418,13 @@ namespace put
         audio_cmd ac;
 
         ac.command_index = e_cmd::add_dsp_to_group;
-        ac.set_valuei.resource_index = group_index;
+        ac.set_valuei.resource_index = audio_get_slot(group_index);
         ac.set_valuei.value = type;
         ac.resource_slot = res;
 
-        _cmd_buffer.put(ac);
+        put_cmd(ac);
 
-        return res;
+        return pen::slot_resources_get_handle(&_audio_slot_resources, res);
     }
 
     void audio_dsp_set_three_band_eq(const u32 eq_index, const f32 low, const f32 med, const f32 high)
@@ -398,12 +432,12 @@ namespace put
         audio_cmd ac;
 
         ac.command_index = e_cmd::dsp_set_three_band_eq;
-        ac.set_value3f.resource_index = eq_index;
+        ac.set_value3f.resource_index = audio_get_slot(eq_index);
         ac.set_value3f.value[0] = low;
         ac.set_value3f.value[1] = med;
         ac.set_value3f.value[2] = high;
 
-        _cmd_buffer.put(ac);
+        put_cmd(ac);
     }
 
     void audio_dsp_set_gain(const u32 dsp_index, const f32 gain)
@@ -411,10 +445,10 @@ namespace put
         audio_cmd ac;
 
         ac.command_index = e_cmd::dsp_set_gain;
-        ac.set_valuef.resource_index = dsp_index;
+        ac.set_valuef.resource_index = audio_get_slot(dsp_index);
         ac.set_valuef.value = gain;
 
-        _cmd_buffer.put(ac);
+        put_cmd(ac);
     }
 
     void audio_channel_stop(const u32 channel_index)
@@ -422,8 +456,8 @@ namespace put
         audio_cmd ac;
 
         ac.command_index = e_cmd::channel_stop;
-        ac.resource_index = channel_index;
+        ac.resource_index = audio_get_slot(channel_index);
 
-        _cmd_buffer.put(ac);
+        put_cmd(ac);
     }
 } // namespace put
@@ -76,6 +76,7 @@ namespace put
 
     void* audio_thread_function(void* params);
     void  audio_consume_command_buffer();
+    u32   audio_get_slot(u32 handle); // strips the generation from a handle, for the platform to index resources
 
     // Creation
     u32  audio_create_stream(const c8* filename);
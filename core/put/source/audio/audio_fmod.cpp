@@ -533,11 +533,13 @@ namespace put
 
     pen_error audio_channel_get_state(const u32 channel_index, audio_channel_state* state)
     {
-        if (_audio_resources[channel_index].assigned_flag)
+        u32 slot = audio_get_slot(channel_index);
+
+        if (_audio_resources[slot].assigned_flag)
         {
-            if (_audio_resources[channel_index].type == AUDIO_RESOURCE_CHANNEL)
+            if (_audio_resources[slot].type == AUDIO_RESOURCE_CHANNEL)
             {
-                const resource_state& rs = _resource_states.frontbuffer()[channel_index];
+                const resource_state& rs = _resource_states.frontbuffer()[slot];
 
                 *state = rs.channel_state;
 
@@ -552,11 +554,13 @@ namespace put
 
     pen_error audio_channel_get_sound_file_info(const u32 sound_index, audio_sound_file_info* info)
     {
-        if (_audio_resources[sound_index].assigned_flag && _sound_file_info_ready[sound_index])
+        u32 slot = audio_get_slot(sound_index);
+
+        if (_audio_resources[slot].assigned_flag && _sound_file_info_ready[slot])
         {
-            if (_audio_resources[sound_index].type == AUDIO_RESOURCE_SOUND)
+            if (_audio_resources[slot].type == AUDIO_RESOURCE_SOUND)
             {
-                *info = _sound_file_info[sound_index];
+                *info = _sound_file_info[slot];
 
                 return PEN_ERR_OK;
             }
@@ -569,11 +573,13 @@ namespace put
 
     pen_error audio_group_get_state(const u32 group_index, audio_group_state* state)
     {
-        if (_audio_resources[group_index].assigned_flag)
+        u32 slot = audio_get_slot(group_index);
+
+        if (_audio_resources[slot].assigned_flag)
         {
-            if (_audio_resources[group_index].type == AUDIO_RESOURCE_GROUP)
+            if (_audio_resources[slot].type == AUDIO_RESOURCE_GROUP)
             {
-                const resource_state& rs = _resource_states.frontbuffer()[group_index];
+                const resource_state& rs = _resource_states.frontbuffer()[slot];
 
                 *state = rs.group_state;
 
@@ -588,11 +594,13 @@ namespace put
 
     pen_error audio_dsp_get_spectrum(const u32 spectrum_dsp, audio_fft_spectrum* spectrum)
     {
-        if (_audio_resources[spectrum_dsp].assigned_flag)
+        u32 slot = audio_get_slot(spectrum_dsp);
+
+        if (_audio_resources[slot].assigned_flag)
         {
-            if (_audio_resources[spectrum_dsp].type == AUDIO_RESOURCE_DSP_FFT)
+            if (_audio_resources[slot].type == AUDIO_RESOURCE_DSP_FFT)
             {
-                const resource_state& rs = _resource_states.frontbuffer()[spectrum_dsp];
+                const resource_state& rs = _resource_states.frontbuffer()[slot];
 
                 if (rs.fft_spectrum != nullptr)
                 {
@@ -610,11 +618,13 @@ namespace put
 
     pen_error audio_dsp_get_three_band_eq(const u32 eq_dsp, audio_eq_state* eq_state)
     {
-        if (_audio_resources[eq_dsp].assigned_flag)
+        u32 slot = audio_get_slot(eq_dsp);
+
+        if (_audio_resources[slot].assigned_flag)
         {
-            if (_audio_resources[eq_dsp].type == AUDIO_RESOURCE_DSP_EQ)
+            if (_audio_resources[slot].type == AUDIO_RESOURCE_DSP_EQ)
             {
-                const resource_state& rs = _resource_states.frontbuffer()[eq_dsp];
+                const resource_state& rs = _resource_states.frontbuffer()[slot];
 
                 *eq_state = rs.eq_state;
 
@@ -629,11 +639,13 @@ namespace put
 
     pen_error audio_dsp_get_gain(const u32 dsp_index, f32* gain)
     {
-        if (_audio_resources[dsp_index].assigned_flag)
+        u32 slot = audio_get_slot(dsp_index);
+
+        if (_audio_resources[slot].assigned_flag)
         {
-            if (_audio_resources[dsp_index].type == AUDIO_RESOURCE_DSP_GAIN)
+            if (_audio_resources[slot].type == AUDIO_RESOURCE_DSP_GAIN)
             {
-                const resource_state& rs = _resource_states.frontbuffer()[dsp_index];
+                const resource_state& rs = _resource_states.frontbuffer()[slot];
 
                 *gain = rs.gain_value;
 
@@ -17,7 +17,9 @@
 #include "pen_json.h"
 #include "pen_string.h"
 #include "pmfx.h"
+#include "profiler.h"
 #include "renderer.h"
+#include "renderer_shared.h"
 #include "str_utilities.h"
 #include "timer.h"
 
@@ -55,6 +57,8 @@ namespace
     render_handles s_imgui_rs;
     pen::json      s_program_preferences;
     Str            s_program_prefs_filename;
+    bool           s_memory_stats_open = false;
+    bool           s_profiler_open = false;
     bool           s_console_open = false;
     s32            s_program_prefs_save_timer = 0;
     bool           s_save_program_prefs = false;
@@ -1428,6 +1432,194 @@ namespace put
             return s_console_open;
         }
 
+        void memory_stats()
+        {
+            if (!s_memory_stats_open)
+                return;
+
+            ImGui::Begin("Memory", &s_memory_stats_open, ImGuiWindowFlags_AlwaysAutoResize);
+
+            ImGui::Columns(5);
+            ImGui::Text("Tag");
+            ImGui::NextColumn();
+            ImGui::Text("Live");
+            ImGui::NextColumn();
+            ImGui::Text("Peak");
+            ImGui::NextColumn();
+            ImGui::Text("Live Allocs");
+            ImGui::NextColumn();
+            ImGui::Text("Total Allocs");
+            ImGui::NextColumn();
+            ImGui::Separator();
+
+            for (u32 i = 0; i < pen::e_mem_tag::COUNT; ++i)
+            {
+                pen::memory_stats ms;
+                pen::memory_get_stats((pen::mem_tag)i, ms);
+
+                ImGui::Text("%s", pen::memory_get_tag_name((pen::mem_tag)i));
+                ImGui::NextColumn();
+                ImGui::Text("%.2f mb", (f64)ms.live_bytes / 1024.0 / 1024.0);
+                ImGui::NextColumn();
+                ImGui::Text("%.2f mb", (f64)ms.peak_bytes / 1024.0 / 1024.0);
+                ImGui::NextColumn();
+                ImGui::Text("%zu", ms.live_count);
+                ImGui::NextColumn();
+                ImGui::Text("%zu", ms.total_count);
+                ImGui::NextColumn();
+            }
+
+            ImGui::Columns(1);
+            ImGui::End();
+        }
+
+        void profiler()
+        {
+            if (!s_profiler_open)
+                return;
+
+            static const u32          k_max_events = 16384;
+            static const u32          k_max_threads = 64;
+            static pen::profile_event s_events[k_max_events];
+            static s32                s_frames_ago = 3;
+
+            ImGui::Begin("Profiler", &s_profiler_open);
+
+            bool record = pen::profiler_is_enabled();
+            if (ImGui::Checkbox("Record", &record))
+                pen::profiler_enable(record);
+
+            // the most recent frames may still be in flight on other threads
+            ImGui::SameLine();
+            ImGui::PushItemWidth(200.0f);
+            ImGui::SliderInt("Frames Ago", &s_frames_ago, 3, 60);
+            ImGui::PopItemWidth();
+
+            ImGui::SameLine();
+            if (ImGui::Button("Export Chrome Trace"))
+            {
+                if (pen::profiler_export_chrome_trace("profile.json"))
+                    dev_console_log("[profiler] exported profile.json");
+                else
+                    dev_console_log_level(e_console_level::error, "[profiler] failed to export profile.json");
+            }
+
+            if (ImGui::CollapsingHeader("Threads"))
+            {
+                pen::thread_timing timings[k_max_threads];
+                u32                nt = pen::thread_get_timings(timings, k_max_threads);
+                for (u32 i = 0; i < nt; ++i)
+                {
+                    f64 busy = timings[i].total_ms > 0.0 ? 1.0 - timings[i].idle_ms / timings[i].total_ms : 0.0;
+                    ImGui::Text("%-12s %5.1f%% busy", timings[i].name, busy * 100.0);
+                }
+            }
+
+            u64 cur_frame = pen::_renderer_frame_index();
+            u64 frame = cur_frame > (u64)s_frames_ago ? cur_frame - s_frames_ago : 0;
+
+            // gather the frame from all threads and find its extents
+            u32 num_threads = min<u32>(pen::profiler_get_num_threads(), k_max_threads);
+            u32 offsets[k_max_threads + 1];
+            u32 max_depth[k_max_threads];
+            f64 frame_start = DBL_MAX;
+            f64 frame_end = 0.0;
+
+            offsets[0] = 0;
+            for (u32 t = 0; t < num_threads; ++t)
+            {
+                u32 n = pen::profiler_get_events(t, frame, &s_events[offsets[t]], k_max_events - offsets[t]);
+                offsets[t + 1] = offsets[t] + n;
+
+                max_depth[t] = 0;
+                for (u32 i = offsets[t]; i < offsets[t + 1]; ++i)
+                {
+                    frame_start = min(frame_start, s_events[i].start_us);
+                    frame_end = max(frame_end, s_events[i].end_us);
+                    max_depth[t] = max(max_depth[t], s_events[i].depth);
+                }
+            }
+
+            if (frame_end <= frame_start)
+            {
+                ImGui::Text("No events recorded for frame %llu", (unsigned long long)frame);
+                ImGui::End();
+                return;
+            }
+
+            f64 frame_us = frame_end - frame_start;
+            ImGui::Text("Frame %llu: %.3f ms", (unsigned long long)frame, frame_us / 1000.0);
+
+            // timeline, a row per thread with nested scopes stacked beneath their parents
+            const f32 k_row_height = 18.0f;
+            const f32 k_label_width = 100.0f;
+
+            ImDrawList* draw_list = ImGui::GetWindowDrawList();
+            ImVec2      origin = ImGui::GetCursorScreenPos();
+            f32         width = max(ImGui::GetContentRegionAvailWidth() - k_label_width, 1.0f);
+            f32         scale = (f32)(width / frame_us);
+            f32         y = origin.y;
+
+            for (u32 t = 0; t < num_threads; ++t)
+            {
+                if (offsets[t] == offsets[t + 1])
+                    continue;
+
+                draw_list->AddText(ImVec2(origin.x, y), 0xffffffff, pen::profiler_get_thread_name(t));
+
+                for (u32 i = offsets[t]; i < offsets[t + 1]; ++i)
+                {
+                    const pen::profile_event& e = s_events[i];
+
+                    ImVec2 r0, r1;
+                    r0.x = origin.x + k_label_width + (f32)(e.start_us - frame_start) * scale;
+                    r0.y = y + e.depth * k_row_height;
+                    r1.x = max(r0.x + 1.0f, origin.x + k_label_width + (f32)(e.end_us - frame_start) * scale);
+                    r1.y = r0.y + k_row_height - 1.0f;
+
+                    // colour by name, so the same scope is recognisable across frames
+                    u32 h = (u32)((uintptr_t)e.name * 2654435761u);
+                    u32 col = 0xff000000 | ((h & 0x007f7f7f) + 0x00404040);
+
+                    draw_list->AddRectFilled(r0, r1, col);
+                    if (r1.x - r0.x > 40.0f)
+                    {
+                        draw_list->PushClipRect(r0, r1, true);
+                        draw_list->AddText(ImVec2(r0.x + 2.0f, r0.y), 0xff000000, e.name);
+                        draw_list->PopClipRect();
+                    }
+
+                    if (ImGui::IsMouseHoveringRect(r0, r1))
+                        ImGui::SetTooltip("%s: %.3f ms", e.name, (e.end_us - e.start_us) / 1000.0);
+                }
+
+                y += (max_depth[t] + 1) * k_row_height + 4.0f;
+            }
+
+            ImGui::Dummy(ImVec2(width + k_label_width, y - origin.y));
+            ImGui::End();
+        }
+
+        void show_profiler(bool val)
+        {
+            s_profiler_open = val;
+        }
+
+        bool is_profiler_open()
+        {
+            return s_profiler_open;
+        }
+
+        void show_memory_stats(bool val)
+        {
+            s_memory_stats_open = val;
+        }
+
+        bool is_memory_stats_open()
+        {
+            return s_memory_stats_open;
+        }
+
         void log(const c8* fmt, ...)
         {
             va_list args;
@@ -1504,6 +1696,12 @@ namespace put
             // update console
             console();
 
+            // update memory stats
+            memory_stats();
+
+            // update profiler
+            profiler();
+
             // perform program prefs save
             perform_save_program_prefs();
         }
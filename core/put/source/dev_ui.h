@@ -82,6 +82,16 @@ namespace put
         void log_level(u32 level, const c8* fmt, ...);
         void console();
 
+        // memory
+        bool is_memory_stats_open();
+        void show_memory_stats(bool val);
+        void memory_stats();
+
+        // profiler
+        bool is_profiler_open();
+        void show_profiler(bool val);
+        void profiler();
+
         // imgui extensions
         bool      state_button(const c8* text, bool state_active);
         void      set_tooltip(const c8* fmt, ...);
@@ -0,0 +1,544 @@
+// ecs_bvh.cpp
+// Copyright 2014 - 2019 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+#include "ecs/ecs_bvh.h"
+#include "ecs/ecs_scene.h"
+
+#include "console.h"
+#include "data_struct.h"
+
+using namespace pen;
+
+namespace
+{
+    using namespace put::ecs;
+
+    static const s32 k_null_node = -1;
+    static const u32 k_max_stack = 128;
+
+    // fat aabb padding, relative to the entity extent plus a constant so tiny entities get some slack
+    static const f32 k_fat_scale = 0.1f;
+    static const f32 k_fat_min = 0.1f;
+
+    pen_inline bool is_leaf(const bvh_node& node)
+    {
+        return node.left == k_null_node;
+    }
+
+    pen_inline f32 surface_area(const vec3f& min, const vec3f& max)
+    {
+        vec3f d = max - min;
+        return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+
+    pen_inline f32 union_area(const bvh_node& a, const bvh_node& b)
+    {
+        return surface_area(min_union(a.min, b.min), max_union(a.max, b.max));
+    }
+
+    pen_inline bool contains(const bvh_node& node, const vec3f& min, const vec3f& max)
+    {
+        return node.min.x <= min.x && node.min.y <= min.y && node.min.z <= min.z && node.max.x >= max.x &&
+               node.max.y >= max.y && node.max.z >= max.z;
+    }
+
+    // same acceptance as filter_entities_scalar
+    pen_inline bool is_renderable(const ecs_scene* scene, u32 e)
+    {
+        u64 flags = scene->entities[e];
+        u64 accept = e_cmp::geometry | e_cmp::material;
+        return (flags & accept) == accept && !(flags & e_cmp::sub_instance);
+    }
+
+    s32 alloc_node(bvh& tree)
+    {
+        if (tree.free_list == k_null_node)
+        {
+            bvh_node node;
+            node.height = -1;
+            node.parent = k_null_node;
+            sb_push(tree.nodes, node);
+            tree.free_list = sb_count(tree.nodes) - 1;
+        }
+
+        s32       index = tree.free_list;
+        bvh_node& node = tree.nodes[index];
+        tree.free_list = node.parent;
+
+        node.parent = k_null_node;
+        node.left = k_null_node;
+        node.right = k_null_node;
+        node.height = 0;
+        node.entity = 0;
+        return index;
+    }
+
+    void free_node(bvh& tree, s32 index)
+    {
+        tree.nodes[index].parent = tree.free_list;
+        tree.nodes[index].height = -1;
+        tree.free_list = index;
+    }
+
+    void fit_node(bvh& tree, s32 index)
+    {
+        bvh_node&       node = tree.nodes[index];
+        const bvh_node& l = tree.nodes[node.left];
+        const bvh_node& r = tree.nodes[node.right];
+
+        node.min = min_union(l.min, r.min);
+        node.max = max_union(l.max, r.max);
+        node.height = 1 + std::max(l.height, r.height);
+    }
+
+    // avl style rotation, promotes the taller grandchild of a when its children differ in height by more than 1
+    s32 balance(bvh& tree, s32 ia)
+    {
+        bvh_node* n = tree.nodes;
+        bvh_node& a = n[ia];
+        if (is_leaf(a) || a.height < 2)
+            return ia;
+
+        s32 ib = a.left;
+        s32 ic = a.right;
+        s32 bal = n[ic].height - n[ib].height;
+
+        // rotate the taller child up
+        s32 iup = k_null_node;
+        if (bal > 1)
+            iup = ic;
+        else if (bal < -1)
+            iup = ib;
+        else
+            return ia;
+
+        bvh_node& up = n[iup];
+        s32       if_ = up.left;
+        s32       ig = up.right;
+
+        // swap a and up
+        up.left = ia;
+        up.parent = a.parent;
+        a.parent = iup;
+
+        if (up.parent != k_null_node)
+        {
+            if (n[up.parent].left == ia)
+                n[up.parent].left = iup;
+            else
+                n[up.parent].right = iup;
+        }
+        else
+        {
+            tree.root = iup;
+        }
+
+        // the taller of up's children stays with it, the other replaces up under a
+        s32 ikeep = if_;
+        s32 igive = ig;
+        if (n[if_].height <= n[ig].height)
+        {
+            ikeep = ig;
+            igive = if_;
+        }
+
+        up.right = ikeep;
+        if (iup == ic)
+            a.right = igive;
+        else
+            a.left = igive;
+
+        n[igive].parent = ia;
+
+        fit_node(tree, ia);
+        fit_node(tree, iup);
+        return iup;
+    }
+
+    void insert_leaf(bvh& tree, s32 leaf)
+    {
+        if (tree.root == k_null_node)
+        {
+            tree.root = leaf;
+            tree.nodes[leaf].parent = k_null_node;
+            return;
+        }
+
+        // descend choosing the child with least cost, stopping when pairing here is cheapest
+        const bvh_node& lnode = tree.nodes[leaf];
+        s32             index = tree.root;
+        while (!is_leaf(tree.nodes[index]))
+        {
+            const bvh_node& node = tree.nodes[index];
+
+            f32 area = surface_area(node.min, node.max);
+            f32 combined = union_area(node, lnode);
+
+            f32 cost = 2.0f * combined;
+            f32 inheritance = 2.0f * (combined - area);
+
+            f32 child_cost[2];
+            s32 child[2] = {node.left, node.right};
+            for (u32 c = 0; c < 2; ++c)
+            {
+                const bvh_node& cn = tree.nodes[child[c]];
+                child_cost[c] = union_area(cn, lnode) + inheritance;
+                if (!is_leaf(cn))
+                    child_cost[c] -= surface_area(cn.min, cn.max);
+            }
+
+            if (cost < child_cost[0] && cost < child_cost[1])
+                break;
+
+            index = child_cost[0] < child_cost[1] ? child[0] : child[1];
+        }
+
+        // pair the leaf with the sibling under a new parent
+        s32 sibling = index;
+        s32 old_parent = tree.nodes[sibling].parent;
+        s32 new_parent = alloc_node(tree);
+
+        bvh_node& np = tree.nodes[new_parent];
+        np.parent = old_parent;
+        np.left = sibling;
+        np.right = leaf;
+
+        if (old_parent != k_null_node)
+        {
+            if (tree.nodes[old_parent].left == sibling)
+                tree.nodes[old_parent].left = new_parent;
+            else
+                tree.nodes[old_parent].right = new_parent;
+        }
+        else
+        {
+            tree.root = new_parent;
+        }
+
+        tree.nodes[sibling].parent = new_parent;
+        tree.nodes[leaf].parent = new_parent;
+
+        // refit and rebalance up to the root
+        index = new_parent;
+        while (index != k_null_node)
+        {
+            index = balance(tree, index);
+            fit_node(tree, index);
+            index = tree.nodes[index].parent;
+        }
+    }
+
+    void remove_leaf(bvh& tree, s32 leaf)
+    {
+        if (leaf == tree.root)
+        {
+            tree.root = k_null_node;
+            return;
+        }
+
+        // the sibling replaces the parent
+        s32 parent = tree.nodes[leaf].parent;
+        s32 grand_parent = tree.nodes[parent].parent;
+        s32 sibling = tree.nodes[parent].left == leaf ? tree.nodes[parent].right : tree.nodes[parent].left;
+
+        free_node(tree, parent);
+
+        if (grand_parent == k_null_node)
+        {
+            tree.root = sibling;
+            tree.nodes[sibling].parent = k_null_node;
+            return;
+        }
+
+        if (tree.nodes[grand_parent].left == parent)
+            tree.nodes[grand_parent].left = sibling;
+        else
+            tree.nodes[grand_parent].right = sibling;
+
+        tree.nodes[sibling].parent = grand_parent;
+
+        s32 index = grand_parent;
+        while (index != k_null_node)
+        {
+            index = balance(tree, index);
+            fit_node(tree, index);
+            index = tree.nodes[index].parent;
+        }
+    }
+
+    void set_fat_aabb(bvh_node& node, const cmp_pos_extent& pe)
+    {
+        vec3f pad = pe.extent.xyz * k_fat_scale + vec3f(k_fat_min);
+        node.min = pe.pos.xyz - pe.extent.xyz - pad;
+        node.max = pe.pos.xyz + pe.extent.xyz + pad;
+    }
+
+    void remove_entity(bvh& tree, u32 e)
+    {
+        s32 leaf = tree.entity_leaf[e];
+        if (leaf == k_null_node)
+            return;
+
+        remove_leaf(tree, leaf);
+        free_node(tree, leaf);
+        tree.entity_leaf[e] = k_null_node;
+        tree.num_leaves--;
+    }
+
+    // walks the tree calling test on each node, which returns false to reject the subtree.
+    // leaves which pass are tested against the exact pos_extent with accept.
+    template <typename T, typename A>
+    void query(const ecs_scene* scene, T test, A accept, u32** entities_out)
+    {
+        const bvh& tree = scene->spatial_index;
+        if (tree.root == k_null_node)
+            return;
+
+        s32 stack[k_max_stack];
+        u32 sp = 0;
+        stack[sp++] = tree.root;
+
+        while (sp > 0)
+        {
+            const bvh_node& node = tree.nodes[stack[--sp]];
+            if (!test(node.min, node.max))
+                continue;
+
+            if (is_leaf(node))
+            {
+                const cmp_pos_extent& pe = scene->pos_extent[node.entity];
+                if (accept(pe.pos.xyz - pe.extent.xyz, pe.pos.xyz + pe.extent.xyz))
+                    sb_push(*entities_out, node.entity);
+                continue;
+            }
+
+            PEN_ASSERT(sp + 2 <= k_max_stack);
+            stack[sp++] = node.right;
+            stack[sp++] = node.left;
+        }
+    }
+
+    void push_subtree(const bvh& tree, s32 index, u32** entities_out)
+    {
+        s32 stack[k_max_stack];
+        u32 sp = 0;
+        stack[sp++] = index;
+
+        while (sp > 0)
+        {
+            const bvh_node& node = tree.nodes[stack[--sp]];
+            if (is_leaf(node))
+            {
+                sb_push(*entities_out, node.entity);
+                continue;
+            }
+
+            PEN_ASSERT(sp + 2 <= k_max_stack);
+            stack[sp++] = node.right;
+            stack[sp++] = node.left;
+        }
+    }
+
+    struct frustum_planes
+    {
+        vec3f n[6];
+        f32   d[6]; // -plane_distance, a point x is outside when dot(x, n) > d
+    };
+
+    // 0 outside, 1 intersecting, 2 inside, the mask tracks which planes the box still straddles
+    pen_inline u32 classify(const frustum_planes& fp, const vec3f& min, const vec3f& max, u32& mask)
+    {
+        vec3f c = (min + max) * 0.5f;
+        vec3f e = max - c;
+
+        for (u32 p = 0; p < 6; ++p)
+        {
+            if (!(mask & (1 << p)))
+                continue;
+
+            const vec3f& n = fp.n[p];
+            f32          dc = dot(c, n);
+            f32          r = e.x * fabsf(n.x) + e.y * fabsf(n.y) + e.z * fabsf(n.z);
+
+            if (dc - r > fp.d[p])
+                return 0;
+
+            if (dc + r <= fp.d[p])
+                mask &= ~(1 << p);
+        }
+
+        return mask ? 1 : 2;
+    }
+} // namespace
+
+namespace put
+{
+    namespace ecs
+    {
+        void bvh_clear(bvh& tree)
+        {
+            sb_free(tree.nodes);
+            sb_free(tree.entity_leaf);
+            tree.nodes = nullptr;
+            tree.entity_leaf = nullptr;
+            tree.root = k_null_node;
+            tree.free_list = k_null_node;
+            tree.num_leaves = 0;
+            tree.num_reinserted = 0;
+        }
+
+        void bvh_update(ecs_scene* scene)
+        {
+            bvh& tree = scene->spatial_index;
+            tree.num_reinserted = 0;
+
+            u32 num_entities = (u32)scene->num_entities;
+            u32 num_tracked = sb_count(tree.entity_leaf);
+
+            // entities beyond the end of the scene have been trimmed or cleared
+            for (u32 e = num_entities; e < num_tracked; ++e)
+                remove_entity(tree, e);
+
+            if (num_tracked > num_entities)
+            {
+                stb__sbn(tree.entity_leaf) = num_entities;
+            }
+            else
+            {
+                for (u32 e = num_tracked; e < num_entities; ++e)
+                    sb_push(tree.entity_leaf, k_null_node);
+            }
+
+            for (u32 e = 0; e < num_entities; ++e)
+            {
+                s32 leaf = tree.entity_leaf[e];
+
+                if (!is_renderable(scene, e))
+                {
+                    remove_entity(tree, e);
+                    continue;
+                }
+
+                const cmp_pos_extent& pe = scene->pos_extent[e];
+                vec3f                 min = pe.pos.xyz - pe.extent.xyz;
+                vec3f                 max = pe.pos.xyz + pe.extent.xyz;
+
+                if (leaf != k_null_node)
+                {
+                    // most entities are static or move within their fat aabb
+                    if (contains(tree.nodes[leaf], min, max))
+                        continue;
+
+                    remove_leaf(tree, leaf);
+                    tree.num_reinserted++;
+                }
+                else
+                {
+                    leaf = alloc_node(tree);
+                    tree.nodes[leaf].entity = e;
+                    tree.entity_leaf[e] = leaf;
+                    tree.num_leaves++;
+                }
+
+                set_fat_aabb(tree.nodes[leaf], pe);
+                insert_leaf(tree, leaf);
+            }
+        }
+
+        void bvh_query_frustum(const ecs_scene* scene, const frustum& frust, u32** entities_out)
+        {
+            const bvh& tree = scene->spatial_index;
+            if (tree.root == k_null_node)
+                return;
+
+            frustum_planes fp;
+            for (u32 p = 0; p < 6; ++p)
+            {
+                fp.n[p] = frust.n[p];
+                fp.d[p] = -maths::plane_distance(frust.p[p], frust.n[p]);
+            }
+
+            struct entry
+            {
+                s32 node;
+                u32 mask;
+            };
+
+            entry stack[k_max_stack];
+            u32   sp = 0;
+            stack[sp++] = {tree.root, 0x3f};
+
+            while (sp > 0)
+            {
+                entry           en = stack[--sp];
+                const bvh_node& node = tree.nodes[en.node];
+
+                u32 mask = en.mask;
+                u32 c = classify(fp, node.min, node.max, mask);
+                if (c == 0)
+                    continue;
+
+                // wholly inside, everything below is visible
+                if (c == 2)
+                {
+                    push_subtree(tree, en.node, entities_out);
+                    continue;
+                }
+
+                if (is_leaf(node))
+                {
+                    // the fat aabb straddles a plane, test the exact bounds
+                    const cmp_pos_extent& pe = scene->pos_extent[node.entity];
+                    if (classify(fp, pe.pos.xyz - pe.extent.xyz, pe.pos.xyz + pe.extent.xyz, mask) != 0)
+                        sb_push(*entities_out, node.entity);
+                    continue;
+                }
+
+                PEN_ASSERT(sp + 2 <= k_max_stack);
+                stack[sp++] = {node.right, mask};
+                stack[sp++] = {node.left, mask};
+            }
+        }
+
+        void bvh_query_sphere(const ecs_scene* scene, const vec3f& pos, f32 radius, u32** entities_out)
+        {
+            f32  r2 = radius * radius;
+            auto test = [&](const vec3f& bmin, const vec3f& bmax) {
+                vec3f d = max_union(bmin, min_union(pos, bmax)) - pos;
+                return dot(d, d) <= r2;
+            };
+
+            query(scene, test, test, entities_out);
+        }
+
+        void bvh_query_aabb(const ecs_scene* scene, const vec3f& min, const vec3f& max, u32** entities_out)
+        {
+            auto test = [&](const vec3f& bmin, const vec3f& bmax) {
+                return bmin.x <= max.x && bmax.x >= min.x && bmin.y <= max.y && bmax.y >= min.y && bmin.z <= max.z &&
+                       bmax.z >= min.z;
+            };
+
+            query(scene, test, test, entities_out);
+        }
+
+        void bvh_query_ray(const ecs_scene* scene, const vec3f& origin, const vec3f& dir, f32 max_t, u32** entities_out)
+        {
+            // slab test, division by zero gives inf which the min / max handle for axis aligned rays
+            vec3f inv = vec3f(1.0f / dir.x, 1.0f / dir.y, 1.0f / dir.z);
+
+            auto test = [&](const vec3f& bmin, const vec3f& bmax) {
+                vec3f ta = (bmin - origin) * inv;
+                vec3f tb = (bmax - origin) * inv;
+                vec3f tn = min_union(ta, tb);
+                vec3f tf = max_union(ta, tb);
+
+                f32 t0 = std::max(std::max(tn.x, tn.y), std::max(tn.z, 0.0f));
+                f32 t1 = std::min(std::min(tf.x, tf.y), std::min(tf.z, max_t));
+                return t0 <= t1;
+            };
+
+            query(scene, test, test, entities_out);
+        }
+    } // namespace ecs
+} // namespace put
@@ -0,0 +1,53 @@
+// ecs_bvh.h
+// Copyright 2014 - 2019 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+// Dynamic aabb tree over the renderable entities of an ecs_scene, used to cull and query without visiting every entity.
+// Leaves hold a fattened copy of the entity pos_extent so entities which move a little need no tree update, those which
+// leave their fat aabb are removed and reinserted with the surface area heuristic and the tree is kept balanced with
+// rotations. Queries early out on whole subtrees and only test the exact pos_extent at the leaves, so results match the
+// linear culling functions in ecs_cull.h.
+
+#pragma once
+
+#include "camera.h"
+#include "types.h"
+
+namespace put
+{
+    namespace ecs
+    {
+        struct ecs_scene;
+
+        struct bvh_node
+        {
+            vec3f min;
+            vec3f max;
+            s32   parent; // next free node, when in the free list
+            s32   left;   // -1 for leaves
+            s32   right;
+            s32   height; // 0 for leaves, -1 for free nodes
+            u32   entity;
+        };
+
+        struct bvh
+        {
+            bvh_node* nodes = nullptr;
+            s32*      entity_leaf = nullptr; // leaf node index per entity, -1 if the entity is not in the tree
+            s32       root = -1;
+            s32       free_list = -1;
+            u32       num_leaves = 0;
+            u32       num_reinserted = 0; // leaves moved by the last bvh_update
+        };
+
+        // syncs the tree with the current entity flags and pos_extent, call after pos_extent is updated
+        void bvh_update(ecs_scene* scene);
+        void bvh_clear(bvh& tree);
+
+        // queries append entity indices to entities_out in no particular order
+        void bvh_query_frustum(const ecs_scene* scene, const frustum& frust, u32** entities_out);
+        void bvh_query_sphere(const ecs_scene* scene, const vec3f& pos, f32 radius, u32** entities_out);
+        void bvh_query_aabb(const ecs_scene* scene, const vec3f& min, const vec3f& max, u32** entities_out);
+        void bvh_query_ray(const ecs_scene* scene, const vec3f& origin, const vec3f& dir, f32 max_t, u32** entities_out);
+    } // namespace ecs
+} // namespace put
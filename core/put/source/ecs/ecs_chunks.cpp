@@ -0,0 +1,290 @@
+// ecs_chunks.cpp
+// Copyright 2014 - 2019 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+#include "ecs/ecs_chunks.h"
+#include "ecs/ecs_scene.h"
+
+#include "data_struct.h"
+#include "memory.h"
+#include "threads.h"
+
+#include <string.h>
+
+namespace
+{
+    using namespace put;
+    using namespace put::ecs;
+
+    static const u32 k_chunk_shift = e_chunk_constants::chunk_shift;
+    static const u32 k_chunk_size = e_chunk_constants::chunk_size;
+    static const u32 k_chunk_mask = e_chunk_constants::chunk_mask;
+
+    // large components which most entities do not have, everything else stays dense
+    u32 get_pooled_components(ecs_scene* scene, generic_cmp_array** out)
+    {
+        void* pooled[] = {&scene->master_instances,
+                          &scene->geometries,
+                          &scene->pre_skin,
+                          &scene->physics_data,
+                          &scene->position_geometries,
+                          &scene->material_data,
+                          &scene->material_resources,
+                          &scene->samplers,
+                          &scene->lights,
+                          &scene->shadows,
+                          &scene->area_light,
+                          &scene->area_light_resources,
+                          &scene->anim_controller_v2,
+                          &scene->physics_matrices,
+                          &scene->physics_offset,
+                          &scene->offset_matrices};
+
+        u32 num = PEN_ARRAY_SIZE(pooled);
+        for (u32 i = 0; i < num; ++i)
+            out[i] = (generic_cmp_array*)pooled[i];
+
+        return num;
+    }
+
+    bool is_zero(const void* data, u32 size)
+    {
+        const u8* b = (const u8*)data;
+        for (u32 i = 0; i < size; ++i)
+            if (b[i])
+                return false;
+
+        return true;
+    }
+
+    u32 num_chunk_entries(u32 capacity)
+    {
+        return (capacity + k_chunk_mask) >> k_chunk_shift;
+    }
+} // namespace
+
+namespace put
+{
+    namespace ecs
+    {
+        void* cmp_pool_alloc(cmp_pool* pool, u32 entity)
+        {
+            pen::mutex_lock(pool->mutex);
+
+            // another job may have allocated this entity while we were waiting
+            void* p = cmp_pool_find(pool, entity);
+            if (!p)
+            {
+                u32 slot;
+                u32 num_free = sb_count(pool->free_slots);
+                if (num_free)
+                {
+                    slot = pool->free_slots[num_free - 1];
+                    stb__sbn(pool->free_slots)--;
+                }
+                else
+                {
+                    slot = pool->num_slots++;
+                }
+
+                // free slots are zeroed on release, new chunks when allocated
+                u32 c = slot >> k_chunk_shift;
+                if (!pool->chunks[c])
+                {
+                    u32 chunk_bytes = k_chunk_size * pool->size;
+                    pool->chunks[c] = (u8*)pen::memory_alloc(chunk_bytes, pen::e_mem_tag::ecs);
+                    pen::memory_zero(pool->chunks[c], chunk_bytes);
+                }
+
+                pool->owners[slot] = entity;
+                pool->num_live++;
+
+                // the slot is published last so lock free readers only ever see a complete component
+                p = pool->chunks[c] + (slot & k_chunk_mask) * pool->size;
+                pool->slots[entity].store(slot + 1, std::memory_order_release);
+            }
+
+            pen::mutex_unlock(pool->mutex);
+            return p;
+        }
+
+        void cmp_pool_release(cmp_pool* pool, u32 entity)
+        {
+            void* p = cmp_pool_find(pool, entity);
+            if (!p)
+                return;
+
+            pen::mutex_lock(pool->mutex);
+
+            u32 slot = pool->slots[entity] - 1;
+            pen::memory_zero(p, pool->size);
+
+            pool->owners[slot] = PEN_INVALID_HANDLE;
+            pool->slots[entity] = 0;
+            pool->num_live--;
+            sb_push(pool->free_slots, slot);
+
+            pen::mutex_unlock(pool->mutex);
+        }
+
+        void cmp_pool_resize(cmp_pool* pool, u32 capacity)
+        {
+            if (capacity <= pool->capacity)
+                return;
+
+            u32 prev_capacity = pool->capacity;
+            u32 prev_chunks = num_chunk_entries(prev_capacity);
+            u32 new_chunks = num_chunk_entries(capacity);
+
+            // resizing is never concurrent with access, so the atomics can move
+            pool->slots = (a_u32*)pen::memory_realloc(pool->slots, capacity * sizeof(a_u32));
+            pen::memory_zero(pool->slots + prev_capacity, (capacity - prev_capacity) * sizeof(a_u32));
+
+            // owners are only read below num_slots
+            pool->owners = (u32*)pen::memory_realloc(pool->owners, capacity * sizeof(u32));
+
+            pool->chunks = (u8**)pen::memory_realloc(pool->chunks, new_chunks * sizeof(u8*));
+            pen::memory_zero(pool->chunks + prev_chunks, (new_chunks - prev_chunks) * sizeof(u8*));
+
+            pool->capacity = capacity;
+        }
+
+        void cmp_pool_clear(cmp_pool* pool)
+        {
+            u32 num_chunks = num_chunk_entries(pool->capacity);
+            for (u32 c = 0; c < num_chunks; ++c)
+                pen::memory_free(pool->chunks[c]);
+
+            pen::memory_free(pool->chunks);
+            pen::memory_free(pool->slots);
+            pen::memory_free(pool->owners);
+            sb_free(pool->free_slots);
+
+            pool->chunks = nullptr;
+            pool->slots = nullptr;
+            pool->owners = nullptr;
+            pool->free_slots = nullptr;
+            pool->capacity = 0;
+            pool->num_slots = 0;
+            pool->num_live = 0;
+        }
+
+        void cmp_pool_copy(cmp_pool* pool, u32 dst, u32 src)
+        {
+            if (dst == src)
+                return;
+
+            void* ps = cmp_pool_find(pool, src);
+            if (!ps)
+            {
+                cmp_pool_release(pool, dst);
+                return;
+            }
+
+            memcpy(cmp_pool_get(pool, dst), ps, pool->size);
+        }
+
+        u32 cmp_pool_num_chunks(const cmp_pool* pool)
+        {
+            return num_chunk_entries(pool->num_slots);
+        }
+
+        cmp_chunk cmp_pool_get_chunk(const cmp_pool* pool, u32 chunk)
+        {
+            u32 first = chunk << k_chunk_shift;
+
+            cmp_chunk c;
+            c.data = pool->chunks[chunk];
+            c.owners = &pool->owners[first];
+            c.count = min<u32>(k_chunk_size, pool->num_slots - first);
+            return c;
+        }
+
+        void set_chunked_storage(ecs_scene* scene, bool enable)
+        {
+            generic_cmp_array* pooled[64];
+            u32                num = get_pooled_components(scene, pooled);
+
+            for (u32 i = 0; i < num; ++i)
+            {
+                generic_cmp_array& cmp = *pooled[i];
+
+                if (enable && !cmp.pool)
+                {
+                    cmp_pool* pool = new cmp_pool();
+                    pool->size = cmp.size;
+                    pool->mutex = pen::mutex_create();
+                    cmp_pool_resize(pool, scene->soa_size);
+
+                    // zeroed components read the same with or without storage
+                    for (u32 n = 0; n < scene->soa_size; ++n)
+                    {
+                        const void* src = cmp[n];
+                        if (!is_zero(src, cmp.size))
+                            memcpy(cmp_pool_alloc(pool, n), src, cmp.size);
+                    }
+
+                    pen::memory_free(cmp.data);
+                    cmp.data = nullptr;
+                    cmp.pool = pool;
+                }
+                else if (!enable && cmp.pool)
+                {
+                    cmp_pool* pool = cmp.pool;
+                    cmp.pool = nullptr;
+
+                    if (scene->soa_size)
+                    {
+                        u32 alloc_size = cmp.size * scene->soa_size;
+                        cmp.data = pen::memory_alloc(alloc_size, pen::e_mem_tag::ecs);
+                        pen::memory_zero(cmp.data, alloc_size);
+
+                        for (u32 n = 0; n < scene->soa_size; ++n)
+                        {
+                            const void* src = cmp_pool_find(pool, n);
+                            if (src)
+                                memcpy(cmp[n], src, cmp.size);
+                        }
+                    }
+
+                    cmp_pool_clear(pool);
+                    pen::mutex_destroy(pool->mutex);
+                    delete pool;
+                }
+            }
+        }
+
+        bool has_chunked_storage(const ecs_scene* scene)
+        {
+            return scene->geometries.pool != nullptr;
+        }
+
+        void get_chunked_storage_stats(ecs_scene* scene, chunked_storage_stats& stats)
+        {
+            stats = chunked_storage_stats();
+
+            for (u32 i = 0; i < scene->num_components; ++i)
+            {
+                generic_cmp_array& cmp = scene->get_component_array(i);
+
+                if (!cmp.pool)
+                {
+                    stats.dense_bytes += (size_t)cmp.size * scene->soa_size;
+                    continue;
+                }
+
+                const cmp_pool* pool = cmp.pool;
+                u32             num_chunks = num_chunk_entries(pool->capacity);
+
+                stats.pooled_bytes += (size_t)pool->capacity * sizeof(u32) * 2;
+                stats.pooled_bytes += (size_t)num_chunks * sizeof(u8*);
+
+                for (u32 c = 0; c < num_chunks; ++c)
+                    if (pool->chunks[c])
+                        stats.pooled_bytes += (size_t)k_chunk_size * pool->size;
+
+                stats.live += pool->num_live;
+            }
+        }
+    } // namespace ecs
+} // namespace put
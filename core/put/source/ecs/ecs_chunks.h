@@ -0,0 +1,109 @@
+// ecs_chunks.h
+// Copyright 2014 - 2019 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+// Chunked component storage. By default every component array holds soa_size entries so large components such as
+// geometry, materials and physics are allocated for lights and empty nodes too. With chunked storage enabled those
+// components are kept in pools of fixed size chunks and an entity only gets a slot in a pool the first time its
+// component is accessed. cmp_array::operator[] goes through a per entity slot table so the index based api keeps
+// working, component addresses remain stable until the entity is deleted and iterating a pooled component only
+// touches the chunks which hold live components.
+
+#pragma once
+
+#include "types.h"
+
+namespace pen
+{
+    struct mutex;
+}
+
+namespace put
+{
+    namespace ecs
+    {
+        struct ecs_scene;
+
+        namespace e_chunk_constants
+        {
+            enum chunk_constants_t
+            {
+                chunk_shift = 6,
+                chunk_size = 1 << chunk_shift, // components per chunk
+                chunk_mask = chunk_size - 1
+            };
+        }
+
+        struct cmp_pool
+        {
+            u32         size = 0;             // component size in bytes
+            u32         capacity = 0;         // entities, matches ecs_scene::soa_size
+            u32         num_slots = 0;        // high water mark of used slots
+            u32         num_live = 0;         // slots owned by an entity
+            a_u32*      slots = nullptr;      // per entity, slot + 1 or 0 when the entity has no storage
+            u32*        owners = nullptr;     // per slot, entity index or PEN_INVALID_HANDLE when free
+            u8**        chunks = nullptr;     // capacity / chunk_size entries, chunks are allocated on demand
+            u32*        free_slots = nullptr; // stb stretchy buffer
+            pen::mutex* mutex = nullptr;      // slots can be allocated from jobs
+        };
+
+        struct cmp_chunk
+        {
+            u8*        data = nullptr;     // count components of cmp_pool::size
+            const u32* owners = nullptr;   // entity index of each component, PEN_INVALID_HANDLE for free slots
+            u32        count = 0;
+        };
+
+        struct chunked_storage_stats
+        {
+            size_t dense_bytes = 0;  // component arrays sized by soa_size
+            size_t pooled_bytes = 0; // allocated chunks, slot tables and chunk directories
+            u32    live = 0;         // pooled components owned by entities
+        };
+
+        // pool management, slots are zeroed when allocated so a new component reads the same as a dense one
+        void* cmp_pool_alloc(cmp_pool* pool, u32 entity);
+        void  cmp_pool_release(cmp_pool* pool, u32 entity);
+        void  cmp_pool_resize(cmp_pool* pool, u32 capacity);
+        void  cmp_pool_clear(cmp_pool* pool);
+        void  cmp_pool_copy(cmp_pool* pool, u32 dst, u32 src);
+
+        u32       cmp_pool_num_chunks(const cmp_pool* pool);
+        cmp_chunk cmp_pool_get_chunk(const cmp_pool* pool, u32 chunk);
+
+        // converts the large sparse base components between dense arrays and pools, can be called at any time
+        void set_chunked_storage(ecs_scene* scene, bool enable);
+        bool has_chunked_storage(const ecs_scene* scene);
+        void get_chunked_storage_stats(ecs_scene* scene, chunked_storage_stats& stats);
+
+        // nullptr when the entity has no storage. lock free, pairs with the release store in cmp_pool_alloc which
+        // publishes a slot only once its chunk exists
+        pen_inline void* cmp_pool_find(const cmp_pool* pool, u32 entity)
+        {
+            u32 slot = pool->slots[entity].load(std::memory_order_acquire);
+            if (!slot)
+                return nullptr;
+
+            --slot;
+            u8* chunk = pool->chunks[slot >> e_chunk_constants::chunk_shift];
+            return chunk + (slot & e_chunk_constants::chunk_mask) * pool->size;
+        }
+
+        pen_inline void* cmp_pool_get(cmp_pool* pool, u32 entity)
+        {
+            void* p = cmp_pool_find(pool, entity);
+            if (p)
+                return p;
+
+            return cmp_pool_alloc(pool, entity);
+        }
+
+        // dense components are zeroed memory, so an entity without pooled storage reads as zeroed bytes too
+        template <typename T>
+        pen_inline const T& cmp_pool_zero()
+        {
+            alignas(T) static const u8 s_zero[sizeof(T)] = {};
+            return *(const T*)s_zero;
+        }
+    } // namespace ecs
+} // namespace put
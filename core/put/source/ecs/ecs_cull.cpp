@@ -1,13 +1,22 @@
 #include "ecs_cull.h"
 
+#include "data_struct.h"
+#include "memory.h"
+#include "threads.h"
 #include "timer.h"
 #include "ecs_scene.h"
+#include "ecs_skinning.h"
+#include "ecs_transform.h"
 
 #if __SSE2__ || __AVX2__ || __AVX__
 #include <xmmintrin.h>
 #include <immintrin.h>
 #endif
 
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
 using namespace::pen;
 
 namespace put
@@ -101,6 +110,73 @@ namespace put
             }
         }
 
+
+        //
+        // fused filter and aabb cull, sweeps entities and pos_extent in order so there is no index list to gather from
+        //
+
+        static const u32 k_cull_chunk = 4096; // entities per job, each chunk writes its results in place
+
+        struct cull_planes
+        {
+            vec3f n[6];
+            vec3f abs_n[6];
+            f32   d[6]; // outside when dot(pos, n) - dot(extent, abs_n) > d
+            u64   accept;
+            u64   reject;
+        };
+
+        static void make_cull_planes(const camera* cam, cull_planes& cp)
+        {
+            const frustum& frust = cam->camera_frustum;
+            for (u32 p = 0; p < 6; ++p)
+            {
+                cp.n[p] = frust.n[p];
+                cp.abs_n[p] = vec3f(fabs(frust.n[p].x), fabs(frust.n[p].y), fabs(frust.n[p].z));
+                cp.d[p] = -maths::plane_distance(frust.p[p], frust.n[p]);
+            }
+
+            // same as filter_entities_scalar
+            cp.accept = e_cmp::geometry | e_cmp::material;
+            cp.reject = e_cmp::sub_instance;
+        }
+
+        static pen_inline bool cull_accept(const ecs_scene* scene, const cull_planes& cp, u32 e)
+        {
+            u64 flags = scene->entities[e];
+            return (flags & cp.accept) == cp.accept && !(flags & cp.reject);
+        }
+
+        // writes visible entities in [start, end) to out and returns the count
+        static u32 filter_cull_aabb_range_scalar(const ecs_scene* scene, const cull_planes& cp, u32 start, u32 end,
+                                                 u32* out)
+        {
+            u32 count = 0;
+            for (u32 i = start; i < end; ++i)
+            {
+                if (!cull_accept(scene, cp, i))
+                    continue;
+
+                vec3f pos = scene->pos_extent[i].pos.xyz;
+                vec3f extent = scene->pos_extent[i].extent.xyz;
+
+                bool inside = true;
+                for (u32 p = 0; p < 6; ++p)
+                {
+                    if (dot(pos, cp.n[p]) - dot(extent, cp.abs_n[p]) > cp.d[p])
+                    {
+                        inside = false;
+                        break;
+                    }
+                }
+
+                if (inside)
+                    out[count++] = i;
+            }
+
+            return count;
+        }
+
         //
         // sse2 128 implementation
         //
@@ -109,12 +185,6 @@ namespace put
         {
             const frustum& frust = cam->camera_frustum;
 
-            // pad to 4
-            u32 xn = sb_count(entities_in);
-            u32 yn = PEN_ALIGN(xn, 4);
-            for (u32 i = 0; i < yn - xn; ++i)
-                sb_push(entities_in, entities_in[0]);
-
             // sphere radius and position
             __m128 posx;
             __m128 posy;
@@ -137,7 +207,7 @@ namespace put
             __m128 sfy[6];
             __m128 sfz[6];
 
-            f32 result[4];
+            alignas(16) f32 result[4];
             u32 e[4];
 
             // load camera planes
@@ -158,9 +228,9 @@ namespace put
             u32 n = sb_count(entities_in);
             for (u32 i = 0; i < n; i += 4)
             {
-                // unpack entities
+                // unpack entities, the last is repeated to fill a partial batch
                 for (u32 j = 0; j < 4; ++j)
-                    e[j] = entities_in[i + j];
+                    e[j] = entities_in[min<u32>(i + j, n - 1)];
 
                 auto& p0 = scene->pos_extent[e[0]].pos;
                 auto& p1 = scene->pos_extent[e[1]].pos;
@@ -171,13 +241,13 @@ namespace put
                 auto& e2 = scene->pos_extent[e[2]].extent;
                 auto& e3 = scene->pos_extent[e[3]].extent;
 
-                posx = _mm_set_ps(p0.x, p1.x, p2.x, p3.x);
-                posy = _mm_set_ps(p0.y, p1.y, p2.y, p3.y);
-                posz = _mm_set_ps(p0.z, p1.z, p2.z, p3.z);
+                posx = _mm_setr_ps(p0.x, p1.x, p2.x, p3.x);
+                posy = _mm_setr_ps(p0.y, p1.y, p2.y, p3.y);
+                posz = _mm_setr_ps(p0.z, p1.z, p2.z, p3.z);
 
-                extx = _mm_set_ps(e0.x, e1.x, e2.x, e3.x);
-                exty = _mm_set_ps(e0.y, e1.y, e2.y, e3.y);
-                extz = _mm_set_ps(e0.z, e1.z, e2.z, e3.z);
+                extx = _mm_setr_ps(e0.x, e1.x, e2.x, e3.x);
+                exty = _mm_setr_ps(e0.y, e1.y, e2.y, e3.y);
+                extz = _mm_setr_ps(e0.z, e1.z, e2.z, e3.z);
 
                 __m128 inside = _mm_set1_ps(0.0f);
 
@@ -185,29 +255,30 @@ namespace put
                 {
                     // get distance to plane
                     // dot product with plane normal and also add plane distance
-                    __m128 dd = _mm_fmadd_ps(posx, pnx[p], pd[p]);
-                    dd = _mm_fmadd_ps(posy, pny[p], dd);
-                    dd = _mm_fmadd_ps(posz, pnz[p], dd);
+                    __m128 dd = _mm_add_ps(_mm_mul_ps(posx, pnx[p]), pd[p]);
+                    dd = _mm_add_ps(_mm_mul_ps(posy, pny[p]), dd);
+                    dd = _mm_add_ps(_mm_mul_ps(posz, pnz[p]), dd);
 
                     // pos + extent * sign_flip
-                    __m128 dpx = _mm_fmadd_ps(extx, sfx[p], posx);
-                    __m128 dpy = _mm_fmadd_ps(exty, sfy[p], posy);
-                    __m128 dpz = _mm_fmadd_ps(extz, sfz[p], posz);
+                    __m128 dpx = _mm_add_ps(_mm_mul_ps(extx, sfx[p]), posx);
+                    __m128 dpy = _mm_add_ps(_mm_mul_ps(exty, sfy[p]), posy);
+                    __m128 dpz = _mm_add_ps(_mm_mul_ps(extz, sfz[p]), posz);
 
                     // dot(pos + extent * sign_flip, frust.n[p]);
                     __m128 r = _mm_mul_ps(dpx, pnx[p]);
-                    r = _mm_fmadd_ps(dpy, pny[p], r);
-                    r = _mm_fmadd_ps(dpz, pnz[p], r);
+                    r = _mm_add_ps(_mm_mul_ps(dpy, pny[p]), r);
+                    r = _mm_add_ps(_mm_mul_ps(dpz, pnz[p]), r);
 
                     // if(r > -pd) inside = false
-                    __m128 ge = _mm_cmpge_ps(r, pd_neg[p]);
+                    __m128 ge = _mm_cmpgt_ps(r, pd_neg[p]);
                     inside = _mm_add_ps(ge, inside);
                 }
 
                 _mm_store_ps(result, inside);
-                for (u32 j = 0; j < 4; ++j)
+                u32 lanes = min<u32>(n - i, 4);
+                for (u32 j = 0; j < lanes; ++j)
                     if (!result[j])
-                        sb_push(*entities_out, e[3 - j]);
+                        sb_push(*entities_out, e[j]);
             }
         }
 
@@ -215,12 +286,6 @@ namespace put
         {
             const frustum& frust = cam->camera_frustum;
 
-            // pad to 4
-            u32 xn = sb_count(entities_in);
-            u32 yn = PEN_ALIGN(xn, 4);
-            for (u32 i = 0; i < yn - xn; ++i)
-                sb_push(entities_in, entities_in[0]);
-
             // sphere radius and position
             __m128 radius;
             __m128 posx;
@@ -235,7 +300,7 @@ namespace put
             // plane distance
             __m128 pd[6];
 
-            f32 result[4];
+            alignas(16) f32 result[4];
             u32 e[4];
 
             // load camera planes
@@ -251,9 +316,9 @@ namespace put
             u32 n = sb_count(entities_in);
             for (u32 i = 0; i < n; i += 4)
             {
-                // unpack entities
+                // unpack entities, the last is repeated to fill a partial batch
                 for (u32 j = 0; j < 4; ++j)
-                    e[j] = entities_in[i + j];
+                    e[j] = entities_in[min<u32>(i + j, n - 1)];
 
                 // load entities values
                 auto& p0 = scene->pos_extent[e[0]].pos;
@@ -265,11 +330,11 @@ namespace put
                 auto& r2 = scene->pos_extent[e[2]].extent;
                 auto& r3 = scene->pos_extent[e[3]].extent;
 
-                radius = _mm_set_ps(r0.w, r1.w, r2.w, r3.w);
+                radius = _mm_setr_ps(r0.w, r1.w, r2.w, r3.w);
 
-                posx = _mm_set_ps(p0.x, p1.x, p2.x, p3.x);
-                posy = _mm_set_ps(p0.y, p1.y, p2.y, p3.y);
-                posz = _mm_set_ps(p0.z, p1.z, p2.z, p3.z);
+                posx = _mm_setr_ps(p0.x, p1.x, p2.x, p3.x);
+                posy = _mm_setr_ps(p0.y, p1.y, p2.y, p3.y);
+                posz = _mm_setr_ps(p0.z, p1.z, p2.z, p3.z);
 
                 __m128 inside = _mm_set1_ps(0.0f);
 
@@ -277,20 +342,85 @@ namespace put
                 {
                     // get distance to plane
                     // dot product with plane normal and also add plane distance
-                    __m128 dd = _mm_fmadd_ps(posx, pnx[p], pd[p]);
-                    dd = _mm_fmadd_ps(posy, pny[p], dd);
-                    dd = _mm_fmadd_ps(posz, pnz[p], dd);
+                    __m128 dd = _mm_add_ps(_mm_mul_ps(posx, pnx[p]), pd[p]);
+                    dd = _mm_add_ps(_mm_mul_ps(posy, pny[p]), dd);
+                    dd = _mm_add_ps(_mm_mul_ps(posz, pnz[p]), dd);
 
                     // compare if dd is greater than radius, if so we are outside
-                    __m128 ge = _mm_cmpge_ps(dd, radius);
+                    __m128 ge = _mm_cmpgt_ps(dd, radius);
                     inside = _mm_add_ps(ge, inside);
                 }
 
                 _mm_store_ps(result, inside);
-                for (u32 j = 0; j < 4; ++j)
+                u32 lanes = min<u32>(n - i, 4);
+                for (u32 j = 0; j < lanes; ++j)
                     if (!result[j])
-                        sb_push(*entities_out, e[3 - j]);
+                        sb_push(*entities_out, e[j]);
+            }
+        }
+
+        // pos_extent is loaded 4 entities at a time and transposed, pos and extent are each a vec4f
+        static u32 filter_cull_aabb_range_simd128(const ecs_scene* scene, const cull_planes& cp, u32 start, u32 end,
+                                                  u32* out)
+        {
+            __m128 nx[6], ny[6], nz[6];
+            __m128 ax[6], ay[6], az[6];
+            __m128 d[6];
+            for (u32 p = 0; p < 6; ++p)
+            {
+                nx[p] = _mm_set1_ps(cp.n[p].x);
+                ny[p] = _mm_set1_ps(cp.n[p].y);
+                nz[p] = _mm_set1_ps(cp.n[p].z);
+                ax[p] = _mm_set1_ps(cp.abs_n[p].x);
+                ay[p] = _mm_set1_ps(cp.abs_n[p].y);
+                az[p] = _mm_set1_ps(cp.abs_n[p].z);
+                d[p] = _mm_set1_ps(cp.d[p]);
             }
+
+            u32 count = 0;
+            u32 i = start;
+            for (; i + 4 <= end; i += 4)
+            {
+                // flags first, entities which are not drawn skip the planes
+                u32 accept = 0;
+                for (u32 j = 0; j < 4; ++j)
+                    accept |= (u32)cull_accept(scene, cp, i + j) << j;
+
+                if (!accept)
+                    continue;
+
+                const f32* pe = &scene->pos_extent[i].pos.x;
+
+                __m128 px = _mm_loadu_ps(pe);
+                __m128 py = _mm_loadu_ps(pe + 8);
+                __m128 pz = _mm_loadu_ps(pe + 16);
+                __m128 pw = _mm_loadu_ps(pe + 24);
+                _MM_TRANSPOSE4_PS(px, py, pz, pw);
+
+                __m128 ex = _mm_loadu_ps(pe + 4);
+                __m128 ey = _mm_loadu_ps(pe + 12);
+                __m128 ez = _mm_loadu_ps(pe + 20);
+                __m128 ew = _mm_loadu_ps(pe + 28);
+                _MM_TRANSPOSE4_PS(ex, ey, ez, ew);
+
+                __m128 outside = _mm_setzero_ps();
+                for (u32 p = 0; p < 6; ++p)
+                {
+                    __m128 dp = _mm_add_ps(_mm_mul_ps(px, nx[p]), _mm_mul_ps(py, ny[p]));
+                    dp = _mm_add_ps(dp, _mm_mul_ps(pz, nz[p]));
+
+                    __m128 de = _mm_add_ps(_mm_mul_ps(ex, ax[p]), _mm_mul_ps(ey, ay[p]));
+                    de = _mm_add_ps(de, _mm_mul_ps(ez, az[p]));
+                    outside = _mm_or_ps(outside, _mm_cmpgt_ps(_mm_sub_ps(dp, de), d[p]));
+                }
+
+                u32 visible = accept & ~(u32)_mm_movemask_ps(outside);
+                for (u32 j = 0; j < 4; ++j)
+                    if (visible & (1 << j))
+                        out[count++] = i + j;
+            }
+
+            return count + filter_cull_aabb_range_scalar(scene, cp, i, end, out + count);
         }
 #endif
 
@@ -302,12 +432,6 @@ namespace put
         {
             const frustum& frust = cam->camera_frustum;
 
-            // pad to 8
-            u32 xn = sb_count(entities_in);
-            u32 yn = PEN_ALIGN(xn, 8);
-            for (u32 i = 0; i < yn - xn; ++i)
-                sb_push(entities_in, entities_in[0]);
-
             // splat constants
             __m256 zero = _mm256_set1_ps(0.0f);
 
@@ -325,7 +449,7 @@ namespace put
             // plane distance
             __m256 pd[6];
 
-            f32 result[8];
+            alignas(32) f32 result[8];
             u32 e[8];
 
             // load camera planes
@@ -341,9 +465,9 @@ namespace put
             u32 n = sb_count(entities_in);
             for (u32 i = 0; i < n; i += 8)
             {
-                // unpack entities
+                // unpack entities, the last is repeated to fill a partial batch
                 for (u32 j = 0; j < 8; ++j)
-                    e[j] = entities_in[i + j];
+                    e[j] = entities_in[min<u32>(i + j, n - 1)];
 
                 // load entities values
                 auto& p0 = scene->pos_extent[e[0]].pos;
@@ -363,11 +487,11 @@ namespace put
                 auto& r6 = scene->pos_extent[e[6]].extent;
                 auto& r7 = scene->pos_extent[e[7]].extent;
 
-                radius = _mm256_set_ps(r0.w, r1.w, r2.w, r3.w, r4.w, r5.w, r6.w, r7.w);
+                radius = _mm256_setr_ps(r0.w, r1.w, r2.w, r3.w, r4.w, r5.w, r6.w, r7.w);
 
-                posx = _mm256_set_ps(p0.x, p1.x, p2.x, p3.x, p4.x, p5.x, p6.x, p7.x);
-                posy = _mm256_set_ps(p0.y, p1.y, p2.y, p3.y, p4.y, p5.y, p6.y, p7.y);
-                posz = _mm256_set_ps(p0.z, p1.z, p2.z, p3.z, p4.z, p5.z, p6.z, p7.z);
+                posx = _mm256_setr_ps(p0.x, p1.x, p2.x, p3.x, p4.x, p5.x, p6.x, p7.x);
+                posy = _mm256_setr_ps(p0.y, p1.y, p2.y, p3.y, p4.y, p5.y, p6.y, p7.y);
+                posz = _mm256_setr_ps(p0.z, p1.z, p2.z, p3.z, p4.z, p5.z, p6.z, p7.z);
 
                 __m256 inside = _mm256_set1_ps(0.0f);
 
@@ -385,9 +509,10 @@ namespace put
                 }
 
                 _mm256_store_ps(result, inside);
-                for (u32 j = 0; j < 8; ++j)
+                u32 lanes = min<u32>(n - i, 8);
+                for (u32 j = 0; j < lanes; ++j)
                     if (!result[j])
-                        sb_push(*entities_out, e[7 - j]);
+                        sb_push(*entities_out, e[j]);
             }
         }
 
@@ -395,12 +520,6 @@ namespace put
         {
             const frustum& frust = cam->camera_frustum;
 
-            // pad to 8
-            u32 xn = sb_count(entities_in);
-            u32 yn = PEN_ALIGN(xn, 8);
-            for (u32 i = 0; i < yn - xn; ++i)
-                sb_push(entities_in, entities_in[0]);
-
             // splat constants
             __m256 zero = _mm256_set1_ps(0.0f);
 
@@ -426,7 +545,7 @@ namespace put
             __m256 pd[6];
             __m256 pd_neg[6];
 
-            f32 result[8];
+            alignas(32) f32 result[8];
             u32 e[8];
 
             // load camera planes
@@ -444,13 +563,12 @@ namespace put
                 sfz[p] = _mm256_set1_ps(sgn(frust.n[p].z) * -1.0f);
             }
 
-            // n is number of entities + padding for alignment
             u32 n = sb_count(entities_in);
             for (u32 i = 0; i < n; i += 8)
             {
-                // unpack entities
+                // unpack entities, the last is repeated to fill a partial batch
                 for (u32 j = 0; j < 8; ++j)
-                    e[j] = entities_in[i + j];
+                    e[j] = entities_in[min<u32>(i + j, n - 1)];
 
                 // load entities values
                 auto& p0 = scene->pos_extent[e[0]].pos;
@@ -470,12 +588,12 @@ namespace put
                 auto& e6 = scene->pos_extent[e[6]].extent;
                 auto& e7 = scene->pos_extent[e[7]].extent;
 
-                posx = _mm256_set_ps(p0.x, p1.x, p2.x, p3.x, p4.x, p5.x, p6.x, p7.x);
-                posy = _mm256_set_ps(p0.y, p1.y, p2.y, p3.y, p4.y, p5.y, p6.y, p7.y);
-                posz = _mm256_set_ps(p0.z, p1.z, p2.z, p3.z, p4.z, p5.z, p6.z, p7.z);
-                extx = _mm256_set_ps(e0.x, e1.x, e2.x, e3.x, e4.x, e5.x, e6.x, e7.x);
-                exty = _mm256_set_ps(e0.y, e1.y, e2.y, e3.y, e4.y, e5.y, e6.y, e7.y);
-                extz = _mm256_set_ps(e0.z, e1.z, e2.z, e3.z, e4.z, e5.z, e6.z, e7.z);
+                posx = _mm256_setr_ps(p0.x, p1.x, p2.x, p3.x, p4.x, p5.x, p6.x, p7.x);
+                posy = _mm256_setr_ps(p0.y, p1.y, p2.y, p3.y, p4.y, p5.y, p6.y, p7.y);
+                posz = _mm256_setr_ps(p0.z, p1.z, p2.z, p3.z, p4.z, p5.z, p6.z, p7.z);
+                extx = _mm256_setr_ps(e0.x, e1.x, e2.x, e3.x, e4.x, e5.x, e6.x, e7.x);
+                exty = _mm256_setr_ps(e0.y, e1.y, e2.y, e3.y, e4.y, e5.y, e6.y, e7.y);
+                extz = _mm256_setr_ps(e0.z, e1.z, e2.z, e3.z, e4.z, e5.z, e6.z, e7.z);
 
                 __m256 inside = _mm256_set1_ps(0.0f);
 
@@ -504,10 +622,92 @@ namespace put
                 }
 
                 _mm256_store_ps(result, inside);
-                for (u32 j = 0; j < 8; ++j)
+                u32 lanes = min<u32>(n - i, 8);
+                for (u32 j = 0; j < lanes; ++j)
                     if (!result[j])
-                        sb_push(*entities_out, e[7 - j]);
+                        sb_push(*entities_out, e[j]);
+            }
+        }
+
+        // transposes the 4x4 in each 128 bit half
+        static pen_inline void transpose_halves(__m256& r0, __m256& r1, __m256& r2, __m256& r3)
+        {
+            __m256 t0 = _mm256_unpacklo_ps(r0, r1);
+            __m256 t1 = _mm256_unpackhi_ps(r0, r1);
+            __m256 t2 = _mm256_unpacklo_ps(r2, r3);
+            __m256 t3 = _mm256_unpackhi_ps(r2, r3);
+            r0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+            r1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+            r2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+            r3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+        }
+
+        // entities 0-3 in the low half and 4-7 in the high half
+        static pen_inline __m256 load_halves(const f32* p, u32 j)
+        {
+            __m128 lo = _mm_loadu_ps(p + j * 8);
+            __m128 hi = _mm_loadu_ps(p + (j + 4) * 8);
+            return _mm256_insertf128_ps(_mm256_castps128_ps256(lo), hi, 1);
+        }
+
+        static u32 filter_cull_aabb_range_simd256(const ecs_scene* scene, const cull_planes& cp, u32 start, u32 end,
+                                                  u32* out)
+        {
+            __m256 nx[6], ny[6], nz[6];
+            __m256 ax[6], ay[6], az[6];
+            __m256 d[6];
+            for (u32 p = 0; p < 6; ++p)
+            {
+                nx[p] = _mm256_set1_ps(cp.n[p].x);
+                ny[p] = _mm256_set1_ps(cp.n[p].y);
+                nz[p] = _mm256_set1_ps(cp.n[p].z);
+                ax[p] = _mm256_set1_ps(cp.abs_n[p].x);
+                ay[p] = _mm256_set1_ps(cp.abs_n[p].y);
+                az[p] = _mm256_set1_ps(cp.abs_n[p].z);
+                d[p] = _mm256_set1_ps(cp.d[p]);
+            }
+
+            u32 count = 0;
+            u32 i = start;
+            for (; i + 8 <= end; i += 8)
+            {
+                // flags first, entities which are not drawn skip the planes
+                u32 accept = 0;
+                for (u32 j = 0; j < 8; ++j)
+                    accept |= (u32)cull_accept(scene, cp, i + j) << j;
+
+                if (!accept)
+                    continue;
+
+                const f32* pe = &scene->pos_extent[i].pos.x;
+
+                __m256 px = load_halves(pe, 0);
+                __m256 py = load_halves(pe, 1);
+                __m256 pz = load_halves(pe, 2);
+                __m256 pw = load_halves(pe, 3);
+                transpose_halves(px, py, pz, pw);
+
+                __m256 ex = load_halves(pe + 4, 0);
+                __m256 ey = load_halves(pe + 4, 1);
+                __m256 ez = load_halves(pe + 4, 2);
+                __m256 ew = load_halves(pe + 4, 3);
+                transpose_halves(ex, ey, ez, ew);
+
+                __m256 outside = _mm256_setzero_ps();
+                for (u32 p = 0; p < 6; ++p)
+                {
+                    __m256 dp = _mm256_fmadd_ps(pz, nz[p], _mm256_fmadd_ps(py, ny[p], _mm256_mul_ps(px, nx[p])));
+                    __m256 de = _mm256_fmadd_ps(ez, az[p], _mm256_fmadd_ps(ey, ay[p], _mm256_mul_ps(ex, ax[p])));
+                    outside = _mm256_or_ps(outside, _mm256_cmp_ps(_mm256_sub_ps(dp, de), d[p], _CMP_GT_OQ));
+                }
+
+                u32 visible = accept & ~(u32)_mm256_movemask_ps(outside);
+                for (u32 j = 0; j < 8; ++j)
+                    if (visible & (1 << j))
+                        out[count++] = i + j;
             }
+
+            return count + filter_cull_aabb_range_scalar(scene, cp, i, end, out + count);
         }
 #endif
         //
@@ -525,21 +725,207 @@ namespace put
 
         }
 #endif
-        void frustum_cull_simd_init()
+        typedef void (*frustum_cull_func)(const ecs_scene*, const camera*, u32*, u32**);
+        typedef u32 (*filter_cull_range_func)(const ecs_scene*, const cull_planes&, u32, u32, u32*);
+
+        static frustum_cull_func      s_frustum_cull_aabb = &frustum_cull_aabb_scalar;
+        static frustum_cull_func      s_frustum_cull_sphere = &frustum_cull_sphere_scalar;
+        static filter_cull_range_func s_filter_cull_aabb_range = &filter_cull_aabb_range_scalar;
+
+        static void frustum_cull_simd_init(bool sse, bool avx2)
         {
+            s_frustum_cull_aabb = &frustum_cull_aabb_scalar;
+            s_frustum_cull_sphere = &frustum_cull_sphere_scalar;
+            s_filter_cull_aabb_range = &filter_cull_aabb_range_scalar;
 
+#if __SSE__ || __AVX__
+            if (sse)
+            {
+                s_frustum_cull_aabb = &frustum_cull_aabb_simd128;
+                s_frustum_cull_sphere = &frustum_cull_sphere_simd128;
+                s_filter_cull_aabb_range = &filter_cull_aabb_range_simd128;
+            }
+#endif
+
+#if __AVX2__
+            if (avx2)
+            {
+                s_frustum_cull_aabb = &frustum_cull_aabb_simd256;
+                s_frustum_cull_sphere = &frustum_cull_sphere_simd256;
+                s_filter_cull_aabb_range = &filter_cull_aabb_range_simd256;
+            }
+#endif
+        }
+
+        // the build may target avx2 while the cpu running it does not support it
+        static void cpu_simd_support(bool& sse, bool& avx2)
+        {
+            sse = false;
+            avx2 = false;
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+            s32 info[4];
+            __cpuid(info, 0);
+            s32 num_ids = info[0];
+
+            __cpuid(info, 1);
+            sse = (info[3] & (1 << 25)) != 0;
+
+            // avx needs the os to save ymm registers
+            bool osxsave = (info[2] & (1 << 27)) != 0;
+            bool avx = (info[2] & (1 << 28)) != 0;
+            if (osxsave && avx && num_ids >= 7 && (_xgetbv(0) & 0x6) == 0x6)
+            {
+                __cpuidex(info, 7, 0);
+                avx2 = (info[1] & (1 << 5)) != 0;
+            }
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+            __builtin_cpu_init();
+            sse = __builtin_cpu_supports("sse2");
+            avx2 = __builtin_cpu_supports("avx2");
+#endif
+        }
+
+        void simd_init()
+        {
+            bool sse, avx2;
+            cpu_simd_support(sse, avx2);
+
+            frustum_cull_simd_init(sse, avx2);
+            transform_simd_init(sse, avx2);
+            skinning_simd_init(sse, avx2);
         }
 
         void frustum_cull_aabb(const ecs_scene* scene, const camera* cam, u32* entities_in, u32** entities_out)
         {
-            frustum_cull_aabb_scalar(scene, cam, entities_in, entities_out);
-            //frustum_cull_aabb_simd256(scene, cam, entities_in, entities_out);
+            s_frustum_cull_aabb(scene, cam, entities_in, entities_out);
         }
 
         void frustum_cull_sphere(const ecs_scene* scene, const camera* cam, u32* entities_in, u32** entities_out)
         {
-            frustum_cull_sphere_scalar(scene, cam, entities_in, entities_out);
-            //frustum_cull_sphere_simd256(scene, cam, entities_in, entities_out);
+            s_frustum_cull_sphere(scene, cam, entities_in, entities_out);
+        }
+
+        struct filter_cull_job
+        {
+            const ecs_scene*       scene;
+            const cull_planes*     planes;
+            filter_cull_range_func func;
+            u32*                   out;
+            u32*                   chunk_counts;
+        };
+
+        static void filter_cull_chunks(u32 start, u32 end, void* user_data)
+        {
+            filter_cull_job* job = (filter_cull_job*)user_data;
+            u32              num_entities = (u32)job->scene->num_entities;
+
+            for (u32 c = start; c < end; ++c)
+            {
+                u32 first = c * k_cull_chunk;
+                u32 last = min<u32>(first + k_cull_chunk, num_entities);
+                job->chunk_counts[c] = job->func(job->scene, *job->planes, first, last, job->out + first);
+            }
+        }
+
+        static void filter_frustum_cull(const ecs_scene* scene, const camera* cam, filter_cull_range_func func,
+                                        u32** entities_out)
+        {
+            if (*entities_out)
+                stb__sbn(*entities_out) = 0;
+
+            u32 num_entities = (u32)scene->num_entities;
+            if (num_entities == 0)
+                return;
+
+            cull_planes cp;
+            make_cull_planes(cam, cp);
+
+            // room for every entity, so each chunk can write at its own offset
+            sb_add(*entities_out, num_entities);
+
+            u32  num_chunks = (num_entities + k_cull_chunk - 1) / k_cull_chunk;
+            u32* chunk_counts = (u32*)memory_alloc(sizeof(u32) * num_chunks);
+
+            filter_cull_job job = {scene, &cp, func, *entities_out, chunk_counts};
+            pen::jobs_parallel_for(num_chunks, 4, filter_cull_chunks, &job);
+
+            // compact in chunk order so the result is in entity order
+            u32* out = *entities_out;
+            u32  count = chunk_counts[0];
+            for (u32 c = 1; c < num_chunks; ++c)
+            {
+                memmove(out + count, out + c * k_cull_chunk, sizeof(u32) * chunk_counts[c]);
+                count += chunk_counts[c];
+            }
+
+            stb__sbn(*entities_out) = count;
+            memory_free(chunk_counts);
+        }
+
+        void filter_frustum_cull_aabb_scalar(const ecs_scene* scene, const camera* cam, u32** entities_out)
+        {
+            filter_frustum_cull(scene, cam, &filter_cull_aabb_range_scalar, entities_out);
+        }
+
+        void filter_frustum_cull_aabb(const ecs_scene* scene, const camera* cam, u32** entities_out)
+        {
+            filter_frustum_cull(scene, cam, s_filter_cull_aabb_range, entities_out);
+        }
+
+        u32** get_cull_buffer(ecs_scene* scene, const camera* cam)
+        {
+            // temporary cameras, such as shadow cameras, can live at a different address each frame
+            static const u32 k_max_cull_views = 16;
+            static u32       s_cull_counter = 0;
+
+            cull_view* cv = nullptr;
+            cull_view* lru = nullptr;
+
+            u32 num_views = sb_count(scene->cull_views);
+            for (u32 i = 0; i < num_views; ++i)
+            {
+                cull_view& v = scene->cull_views[i];
+                if (v.cam == cam)
+                {
+                    cv = &v;
+                    break;
+                }
+
+                if (!lru || v.last_used < lru->last_used)
+                    lru = &v;
+            }
+
+            if (!cv)
+            {
+                if (num_views < k_max_cull_views)
+                {
+                    cull_view new_view;
+                    sb_push(scene->cull_views, new_view);
+                    cv = &sb_last(scene->cull_views);
+                }
+                else
+                {
+                    cv = lru;
+                }
+
+                cv->cam = cam;
+            }
+
+            cv->last_used = ++s_cull_counter;
+            if (cv->entities)
+                stb__sbn(cv->entities) = 0;
+
+            return &cv->entities;
+        }
+
+        void cull_views_clear(cull_view*& views)
+        {
+            u32 num_views = sb_count(views);
+            for (u32 i = 0; i < num_views; ++i)
+                sb_free(views[i].entities);
+
+            sb_clear(views);
         }
         
         void debug_culling()
@@ -1,3 +1,5 @@
+#pragma once
+
 #include "types.h"
 #include "camera.h"
 
@@ -9,6 +11,14 @@ namespace put
     {
         struct ecs_scene;
 
+        // visible entities for a camera, kept by the scene and reused each frame
+        struct cull_view
+        {
+            const camera* cam = nullptr;
+            u32*          entities = nullptr;
+            u32           last_used = 0; // least recently used is replaced when the scene has max_cull_views
+        };
+
         // run time detect of simd extensions and setup function pointers to the fastest implementation
         void simd_init();
         
@@ -20,6 +30,15 @@ namespace put
         // frustum_cull_xxx functions are replaced by simd where available and fall back to scalar if no simd is available
         void frustum_cull_aabb(const ecs_scene* scene, const camera* cam, u32* entities_in, u32** entities_out);
         void frustum_cull_sphere(const ecs_scene* scene, const camera* cam, u32* entities_in, u32** entities_out);
+
+        // filter renderable entities and cull their aabbs in one pass over the whole scene, entities_out is overwritten
+        // with the visible entities in entity order. large scenes are split across the job workers
+        void filter_frustum_cull_aabb_scalar(const ecs_scene* scene, const camera* cam, u32** entities_out);
+        void filter_frustum_cull_aabb(const ecs_scene* scene, const camera* cam, u32** entities_out);
+
+        // returns the empty visible entity buffer for cam, to fill with the culling functions
+        u32** get_cull_buffer(ecs_scene* scene, const camera* cam);
+        void  cull_views_clear(cull_view*& views);
     }
 }
 
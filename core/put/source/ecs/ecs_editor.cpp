@@ -817,6 +817,10 @@ namespace put
                 memcpy(cmp[node_index], ns.components[i], cmp.size);
             }
 
+            // restored components need their matrices and cbuffers updating
+            u64 dirty = e_state::transform_dirty | e_state::draw_call_dirty | e_state::material_dirty;
+            scene->state_flags[node_index] |= dirty;
+
             node_state& us = s_editor_nodes[node_index].action_state[e_editor_actions::undo];
             node_state& rs = s_editor_nodes[node_index].action_state[e_editor_actions::redo];
 
@@ -1136,6 +1140,14 @@ namespace put
                 ImGui::MenuItem("Console", nullptr, &co);
                 dev_ui::show_console(co);
 
+                bool mo = dev_ui::is_memory_stats_open();
+                ImGui::MenuItem("Memory", nullptr, &mo);
+                dev_ui::show_memory_stats(mo);
+
+                bool po = dev_ui::is_profiler_open();
+                ImGui::MenuItem("Profiler", nullptr, &po);
+                dev_ui::show_profiler(po);
+
                 ImGui::MenuItem("Settings", nullptr, &settings_open);
                 ImGui::MenuItem("Dev", nullptr, &dev_open);
 
@@ -2051,6 +2063,8 @@ namespace put
 
                             f32* f3 = &scene->material_data[si].data[cb_offset];
                             memcpy(f3, f1, tc_size);
+
+                            scene->state_flags[si] |= e_state::material_dirty;
                         }
                     }
 
@@ -2112,6 +2126,7 @@ namespace put
                     if (ImGui::Button("Reset Root Motion"))
                     {
                         scene->local_matrices[selected_index].create_identity();
+                        scene->state_flags[selected_index] |= e_state::transform_dirty;
                     }
 
                     s32 num_anims = sb_count(scene->anim_controller[selected_index].handles);
@@ -2275,6 +2290,7 @@ namespace put
                     {
                         s32 s = selected_index;
                         scene->world_matrices[s] = mat4::create_identity();
+                        scene->state_flags[s] |= e_state::transform_dirty;
                     }
                 }
                 else
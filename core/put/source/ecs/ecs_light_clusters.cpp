@@ -0,0 +1,453 @@
+// ecs_light_clusters.cpp
+// Copyright 2014 - 2019 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+#include "ecs/ecs_light_clusters.h"
+#include "ecs/ecs_scene.h"
+
+#include "data_struct.h"
+#include "renderer.h"
+#include "threads.h"
+
+#include <algorithm>
+#include <float.h>
+#include <math.h>
+#include <stddef.h>
+#include <string.h>
+
+using namespace pen;
+
+namespace
+{
+    using namespace put;
+    using namespace put::ecs;
+
+    static const u32 k_tiles_x = e_cluster_limits::tiles_x;
+    static const u32 k_tiles_y = e_cluster_limits::tiles_y;
+    static const u32 k_slices = e_cluster_limits::slices;
+    static const u32 k_num_clusters = k_tiles_x * k_tiles_y * k_slices;
+
+    // point_light_attenuation_cutoff reaches 0 at sqrt(5) * radius
+    static const f32 k_point_influence = 2.23606798f;
+
+    // matches per_pass_light_clusters in libs/globals.pmfx
+    struct cluster_buffer
+    {
+        vec4f info;                                   // tiles x, tiles y, slices, num lights
+        vec4f depth;                                  // near, slices / log(far / near)
+        u32   grid[k_num_clusters * 2];               // offset and count into indices for each cluster
+        u16   indices[e_cluster_limits::max_indices]; // read as packed pairs of 16 bit light indices
+    };
+
+    // matches per_pass_cluster_lights in libs/globals.pmfx
+    struct cluster_light_buffer
+    {
+        light_data lights[e_cluster_limits::max_lights];
+    };
+
+    // inclusive cluster bounds of a light
+    struct cluster_range
+    {
+        u8 x0, x1, y0, y1, z0, z1;
+    };
+
+    struct cluster_job
+    {
+        const cluster_range* ranges;
+        u32                  num_ranges;
+        u32*                 counts;
+        u32*                 grid;
+        u16*                 indices;
+    };
+
+    static cluster_buffer       s_cluster_buffer;
+    static cluster_light_buffer s_light_buffer;
+    static u32                  s_counts[k_num_clusters];
+    static cluster_range*       s_ranges = nullptr;
+
+    pen_inline u32 cluster_index(u32 x, u32 y, u32 z)
+    {
+        return (z * k_tiles_y + y) * k_tiles_x + x;
+    }
+
+    pen_inline u32 depth_slice(f32 d, f32 near_plane, f32 log_scale)
+    {
+        if (d <= near_plane)
+            return 0;
+
+        return min<u32>((u32)(logf(d / near_plane) * log_scale), k_slices - 1);
+    }
+
+    pen_inline u32 tile(f32 ndc, u32 num_tiles)
+    {
+        f32 t = (ndc * 0.5f + 0.5f) * (f32)num_tiles;
+        if (t <= 0.0f)
+            return 0;
+
+        return min<u32>((u32)t, num_tiles - 1);
+    }
+
+    // row major m * v, as used by the camera matrices
+    pen_inline vec4f transform(const mat4& m, const vec4f& v)
+    {
+        vec4f r;
+        r.x = m.m[0] * v.x + m.m[1] * v.y + m.m[2] * v.z + m.m[3] * v.w;
+        r.y = m.m[4] * v.x + m.m[5] * v.y + m.m[6] * v.z + m.m[7] * v.w;
+        r.z = m.m[8] * v.x + m.m[9] * v.y + m.m[10] * v.z + m.m[11] * v.w;
+        r.w = m.m[12] * v.x + m.m[13] * v.y + m.m[14] * v.z + m.m[15] * v.w;
+        return r;
+    }
+
+    // false when the sphere is outside of the view
+    bool light_cluster_range(const camera* cam, const vec4f& sphere, f32 near_plane, f32 far_plane, f32 log_scale,
+                             cluster_range& range)
+    {
+        vec4f vc = transform(cam->view, vec4f(sphere.xyz, 1.0f));
+        f32   r = sphere.w;
+        f32   d = -vc.z;
+
+        if (d + r < near_plane || d - r > far_plane)
+            return false;
+
+        range.z0 = (u8)depth_slice(d - r, near_plane, log_scale);
+        range.z1 = (u8)depth_slice(d + r, near_plane, log_scale);
+
+        // spheres crossing the near plane can project anywhere
+        if (d - r <= near_plane)
+        {
+            range.x0 = range.y0 = 0;
+            range.x1 = k_tiles_x - 1;
+            range.y1 = k_tiles_y - 1;
+            return true;
+        }
+
+        // screen bounds of the view space box around the sphere
+        f32 min_x = FLT_MAX, min_y = FLT_MAX;
+        f32 max_x = -FLT_MAX, max_y = -FLT_MAX;
+        for (u32 c = 0; c < 8; ++c)
+        {
+            vec4f corner = vc;
+            corner.x += c & 1 ? r : -r;
+            corner.y += c & 2 ? r : -r;
+            corner.z += c & 4 ? r : -r;
+
+            vec4f p = transform(cam->proj, corner);
+            f32   x = p.x / p.w;
+            f32   y = p.y / p.w;
+
+            min_x = min(min_x, x);
+            min_y = min(min_y, y);
+            max_x = max(max_x, x);
+            max_y = max(max_y, y);
+        }
+
+        if (max_x < -1.0f || min_x > 1.0f || max_y < -1.0f || min_y > 1.0f)
+            return false;
+
+        range.x0 = (u8)tile(min_x, k_tiles_x);
+        range.x1 = (u8)tile(max_x, k_tiles_x);
+        range.y0 = (u8)tile(min_y, k_tiles_y);
+        range.y1 = (u8)tile(max_y, k_tiles_y);
+        return true;
+    }
+
+    // each job owns whole slices so counts and indices are written without contention
+    void count_clusters_job(u32 start, u32 end, void* user_data)
+    {
+        cluster_job* job = (cluster_job*)user_data;
+
+        for (u32 z = start; z < end; ++z)
+        {
+            for (u32 i = 0; i < job->num_ranges; ++i)
+            {
+                const cluster_range& r = job->ranges[i];
+                if (z < r.z0 || z > r.z1)
+                    continue;
+
+                for (u32 y = r.y0; y <= r.y1; ++y)
+                    for (u32 x = r.x0; x <= r.x1; ++x)
+                        job->counts[cluster_index(x, y, z)]++;
+            }
+        }
+    }
+
+    void fill_clusters_job(u32 start, u32 end, void* user_data)
+    {
+        cluster_job* job = (cluster_job*)user_data;
+
+        for (u32 z = start; z < end; ++z)
+        {
+            u32 first = cluster_index(0, 0, z);
+            u32 last = cluster_index(0, 0, z + 1);
+
+            // counts are reused as cursors, the grid already holds the clamped totals
+            for (u32 c = first; c < last; ++c)
+                job->counts[c] = 0;
+
+            for (u32 i = 0; i < job->num_ranges; ++i)
+            {
+                const cluster_range& r = job->ranges[i];
+                if (z < r.z0 || z > r.z1)
+                    continue;
+
+                for (u32 y = r.y0; y <= r.y1; ++y)
+                {
+                    for (u32 x = r.x0; x <= r.x1; ++x)
+                    {
+                        u32 c = cluster_index(x, y, z);
+                        if (job->counts[c] == job->grid[c * 2 + 1])
+                            continue;
+
+                        job->indices[job->grid[c * 2] + job->counts[c]++] = (u16)i;
+                    }
+                }
+            }
+        }
+    }
+
+    // bounding sphere of the spot cone, apex p, direction d, length l and half angle a
+    vec4f spot_sphere(const vec3f& p, const vec3f& d, f32 l, f32 a)
+    {
+        f32 ca = cosf(a);
+        if (a > (f32)M_PI * 0.25f)
+            return vec4f(p + d * (l * ca), l * sinf(a));
+
+        f32 r = l / (2.0f * ca);
+        return vec4f(p + d * r, r);
+    }
+
+    void create_cluster_buffers(light_clusters& lc)
+    {
+        pen::buffer_creation_params bcp;
+        bcp.usage_flags = PEN_USAGE_DYNAMIC;
+        bcp.bind_flags = PEN_BIND_CONSTANT_BUFFER;
+        bcp.cpu_access_flags = PEN_CPU_ACCESS_WRITE;
+        bcp.buffer_size = sizeof(cluster_buffer);
+        bcp.data = nullptr;
+
+        lc.cluster_buffer = pen::renderer_create_buffer(bcp);
+
+        bcp.buffer_size = sizeof(cluster_light_buffer);
+        lc.light_buffer = pen::renderer_create_buffer(bcp);
+    }
+} // namespace
+
+namespace put
+{
+    namespace ecs
+    {
+        void gather_lights(ecs_scene* scene, forward_light_buffer& flb)
+        {
+            light_clusters& lc = scene->clustered_lights;
+            bool            clustered = !(scene->flags & e_scene_flags::no_light_clusters);
+
+            if (lc.lights)
+                stb__sbn(lc.lights) = 0;
+
+            if (lc.spheres)
+                stb__sbn(lc.spheres) = 0;
+
+            // forward lights are ordered by type, shadow map indices are assigned in this order by the shaders
+            static light_data* s_type_lights[3] = {nullptr};
+            for (u32 t = 0; t < 3; ++t)
+                if (s_type_lights[t])
+                    stb__sbn(s_type_lights[t]) = 0;
+
+            for (size_t n = 0; n < scene->num_entities; ++n)
+            {
+                if (!(scene->entities[n] & e_cmp::light))
+                    continue;
+
+                cmp_light&     l = scene->lights[n];
+                cmp_transform& t = scene->transforms[n];
+
+                light_data ld;
+                memset(&ld, 0x0, sizeof(light_data));
+
+                if (l.type == e_light_type::dir)
+                {
+                    // update bv and transform
+                    scene->bounding_volumes[n].min_extents = -vec3f(FLT_MAX);
+                    scene->bounding_volumes[n].max_extents = vec3f(FLT_MAX);
+
+                    // current directional light is a point light very far away
+                    // with no attenuation..
+                    bool  sm = l.flags & e_light_flags::shadow_map;
+                    vec3f light_pos = l.direction * k_dir_light_offset;
+                    ld.pos_radius = vec4f(light_pos, 0.0);
+                    ld.colour = vec4f(l.colour, sm ? 1.0 : 0.0);
+
+                    sb_push(s_type_lights[0], ld);
+                }
+                else if (l.type == e_light_type::point)
+                {
+                    // update bv and transform
+                    scene->bounding_volumes[n].min_extents = -vec3f::one();
+                    scene->bounding_volumes[n].max_extents = vec3f::one();
+
+                    f32 rad = std::max<f32>(l.radius, 1.0f) * 2.0f;
+                    scene->transforms[n].scale = vec3f(rad, rad, rad);
+                    scene->entities[n] |= e_cmp::transform;
+
+                    bool sm = l.flags & e_light_flags::omni_shadow_map;
+                    ld.pos_radius = vec4f(t.translation, l.radius);
+                    ld.colour = vec4f(l.colour, sm ? 1.0 : 0.0);
+
+                    if (clustered && !sm)
+                    {
+                        sb_push(lc.lights, ld);
+                        sb_push(lc.spheres, vec4f(t.translation, l.radius * k_point_influence));
+                        continue;
+                    }
+
+                    sb_push(s_type_lights[1], ld);
+                }
+                else if (l.type == e_light_type::spot)
+                {
+                    // update bv and transform
+                    scene->bounding_volumes[n].min_extents = -vec3f::one();
+                    scene->bounding_volumes[n].max_extents = vec3f(1.0f, 0.0f, 1.0f);
+
+                    f32 angle = acos(1.0f - l.cos_cutoff);
+                    f32 lo = tan(angle);
+                    f32 range = l.radius;
+
+                    scene->transforms[n].scale = vec3f(lo * range, range, lo * range);
+                    scene->entities[n] |= e_cmp::transform;
+
+                    vec3f dir = normalized(-scene->world_matrices[n].get_column(1).xyz);
+
+                    bool sm = l.flags & e_light_flags::shadow_map;
+                    ld.pos_radius = vec4f(t.translation, l.radius);
+                    ld.dir_cutoff = vec4f(dir, l.cos_cutoff);
+                    ld.colour = vec4f(l.colour, sm ? 1.0 : 0.0);
+                    ld.data = vec4f(l.spot_falloff, 0.0f, 0.0f, 0.0f);
+
+                    if (clustered && !sm)
+                    {
+                        sb_push(lc.lights, ld);
+                        sb_push(lc.spheres, spot_sphere(t.translation, dir, range, angle));
+                        continue;
+                    }
+
+                    sb_push(s_type_lights[2], ld);
+                }
+            }
+
+            // info for loops
+            u32 pos = 0;
+            f32 type_count[3] = {0.0f};
+            for (u32 ty = 0; ty < 3; ++ty)
+            {
+                u32 nl = sb_count(s_type_lights[ty]);
+                for (u32 i = 0; i < nl && pos < e_scene_limits::max_forward_lights; ++i)
+                {
+                    flb.lights[pos++] = s_type_lights[ty][i];
+                    type_count[ty] += 1.0f;
+                }
+            }
+
+            flb.info = vec4f(type_count[0], type_count[1], type_count[2], 0.0f);
+        }
+
+        void build_light_clusters(ecs_scene* scene, const camera* cam)
+        {
+            light_clusters& lc = scene->clustered_lights;
+
+            if (!is_valid(lc.cluster_buffer))
+                create_cluster_buffers(lc);
+
+            // exponential slices, orthographic views still slice by view depth
+            f32 near_plane = max(cam->near_plane, 0.01f);
+            f32 far_plane = max(cam->far_plane, near_plane + 1.0f);
+            f32 log_scale = (f32)k_slices / logf(far_plane / near_plane);
+
+            if (s_ranges)
+                stb__sbn(s_ranges) = 0;
+
+            lc.num_visible = 0;
+            lc.num_dropped = 0;
+
+            u32 num_lights = sb_count(lc.lights);
+            for (u32 i = 0; i < num_lights; ++i)
+            {
+                cluster_range r;
+                if (!light_cluster_range(cam, lc.spheres[i], near_plane, far_plane, log_scale, r))
+                    continue;
+
+                if (lc.num_visible == e_cluster_limits::max_lights)
+                {
+                    lc.num_dropped++;
+                    continue;
+                }
+
+                sb_push(s_ranges, r);
+                s_light_buffer.lights[lc.num_visible++] = lc.lights[i];
+            }
+
+            memset(s_counts, 0x0, sizeof(s_counts));
+
+            cluster_job job;
+            job.ranges = s_ranges;
+            job.num_ranges = lc.num_visible;
+            job.counts = s_counts;
+            job.grid = s_cluster_buffer.grid;
+            job.indices = s_cluster_buffer.indices;
+
+            if (lc.num_visible > 0)
+                pen::jobs_parallel_for(k_slices, 1, count_clusters_job, &job);
+
+            // offsets, when the index list would overflow every cluster gives up the same share of its lights
+            u32 requested = 0;
+            for (u32 c = 0; c < k_num_clusters; ++c)
+                requested += s_counts[c];
+
+            f32 share = 1.0f;
+            if (requested > e_cluster_limits::max_indices)
+                share = (f32)e_cluster_limits::max_indices / (f32)requested;
+
+            u32 total = 0;
+            for (u32 c = 0; c < k_num_clusters; ++c)
+            {
+                u32 count = min<u32>((u32)((f32)s_counts[c] * share), e_cluster_limits::max_indices - total);
+                lc.num_dropped += s_counts[c] - count;
+
+                s_cluster_buffer.grid[c * 2 + 0] = total;
+                s_cluster_buffer.grid[c * 2 + 1] = count;
+                total += count;
+            }
+
+            if (total > 0)
+                pen::jobs_parallel_for(k_slices, 1, fill_clusters_job, &job);
+
+            s_cluster_buffer.info = vec4f((f32)k_tiles_x, (f32)k_tiles_y, (f32)k_slices, (f32)lc.num_visible);
+            s_cluster_buffer.depth = vec4f(near_plane, log_scale, 0.0f, 0.0f);
+
+            // only the used part of the index list and lights is uploaded
+            u32 index_bytes = ((total * sizeof(u16)) + 15) & ~15;
+            u32 cluster_bytes = (u32)offsetof(cluster_buffer, indices) + index_bytes;
+            pen::renderer_update_buffer(lc.cluster_buffer, &s_cluster_buffer, cluster_bytes);
+
+            if (lc.num_visible > 0)
+                pen::renderer_update_buffer(lc.light_buffer, &s_light_buffer, sizeof(light_data) * lc.num_visible);
+
+            pen::renderer_set_constant_buffer(lc.cluster_buffer, 12, pen::CBUFFER_BIND_PS);
+            pen::renderer_set_constant_buffer(lc.light_buffer, 13, pen::CBUFFER_BIND_PS);
+        }
+
+        void light_clusters_clear(light_clusters& lc)
+        {
+            sb_clear(lc.lights);
+            sb_clear(lc.spheres);
+
+            if (is_valid(lc.cluster_buffer))
+                pen::renderer_release_buffer(lc.cluster_buffer);
+
+            if (is_valid(lc.light_buffer))
+                pen::renderer_release_buffer(lc.light_buffer);
+
+            lc.cluster_buffer = PEN_INVALID_HANDLE;
+            lc.light_buffer = PEN_INVALID_HANDLE;
+        }
+    } // namespace ecs
+} // namespace put
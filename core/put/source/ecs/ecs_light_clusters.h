@@ -0,0 +1,54 @@
+// ecs_light_clusters.h
+// Copyright 2014 - 2019 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+// Clustered forward lighting. Lights are gathered from the scene in a single pass, directional lights and lights which
+// cast shadows stay in the forward_light_buffer where their shadow map indices are assigned in order. The remaining
+// point and spot lights are assigned per view to a froxel grid of screen tiles and exponential depth slices, each
+// pixel then only loops over the lights which touch its cluster. Assignment is split across the job workers by slice.
+
+#pragma once
+
+#include "camera.h"
+#include "types.h"
+
+namespace put
+{
+    namespace ecs
+    {
+        struct ecs_scene;
+        struct light_data;
+        struct forward_light_buffer;
+
+        namespace e_cluster_limits
+        {
+            enum cluster_limits_t
+            {
+                tiles_x = 16,
+                tiles_y = 8,
+                slices = 16,
+                max_lights = 1023,  // per view, the lights cbuffer is 64kb
+                max_indices = 24000 // per view, 16 bit indices share a 64kb cbuffer with the grid
+            };
+        }
+
+        struct light_clusters
+        {
+            light_data* lights = nullptr;  // point and spot lights without shadows, gathered by gather_lights
+            vec4f*      spheres = nullptr; // world space sphere of influence for each of lights
+            u32         cluster_buffer = PEN_INVALID_HANDLE;
+            u32         light_buffer = PEN_INVALID_HANDLE;
+            u32         num_visible = 0; // lights assigned by the last build
+            u32         num_dropped = 0; // visible lights or indices which did not fit the limits in the last build
+        };
+
+        // single pass over the scene, fills flb with directional and shadowed lights, or every light when
+        // e_scene_flags::no_light_clusters is set, and the scene light_clusters with the rest
+        void gather_lights(ecs_scene* scene, forward_light_buffer& flb);
+
+        // assigns lights to the clusters of cam, uploads and binds the cluster cbuffers (b12 and b13)
+        void build_light_clusters(ecs_scene* scene, const camera* cam);
+
+        void light_clusters_clear(light_clusters& lc);
+    } // namespace ecs
+} // namespace put
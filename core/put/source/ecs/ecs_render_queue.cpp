@@ -0,0 +1,384 @@
+// ecs_render_queue.cpp
+// Copyright 2014 - 2019 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+#include "ecs/ecs_render_queue.h"
+#include "ecs/ecs_scene.h"
+
+#include "data_struct.h"
+#include "renderer.h"
+
+#include <algorithm>
+#include <float.h>
+#include <string.h>
+
+using namespace pen;
+
+namespace
+{
+    using namespace put;
+    using namespace put::ecs;
+
+    // key layouts, most significant first
+    // opaque: shader 16 | textures 12 | geometry 12 | depth 16 front to back | 8 unused
+    // alpha blended: depth 16 back to front | shader 16 | textures 12 | geometry 12 | 8 unused
+    static const u32 k_shader_bits = 16;
+    static const u32 k_texture_bits = 12;
+    static const u32 k_geometry_bits = 12;
+    static const u32 k_depth_bits = 16;
+
+    pen_inline u64 fold(u32 v, u32 bits)
+    {
+        v ^= v >> 16;
+        v *= 0x7feb352d;
+        v ^= v >> 15;
+        v *= 0x846ca68b;
+        v ^= v >> 16;
+        return v & ((1 << bits) - 1);
+    }
+
+    pen_inline u32 combine(u32 h, u32 v)
+    {
+        return (h ^ v) * 0x01000193;
+    }
+
+    // matches the geometry selection in render_scene_view
+    const cmp_geometry& view_geometry(const ecs_scene* scene, const pmfx::scene_view& view, u32 n)
+    {
+        if (!(scene->entities[n] & e_cmp::skinned))
+            if (view.render_flags & pmfx::e_scene_render_flags::shadow_map)
+                return scene->position_geometries[n];
+
+        return scene->geometries[n];
+    }
+
+    // matches the technique selection in render_scene_view
+    u32 shader_state(const ecs_scene* scene, const pmfx::scene_view& view, u32 n)
+    {
+        u32 shader = scene->materials[n].shader;
+        u32 technique = scene->materials[n].technique_index;
+        if (is_valid(view.pmfx_shader))
+        {
+            shader = view.pmfx_shader;
+            technique = view.id_technique;
+        }
+
+        // entities sharing a material are adjacent so they can be instanced
+        u32 h = combine(0x811c9dc5, shader);
+        h = combine(h, technique);
+        h = combine(h, scene->id_material[n]);
+        return combine(h, scene->material_permutation[n]);
+    }
+
+    u32 texture_state(const ecs_scene* scene, u32 n)
+    {
+        const cmp_samplers& samplers = scene->samplers[n];
+
+        u32 h = 0x811c9dc5;
+        for (u32 s = 0; s < e_pmfx_constants::max_technique_sampler_bindings; ++s)
+        {
+            h = combine(h, samplers.sb[s].handle);
+            h = combine(h, samplers.sb[s].sampler_state);
+            h = combine(h, samplers.sb[s].sampler_unit);
+        }
+
+        return h;
+    }
+
+    u32 geometry_state(const ecs_scene* scene, const pmfx::scene_view& view, u32 n)
+    {
+        const cmp_geometry& geom = view_geometry(scene, view, n);
+        return combine(combine(0x811c9dc5, geom.vertex_buffer), geom.index_buffer);
+    }
+
+    bool can_instance(const ecs_scene* scene, u32 n)
+    {
+        static const u64 k_excluded = e_cmp::skinned | e_cmp::master_instance | e_cmp::sub_instance;
+        if (scene->entities[n] & k_excluded)
+            return false;
+
+        return !(scene->material_permutation[n] & e_shader_permutation::instanced);
+    }
+
+    // entities a and b would render identically apart from their draw call data
+    bool same_instance_state(const ecs_scene* scene, const pmfx::scene_view& view, u32 a, u32 b)
+    {
+        if (scene->material_permutation[a] != scene->material_permutation[b])
+            return false;
+
+        if (!is_valid(view.pmfx_shader))
+        {
+            if (scene->materials[a].shader != scene->materials[b].shader)
+                return false;
+
+            if (scene->materials[a].technique_index != scene->materials[b].technique_index)
+                return false;
+        }
+
+        const cmp_geometry& ga = view_geometry(scene, view, a);
+        const cmp_geometry& gb = view_geometry(scene, view, b);
+        if (ga.vertex_buffer != gb.vertex_buffer || ga.index_buffer != gb.index_buffer)
+            return false;
+
+        if (ga.num_indices != gb.num_indices || ga.vertex_size != gb.vertex_size || ga.index_type != gb.index_type)
+            return false;
+
+        for (u32 s = 0; s < e_pmfx_constants::max_technique_sampler_bindings; ++s)
+        {
+            const sampler_binding& sa = scene->samplers[a].sb[s];
+            const sampler_binding& sb = scene->samplers[b].sb[s];
+            if (sa.handle != sb.handle || sa.sampler_state != sb.sampler_state || sa.sampler_unit != sb.sampler_unit)
+                return false;
+        }
+
+        // material cbuffers are per entity, only the first in a batch is bound so the contents must match
+        u32 cbuffer_size = scene->materials[a].material_cbuffer_size;
+        if (cbuffer_size != scene->materials[b].material_cbuffer_size)
+            return false;
+
+        cbuffer_size = min<u32>(cbuffer_size, sizeof(cmp_material_data));
+        return memcmp(scene->material_data[a].data, scene->material_data[b].data, cbuffer_size) == 0;
+    }
+
+    u32 instanced_technique(const ecs_scene* scene, const pmfx::scene_view& view, u32 n)
+    {
+        u32 permutation = scene->material_permutation[n] | e_shader_permutation::instanced;
+
+        u32 shader = scene->materials[n].shader;
+        u32 ti = PEN_INVALID_HANDLE;
+        if (is_valid(view.pmfx_shader))
+        {
+            shader = view.pmfx_shader;
+            ti = pmfx::get_technique_index_perm(shader, view.id_technique, permutation);
+        }
+        else
+        {
+            ti = pmfx::get_technique_index_perm(shader, scene->material_resources[n].id_technique, permutation);
+        }
+
+        if (!is_valid(ti))
+            return PEN_INVALID_HANDLE;
+
+        // techniques without an instanced option ignore the bit and match the non instanced version
+        if (!(pmfx::get_technique_permutation_id(shader, ti) & e_shader_permutation::instanced))
+            return PEN_INVALID_HANDLE;
+
+        return ti;
+    }
+
+    pen_inline f32 view_depth(const ecs_scene* scene, const mat4& view, u32 n)
+    {
+        // view space z of the bounds centre, negated so increasing values are further from the camera
+        const vec4f& p = scene->pos_extent[n].pos;
+        return -(view.m[8] * p.x + view.m[9] * p.y + view.m[10] * p.z + view.m[11]);
+    }
+} // namespace
+
+namespace put
+{
+    namespace ecs
+    {
+        void radix_sort(draw_item*& items, draw_item*& scratch, u32 count)
+        {
+            if (count < 2)
+                return;
+
+            if (scratch)
+                stb__sbn(scratch) = 0;
+
+            sb_add(scratch, count);
+
+            // all 8 histograms in one pass
+            u32 hist[8][256];
+            memset(hist, 0x0, sizeof(hist));
+
+            for (u32 i = 0; i < count; ++i)
+            {
+                u64 k = items[i].key;
+                for (u32 b = 0; b < 8; ++b)
+                    hist[b][(k >> (b * 8)) & 0xff]++;
+            }
+
+            for (u32 b = 0; b < 8; ++b)
+            {
+                u32 shift = b * 8;
+
+                // every key has the same byte, nothing to do
+                if (hist[b][(items[0].key >> shift) & 0xff] == count)
+                    continue;
+
+                u32 offset = 0;
+                for (u32 d = 0; d < 256; ++d)
+                {
+                    u32 c = hist[b][d];
+                    hist[b][d] = offset;
+                    offset += c;
+                }
+
+                for (u32 i = 0; i < count; ++i)
+                {
+                    u32 d = (items[i].key >> shift) & 0xff;
+                    scratch[hist[b][d]++] = items[i];
+                }
+
+                std::swap(items, scratch);
+            }
+        }
+
+        void render_queue_build(render_queue& rq, const ecs_scene* scene, const pmfx::scene_view& view,
+                                const u32* entities, u32 count)
+        {
+            if (rq.items)
+                stb__sbn(rq.items) = 0;
+
+            if (count == 0)
+                return;
+
+            sb_add(rq.items, count);
+
+            // depth is quantised over the range of the visible set
+            const mat4& view_mat = view.camera->view;
+            f32         dmin = FLT_MAX;
+            f32         dmax = -FLT_MAX;
+            for (u32 i = 0; i < count; ++i)
+            {
+                f32 d = view_depth(scene, view_mat, entities[i]);
+                dmin = min(dmin, d);
+                dmax = max(dmax, d);
+            }
+
+            f32  range = dmax - dmin;
+            f32  scale = range > 0.0f ? (f32)((1 << k_depth_bits) - 1) / range : 0.0f;
+            bool alpha = view.render_flags & pmfx::e_scene_render_flags::alpha_blended;
+
+            for (u32 i = 0; i < count; ++i)
+            {
+                u32 n = entities[i];
+
+                u64 shader = fold(shader_state(scene, view, n), k_shader_bits);
+                u64 textures = fold(texture_state(scene, n), k_texture_bits);
+                u64 geometry = fold(geometry_state(scene, view, n), k_geometry_bits);
+                u64 depth = min<u64>((u64)((view_depth(scene, view_mat, n) - dmin) * scale), (1 << k_depth_bits) - 1);
+
+                u64 state = (shader << (k_texture_bits + k_geometry_bits)) | (textures << k_geometry_bits) | geometry;
+
+                u64 key;
+                if (alpha)
+                {
+                    u64 back_to_front = ((1 << k_depth_bits) - 1) - depth;
+                    key = (back_to_front << 48) | (state << 8);
+                }
+                else
+                {
+                    key = (state << 24) | (depth << 8);
+                }
+
+                rq.items[i].key = key;
+                rq.items[i].entity = n;
+            }
+
+            radix_sort(rq.items, rq.scratch, count);
+        }
+
+        void render_queue_build_batches(render_queue& rq, const ecs_scene* scene, const pmfx::scene_view& view,
+                                        bool instancing)
+        {
+            if (rq.batches)
+                stb__sbn(rq.batches) = 0;
+
+            if (rq.instances)
+                stb__sbn(rq.instances) = 0;
+
+            u32 count = sb_count(rq.items);
+            for (u32 i = 0; i < count;)
+            {
+                u32 n = rq.items[i].entity;
+
+                draw_batch b;
+                b.start = i;
+                b.count = 1;
+                b.technique = PEN_INVALID_HANDLE;
+                b.instance_offset = 0;
+
+                if (instancing && can_instance(scene, n))
+                {
+                    u32 end = i + 1;
+                    while (end < count && can_instance(scene, rq.items[end].entity) &&
+                           same_instance_state(scene, view, n, rq.items[end].entity))
+                        ++end;
+
+                    u32 run = end - i;
+                    if (run > 1)
+                    {
+                        // without an instanced technique the run is drawn one entity at a time
+                        u32 ti = instanced_technique(scene, view, n);
+                        if (is_valid(ti))
+                        {
+                            b.count = run;
+                            b.technique = ti;
+                            b.instance_offset = sb_count(rq.instances);
+
+                            cmp_draw_call* dst = sb_add(rq.instances, run);
+                            for (u32 j = 0; j < run; ++j)
+                                dst[j] = scene->draw_call_data[rq.items[i + j].entity];
+                        }
+                    }
+                }
+
+                sb_push(rq.batches, b);
+                i += b.count;
+            }
+
+            // one upload per view, batches bind the stream at their instance_offset
+            u32 num_instances = sb_count(rq.instances);
+            if (num_instances == 0)
+                return;
+
+            if (num_instances > rq.instance_capacity)
+            {
+                if (is_valid(rq.instance_buffer))
+                    pen::renderer_release_buffer(rq.instance_buffer);
+
+                rq.instance_capacity = max<u32>(num_instances, rq.instance_capacity * 2);
+
+                pen::buffer_creation_params bcp;
+                bcp.usage_flags = PEN_USAGE_DYNAMIC;
+                bcp.bind_flags = PEN_BIND_VERTEX_BUFFER;
+                bcp.buffer_size = sizeof(cmp_draw_call) * rq.instance_capacity;
+                bcp.data = nullptr;
+                bcp.cpu_access_flags = PEN_CPU_ACCESS_WRITE;
+
+                rq.instance_buffer = pen::renderer_create_buffer(bcp);
+            }
+
+            pen::renderer_update_buffer(rq.instance_buffer, rq.instances, sizeof(cmp_draw_call) * num_instances);
+        }
+
+        void render_queue_clear(render_queue& rq)
+        {
+            sb_clear(rq.items);
+            sb_clear(rq.scratch);
+            sb_clear(rq.batches);
+            sb_clear(rq.instances);
+
+            if (is_valid(rq.instance_buffer))
+                pen::renderer_release_buffer(rq.instance_buffer);
+
+            rq.instance_buffer = PEN_INVALID_HANDLE;
+            rq.instance_capacity = 0;
+        }
+
+        view_render_stats& get_view_render_stats(ecs_scene* scene, hash_id id_view)
+        {
+            u32 num_views = sb_count(scene->view_stats);
+            for (u32 i = 0; i < num_views; ++i)
+                if (scene->view_stats[i].id_view == id_view)
+                    return scene->view_stats[i];
+
+            view_render_stats vs;
+            vs.id_view = id_view;
+            sb_push(scene->view_stats, vs);
+            return sb_last(scene->view_stats);
+        }
+    } // namespace ecs
+} // namespace put
@@ -0,0 +1,74 @@
+// ecs_render_queue.h
+// Copyright 2014 - 2019 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+// Sorted draw list for the visible entities of a view. Each entity gets a 64 bit key made of its shader, technique and
+// permutation, textures, geometry and depth, the keys are radix sorted so draws which share state are submitted
+// together. Opaque views sort by state and then front to back, alpha blended views sort back to front first.
+// Keys only decide the order, the state fields are hashed to fit so submission still compares the real state.
+// Runs of sorted items with the same geometry, material, samplers and permutation are batched and drawn with a single
+// instanced draw, their draw call data is packed into a per frame instance stream. Runs whose shader technique has no
+// instanced permutation are drawn one entity at a time.
+
+#pragma once
+
+#include "pmfx.h"
+#include "types.h"
+
+namespace put
+{
+    namespace ecs
+    {
+        struct ecs_scene;
+        struct cmp_draw_call;
+
+        struct draw_item
+        {
+            u64 key;
+            u32 entity;
+        };
+
+        // consecutive items drawn together, a single entity is a batch of 1
+        struct draw_batch
+        {
+            u32 start;
+            u32 count;
+            u32 technique;       // instanced technique index, invalid when the items are drawn one at a time
+            u32 instance_offset; // first instance of the batch in the instance stream
+        };
+
+        struct render_queue
+        {
+            draw_item*     items = nullptr;
+            draw_item*     scratch = nullptr; // radix sort ping pong
+            draw_batch*    batches = nullptr;
+            cmp_draw_call* instances = nullptr;
+            u32            instance_buffer = PEN_INVALID_HANDLE;
+            u32            instance_capacity = 0;
+        };
+
+        // counts from the last render of each view
+        struct view_render_stats
+        {
+            hash_id id_view = 0;
+            u32     entities = 0;
+            u32     draw_calls = 0;
+            u32     state_changes = 0; // binds issued by the view, redundant binds are skipped
+            u32     instanced = 0;     // entities drawn as part of an instanced batch
+        };
+
+        // fills rq.items with sorted keys for entities, which must be valid for the scene
+        void render_queue_build(render_queue& rq, const ecs_scene* scene, const pmfx::scene_view& view,
+                                const u32* entities, u32 count);
+
+        // groups the sorted items into batches and uploads the instance stream, instancing false gives a batch per item
+        void render_queue_build_batches(render_queue& rq, const ecs_scene* scene, const pmfx::scene_view& view,
+                                        bool instancing);
+        void render_queue_clear(render_queue& rq);
+
+        // stable sort of items by key, scratch is resized to match and the pointers may be swapped
+        void radix_sort(draw_item*& items, draw_item*& scratch, u32 count);
+
+        view_render_stats& get_view_render_stats(ecs_scene* scene, hash_id id_view);
+    } // namespace ecs
+} // namespace put
@@ -299,7 +299,6 @@ namespace
                 if (sm.skinned)
                 {
                     p_geometry->p_skin = (cmp_skin*)pen::memory_alloc(sizeof(cmp_skin));
-                    p_geometry->p_skin->bone_cbuffer = PEN_INVALID_HANDLE;
                     p_geometry->p_skin->bind_shape_matrix = sm.bind_shape_matrix;
                     p_geometry->p_skin->num_joints = sm.num_joint_floats / k_matrix_floats;
                     memset(p_geometry->p_skin->joint_bind_matrices, 0x0, sizeof(p_geometry->p_skin->joint_bind_matrices));
@@ -964,6 +963,7 @@ namespace put
             bv->min_extents = gr->min_extents;
             bv->max_extents = gr->max_extents;
             bv->radius = mag(bv->max_extents - bv->min_extents) * 0.5f;
+            scene->state_flags[node_index] |= e_state::transform_dirty;
 
             scene->geometry_names[node_index] = gr->geometry_name;
             scene->id_geometry[node_index] = gr->hash;
@@ -1048,6 +1048,7 @@ namespace put
             bcp.data = nullptr;
 
             scene->cbuffer[node_index] = pen::renderer_create_buffer(bcp);
+            scene->state_flags[node_index] |= e_state::draw_call_dirty;
         }
 
         void instantiate_model_pre_skin(ecs_scene* scene, s32 node_index)
@@ -1310,6 +1311,7 @@ namespace put
             }
 
             instantiate_material_cbuffer(scene, node_index, cbuffer_size);
+            scene->state_flags[node_index] |= e_state::material_dirty;
 
             // material samplers
             if (!(scene->state_flags[node_index] & e_state::samplers_initialised))
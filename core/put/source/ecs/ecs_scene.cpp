@@ -2,6 +2,7 @@
 // Copyright 2014 - 2019 Alex Dixon.
 // License: https://github.com/polymonster/pmtech/blob/master/license.md
 
+#include <algorithm>
 #include <fstream>
 #include <functional>
 
@@ -13,8 +14,10 @@
 #include "hash.h"
 #include "os.h"
 #include "pmfx.h"
+#include "profiler.h"
 #include "str/Str.h"
 #include "str_utilities.h"
+#include "threads.h"
 #include "timer.h"
 #include "input.h"
 
@@ -87,6 +90,13 @@ namespace put
                 generic_cmp_array& cmp = scene->get_component_array(i);
                 u32                alloc_size = cmp.size * new_size;
 
+                // pooled components only grow their slot tables, new slots read as zero
+                if (cmp.pool)
+                {
+                    cmp_pool_resize(cmp.pool, new_size);
+                    continue;
+                }
+
                 if (cmp.data)
                 {
                     // realloc
@@ -102,7 +112,7 @@ namespace put
                 }
 
                 // alloc and zero
-                cmp.data = pen::memory_alloc(alloc_size);
+                cmp.data = pen::memory_alloc(alloc_size, pen::e_mem_tag::ecs);
                 pen::memory_zero(cmp.data, alloc_size);
             }
 
@@ -126,12 +136,26 @@ namespace put
             for (u32 i = 0; i < scene->num_components; ++i)
             {
                 generic_cmp_array& cmp = scene->get_component_array(i);
+                if (cmp.pool)
+                    cmp_pool_clear(cmp.pool);
+
                 pen::memory_free(cmp.data);
                 cmp.data = nullptr;
             }
 
             scene->soa_size = 0;
             scene->num_entities = 0;
+
+            if (!cmp_mem_only)
+            {
+                bvh_clear(scene->spatial_index);
+                transform_hierarchy_clear(scene->hierarchy);
+                cull_views_clear(scene->cull_views);
+                render_queue_clear(scene->draw_queue);
+                light_clusters_clear(scene->clustered_lights);
+                skin_palettes_clear(scene->bone_palettes);
+                sb_clear(scene->view_stats);
+            }
         }
 
         void zero_entity_components(ecs_scene* scene, u32 node_index)
@@ -139,12 +163,19 @@ namespace put
             for (u32 i = 0; i < scene->num_components; ++i)
             {
                 generic_cmp_array& cmp = scene->get_component_array(i);
-                u8*                offset = (u8*)cmp.data + node_index * cmp.size;
+                if (cmp.pool)
+                {
+                    cmp_pool_release(cmp.pool, node_index);
+                    continue;
+                }
+
+                u8* offset = (u8*)cmp.data + node_index * cmp.size;
                 pen::memory_zero(offset, cmp.size);
             }
 
             // Annoyingly nodeindex == parent is used to determine if a node is not a child
             scene->parents[node_index] = node_index;
+            scene->flags |= e_scene_flags::invalidate_transforms;
         }
 
         void delete_entity(ecs_scene* scene, u32 node_index)
@@ -178,8 +209,11 @@ namespace put
                     pen::renderer_release_buffer(scene->pre_skin[node_index].position_buffer);
             }
 
-            if (scene->master_instances[node_index].instance_buffer)
-                pen::renderer_release_buffer(scene->master_instances[node_index].instance_buffer);
+            if (scene->entities[node_index] & e_cmp::master_instance)
+            {
+                if (scene->master_instances[node_index].instance_buffer)
+                    pen::renderer_release_buffer(scene->master_instances[node_index].instance_buffer);
+            }
         }
 
         void delete_entity_second_pass(ecs_scene* scene, u32 node_index)
@@ -204,6 +238,12 @@ namespace put
             for (u32 i = 0; i < scene->num_components; ++i)
             {
                 generic_cmp_array& cmp = scene->get_component_array(i);
+                if (cmp.pool)
+                {
+                    cmp_pool_copy(cmp.pool, dst, src);
+                    continue;
+                }
+
                 memcpy(cmp[dst], cmp[src], cmp.size);
             }
         }
@@ -237,6 +277,8 @@ namespace put
             {
                 if (dst >= scene->num_entities)
                     scene->num_entities = dst + 1;
+
+                scene->flags |= e_scene_flags::invalidate_transforms;
             }
 
             ecs_scene* p_sn = scene;
@@ -295,11 +337,16 @@ namespace put
                 zero_entity_components(scene, src);
             }
 
+            // draw call data stores the entity index and the buffers may be new
+            p_sn->state_flags[dst] |= e_state::draw_call_dirty | e_state::material_dirty;
+
             return dst;
         }
         
         void init()
         {
+            simd_init();
+
             // create view renderers
             put::scene_view_renderer svr_main;
             svr_main.name = "ecs_render_scene";
@@ -404,6 +451,7 @@ namespace put
         void destroy_scene(ecs_scene* scene)
         {
             free_scene_buffers(scene);
+            set_chunked_storage(scene, false);
 
             // todo release resource refs
             // geom
@@ -839,143 +887,167 @@ namespace put
             pen::renderer_set_texture(0, 0, 2, pen::TEXTURE_BIND_CS);
         }
         
-        void render_scene_view(const scene_view& view)
+        // draw loops with fewer batches than this per cmd list are recorded on the calling thread
+        static const u32 k_batches_per_cmd_list = 256;
+        static const u32 k_max_draw_cmd_lists = 16;
+        static const u32 k_tracked_units = e_pmfx_constants::max_sampler_bindings;
+
+        struct draw_counts
         {
-            // PEN_PERF_SCOPE_PRINT(render_scene_view);
-            
-            ecs_scene* scene = view.scene;
-            if (scene->view_flags & e_scene_view_flags::hide)
-                return;
-            
-            // view
-            pen::renderer_set_constant_buffer(view.cb_view, 0, pen::CBUFFER_BIND_PS | pen::CBUFFER_BIND_VS);
+            u32 state_changes = 0;
+            u32 draw_calls = 0;
+            u32 instanced = 0;
+        };
 
-            // fwd lights
-            if (view.render_flags & pmfx::e_scene_render_flags::forward_lit)
-            {
-                pen::renderer_set_constant_buffer(scene->forward_light_buffer, 3, pen::CBUFFER_BIND_PS);
-                pen::renderer_set_constant_buffer(scene->shadow_map_buffer, 4, pen::CBUFFER_BIND_PS);
-                pen::renderer_set_constant_buffer(scene->area_light_buffer, 6, pen::CBUFFER_BIND_PS);
+        struct batch_technique
+        {
+            u32  shader;
+            u32  technique;   // index when by_index, otherwise the technique id to specialise by permutation
+            u32  permutation;
+            bool by_index;
+        };
 
-                // ltc lookups
-                static u32 ltc_mat = put::load_texture("data/textures/ltc/ltc_mat.dds");
-                static u32 ltc_mag = put::load_texture("data/textures/ltc/ltc_amp.dds");
+        static batch_technique get_batch_technique(const scene_view& view, const render_queue& rq, const draw_batch& batch)
+        {
+            const ecs_scene* scene = view.scene;
+            u32              n = rq.items[batch.start].entity;
+            bool             batched = is_valid(batch.technique);
 
-                static hash_id id_clamp_linear = PEN_HASH("clamp_linear");
-                u32            clamp_linear = pmfx::get_render_state(id_clamp_linear, pmfx::e_render_state::sampler);
+            // per entity material, or per pass material with permutation specialisation (instanced, skinned etc)
+            bool per_pass = is_valid(view.pmfx_shader);
 
-                pen::renderer_set_texture(ltc_mat, clamp_linear, 13, pen::TEXTURE_BIND_PS);
-                pen::renderer_set_texture(ltc_mag, clamp_linear, 12, pen::TEXTURE_BIND_PS);
+            batch_technique bt;
+            bt.shader = per_pass ? view.pmfx_shader : scene->materials[n].shader;
+            bt.technique = per_pass ? view.id_technique : scene->materials[n].technique_index;
+            bt.permutation = scene->material_permutation[n];
+            bt.by_index = !per_pass || batched;
+
+            // instanced batches use the resolved instanced technique index
+            if (batched)
+            {
+                bt.technique = batch.technique;
+                bt.permutation |= e_shader_permutation::instanced;
             }
 
-            // sdf shadows
-            pen::renderer_set_constant_buffer(scene->sdf_shadow_buffer, 5, pen::CBUFFER_BIND_PS);
-            for (u32 n = 0; n < scene->num_entities; ++n)
+            return bt;
+        }
+
+        // techniques load on first use, which must happen before the draw loop is recorded on the job workers
+        static void load_batch_techniques(const scene_view& view, const render_queue& rq)
+        {
+            u32 cur_shader = -1, cur_technique = -1, cur_permutation = -1;
+
+            u32 num_batches = sb_count(rq.batches);
+            for (u32 bi = 0; bi < num_batches; ++bi)
             {
-                if (!(scene->entities[n] & e_cmp::sdf_shadow))
+                const batch_technique bt = get_batch_technique(view, rq, rq.batches[bi]);
+                if (bt.shader == cur_shader && bt.technique == cur_technique && bt.permutation == cur_permutation)
                     continue;
 
-                cmp_shadow& shadow = scene->shadows[n];
-
-                if (is_valid(shadow.texture_handle))
-                    pen::renderer_set_texture(shadow.texture_handle, shadow.sampler_state, e_global_textures::sdf_shadow,
-                                              pen::TEXTURE_BIND_PS);
+                if (bt.by_index)
+                    pmfx::load_technique(bt.shader, bt.technique);
+                else
+                    pmfx::get_technique_index_perm(bt.shader, bt.technique, bt.permutation);
 
-                // info for sdf
-                pen::renderer_set_constant_buffer(scene->sdf_shadow_buffer, 5, pen::CBUFFER_BIND_PS);
+                cur_shader = bt.shader;
+                cur_technique = bt.technique;
+                cur_permutation = bt.permutation;
             }
-            
-            // gi volume
-            pen::renderer_set_constant_buffer(scene->gi_volume_buffer, 11, pen::CBUFFER_BIND_PS);
-            
-            // filter and cull
-            u32* filtered_entities = nullptr;
-            u32* culled_entities = nullptr;
-            filter_entities_scalar(scene, &filtered_entities);
-            frustum_cull_aabb_scalar(scene, view.camera, filtered_entities, &culled_entities);
-
-            // render
-            u32 cur_shader, cur_technique, cur_permutation, cur_vb, cur_ib = -1;
-            u32 vc = sb_count(culled_entities);
-            for(u32 i = 0; i < vc; ++i)
-            {
-                u32 n = culled_entities[i];
+        }
+
+        // records batches [first, last), only binding state which changed since the last draw in the range
+        static void record_draw_batches(const scene_view& view, const render_queue& rq, u32 first, u32 last,
+                                        draw_counts& counts)
+        {
+            ecs_scene* scene = view.scene;
+
+            u32 cur_shader = -1, cur_technique = -1, cur_permutation = -1;
+            u32 cur_vb = -1, cur_ib = -1, cur_mcb = -1;
+            u32 cur_texture[k_tracked_units];
+            u32 cur_sampler[k_tracked_units];
+            for (u32 u = 0; u < k_tracked_units; ++u)
+                cur_texture[u] = cur_sampler[u] = -1;
+
+            u32 state_changes = 0;
+            u32 draw_calls = 0;
+            u32 instanced = 0;
+
+            for (u32 bi = first; bi < last; ++bi)
+            {
+                const draw_batch&     batch = rq.batches[bi];
+                bool                  batched = is_valid(batch.technique);
+                const batch_technique bt = get_batch_technique(view, rq, batch);
+
+                // batches share all state, the first entity supplies it
+                u32 n = rq.items[batch.start].entity;
                 
                 cmp_geometry* p_geom = &scene->geometries[n];
                 if (!(scene->entities[n] & e_cmp::skinned))
                     if(view.render_flags & pmfx::e_scene_render_flags::shadow_map)
                         p_geom = &scene->position_geometries[n];
 
-                cmp_material* p_mat = &scene->materials[n];
-                u32           permutation = scene->material_permutation[n];
-
                 // set shader / technique only if we need to change
-                if(p_mat->shader != cur_shader || p_mat->technique_index != cur_technique || permutation != cur_permutation)
+                if (bt.shader != cur_shader || bt.technique != cur_technique || bt.permutation != cur_permutation)
                 {
-                    if (!is_valid(view.pmfx_shader))
-                    {
-                        // per entity material
-                        pmfx::set_technique(p_mat->shader, p_mat->technique_index);
-                        cur_shader = p_mat->shader;
-                        cur_technique = p_mat->technique_index;
-                        cur_permutation = permutation;
-                    }
+                    if (bt.by_index)
+                        pmfx::set_technique(bt.shader, bt.technique);
                     else
-                    {
-                        // per pass material but with permutation specialisation (instanced, skinned etc)
-                        pmfx::set_technique_perm(view.pmfx_shader, view.id_technique, permutation);
-                        cur_shader = view.pmfx_shader;
-                        cur_technique = view.id_technique;
-                        cur_permutation = permutation;
-                    }
+                        pmfx::set_technique_perm(bt.shader, bt.technique, bt.permutation);
+
+                    cur_shader = bt.shader;
+                    cur_technique = bt.technique;
+                    cur_permutation = bt.permutation;
+                    state_changes++;
                 }
 
-                // update skin
+                // bind skin, palettes are built once per frame by update_skin_palettes
                 if (scene->entities[n] & e_cmp::skinned && !(scene->entities[n] & e_cmp::sub_geometry))
                 {
-                    static mat4 bb[85];
-                    if (p_geom->p_skin->bone_cbuffer == PEN_INVALID_HANDLE)
+                    u32 bone_cbuffer = get_skin_palette_cbuffer(scene, n);
+                    if (is_valid(bone_cbuffer))
                     {
-                        pen::buffer_creation_params bcp;
-                        bcp.usage_flags = PEN_USAGE_DYNAMIC;
-                        bcp.bind_flags = PEN_BIND_CONSTANT_BUFFER;
-                        bcp.cpu_access_flags = PEN_CPU_ACCESS_WRITE;
-                        bcp.buffer_size = sizeof(mat4) * 85;
-                        bcp.data = nullptr;
-
-                        p_geom->p_skin->bone_cbuffer = pen::renderer_create_buffer(bcp);
+                        pen::renderer_set_constant_buffer(bone_cbuffer, 2, pen::CBUFFER_BIND_VS);
+                        state_changes++;
                     }
-
-                    s32 joints_offset = scene->anim_controller_v2[n].joints_offset;
-                    for (s32 i = 0; i < p_geom->p_skin->num_joints; ++i)
-                        bb[i] = scene->world_matrices[joints_offset + i] * p_geom->p_skin->joint_bind_matrices[i];
-
-                    pen::renderer_update_buffer(p_geom->p_skin->bone_cbuffer, bb, sizeof(bb));
-                    pen::renderer_set_constant_buffer(p_geom->p_skin->bone_cbuffer, 2, pen::CBUFFER_BIND_VS);
                 }
 
                 // set material cbs
                 u32 mcb = scene->materials[n].material_cbuffer;
-                if (is_valid(mcb))
+                if (is_valid(mcb) && mcb != cur_mcb)
                 {
                     pen::renderer_set_constant_buffer(mcb, 7, pen::CBUFFER_BIND_PS | pen::CBUFFER_BIND_VS);
+                    cur_mcb = mcb;
+                    state_changes++;
                 }
 
-                // draw call cb
-                pen::renderer_set_constant_buffer(scene->cbuffer[n], 1, pen::CBUFFER_BIND_PS | pen::CBUFFER_BIND_VS);
+                // draw call cb, instanced batches read it from the instance stream
+                if (!batched)
+                {
+                    u32 cb = scene->cbuffer[n];
+                    pen::renderer_set_constant_buffer(cb, 1, pen::CBUFFER_BIND_PS | pen::CBUFFER_BIND_VS);
+                    state_changes++;
+                }
 
                 // set textures
-                if (p_mat)
+                cmp_samplers& samplers = scene->samplers[n];
+                for (u32 s = 0; s < e_pmfx_constants::max_technique_sampler_bindings; ++s)
                 {
-                    cmp_samplers& samplers = scene->samplers[n];
-                    for (u32 s = 0; s < e_pmfx_constants::max_technique_sampler_bindings; ++s)
+                    const sampler_binding& sb = samplers.sb[s];
+                    if (!sb.handle)
+                        continue;
+
+                    u32 unit = sb.sampler_unit;
+                    if (unit < k_tracked_units)
                     {
-                        if (!samplers.sb[s].handle)
+                        if (cur_texture[unit] == sb.handle && cur_sampler[unit] == sb.sampler_state)
                             continue;
 
-                        pen::renderer_set_texture(samplers.sb[s].handle, samplers.sb[s].sampler_state,
-                                                  samplers.sb[s].sampler_unit, pen::TEXTURE_BIND_PS);
+                        cur_texture[unit] = sb.handle;
+                        cur_sampler[unit] = sb.sampler_state;
                     }
+
+                    pen::renderer_set_texture(sb.handle, sb.sampler_state, sb.sampler_unit, pen::TEXTURE_BIND_PS);
+                    state_changes++;
                 }
 
                 // set vertex buffer
@@ -986,6 +1058,18 @@ namespace put
                     u32 offsets[2] = {0};
 
                     pen::renderer_set_vertex_buffers(vbs, 2, 0, strides, offsets);
+                    cur_vb = -1;
+                    state_changes++;
+                }
+                else if (batched)
+                {
+                    u32 vbs[2] = {p_geom->vertex_buffer, rq.instance_buffer};
+                    u32 strides[2] = {p_geom->vertex_size, (u32)sizeof(cmp_draw_call)};
+                    u32 offsets[2] = {0, (u32)sizeof(cmp_draw_call) * batch.instance_offset};
+
+                    pen::renderer_set_vertex_buffers(vbs, 2, 0, strides, offsets);
+                    cur_vb = -1;
+                    state_changes++;
                 }
                 else
                 {
@@ -993,6 +1077,7 @@ namespace put
                     {
                         pen::renderer_set_vertex_buffer(p_geom->vertex_buffer, 0, p_geom->vertex_size, 0);
                         cur_vb = p_geom->vertex_buffer;
+                        state_changes++;
                     }
                 }
 
@@ -1001,9 +1086,11 @@ namespace put
                 {
                     pen::renderer_set_index_buffer(p_geom->index_buffer, p_geom->index_type, 0);
                     cur_ib = p_geom->index_buffer;
+                    state_changes++;
                 }
                 
                 // draw
+                draw_calls++;
 
                 // instances
                 if (scene->entities[n] & e_cmp::master_instance)
@@ -1011,13 +1098,162 @@ namespace put
                     u32 num_instances = scene->master_instances[n].num_instances;
                     pen::renderer_draw_indexed_instanced(num_instances, 0, p_geom->num_indices, 0, 0,
                                                          PEN_PT_TRIANGLELIST);
-                    n += num_instances;
+                    continue;
+                }
+
+                if (batched)
+                {
+                    u32 num_indices = p_geom->num_indices;
+                    pen::renderer_draw_indexed_instanced(batch.count, 0, num_indices, 0, 0, PEN_PT_TRIANGLELIST);
+                    instanced += batch.count;
                     continue;
                 }
 
                 // single
                 pen::renderer_draw_indexed(p_geom->num_indices, 0, 0, PEN_PT_TRIANGLELIST);
             }
+
+            counts.state_changes += state_changes;
+            counts.draw_calls += draw_calls;
+            counts.instanced += instanced;
+        }
+
+        struct record_batches_job
+        {
+            const scene_view*   view;
+            const render_queue* rq;
+            const u32*          cmd_lists;
+            u32                 batches_per_list;
+            draw_counts*        counts;
+        };
+
+        static void record_batches(u32 start, u32 end, void* user_data)
+        {
+            record_batches_job* job = (record_batches_job*)user_data;
+            u32                 num_batches = sb_count(job->rq->batches);
+
+            for (u32 l = start; l < end; ++l)
+            {
+                u32 first = min<u32>(l * job->batches_per_list, num_batches);
+                u32 last = min<u32>(first + job->batches_per_list, num_batches);
+
+                pen::renderer_begin_cmd_list(job->cmd_lists[l]);
+                record_draw_batches(*job->view, *job->rq, first, last, job->counts[l]);
+                pen::renderer_end_cmd_list();
+            }
+        }
+
+        void render_scene_view(const scene_view& view)
+        {
+            PEN_PROFILE_SCOPE("render_scene_view");
+            
+            ecs_scene* scene = view.scene;
+            if (scene->view_flags & e_scene_view_flags::hide)
+                return;
+            
+            // view
+            pen::renderer_set_constant_buffer(view.cb_view, 0, pen::CBUFFER_BIND_PS | pen::CBUFFER_BIND_VS);
+
+            // fwd lights
+            if (view.render_flags & pmfx::e_scene_render_flags::forward_lit)
+            {
+                pen::renderer_set_constant_buffer(scene->forward_light_buffer, 3, pen::CBUFFER_BIND_PS);
+                pen::renderer_set_constant_buffer(scene->shadow_map_buffer, 4, pen::CBUFFER_BIND_PS);
+                pen::renderer_set_constant_buffer(scene->area_light_buffer, 6, pen::CBUFFER_BIND_PS);
+
+                // clustered lights for this view
+                build_light_clusters(scene, view.camera);
+
+                // ltc lookups
+                static u32 ltc_mat = put::load_texture("data/textures/ltc/ltc_mat.dds");
+                static u32 ltc_mag = put::load_texture("data/textures/ltc/ltc_amp.dds");
+
+                static hash_id id_clamp_linear = PEN_HASH("clamp_linear");
+                u32            clamp_linear = pmfx::get_render_state(id_clamp_linear, pmfx::e_render_state::sampler);
+
+                pen::renderer_set_texture(ltc_mat, clamp_linear, 13, pen::TEXTURE_BIND_PS);
+                pen::renderer_set_texture(ltc_mag, clamp_linear, 12, pen::TEXTURE_BIND_PS);
+            }
+
+            // sdf shadows
+            pen::renderer_set_constant_buffer(scene->sdf_shadow_buffer, 5, pen::CBUFFER_BIND_PS);
+            for (u32 n = 0; n < scene->num_entities; ++n)
+            {
+                if (!(scene->entities[n] & e_cmp::sdf_shadow))
+                    continue;
+
+                cmp_shadow& shadow = scene->shadows[n];
+
+                if (is_valid(shadow.texture_handle))
+                    pen::renderer_set_texture(shadow.texture_handle, shadow.sampler_state, e_global_textures::sdf_shadow,
+                                              pen::TEXTURE_BIND_PS);
+
+                // info for sdf
+                pen::renderer_set_constant_buffer(scene->sdf_shadow_buffer, 5, pen::CBUFFER_BIND_PS);
+            }
+            
+            // gi volume
+            pen::renderer_set_constant_buffer(scene->gi_volume_buffer, 11, pen::CBUFFER_BIND_PS);
+            
+            // filter and cull into the buffer kept for this camera
+            u32** cull_buffer = get_cull_buffer(scene, view.camera);
+            if (scene->flags & e_scene_flags::linear_cull)
+            {
+                filter_frustum_cull_aabb(scene, view.camera, cull_buffer);
+            }
+            else
+            {
+                // keep entity order so draw order matches the linear cull
+                bvh_query_frustum(scene, view.camera->camera_frustum, cull_buffer);
+                std::sort(*cull_buffer, *cull_buffer + sb_count(*cull_buffer));
+            }
+
+            // sort by state and depth, then batch runs with matching state into instanced draws
+            u32 vc = sb_count(*cull_buffer);
+            render_queue& rq = scene->draw_queue;
+            render_queue_build(rq, scene, view, *cull_buffer, vc);
+            render_queue_build_batches(rq, scene, view, !(scene->flags & e_scene_flags::no_auto_instance));
+
+            // render, large queues are split into ranges which are recorded into cmd lists on the job workers and
+            // submitted in range order, so the stream matches recording them here
+            u32 num_batches = sb_count(rq.batches);
+            u32 max_lists = min<u32>(pen::jobs_get_num_workers() + 1, k_max_draw_cmd_lists);
+            u32 num_lists = min<u32>(num_batches / k_batches_per_cmd_list, max_lists);
+
+            draw_counts counts;
+            if (num_lists <= 1)
+            {
+                record_draw_batches(view, rq, 0, num_batches, counts);
+            }
+            else
+            {
+                static u32 s_draw_cmd_lists[k_max_draw_cmd_lists];
+                static u32 s_num_draw_cmd_lists = 0;
+                for (; s_num_draw_cmd_lists < num_lists; ++s_num_draw_cmd_lists)
+                    s_draw_cmd_lists[s_num_draw_cmd_lists] = pen::renderer_create_cmd_list();
+
+                load_batch_techniques(view, rq);
+
+                draw_counts        list_counts[k_max_draw_cmd_lists];
+                record_batches_job job = {&view, &rq, s_draw_cmd_lists, (num_batches + num_lists - 1) / num_lists,
+                                          list_counts};
+
+                pen::jobs_parallel_for(num_lists, 1, record_batches, &job);
+                pen::renderer_submit_cmd_lists(s_draw_cmd_lists, num_lists);
+
+                for (u32 l = 0; l < num_lists; ++l)
+                {
+                    counts.state_changes += list_counts[l].state_changes;
+                    counts.draw_calls += list_counts[l].draw_calls;
+                    counts.instanced += list_counts[l].instanced;
+                }
+            }
+
+            view_render_stats& stats = get_view_render_stats(scene, view.id_name);
+            stats.entities = vc;
+            stats.draw_calls = counts.draw_calls;
+            stats.state_changes = counts.state_changes;
+            stats.instanced = counts.instanced;
         }
 
         void update_animations(ecs_scene* scene, f32 dt)
@@ -1225,7 +1461,7 @@ namespace put
 
         void update(f32 dt)
         {
-            //PEN_PERF_SCOPE_PRINT(ecs_update);Oe
+            PEN_PROFILE_SCOPE("ecs_update");
             
             // allow run time switching between dynamic and fixed timestep
             static f32 fft = 1.0f / 60.0f;
@@ -1278,273 +1514,18 @@ namespace put
             static pen::timer* timer = pen::timer_create();
             pen::timer_start(timer);
 
-            // scene node transform
-            for (size_t n = 0; n < scene->num_entities; ++n)
-            {
-                // force physics entity to sync and ignore controlled transform
-                if (scene->state_flags[n] & e_state::sync_physics_transform)
-                {
-                    scene->state_flags[n] &= ~e_state::sync_physics_transform;
-                    scene->entities[n] &= ~e_cmp::transform;
-                }
-
-                // controlled transform
-                if (scene->entities[n] & e_cmp::transform)
-                {
-                    cmp_transform& t = scene->transforms[n];
-
-                    // generate matrix from transform
-                    mat4 rot_mat;
-                    t.rotation.get_matrix(rot_mat);
-
-                    mat4 translation_mat = mat::create_translation(t.translation);
-
-                    mat4 scale_mat = mat::create_scale(t.scale);
-
-                    scene->local_matrices[n] = translation_mat * rot_mat * scale_mat;
-
-                    if (scene->entities[n] & e_cmp::physics)
-                    {
-                        if (scene->physics_data[n].type == e_physics_type::rigid_body)
-                        {
-                            cmp_transform& pt = scene->physics_offset[n];
-                            physics::set_transform(scene->physics_handles[n], t.translation + pt.translation, t.rotation);
-                            physics::set_v3(scene->physics_handles[n], vec3f::zero(), physics::e_cmd::set_angular_velocity);
-                            physics::set_v3(scene->physics_handles[n], vec3f::zero(), physics::e_cmd::set_linear_velocity);
-                        }
-                    }
-
-                    // local matrix will be baked
-                    scene->entities[n] &= ~e_cmp::transform;
-                }
-                else if (scene->entities[n] & e_cmp::physics)
-                {
-                    if (!physics::has_rb_matrix(n))
-                        continue;
-
-                    cmp_transform& t = scene->transforms[n];
-                    cmp_transform& pt = scene->physics_offset[n];
-
-                    mat4 scale_mat = mat::create_scale(t.scale);
-
-                    vec3f os = t.scale;
-                    t = physics::get_rb_transform(scene->physics_handles[n]);
-                    t.scale = os;
-
-                    mat4 rot_mat;
-                    t.rotation.get_matrix(rot_mat);
-
-                    mat4 translation_mat = mat::create_translation(t.translation - pt.translation);
-
-                    scene->local_matrices[n] = translation_mat * rot_mat * scale_mat;
-                }
-
-                // heirarchical scene transform
-                u32 parent = scene->parents[n];
-                if (parent == n)
-                    scene->world_matrices[n] = scene->local_matrices[n];
-                else
-                    scene->world_matrices[n] = scene->world_matrices[parent] * scene->local_matrices[n];
-            }
-
-            // bounding volume transform
-            static vec3f corners[] = {vec3f(0.0f, 0.0f, 0.0f),
-
-                                      vec3f(1.0f, 0.0f, 0.0f), vec3f(0.0f, 1.0f, 0.0f), vec3f(0.0f, 0.0f, 1.0f),
-
-                                      vec3f(1.0f, 1.0f, 0.0f), vec3f(0.0f, 1.0f, 1.0f), vec3f(1.0f, 0.0f, 1.0f),
-
-                                      vec3f(1.0f, 1.0f, 1.0f)};
-
-            scene->renderable_extents.min = vec3f::flt_max();
-            scene->renderable_extents.max = -vec3f::flt_max();
-
-            // transform extents by transform
-            for (size_t n = 0; n < scene->num_entities; ++n)
-            {
-                vec3f min = scene->bounding_volumes[n].min_extents;
-                vec3f max = scene->bounding_volumes[n].max_extents - min;
-
-                vec3f& tmin = scene->bounding_volumes[n].transformed_min_extents;
-                vec3f& tmax = scene->bounding_volumes[n].transformed_max_extents;
-
-                if (scene->entities[n] & e_cmp::bone)
-                {
-                    tmin = tmax = scene->world_matrices[n].get_translation();
-                    continue;
-                }
-
-                tmax = -vec3f::flt_max();
-                tmin = vec3f::flt_max();
-
-                for (s32 c = 0; c < 8; ++c)
-                {
-                    vec3f p = scene->world_matrices[n].transform_vector(min + max * corners[c]);
-
-                    tmax = max_union(tmax, p);
-                    tmin = min_union(tmin, p);
-                }
+            // local and world matrices, bounds and extents for entities which moved
+            update_transforms(scene);
 
-                f32& trad = scene->bounding_volumes[n].radius;
-                trad = mag(tmax - tmin) * 0.5f;
-                
-                // pos extent for faster aabb and sphere culling
-                auto& pe = scene->pos_extent[n];
-                pe.pos.xyz = tmin + (tmax - tmin) * 0.5f;
-                pe.extent.xyz = tmax - pe.pos.xyz;
-                pe.extent.w = trad;
-
-                if (!(scene->entities[n] & e_cmp::geometry))
-                    continue;
-
-                // also set scene extents
-                scene->renderable_extents.min = min_union(tmin, scene->renderable_extents.min);
-                scene->renderable_extents.max = max_union(tmax, scene->renderable_extents.max);
-            }
-
-            // reverse iterate over scene and expand parents extents by children
-            for (intptr_t n = scene->num_entities - 1; n > 0; --n)
-            {
-                if (!(scene->entities[n] & e_cmp::allocated))
-                    continue;
-
-                u32 p = scene->parents[n];
-                if (p == n)
-                    continue;
+            // refit the spatial index for entities which moved out of their fat bounds
+            bvh_update(scene);
 
-                vec3f& parent_tmin = scene->bounding_volumes[p].transformed_min_extents;
-                vec3f& parent_tmax = scene->bounding_volumes[p].transformed_max_extents;
-
-                vec3f& tmin = scene->bounding_volumes[n].transformed_min_extents;
-                vec3f& tmax = scene->bounding_volumes[n].transformed_max_extents;
-
-                if (scene->entities[p] & e_cmp::anim_controller)
-                {
-                    vec3f pad = vec3f(0.0f);
-
-                    parent_tmin = min_union(parent_tmin, tmin - pad);
-                    parent_tmax = max_union(parent_tmax, tmax + pad);
-                }
-                else
-                {
-                    parent_tmin = min_union(parent_tmin, tmin);
-                    parent_tmax = max_union(parent_tmax, tmax);
-                }
-            }
-
-            // Forward light buffer
+            // forward light buffer in a single pass, point and spot lights without shadows are clustered per view
             static forward_light_buffer light_buffer;
-            s32                         pos = 0;
-            s32                         num_lights = 0;
-
             memset(&light_buffer, 0x0, sizeof(forward_light_buffer));
 
-            // directional lights
-            s32 num_directions_lights = 0;
-            for (size_t n = 0; n < scene->num_entities; ++n)
-            {
-                if (!(scene->entities[n] & e_cmp::light))
-                    continue;
-
-                cmp_light& l = scene->lights[n];
-                if (l.type != e_light_type::dir)
-                    continue;
-
-                // update bv and transform
-                scene->bounding_volumes[n].min_extents = -vec3f(FLT_MAX);
-                scene->bounding_volumes[n].max_extents = vec3f(FLT_MAX);
-
-                if (num_lights >= e_scene_limits::max_forward_lights)
-                    break;
-
-                // current directional light is a point light very far away
-                // with no attenuation..
-                bool sm = l.flags & e_light_flags::shadow_map;
-                vec3f light_pos = l.direction * k_dir_light_offset;
-                light_buffer.lights[pos].pos_radius = vec4f(light_pos, 0.0);
-                light_buffer.lights[pos].colour = vec4f(l.colour, sm ? 1.0 : 0.0);
-
-                ++num_directions_lights;
-                ++num_lights;
-                ++pos;
-            }
-
-            // point lights
-            s32 num_point_lights = 0;
-            for (size_t n = 0; n < scene->num_entities; ++n)
-            {
-                if (!(scene->entities[n] & e_cmp::light))
-                    continue;
-
-                cmp_light& l = scene->lights[n];
-                if (l.type != e_light_type::point)
-                    continue;
-
-                // update bv and transform
-                scene->bounding_volumes[n].min_extents = -vec3f::one();
-                scene->bounding_volumes[n].max_extents = vec3f::one();
-
-                f32 rad = std::max<f32>(l.radius, 1.0f) * 2.0f;
-                scene->transforms[n].scale = vec3f(rad, rad, rad);
-                scene->entities[n] |= e_cmp::transform;
-
-                if (num_lights >= e_scene_limits::max_forward_lights)
-                    break;
-
-                cmp_transform& t = scene->transforms[n];
-
-                bool sm = l.flags & e_light_flags::omni_shadow_map;
-                light_buffer.lights[pos].pos_radius = vec4f(t.translation, l.radius);
-                light_buffer.lights[pos].colour = vec4f(l.colour, sm ? 1.0 : 0.0);
-
-                ++num_point_lights;
-                ++num_lights;
-                ++pos;
-            }
-
-            // spot lights
-            s32 num_spot_lights = 0;
-            for (size_t n = 0; n < scene->num_entities; ++n)
-            {
-                if (num_lights >= e_scene_limits::max_forward_lights)
-                    break;
-
-                if (!(scene->entities[n] & e_cmp::light))
-                    continue;
-
-                cmp_light& l = scene->lights[n];
-
-                if (l.type != e_light_type::spot)
-                    continue;
-
-                // update bv and transform
-                scene->bounding_volumes[n].min_extents = -vec3f::one();
-                scene->bounding_volumes[n].max_extents = vec3f(1.0f, 0.0f, 1.0f);
-
-                f32 angle = acos(1.0f - l.cos_cutoff);
-                f32 lo = tan(angle);
-                f32 range = l.radius;
-
-                scene->transforms[n].scale = vec3f(lo * range, range, lo * range);
-                scene->entities[n] |= e_cmp::transform;
-
-                cmp_transform& t = scene->transforms[n];
-
-                vec3f dir = normalized(-scene->world_matrices[n].get_column(1).xyz);
-
-                bool sm = l.flags & e_light_flags::shadow_map;
-                light_buffer.lights[pos].pos_radius = vec4f(t.translation, l.radius);
-                light_buffer.lights[pos].dir_cutoff = vec4f(dir, l.cos_cutoff);
-                light_buffer.lights[pos].colour = vec4f(l.colour, sm ? 1.0 : 0.0);
-                light_buffer.lights[pos].data = vec4f(l.spot_falloff, 0.0f, 0.0f, 0.0f);
-
-                ++num_spot_lights;
-                ++num_lights;
-                ++pos;
-            }
-
-            // info for loops
-            light_buffer.info = vec4f(num_directions_lights, num_point_lights, num_spot_lights, 0.0f);
+            gather_lights(scene, light_buffer);
+            s32 num_lights = (s32)(light_buffer.info.x + light_buffer.info.y + light_buffer.info.z);
 
             pen::renderer_update_buffer(scene->forward_light_buffer, &light_buffer, sizeof(light_buffer));
 
@@ -1599,6 +1580,7 @@ namespace put
                 scene->draw_call_data[n].v1.y = (f32)anim_time; // time
                 al_buffer.lights[num_area_lights].colour = vec4f(l.colour, num_textured_area_lights);
                 scene->draw_call_data[n].v1.z = (f32)num_textured_area_lights;
+                scene->state_flags[n] |= e_state::draw_call_dirty;
                 ++num_textured_area_lights;
 
                 ++num_area_lights;
@@ -1711,6 +1693,9 @@ namespace put
                 }
             }
             
+            // bone palettes for every skinned entity, shared by pre skinning and all views
+            update_skin_palettes(scene);
+
             // Update pre skinned vertex buffers
             static hash_id id_pre_skin_technique = PEN_HASH("pre_skin");
             static u32     shader = pmfx::load_shader("forward_render");
@@ -1721,31 +1706,15 @@ namespace put
                     if (!(scene->entities[n] & e_cmp::pre_skinned))
                         continue;
 
-                    // update bone cbuffer
-                    cmp_geometry& geom = scene->geometries[n];
-                    if (geom.p_skin->bone_cbuffer == PEN_INVALID_HANDLE)
-                    {
-                        pen::buffer_creation_params bcp;
-                        bcp.usage_flags = PEN_USAGE_DYNAMIC;
-                        bcp.bind_flags = PEN_BIND_CONSTANT_BUFFER;
-                        bcp.cpu_access_flags = PEN_CPU_ACCESS_WRITE;
-                        bcp.buffer_size = sizeof(mat4) * 85;
-                        bcp.data = nullptr;
-
-                        geom.p_skin->bone_cbuffer = pen::renderer_create_buffer(bcp);
-                    }
-
-                    static mat4 bb[85];
-                    s32         joints_offset = scene->anim_controller_v2[n].joints_offset;
-                    for (s32 i = 0; i < geom.p_skin->num_joints; ++i)
-                        bb[i] = scene->world_matrices[joints_offset + i] * geom.p_skin->joint_bind_matrices[i];
-
-                    pen::renderer_update_buffer(geom.p_skin->bone_cbuffer, bb, sizeof(bb));
+                    u32 bone_cbuffer = get_skin_palette_cbuffer(scene, n);
+                    if (!is_valid(bone_cbuffer))
+                        continue;
 
                     // bind stream out targets
+                    cmp_geometry& geom = scene->geometries[n];
                     cmp_pre_skin& pre_skin = scene->pre_skin[n];
                     pen::renderer_set_stream_out_target(geom.vertex_buffer);
-                    pen::renderer_set_constant_buffer(geom.p_skin->bone_cbuffer, 2, pen::CBUFFER_BIND_VS);
+                    pen::renderer_set_constant_buffer(bone_cbuffer, 2, pen::CBUFFER_BIND_VS);
                     pen::renderer_set_vertex_buffer(pre_skin.vertex_buffer, 0, pre_skin.vertex_size, 0);
 
                     // render point list
@@ -1754,17 +1723,31 @@ namespace put
                 }
             }
 
-            // update draw call data
+            // update draw call data and material cbuffers, only for entities which moved or were edited
+            u32* draw_call_entities = nullptr;
+            u32  material_uploads = 0;
             for (size_t n = 0; n < scene->num_entities; ++n)
             {
-                if (scene->entities[n] & e_cmp::material)
+                u64& state = scene->state_flags[n];
+
+                if (state & e_state::material_dirty)
                 {
+                    state &= ~e_state::material_dirty;
+
                     // per node material cbuffer
-                    if (is_valid(scene->materials[n].material_cbuffer))
+                    if ((scene->entities[n] & e_cmp::material) && is_valid(scene->materials[n].material_cbuffer))
+                    {
                         pen::renderer_update_buffer(scene->materials[n].material_cbuffer, &scene->material_data[n].data[0],
                                                     scene->materials[n].material_cbuffer_size);
+                        material_uploads++;
+                    }
                 }
 
+                if (!(state & e_state::draw_call_dirty))
+                    continue;
+
+                state &= ~e_state::draw_call_dirty;
+
                 scene->draw_call_data[n].world_matrix = scene->world_matrices[n];
 
                 // store node index in v1.x
@@ -1780,31 +1763,30 @@ namespace put
                 if (scene->entities[n] & e_cmp::skinned || scene->entities[n] & e_cmp::pre_skinned)
                     scene->draw_call_data[n].world_matrix = mat4::create_identity();
 
-                mat4 invt = scene->world_matrices[n];
-
-                invt = invt.transposed();
-                invt = mat::inverse4x4(invt);
+                sb_push(draw_call_entities, (u32)n);
+            }
 
-                scene->draw_call_data[n].world_matrix_inv_transpose = invt;
+            // normal matrices in batches
+            u32 num_draw_call_entities = sb_count(draw_call_entities);
+            normal_matrices(scene, draw_call_entities, num_draw_call_entities);
 
-                // todo mark dirty?
+            for (u32 i = 0; i < num_draw_call_entities; ++i)
+            {
+                u32 n = draw_call_entities[i];
                 pen::renderer_update_buffer(scene->cbuffer[n], &scene->draw_call_data[n], sizeof(cmp_draw_call));
             }
+            sb_free(draw_call_entities);
 
-            // update instance buffers
-            for (size_t n = 0; n < scene->num_entities; ++n)
-            {
-                if (!(scene->entities[n] & e_cmp::master_instance))
-                    continue;
-
-                cmp_master_instance& master = scene->master_instances[n];
-
-                u32 instance_data_size = master.num_instances * master.instance_stride;
-                pen::renderer_update_buffer(master.instance_buffer, &scene->draw_call_data[n + 1], instance_data_size);
+            scene->upload_stats.draw_calls = num_draw_call_entities;
+            scene->upload_stats.materials = material_uploads;
 
-                // stride over sub instances
-                n += scene->master_instances[n].num_instances;
-            }
+            // update instance buffers
+            for_each_component(scene, scene->master_instances, e_cmp::master_instance,
+                               [scene](u32 n, cmp_master_instance& master) {
+                                   u32 instance_data_size = master.num_instances * master.instance_stride;
+                                   pen::renderer_update_buffer(master.instance_buffer, &scene->draw_call_data[n + 1],
+                                                               instance_data_size);
+                               });
 
             // update physics running 1 frame behind to allow the sets to take effect
             physics::step(dt);
@@ -1935,7 +1917,9 @@ namespace put
                     generic_cmp_array& src = scene->get_component_array(c);
                     generic_cmp_array& dst = sub_scene.get_component_array(c);
 
-                    memcpy(dst[ni], src[ii], src.size);
+                    const void* data = src.find(ii);
+                    if (data)
+                        memcpy(dst[ni], data, src.size);
                 }
 
                 sub_scene.parents[ni] -= root;
@@ -1965,7 +1949,23 @@ namespace put
             for (u32 i = 0; i < scene->num_components; ++i)
             {
                 generic_cmp_array& cmp = scene->get_component_array(i);
-                ofs.write((const c8*)cmp.data, cmp.size * scene->num_entities);
+                if (!cmp.pool)
+                {
+                    ofs.write((const c8*)cmp.data, cmp.size * scene->num_entities);
+                    continue;
+                }
+
+                // pooled components are written dense so files are the same with either storage
+                u8* zero = (u8*)pen::memory_alloc(cmp.size);
+                pen::memory_zero(zero, cmp.size);
+
+                for (s32 n = 0; n < scene->num_entities; ++n)
+                {
+                    const void* data = cmp.find(n);
+                    ofs.write(data ? (const c8*)data : (const c8*)zero, cmp.size);
+                }
+
+                pen::memory_free(zero);
             }
 
             // specialisations ------------------------------------------------------------------------------
@@ -2141,7 +2141,7 @@ namespace put
 
         void load_scene(const c8* filename, ecs_scene* scene, bool merge)
         {
-            scene->flags |= e_scene_flags::invalidate_scene_tree;
+            scene->flags |= e_scene_flags::invalidate_scene_tree | e_scene_flags::invalidate_transforms;
             bool      error = false;
             const c8* wd = pen::os_get_user_info().working_directory;
             Str       project_dir = dev_ui::get_program_preference_filename("project_dir", wd);
@@ -2295,7 +2295,30 @@ namespace put
                 {
                     generic_cmp_array& cmp = scene->get_component_array(ri);
 
-                    if (cmp.size == component_sizes[i])
+                    if (cmp.size == component_sizes[i] && cmp.pool)
+                    {
+                        // only non zero components take storage in a pool
+                        u32 array_size = cmp.size * num_nodes;
+                        c8* dense = (c8*)pen::memory_alloc(array_size);
+                        ifs.read(dense, array_size);
+
+                        for (s32 n = 0; n < num_nodes; ++n)
+                        {
+                            const c8* src = dense + n * cmp.size;
+                            for (u32 b = 0; b < cmp.size; ++b)
+                            {
+                                if (src[b])
+                                {
+                                    memcpy(cmp[zero_offset + n], src, cmp.size);
+                                    break;
+                                }
+                            }
+                        }
+
+                        pen::memory_free(dense);
+                        read = true;
+                    }
+                    else if (cmp.size == component_sizes[i])
                     {
                         // read whole array
                         c8* data_offset = (c8*)cmp.data + zero_offset * cmp.size;
@@ -5,6 +5,13 @@
 #pragma once
 
 #include "camera.h"
+#include "ecs/ecs_bvh.h"
+#include "ecs/ecs_chunks.h"
+#include "ecs/ecs_cull.h"
+#include "ecs/ecs_light_clusters.h"
+#include "ecs/ecs_render_queue.h"
+#include "ecs/ecs_skinning.h"
+#include "ecs/ecs_transform.h"
 #include "loader.h"
 #include "physics/physics.h"
 #include "pmfx.h"
@@ -59,7 +66,11 @@ namespace put
             {
                 none = 0,
                 invalidate_scene_tree = 1 << 1,
-                pause_update = 1 << 2
+                pause_update = 1 << 2,
+                linear_cull = 1 << 3,          // cull views by testing every entity instead of with the bvh
+                invalidate_transforms = 1 << 4, // entities were added, removed or reparented, update all transforms
+                no_auto_instance = 1 << 5,      // draw every entity individually instead of instancing matching runs
+                no_light_clusters = 1 << 6      // put every light in the forward light buffer instead of clustering
             };
         }
         typedef u32 scene_flags;
@@ -76,6 +87,9 @@ namespace put
                 samplers_initialised = (1 << 5),
                 apply_anim_transform = (1 << 6),
                 sync_physics_transform = (1 << 7),
+                transform_dirty = (1 << 8), // local_matrices or extents were changed directly, update next frame
+                draw_call_dirty = (1 << 9), // draw_call_data was changed directly, upload the cbuffer next frame
+                material_dirty = (1 << 10), // material_data was changed directly, upload the material cbuffer
                 alpha_blended = (1 << 0)
             };
         }
@@ -191,7 +205,6 @@ namespace put
             u32  num_joints;
             mat4 bind_shape_matrix;
             mat4 joint_bind_matrices[85];
-            u32  bone_cbuffer = PEN_INVALID_HANDLE;
         };
 
         // contains handles and data to re-create a material from scratch
@@ -395,11 +408,13 @@ namespace put
             free_node_list* prev;
         };
 
+        // data is null when the component is in chunked storage, see ecs_chunks.h
         template <typename T>
         struct cmp_array
         {
-            u32 size = sizeof(T);
-            T*  data = nullptr;
+            u32       size = sizeof(T);
+            T*        data = nullptr;
+            cmp_pool* pool = nullptr;
 
             T&       operator[](size_t index);
             const T& operator[](size_t index) const;
@@ -407,10 +422,12 @@ namespace put
 
         struct generic_cmp_array
         {
-            u32   size;
-            void* data;
+            u32       size;
+            void*     data;
+            cmp_pool* pool;
 
-            void* operator[](size_t index);
+            void*       operator[](size_t index);
+            const void* find(size_t index) const; // nullptr when a pooled component has no storage
         };
 
         struct ecs_extension
@@ -440,6 +457,13 @@ namespace put
             void (*post_update_func)(ecs_controller&, ecs_scene* scene, f32 dt) = nullptr;
         };
 
+        // cbuffer uploads issued by the last update_scene, clean entities are skipped
+        struct cbuffer_upload_stats
+        {
+            u32 draw_calls = 0;
+            u32 materials = 0;
+        };
+
         struct ecs_scene
         {
             static const u32 k_version = 9;
@@ -500,21 +524,29 @@ namespace put
             ecs_controller* controllers = nullptr;
 
             // Scene Data
-            size_t           num_entities = 0;
-            u32              soa_size = 0;
-            free_node_list*  free_list_head = nullptr;
-            u32              forward_light_buffer = PEN_INVALID_HANDLE;
-            u32              sdf_shadow_buffer = PEN_INVALID_HANDLE;
-            u32              area_light_buffer = PEN_INVALID_HANDLE;
-            u32              shadow_map_buffer = PEN_INVALID_HANDLE;
-            u32              gi_volume_buffer = PEN_INVALID_HANDLE;
-            s32              selected_index = -1;
-            scene_flags      flags = 0;
-            scene_view_flags view_flags = 0;
-            extents          renderable_extents;
-            u32*             selection_list = nullptr;
-            u32              version = k_version;
-            Str              filename = "";
+            size_t               num_entities = 0;
+            u32                  soa_size = 0;
+            free_node_list*      free_list_head = nullptr;
+            u32                  forward_light_buffer = PEN_INVALID_HANDLE;
+            u32                  sdf_shadow_buffer = PEN_INVALID_HANDLE;
+            u32                  area_light_buffer = PEN_INVALID_HANDLE;
+            u32                  shadow_map_buffer = PEN_INVALID_HANDLE;
+            u32                  gi_volume_buffer = PEN_INVALID_HANDLE;
+            s32                  selected_index = -1;
+            scene_flags          flags = 0;
+            scene_view_flags     view_flags = 0;
+            extents              renderable_extents;
+            bvh                  spatial_index;
+            transform_hierarchy  hierarchy;
+            cull_view*           cull_views = nullptr;
+            render_queue         draw_queue;
+            view_render_stats*   view_stats = nullptr;
+            light_clusters       clustered_lights;
+            skin_palettes        bone_palettes;
+            cbuffer_upload_stats upload_stats;
+            u32*                 selection_list = nullptr;
+            u32                  version = k_version;
+            Str                  filename = "";
 
             generic_cmp_array& get_component_array(u32 index);
         };
@@ -563,22 +595,75 @@ namespace put
         template <typename T>
         pen_inline T& cmp_array<T>::operator[](size_t index)
         {
+            if (pool)
+                return *(T*)cmp_pool_get(pool, (u32)index);
+
             return data[index];
         }
 
         template <typename T>
         pen_inline const T& cmp_array<T>::operator[](size_t index) const
         {
+            // reads never allocate, an entity without storage shares one zeroed component
+            if (pool)
+            {
+                const void* p = cmp_pool_find(pool, (u32)index);
+                return p ? *(const T*)p : cmp_pool_zero<T>();
+            }
+
             return data[index];
         }
 
         pen_inline void* generic_cmp_array::operator[](size_t index)
         {
+            if (pool)
+                return cmp_pool_get(pool, (u32)index);
+
             u8* d = (u8*)data;
             u8* di = &d[index * size];
             return (void*)(di);
         }
 
+        pen_inline const void* generic_cmp_array::find(size_t index) const
+        {
+            if (pool)
+                return cmp_pool_find(pool, (u32)index);
+
+            return (const u8*)data + index * size;
+        }
+
+        // calls func(entity, component) for each entity with all of the required e_cmp flags, with chunked storage
+        // only the chunks of cmp are visited in storage order instead of every entity in the scene
+        template <typename T, typename F>
+        void for_each_component(ecs_scene* scene, cmp_array<T>& cmp, u64 required, F func)
+        {
+            if (!cmp.pool)
+            {
+                for (u32 n = 0; n < scene->num_entities; ++n)
+                    if ((scene->entities[n] & required) == required)
+                        func(n, cmp.data[n]);
+
+                return;
+            }
+
+            u32 num_chunks = cmp_pool_num_chunks(cmp.pool);
+            for (u32 c = 0; c < num_chunks; ++c)
+            {
+                cmp_chunk chunk = cmp_pool_get_chunk(cmp.pool, c);
+                T*        data = (T*)chunk.data;
+
+                for (u32 i = 0; i < chunk.count; ++i)
+                {
+                    u32 n = chunk.owners[i];
+                    if (n == PEN_INVALID_HANDLE || n >= scene->num_entities)
+                        continue;
+
+                    if ((scene->entities[n] & required) == required)
+                        func(n, data[i]);
+                }
+            }
+        }
+
         pen_inline u32 get_extension_component_offset(ecs_scene* scene, u32 extension)
         {
             u32 offset = scene->num_base_components;
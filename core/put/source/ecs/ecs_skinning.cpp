@@ -0,0 +1,202 @@
+// ecs_skinning.cpp
+// Copyright 2014 - 2019 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+#include "ecs/ecs_skinning.h"
+#include "ecs/ecs_scene.h"
+#include "ecs/ecs_transform.h"
+
+#include "data_struct.h"
+#include "renderer.h"
+#include "threads.h"
+
+using namespace pen;
+
+namespace
+{
+    using namespace put;
+    using namespace put::ecs;
+
+    static const u32 k_max_joints = e_skinning_limits::max_joints;
+
+    struct palette_job
+    {
+        ecs_scene*     scene;
+        skin_palettes* sp;
+    };
+
+    void (*s_skin_palette)(const mat4* joints, const mat4* bind, mat4* out, u32 count) = nullptr;
+
+#if __SSE__ || __AVX__
+    void skin_palette_simd128(const mat4* joints, const mat4* bind, mat4* out, u32 count)
+    {
+        for (u32 i = 0; i < count; ++i)
+            mul4x4_simd128(joints[i].m, bind[i].m, out[i].m);
+    }
+#endif
+
+    pen_inline bool has_palette(const ecs_scene* scene, u32 n)
+    {
+        u64 cmp = scene->entities[n];
+        if (cmp & e_cmp::pre_skinned)
+            return true;
+
+        return (cmp & e_cmp::skinned) && !(cmp & e_cmp::sub_geometry);
+    }
+
+    pen_inline u32 num_joints(ecs_scene* scene, u32 n)
+    {
+        const cmp_skin* skin = scene->geometries[n].p_skin;
+        if (!skin)
+            return 0;
+
+        return min<u32>(skin->num_joints, k_max_joints);
+    }
+
+    // entities are independent, each writes only its own range of matrices
+    void palette_job_func(u32 start, u32 end, void* user_data)
+    {
+        palette_job*   job = (palette_job*)user_data;
+        ecs_scene*     scene = job->scene;
+        skin_palettes& sp = *job->sp;
+
+        for (u32 i = start; i < end; ++i)
+        {
+            u32 n = sp.entities[i];
+            u32 count = sp.offsets[i + 1] - sp.offsets[i];
+
+            const cmp_skin* skin = scene->geometries[n].p_skin;
+            s32             joints_offset = scene->anim_controller_v2[n].joints_offset;
+
+            skin_palette(&scene->world_matrices[joints_offset], skin->joint_bind_matrices, &sp.matrices[sp.offsets[i]],
+                         count);
+        }
+    }
+
+    u32 create_bone_cbuffer()
+    {
+        pen::buffer_creation_params bcp;
+        bcp.usage_flags = PEN_USAGE_DYNAMIC;
+        bcp.bind_flags = PEN_BIND_CONSTANT_BUFFER;
+        bcp.cpu_access_flags = PEN_CPU_ACCESS_WRITE;
+        bcp.buffer_size = sizeof(mat4) * k_max_joints;
+        bcp.data = nullptr;
+
+        return pen::renderer_create_buffer(bcp);
+    }
+} // namespace
+
+namespace put
+{
+    namespace ecs
+    {
+        void update_skin_palettes(ecs_scene* scene)
+        {
+            skin_palettes& sp = scene->bone_palettes;
+
+            if (sp.entities)
+                stb__sbn(sp.entities) = 0;
+
+            if (sp.offsets)
+                stb__sbn(sp.offsets) = 0;
+
+            // cbuffers are indexed by entity and follow the scene size
+            u32 num_cbuffers = sb_count(sp.cbuffers);
+            if (num_cbuffers < scene->soa_size)
+            {
+                u32* added = sb_add(sp.cbuffers, scene->soa_size - num_cbuffers);
+                for (u32 i = 0; i < scene->soa_size - num_cbuffers; ++i)
+                    added[i] = PEN_INVALID_HANDLE;
+            }
+
+            // gather skinned entities and lay out their palettes
+            u32 num_matrices = 0;
+            for (u32 n = 0; n < scene->num_entities; ++n)
+            {
+                if (!has_palette(scene, n))
+                    continue;
+
+                u32 count = num_joints(scene, n);
+                if (count == 0)
+                    continue;
+
+                if (!is_valid(sp.cbuffers[n]))
+                    sp.cbuffers[n] = create_bone_cbuffer();
+
+                sb_push(sp.entities, n);
+                sb_push(sp.offsets, num_matrices);
+                num_matrices += count;
+            }
+
+            u32 num_skinned = sb_count(sp.entities);
+            if (num_skinned == 0)
+                return;
+
+            sb_push(sp.offsets, num_matrices);
+
+            u32 cur_matrices = sb_count(sp.matrices);
+            if (cur_matrices < num_matrices)
+                sb_add(sp.matrices, num_matrices - cur_matrices);
+
+            palette_job job;
+            job.scene = scene;
+            job.sp = &sp;
+            pen::jobs_parallel_for(num_skinned, 8, palette_job_func, &job);
+
+            // one upload per entity per frame, views only bind
+            for (u32 i = 0; i < num_skinned; ++i)
+            {
+                u32 count = sp.offsets[i + 1] - sp.offsets[i];
+                u32 cb = sp.cbuffers[sp.entities[i]];
+                pen::renderer_update_buffer(cb, &sp.matrices[sp.offsets[i]], sizeof(mat4) * count);
+            }
+        }
+
+        void skin_palettes_clear(skin_palettes& sp)
+        {
+            u32 num_cbuffers = sb_count(sp.cbuffers);
+            for (u32 i = 0; i < num_cbuffers; ++i)
+                if (is_valid(sp.cbuffers[i]))
+                    pen::renderer_release_buffer(sp.cbuffers[i]);
+
+            sb_clear(sp.cbuffers);
+            sb_clear(sp.entities);
+            sb_clear(sp.offsets);
+            sb_clear(sp.matrices);
+        }
+
+        u32 get_skin_palette_cbuffer(const ecs_scene* scene, u32 entity)
+        {
+            const skin_palettes& sp = scene->bone_palettes;
+            if (entity >= (u32)sb_count(sp.cbuffers))
+                return PEN_INVALID_HANDLE;
+
+            return sp.cbuffers[entity];
+        }
+
+        void skin_palette_scalar(const mat4* joints, const mat4* bind, mat4* out, u32 count)
+        {
+            for (u32 i = 0; i < count; ++i)
+                out[i] = joints[i] * bind[i];
+        }
+
+        void skin_palette(const mat4* joints, const mat4* bind, mat4* out, u32 count)
+        {
+            if (!s_skin_palette)
+                skinning_simd_init(false, false);
+
+            s_skin_palette(joints, bind, out, count);
+        }
+
+        void skinning_simd_init(bool sse, bool avx2)
+        {
+            s_skin_palette = &skin_palette_scalar;
+
+#if __SSE__ || __AVX__
+            // a 4x4 multiply is a row of broadcasts, wider registers do not help
+            if (sse || avx2)
+                s_skin_palette = &skin_palette_simd128;
+#endif
+        }
+    } // namespace ecs
+} // namespace put
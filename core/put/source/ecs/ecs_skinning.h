@@ -0,0 +1,51 @@
+// ecs_skinning.h
+// Copyright 2014 - 2019 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+// Bone palettes for skinned and pre skinned entities are built once per frame after the transforms are updated,
+// split across the job workers. Each entity keeps its own bone cbuffer which is uploaded once and then only bound
+// by every view that draws it, so shadow and other passes no longer rebuild and upload palettes.
+
+#pragma once
+
+#include "types.h"
+
+#include "maths/mat.h"
+
+namespace put
+{
+    namespace ecs
+    {
+        struct ecs_scene;
+
+        namespace e_skinning_limits
+        {
+            enum skinning_limits_t
+            {
+                max_joints = 85 // matches the bone cbuffer in the shaders
+            };
+        }
+
+        struct skin_palettes
+        {
+            u32*  entities = nullptr; // entities with a palette this frame
+            u32*  offsets = nullptr;  // per entities entry, first matrix in matrices
+            mat4* matrices = nullptr; // joint world matrix * joint bind matrix, contiguous for all entities
+            u32*  cbuffers = nullptr; // per scene entity, bone cbuffer or PEN_INVALID_HANDLE
+        };
+
+        // builds and uploads the palettes of every skinned entity, world matrices must be up to date
+        void update_skin_palettes(ecs_scene* scene);
+        void skin_palettes_clear(skin_palettes& sp);
+
+        // bone cbuffer (b2) holding the palette from the last update, PEN_INVALID_HANDLE when the entity has none
+        u32 get_skin_palette_cbuffer(const ecs_scene* scene, u32 entity);
+
+        // out[i] = joints[i] * bind[i], the scalar version is the cross platform reference
+        void skin_palette_scalar(const mat4* joints, const mat4* bind, mat4* out, u32 count);
+        void skin_palette(const mat4* joints, const mat4* bind, mat4* out, u32 count);
+
+        // called by simd_init with what the cpu supports
+        void skinning_simd_init(bool sse, bool avx2);
+    } // namespace ecs
+} // namespace put
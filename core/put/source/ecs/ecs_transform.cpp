@@ -0,0 +1,1220 @@
+// ecs_transform.cpp
+// Copyright 2014 - 2019 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+#include "ecs/ecs_transform.h"
+#include "ecs/ecs_scene.h"
+
+#include "data_struct.h"
+#include "threads.h"
+
+#include <algorithm>
+#include <string.h>
+
+#if __SSE__ || __AVX__
+#include <immintrin.h>
+#include <xmmintrin.h>
+#endif
+
+using namespace pen;
+
+namespace
+{
+    using namespace put;
+    using namespace put::ecs;
+
+    static const u32 k_batch_size = 256;
+
+    namespace e_mark
+    {
+        enum mark_t : u8
+        {
+            none = 0,
+            updated,
+            ancestor
+        };
+    }
+
+    template <typename T>
+    void resize(T*& arr, u32 count)
+    {
+        if (arr)
+            stb__sbn(arr) = 0;
+
+        sb_add(arr, count);
+    }
+
+    template <typename T>
+    void reset(T* arr)
+    {
+        if (arr)
+            stb__sbn(arr) = 0;
+    }
+
+    u32 entity_depth(const ecs_scene* scene, u32 n)
+    {
+        // bounded by the entity count in case of a cycle
+        u32 d = 0;
+        while (scene->parents[n] != n && d < scene->num_entities)
+        {
+            n = scene->parents[n];
+            ++d;
+        }
+        return d;
+    }
+
+    void build_order(ecs_scene* scene, transform_hierarchy& th)
+    {
+        u32 num_entities = (u32)scene->num_entities;
+
+        resize(th.depth, num_entities);
+        resize(th.first_child, num_entities);
+        resize(th.next_sibling, num_entities);
+        resize(th.mark, num_entities);
+        reset(th.order);
+        reset(th.level_start);
+
+        u32 num_levels = 0;
+        for (u32 n = 0; n < num_entities; ++n)
+        {
+            th.first_child[n] = -1;
+            th.next_sibling[n] = -1;
+
+            if (!(scene->entities[n] & e_cmp::allocated))
+                continue;
+
+            // parents are usually above their children so the depth is already known
+            u32 p = scene->parents[n];
+            if (p == n)
+                th.depth[n] = 0;
+            else if (p < n && (scene->entities[p] & e_cmp::allocated))
+                th.depth[n] = th.depth[p] + 1;
+            else
+                th.depth[n] = entity_depth(scene, n);
+
+            num_levels = max<u32>(num_levels, th.depth[n] + 1);
+        }
+
+        // children in ascending order
+        for (s32 n = (s32)num_entities - 1; n >= 0; --n)
+        {
+            if (!(scene->entities[n] & e_cmp::allocated))
+                continue;
+
+            u32 p = scene->parents[n];
+            if (p == (u32)n)
+                continue;
+
+            th.next_sibling[n] = th.first_child[p];
+            th.first_child[p] = n;
+        }
+
+        // counting sort by depth keeps index order within a depth
+        resize(th.level_start, num_levels + 1);
+        memset(th.level_start, 0x0, sizeof(u32) * (num_levels + 1));
+
+        for (u32 n = 0; n < num_entities; ++n)
+            if (scene->entities[n] & e_cmp::allocated)
+                th.level_start[th.depth[n] + 1]++;
+
+        for (u32 l = 0; l < num_levels; ++l)
+            th.level_start[l + 1] += th.level_start[l];
+
+        resize(th.order, th.level_start[num_levels]);
+
+        u32* write = (u32*)memory_alloc(sizeof(u32) * max<u32>(num_levels, 1));
+        memcpy(write, th.level_start, sizeof(u32) * num_levels);
+
+        for (u32 n = 0; n < num_entities; ++n)
+            if (scene->entities[n] & e_cmp::allocated)
+                th.order[write[th.depth[n]]++] = n;
+
+        memory_free(write);
+
+        th.num_entities = num_entities;
+    }
+
+    pen_inline void grow_extents(extents& e, const vec3f& min, const vec3f& max)
+    {
+        e.min = min_union(min, e.min);
+        e.max = max_union(max, e.max);
+    }
+
+    pen_inline void add_renderable_extents(ecs_scene* scene, u32 n)
+    {
+        if ((scene->entities[n] & e_cmp::bone) || !(scene->entities[n] & e_cmp::geometry))
+            return;
+
+        // pos_extent holds the entity bounds before they are grown by children
+        const cmp_pos_extent& pe = scene->pos_extent[n];
+        grow_extents(scene->renderable_extents, pe.pos.xyz - pe.extent.xyz, pe.pos.xyz + pe.extent.xyz);
+    }
+
+    void grow_by_children(ecs_scene* scene, const transform_hierarchy& th, u32 n)
+    {
+        vec3f& tmin = scene->bounding_volumes[n].transformed_min_extents;
+        vec3f& tmax = scene->bounding_volumes[n].transformed_max_extents;
+
+        for (s32 c = th.first_child[n]; c != -1; c = th.next_sibling[c])
+        {
+            tmin = min_union(tmin, scene->bounding_volumes[c].transformed_min_extents);
+            tmax = max_union(tmax, scene->bounding_volumes[c].transformed_max_extents);
+        }
+    }
+
+    struct transform_job
+    {
+        ecs_scene*           scene;
+        const u32*           entities;
+        physics::pose_stream poses;
+    };
+
+    // a body has a pose once the physics thread has written it
+    pen_inline bool has_pose(const physics::pose_stream& poses, u32 h)
+    {
+        return h < (u32)sb_count(poses.stamps) && poses.stamps[h] != 0;
+    }
+
+    void update_entities_job(u32 start, u32 end, void* user_data)
+    {
+        transform_job* job = (transform_job*)user_data;
+        ecs_scene*     scene = job->scene;
+
+        u32 trs[k_batch_size];
+        u32 bodies[k_batch_size];
+        u32 world[k_batch_size];
+
+        for (u32 b = start; b < end; b += k_batch_size)
+        {
+            u32        count = min<u32>(end - b, k_batch_size);
+            const u32* entities = job->entities + b;
+
+            u32 num_trs = 0;
+            u32 num_bodies = 0;
+            u32 num_world = 0;
+            for (u32 i = 0; i < count; ++i)
+            {
+                u32 n = entities[i];
+
+                // controlled transform, local matrix will be baked
+                if (scene->entities[n] & e_cmp::transform)
+                {
+                    scene->entities[n] &= ~e_cmp::transform;
+                    trs[num_trs++] = n;
+                }
+                else if (scene->entities[n] & e_cmp::physics)
+                {
+                    // keep the last world matrix until the body exists
+                    if (!has_pose(job->poses, physics::pose_index(scene->physics_handles[n])))
+                        continue;
+
+                    bodies[num_bodies++] = n;
+                }
+
+                world[num_world++] = n;
+            }
+
+            compose_trs(scene, trs, num_trs);
+            rigid_body_poses(scene, job->poses, bodies, num_bodies);
+            multiply_parents(scene, world, num_world);
+            transform_aabbs(scene, entities, count);
+        }
+    }
+
+    void grow_entities_job(u32 start, u32 end, void* user_data)
+    {
+        transform_job* job = (transform_job*)user_data;
+        for (u32 i = start; i < end; ++i)
+        {
+            u32 n = job->entities[i];
+            if (job->scene->hierarchy.first_child[n] != -1)
+                grow_by_children(job->scene, job->scene->hierarchy, n);
+        }
+    }
+
+#if __SSE__ || __AVX__
+    struct simd128
+    {
+        typedef __m128   f;
+        static const u32 width = 4;
+
+        static pen_inline f set1(f32 v)
+        {
+            return _mm_set1_ps(v);
+        }
+
+        static pen_inline f add(f a, f b)
+        {
+            return _mm_add_ps(a, b);
+        }
+
+        static pen_inline f sub(f a, f b)
+        {
+            return _mm_sub_ps(a, b);
+        }
+
+        static pen_inline f mul(f a, f b)
+        {
+            return _mm_mul_ps(a, b);
+        }
+
+        static pen_inline f div(f a, f b)
+        {
+            return _mm_div_ps(a, b);
+        }
+
+        static pen_inline f sqrt(f a)
+        {
+            return _mm_sqrt_ps(a);
+        }
+
+        static pen_inline f abs(f a)
+        {
+            return _mm_andnot_ps(_mm_set1_ps(-0.0f), a);
+        }
+
+        // 1 or -1 with the sign of a
+        static pen_inline f sign(f a)
+        {
+            return _mm_or_ps(_mm_and_ps(_mm_set1_ps(-0.0f), a), _mm_set1_ps(1.0f));
+        }
+
+        static pen_inline void store(f a, f32* out)
+        {
+            _mm_store_ps(out, a);
+        }
+
+        // 4 floats from each lane pointer, out[i] holds component i of every lane
+        static pen_inline void load4(const f32* const* p, f* out)
+        {
+            __m128 r0 = _mm_loadu_ps(p[0]);
+            __m128 r1 = _mm_loadu_ps(p[1]);
+            __m128 r2 = _mm_loadu_ps(p[2]);
+            __m128 r3 = _mm_loadu_ps(p[3]);
+            _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+            out[0] = r0;
+            out[1] = r1;
+            out[2] = r2;
+            out[3] = r3;
+        }
+
+        static pen_inline void load3(const f32* const* p, f* out)
+        {
+            for (u32 k = 0; k < 3; ++k)
+                out[k] = _mm_setr_ps(p[0][k], p[1][k], p[2][k], p[3][k]);
+        }
+
+        static pen_inline void store4(const f* in, f32* const* p)
+        {
+            __m128 r0 = in[0];
+            __m128 r1 = in[1];
+            __m128 r2 = in[2];
+            __m128 r3 = in[3];
+            _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+            _mm_storeu_ps(p[0], r0);
+            _mm_storeu_ps(p[1], r1);
+            _mm_storeu_ps(p[2], r2);
+            _mm_storeu_ps(p[3], r3);
+        }
+    };
+#endif
+
+#if __AVX2__
+    struct simd256
+    {
+        typedef __m256   f;
+        static const u32 width = 8;
+
+        static pen_inline f set1(f32 v)
+        {
+            return _mm256_set1_ps(v);
+        }
+
+        static pen_inline f add(f a, f b)
+        {
+            return _mm256_add_ps(a, b);
+        }
+
+        static pen_inline f sub(f a, f b)
+        {
+            return _mm256_sub_ps(a, b);
+        }
+
+        static pen_inline f mul(f a, f b)
+        {
+            return _mm256_mul_ps(a, b);
+        }
+
+        static pen_inline f div(f a, f b)
+        {
+            return _mm256_div_ps(a, b);
+        }
+
+        static pen_inline f sqrt(f a)
+        {
+            return _mm256_sqrt_ps(a);
+        }
+
+        static pen_inline f abs(f a)
+        {
+            return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a);
+        }
+
+        static pen_inline f sign(f a)
+        {
+            return _mm256_or_ps(_mm256_and_ps(_mm256_set1_ps(-0.0f), a), _mm256_set1_ps(1.0f));
+        }
+
+        static pen_inline void store(f a, f32* out)
+        {
+            _mm256_store_ps(out, a);
+        }
+
+        // transposes the 4x4 in each 128 bit half
+        static pen_inline void transpose(f& r0, f& r1, f& r2, f& r3)
+        {
+            __m256 t0 = _mm256_unpacklo_ps(r0, r1);
+            __m256 t1 = _mm256_unpackhi_ps(r0, r1);
+            __m256 t2 = _mm256_unpacklo_ps(r2, r3);
+            __m256 t3 = _mm256_unpackhi_ps(r2, r3);
+            r0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+            r1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+            r2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+            r3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+        }
+
+        // 4 floats from each lane pointer, lanes 0-3 in the low half and 4-7 in the high half
+        static pen_inline void load4(const f32* const* p, f* out)
+        {
+            for (u32 k = 0; k < 4; ++k)
+                out[k] = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(p[k])), _mm_loadu_ps(p[k + 4]), 1);
+
+            transpose(out[0], out[1], out[2], out[3]);
+        }
+
+        static pen_inline void load3(const f32* const* p, f* out)
+        {
+            for (u32 k = 0; k < 3; ++k)
+                out[k] = _mm256_setr_ps(p[0][k], p[1][k], p[2][k], p[3][k], p[4][k], p[5][k], p[6][k], p[7][k]);
+        }
+
+        static pen_inline void store4(const f* in, f32* const* p)
+        {
+            __m256 r[4] = {in[0], in[1], in[2], in[3]};
+            transpose(r[0], r[1], r[2], r[3]);
+
+            for (u32 k = 0; k < 4; ++k)
+            {
+                _mm_storeu_ps(p[k], _mm256_castps256_ps128(r[k]));
+                _mm_storeu_ps(p[k + 4], _mm256_extractf128_ps(r[k], 1));
+            }
+        }
+    };
+#endif
+
+#if __SSE__ || __AVX__
+    //
+    // simd implementations, entities are gathered into lanes so each register holds one component of width entities
+    //
+
+    // the last entity is repeated to fill a partial batch, repeated lanes write the same result
+    pen_inline u32 lane_entity(const u32* entities, u32 i, u32 lane, u32 count)
+    {
+        return entities[min<u32>(i + lane, count - 1)];
+    }
+
+    // affine inverse transpose, matches inverse4x4 of the transposed matrix for affine world matrices
+    template <typename V>
+    void normal_matrix_lanes(const typename V::f* a, typename V::f* out)
+    {
+        typedef typename V::f f;
+
+        // a is the upper 3x3 as rows followed by the translation
+        f c00 = V::sub(V::mul(a[4], a[8]), V::mul(a[5], a[7]));
+        f c01 = V::sub(V::mul(a[5], a[6]), V::mul(a[3], a[8]));
+        f c02 = V::sub(V::mul(a[3], a[7]), V::mul(a[4], a[6]));
+        f c10 = V::sub(V::mul(a[2], a[7]), V::mul(a[1], a[8]));
+        f c11 = V::sub(V::mul(a[0], a[8]), V::mul(a[2], a[6]));
+        f c12 = V::sub(V::mul(a[1], a[6]), V::mul(a[0], a[7]));
+        f c20 = V::sub(V::mul(a[1], a[5]), V::mul(a[2], a[4]));
+        f c21 = V::sub(V::mul(a[2], a[3]), V::mul(a[0], a[5]));
+        f c22 = V::sub(V::mul(a[0], a[4]), V::mul(a[1], a[3]));
+
+        f det = V::add(V::add(V::mul(a[0], c00), V::mul(a[1], c01)), V::mul(a[2], c02));
+        f rdet = V::div(V::set1(1.0f), det);
+
+        f n[9] = {V::mul(c00, rdet), V::mul(c01, rdet), V::mul(c02, rdet), V::mul(c10, rdet), V::mul(c11, rdet),
+                  V::mul(c12, rdet), V::mul(c20, rdet), V::mul(c21, rdet), V::mul(c22, rdet)};
+
+        f zero = V::set1(0.0f);
+        for (u32 r = 0; r < 3; ++r)
+        {
+            out[r * 4 + 0] = n[r * 3 + 0];
+            out[r * 4 + 1] = n[r * 3 + 1];
+            out[r * 4 + 2] = n[r * 3 + 2];
+            out[r * 4 + 3] = zero;
+        }
+
+        // translation moves to the bottom row
+        for (u32 c = 0; c < 3; ++c)
+        {
+            f d = V::add(V::add(V::mul(a[9], n[c]), V::mul(a[10], n[3 + c])), V::mul(a[11], n[6 + c]));
+            out[12 + c] = V::sub(zero, d);
+        }
+        out[15] = V::set1(1.0f);
+    }
+
+    template <typename V>
+    void normalise_quat_lanes(typename V::f* q)
+    {
+        typedef typename V::f f;
+
+        f len2 = V::add(V::add(V::mul(q[0], q[0]), V::mul(q[1], q[1])), V::add(V::mul(q[2], q[2]), V::mul(q[3], q[3])));
+        f rlen = V::div(V::set1(1.0f), V::sqrt(len2));
+
+        for (u32 k = 0; k < 4; ++k)
+            q[k] = V::mul(q[k], rlen);
+    }
+
+    // translation * rotation * scale from a unit quaternion
+    template <typename V>
+    void trs_matrix_lanes(const typename V::f* q, const typename V::f* t, const typename V::f* s, typename V::f* m)
+    {
+        typedef typename V::f f;
+
+        f one = V::set1(1.0f);
+        f two = V::set1(2.0f);
+        f zero = V::set1(0.0f);
+
+        f x = q[0];
+        f y = q[1];
+        f z = q[2];
+        f qw = q[3];
+
+        f xx = V::mul(x, x);
+        f yy = V::mul(y, y);
+        f zz = V::mul(z, z);
+        f xy = V::mul(x, y);
+        f xz = V::mul(x, z);
+        f yz = V::mul(y, z);
+        f wx = V::mul(qw, x);
+        f wy = V::mul(qw, y);
+        f wz = V::mul(qw, z);
+
+        m[0] = V::mul(V::sub(one, V::mul(two, V::add(yy, zz))), s[0]);
+        m[1] = V::mul(V::mul(two, V::sub(xy, wz)), s[1]);
+        m[2] = V::mul(V::mul(two, V::add(xz, wy)), s[2]);
+        m[3] = t[0];
+        m[4] = V::mul(V::mul(two, V::add(xy, wz)), s[0]);
+        m[5] = V::mul(V::sub(one, V::mul(two, V::add(xx, zz))), s[1]);
+        m[6] = V::mul(V::mul(two, V::sub(yz, wx)), s[2]);
+        m[7] = t[1];
+        m[8] = V::mul(V::mul(two, V::sub(xz, wy)), s[0]);
+        m[9] = V::mul(V::mul(two, V::add(yz, wx)), s[1]);
+        m[10] = V::mul(V::sub(one, V::mul(two, V::add(xx, yy))), s[2]);
+        m[11] = t[2];
+        m[12] = zero;
+        m[13] = zero;
+        m[14] = zero;
+        m[15] = one;
+    }
+
+    template <typename V>
+    void compose_trs_simd(ecs_scene* scene, const u32* entities, u32 count)
+    {
+        typedef typename V::f f;
+        static const u32      w = V::width;
+
+        for (u32 i = 0; i < count; i += w)
+        {
+            const f32* q[w];
+            const f32* t[w];
+            const f32* s[w];
+            f32*       rows[4][w];
+            for (u32 j = 0; j < w; ++j)
+            {
+                u32            e = lane_entity(entities, i, j, count);
+                cmp_transform& tc = scene->transforms[e];
+
+                q[j] = &tc.rotation.x;
+                t[j] = &tc.translation.x;
+                s[j] = &tc.scale.x;
+
+                for (u32 r = 0; r < 4; ++r)
+                    rows[r][j] = &scene->local_matrices[e].m[r * 4];
+            }
+
+            f qv[4];
+            f tv[3];
+            f sv[3];
+            V::load4(q, qv);
+            V::load3(t, tv);
+            V::load3(s, sv);
+
+            normalise_quat_lanes<V>(qv);
+
+            f m[16];
+            trs_matrix_lanes<V>(qv, tv, sv, m);
+
+            for (u32 r = 0; r < 4; ++r)
+                V::store4(&m[r * 4], rows[r]);
+        }
+    }
+
+    // poses are read straight from the physics buffers by handle, bodies are offset back to the entity origin
+    template <typename V>
+    void rigid_body_poses_simd(ecs_scene* scene, const physics::pose_stream& poses, const u32* entities, u32 count)
+    {
+        typedef typename V::f f;
+        static const u32      w = V::width;
+
+        f    alpha = V::set1(poses.alpha);
+        bool interpolate = poses.alpha < 1.0f;
+
+        for (u32 i = 0; i < count; i += w)
+        {
+            const f32* q[w];
+            const f32* t[w];
+            const f32* pq[w];
+            const f32* pt[w];
+            const f32* o[w];
+            const f32* s[w];
+            f32*       rows[4][w];
+            for (u32 j = 0; j < w; ++j)
+            {
+                u32 e = lane_entity(entities, i, j, count);
+                u32 h = physics::pose_index(scene->physics_handles[e]);
+
+                q[j] = &poses.rotations[h].x;
+                t[j] = &poses.translations[h].x;
+                pq[j] = &poses.prev_rotations[h].x;
+                pt[j] = &poses.prev_translations[h].x;
+                o[j] = &scene->physics_offset[e].translation.x;
+                s[j] = &scene->transforms[e].scale.x;
+
+                for (u32 r = 0; r < 4; ++r)
+                    rows[r][j] = &scene->local_matrices[e].m[r * 4];
+            }
+
+            f qv[4];
+            f tv[3];
+            f ov[3];
+            f sv[3];
+            V::load4(q, qv);
+            V::load3(t, tv);
+            V::load3(o, ov);
+            V::load3(s, sv);
+
+            // normalised lerp along the shortest arc, steps are small enough that it matches a slerp
+            if (interpolate)
+            {
+                f pqv[4];
+                f ptv[3];
+                V::load4(pq, pqv);
+                V::load3(pt, ptv);
+
+                for (u32 k = 0; k < 3; ++k)
+                    tv[k] = V::add(ptv[k], V::mul(V::sub(tv[k], ptv[k]), alpha));
+
+                f d = V::add(V::add(V::mul(pqv[0], qv[0]), V::mul(pqv[1], qv[1])),
+                             V::add(V::mul(pqv[2], qv[2]), V::mul(pqv[3], qv[3])));
+                f sd = V::sign(d);
+
+                for (u32 k = 0; k < 4; ++k)
+                    qv[k] = V::add(pqv[k], V::mul(V::sub(V::mul(qv[k], sd), pqv[k]), alpha));
+            }
+
+            normalise_quat_lanes<V>(qv);
+
+            // the transform keeps the body position
+            alignas(32) f32 out[7][w];
+            for (u32 k = 0; k < 3; ++k)
+                V::store(tv[k], out[k]);
+
+            for (u32 k = 0; k < 4; ++k)
+                V::store(qv[k], out[3 + k]);
+
+            u32 lanes = min<u32>(count - i, w);
+            for (u32 j = 0; j < lanes; ++j)
+            {
+                cmp_transform& tc = scene->transforms[entities[i + j]];
+                tc.translation = vec3f(out[0][j], out[1][j], out[2][j]);
+                tc.rotation.x = out[3][j];
+                tc.rotation.y = out[4][j];
+                tc.rotation.z = out[5][j];
+                tc.rotation.w = out[6][j];
+            }
+
+            for (u32 k = 0; k < 3; ++k)
+                tv[k] = V::sub(tv[k], ov[k]);
+
+            f m[16];
+            trs_matrix_lanes<V>(qv, tv, sv, m);
+
+            for (u32 r = 0; r < 4; ++r)
+                V::store4(&m[r * 4], rows[r]);
+        }
+    }
+
+    // a 4x4 multiply is already 4 wide per row, so each matrix is done on its own without the transpose
+    void multiply_parents_simd128(ecs_scene* scene, const u32* entities, u32 count)
+    {
+        for (u32 i = 0; i < count; ++i)
+        {
+            u32 n = entities[i];
+            u32 parent = scene->parents[n];
+            if (parent == n)
+            {
+                scene->world_matrices[n] = scene->local_matrices[n];
+                continue;
+            }
+
+            mul4x4_simd128(scene->world_matrices[parent].m, scene->local_matrices[n].m, scene->world_matrices[n].m);
+        }
+    }
+
+    template <typename V>
+    void transform_aabbs_simd(ecs_scene* scene, const u32* entities, u32 count)
+    {
+        typedef typename V::f f;
+        static const u32      w = V::width;
+
+        f half = V::set1(0.5f);
+
+        for (u32 i = 0; i < count; i += w)
+        {
+            const f32* rows[3][w];
+            const f32* mn[w];
+            const f32* mx[w];
+            for (u32 j = 0; j < w; ++j)
+            {
+                u32 e = lane_entity(entities, i, j, count);
+                for (u32 r = 0; r < 3; ++r)
+                    rows[r][j] = &scene->world_matrices[e].m[r * 4];
+
+                mn[j] = &scene->bounding_volumes[e].min_extents.x;
+                mx[j] = &scene->bounding_volumes[e].max_extents.x;
+            }
+
+            f m[12];
+            for (u32 r = 0; r < 3; ++r)
+                V::load4(rows[r], &m[r * 4]);
+
+            f bmin[3];
+            f bmax[3];
+            V::load3(mn, bmin);
+            V::load3(mx, bmax);
+
+            f c[3];
+            f e[3];
+            for (u32 k = 0; k < 3; ++k)
+            {
+                c[k] = V::mul(V::add(bmin[k], bmax[k]), half);
+                e[k] = V::mul(V::sub(bmax[k], bmin[k]), half);
+            }
+
+            // centre by the full matrix, extent by the absolute rotation and scale, bones only keep the translation
+            alignas(32) f32 out[10][w];
+            f               ext2 = V::set1(0.0f);
+            for (u32 r = 0; r < 3; ++r)
+            {
+                f cr = m[r * 4 + 3];
+                f er = V::set1(0.0f);
+                for (u32 k = 0; k < 3; ++k)
+                {
+                    cr = V::add(cr, V::mul(m[r * 4 + k], c[k]));
+                    er = V::add(er, V::mul(V::abs(m[r * 4 + k]), e[k]));
+                }
+
+                ext2 = V::add(ext2, V::mul(er, er));
+                V::store(cr, out[r]);
+                V::store(er, out[3 + r]);
+                V::store(m[r * 4 + 3], out[7 + r]);
+            }
+            V::store(V::sqrt(ext2), out[6]);
+
+            u32 lanes = min<u32>(count - i, w);
+            for (u32 j = 0; j < lanes; ++j)
+            {
+                u32                  n = entities[i + j];
+                cmp_bounding_volume& bv = scene->bounding_volumes[n];
+
+                if (scene->entities[n] & e_cmp::bone)
+                {
+                    bv.transformed_min_extents = vec3f(out[7][j], out[8][j], out[9][j]);
+                    bv.transformed_max_extents = bv.transformed_min_extents;
+                    continue;
+                }
+
+                vec3f pos = vec3f(out[0][j], out[1][j], out[2][j]);
+                vec3f ext = vec3f(out[3][j], out[4][j], out[5][j]);
+
+                bv.transformed_min_extents = pos - ext;
+                bv.transformed_max_extents = pos + ext;
+                bv.radius = out[6][j];
+
+                cmp_pos_extent& pe = scene->pos_extent[n];
+                pe.pos.xyz = pos;
+                pe.extent.xyz = ext;
+                pe.extent.w = bv.radius;
+            }
+        }
+    }
+
+    template <typename V>
+    void normal_matrices_simd(ecs_scene* scene, const u32* entities, u32 count)
+    {
+        typedef typename V::f f;
+        static const u32      w = V::width;
+
+        for (u32 i = 0; i < count; i += w)
+        {
+            const f32* rows[3][w];
+            f32*       out_rows[4][w];
+            for (u32 j = 0; j < w; ++j)
+            {
+                u32 e = lane_entity(entities, i, j, count);
+                for (u32 r = 0; r < 3; ++r)
+                    rows[r][j] = &scene->world_matrices[e].m[r * 4];
+
+                for (u32 r = 0; r < 4; ++r)
+                    out_rows[r][j] = &scene->draw_call_data[e].world_matrix_inv_transpose.m[r * 4];
+            }
+
+            f m[12];
+            for (u32 r = 0; r < 3; ++r)
+                V::load4(rows[r], &m[r * 4]);
+
+            // upper 3x3 rows then translation
+            f a[12] = {m[0], m[1], m[2], m[4], m[5], m[6], m[8], m[9], m[10], m[3], m[7], m[11]};
+
+            f n[16];
+            normal_matrix_lanes<V>(a, n);
+
+            for (u32 r = 0; r < 4; ++r)
+                V::store4(&n[r * 4], out_rows[r]);
+        }
+    }
+#endif
+
+#if __AVX2__
+    // two rows of the result per register
+    void multiply_parents_simd256(ecs_scene* scene, const u32* entities, u32 count)
+    {
+        for (u32 i = 0; i < count; ++i)
+        {
+            u32 n = entities[i];
+            u32 parent = scene->parents[n];
+            if (parent == n)
+            {
+                scene->world_matrices[n] = scene->local_matrices[n];
+                continue;
+            }
+
+            const f32* a = scene->world_matrices[parent].m;
+            const f32* b = scene->local_matrices[n].m;
+            f32*       out = scene->world_matrices[n].m;
+
+            __m256 b0 = _mm256_broadcast_ps((const __m128*)&b[0]);
+            __m256 b1 = _mm256_broadcast_ps((const __m128*)&b[4]);
+            __m256 b2 = _mm256_broadcast_ps((const __m128*)&b[8]);
+            __m256 b3 = _mm256_broadcast_ps((const __m128*)&b[12]);
+
+            for (u32 r = 0; r < 4; r += 2)
+            {
+                __m256 ar = _mm256_loadu_ps(&a[r * 4]);
+                __m256 v = _mm256_mul_ps(_mm256_permute_ps(ar, _MM_SHUFFLE(0, 0, 0, 0)), b0);
+                v = _mm256_add_ps(v, _mm256_mul_ps(_mm256_permute_ps(ar, _MM_SHUFFLE(1, 1, 1, 1)), b1));
+                v = _mm256_add_ps(v, _mm256_mul_ps(_mm256_permute_ps(ar, _MM_SHUFFLE(2, 2, 2, 2)), b2));
+                v = _mm256_add_ps(v, _mm256_mul_ps(_mm256_permute_ps(ar, _MM_SHUFFLE(3, 3, 3, 3)), b3));
+                _mm256_storeu_ps(&out[r * 4], v);
+            }
+        }
+    }
+#endif
+
+    typedef void (*entity_kernel)(ecs_scene* scene, const u32* entities, u32 count);
+
+    entity_kernel s_compose_trs = nullptr;
+    entity_kernel s_multiply_parents = nullptr;
+    entity_kernel s_transform_aabbs = nullptr;
+    entity_kernel s_normal_matrices = nullptr;
+
+    void (*s_rigid_body_poses)(ecs_scene*, const physics::pose_stream&, const u32*, u32) = nullptr;
+} // namespace
+
+namespace put
+{
+    namespace ecs
+    {
+        void transform_hierarchy_clear(transform_hierarchy& th)
+        {
+            sb_clear(th.order);
+            sb_clear(th.level_start);
+            sb_clear(th.depth);
+            sb_clear(th.first_child);
+            sb_clear(th.next_sibling);
+            sb_clear(th.mark);
+            sb_clear(th.updated);
+            sb_clear(th.updated_level_start);
+            sb_clear(th.ancestors);
+            th.num_entities = 0;
+            th.physics_update = 0;
+        }
+
+        void compose_trs_scalar(ecs_scene* scene, const u32* entities, u32 count)
+        {
+            for (u32 i = 0; i < count; ++i)
+            {
+                u32            n = entities[i];
+                cmp_transform& t = scene->transforms[n];
+
+                // generate matrix from transform
+                mat4 rot_mat;
+                t.rotation.get_matrix(rot_mat);
+
+                mat4 translation_mat = mat::create_translation(t.translation);
+
+                mat4 scale_mat = mat::create_scale(t.scale);
+
+                scene->local_matrices[n] = translation_mat * rot_mat * scale_mat;
+            }
+        }
+
+        void rigid_body_poses_scalar(ecs_scene* scene, const physics::pose_stream& poses, const u32* entities,
+                                     u32 count)
+        {
+            f32 a = poses.alpha;
+
+            for (u32 i = 0; i < count; ++i)
+            {
+                u32            n = entities[i];
+                u32            h = physics::pose_index(scene->physics_handles[n]);
+                cmp_transform& t = scene->transforms[n];
+
+                vec3f tr = poses.translations[h];
+                quat  q = poses.rotations[h];
+
+                if (a < 1.0f)
+                {
+                    const vec3f& ptr = poses.prev_translations[h];
+                    const quat&  pq = poses.prev_rotations[h];
+
+                    tr = ptr + (tr - ptr) * a;
+
+                    f32 d = pq.x * q.x + pq.y * q.y + pq.z * q.z + pq.w * q.w;
+                    f32 sd = d < 0.0f ? -1.0f : 1.0f;
+                    q.x = pq.x + (q.x * sd - pq.x) * a;
+                    q.y = pq.y + (q.y * sd - pq.y) * a;
+                    q.z = pq.z + (q.z * sd - pq.z) * a;
+                    q.w = pq.w + (q.w * sd - pq.w) * a;
+                }
+
+                f32 rlen = 1.0f / sqrt(q.x * q.x + q.y * q.y + q.z * q.z + q.w * q.w);
+                q.x *= rlen;
+                q.y *= rlen;
+                q.z *= rlen;
+                q.w *= rlen;
+
+                t.translation = tr;
+                t.rotation = q;
+
+                mat4 rot_mat;
+                q.get_matrix(rot_mat);
+
+                mat4 translation_mat = mat::create_translation(tr - scene->physics_offset[n].translation);
+                mat4 scale_mat = mat::create_scale(t.scale);
+
+                scene->local_matrices[n] = translation_mat * rot_mat * scale_mat;
+            }
+        }
+
+        void multiply_parents_scalar(ecs_scene* scene, const u32* entities, u32 count)
+        {
+            for (u32 i = 0; i < count; ++i)
+            {
+                u32 n = entities[i];
+                u32 parent = scene->parents[n];
+                if (parent == n)
+                    scene->world_matrices[n] = scene->local_matrices[n];
+                else
+                    scene->world_matrices[n] = scene->world_matrices[parent] * scene->local_matrices[n];
+            }
+        }
+
+        void transform_aabbs_scalar(ecs_scene* scene, const u32* entities, u32 count)
+        {
+            for (u32 i = 0; i < count; ++i)
+            {
+                u32                  n = entities[i];
+                cmp_bounding_volume& bv = scene->bounding_volumes[n];
+                const mat4&          wm = scene->world_matrices[n];
+
+                if (scene->entities[n] & e_cmp::bone)
+                {
+                    bv.transformed_min_extents = bv.transformed_max_extents = wm.get_translation();
+                    continue;
+                }
+
+                // centre by the full matrix, extent by the absolute rotation and scale
+                vec3f centre = (bv.min_extents + bv.max_extents) * 0.5f;
+                vec3f half = (bv.max_extents - bv.min_extents) * 0.5f;
+
+                f32 p[3];
+                f32 e[3];
+                for (u32 r = 0; r < 3; ++r)
+                {
+                    const f32* row = &wm.m[r * 4];
+                    p[r] = row[0] * centre.x + row[1] * centre.y + row[2] * centre.z + row[3];
+                    e[r] = fabs(row[0]) * half.x + fabs(row[1]) * half.y + fabs(row[2]) * half.z;
+                }
+
+                vec3f pos = vec3f(p[0], p[1], p[2]);
+                vec3f ext = vec3f(e[0], e[1], e[2]);
+
+                bv.transformed_min_extents = pos - ext;
+                bv.transformed_max_extents = pos + ext;
+                bv.radius = mag(ext);
+
+                // pos extent for faster aabb and sphere culling
+                cmp_pos_extent& pe = scene->pos_extent[n];
+                pe.pos.xyz = pos;
+                pe.extent.xyz = ext;
+                pe.extent.w = bv.radius;
+            }
+        }
+
+        void normal_matrices_scalar(ecs_scene* scene, const u32* entities, u32 count)
+        {
+            for (u32 i = 0; i < count; ++i)
+            {
+                u32  n = entities[i];
+                mat4 invt = scene->world_matrices[n];
+
+                invt = invt.transposed();
+                invt = mat::inverse4x4(invt);
+
+                scene->draw_call_data[n].world_matrix_inv_transpose = invt;
+            }
+        }
+
+        void compose_trs(ecs_scene* scene, const u32* entities, u32 count)
+        {
+            if (!s_compose_trs)
+                transform_simd_init(false, false);
+
+            s_compose_trs(scene, entities, count);
+        }
+
+        void rigid_body_poses(ecs_scene* scene, const physics::pose_stream& poses, const u32* entities, u32 count)
+        {
+            if (!s_rigid_body_poses)
+                transform_simd_init(false, false);
+
+            s_rigid_body_poses(scene, poses, entities, count);
+        }
+
+        void multiply_parents(ecs_scene* scene, const u32* entities, u32 count)
+        {
+            if (!s_multiply_parents)
+                transform_simd_init(false, false);
+
+            s_multiply_parents(scene, entities, count);
+        }
+
+        void transform_aabbs(ecs_scene* scene, const u32* entities, u32 count)
+        {
+            if (!s_transform_aabbs)
+                transform_simd_init(false, false);
+
+            s_transform_aabbs(scene, entities, count);
+        }
+
+        void normal_matrices(ecs_scene* scene, const u32* entities, u32 count)
+        {
+            if (!s_normal_matrices)
+                transform_simd_init(false, false);
+
+            s_normal_matrices(scene, entities, count);
+        }
+
+        void transform_simd_init(bool sse, bool avx2)
+        {
+            s_compose_trs = &compose_trs_scalar;
+            s_rigid_body_poses = &rigid_body_poses_scalar;
+            s_multiply_parents = &multiply_parents_scalar;
+            s_transform_aabbs = &transform_aabbs_scalar;
+            s_normal_matrices = &normal_matrices_scalar;
+
+#if __SSE__ || __AVX__
+            if (sse)
+            {
+                s_compose_trs = &compose_trs_simd<simd128>;
+                s_rigid_body_poses = &rigid_body_poses_simd<simd128>;
+                s_multiply_parents = &multiply_parents_simd128;
+                s_transform_aabbs = &transform_aabbs_simd<simd128>;
+                s_normal_matrices = &normal_matrices_simd<simd128>;
+            }
+#endif
+
+#if __AVX2__
+            if (avx2)
+            {
+                s_compose_trs = &compose_trs_simd<simd256>;
+                s_rigid_body_poses = &rigid_body_poses_simd<simd256>;
+                s_multiply_parents = &multiply_parents_simd256;
+                s_transform_aabbs = &transform_aabbs_simd<simd256>;
+                s_normal_matrices = &normal_matrices_simd<simd256>;
+            }
+#endif
+        }
+
+        void update_transforms(ecs_scene* scene)
+        {
+            transform_hierarchy& th = scene->hierarchy;
+
+            bool full = (scene->flags & e_scene_flags::invalidate_transforms) || !th.level_start;
+            full |= th.num_entities != scene->num_entities;
+            if (full)
+            {
+                build_order(scene, th);
+                scene->flags &= ~e_scene_flags::invalidate_transforms;
+            }
+
+            reset(th.updated);
+            reset(th.updated_level_start);
+            reset(th.ancestors);
+
+            scene->renderable_extents.min = vec3f::flt_max();
+            scene->renderable_extents.max = -vec3f::flt_max();
+
+            // physics will not write this buffer until poses are next read on this thread, the jobs below can use it
+            physics::pose_stream poses = physics::get_pose_stream();
+
+            // serial pass over flags to find what moved, physics commands must be issued from this thread
+            u32 num_levels = sb_count(th.level_start) - 1;
+            for (u32 l = 0; l < num_levels; ++l)
+            {
+                sb_push(th.updated_level_start, sb_count(th.updated));
+
+                for (u32 i = th.level_start[l]; i < th.level_start[l + 1]; ++i)
+                {
+                    u32 n = th.order[i];
+                    u64 cmp = scene->entities[n];
+                    u64 state = scene->state_flags[n];
+
+                    // force physics entity to sync and ignore controlled transform
+                    if (state & e_state::sync_physics_transform)
+                    {
+                        scene->state_flags[n] &= ~e_state::sync_physics_transform;
+                        scene->entities[n] &= ~e_cmp::transform;
+                        cmp &= ~e_cmp::transform;
+                    }
+
+                    bool dirty = full;
+
+                    if (state & e_state::transform_dirty)
+                    {
+                        scene->state_flags[n] &= ~e_state::transform_dirty;
+                        dirty = true;
+                    }
+
+                    if (cmp & e_cmp::transform)
+                    {
+                        dirty = true;
+
+                        if ((cmp & e_cmp::physics) && scene->physics_data[n].type == e_physics_type::rigid_body)
+                        {
+                            u32            h = scene->physics_handles[n];
+                            cmp_transform& t = scene->transforms[n];
+                            cmp_transform& pt = scene->physics_offset[n];
+                            physics::set_transform(h, t.translation + pt.translation, t.rotation);
+                            physics::set_v3(h, vec3f::zero(), physics::e_cmd::set_angular_velocity);
+                            physics::set_v3(h, vec3f::zero(), physics::e_cmd::set_linear_velocity);
+                        }
+                    }
+                    else if (!dirty && (cmp & e_cmp::physics))
+                    {
+                        // sleeping or static bodies are not written again, so their stamp stays behind
+                        u32 h = physics::pose_index(scene->physics_handles[n]);
+                        dirty = has_pose(poses, h) && poses.stamps[h] > th.physics_update;
+                    }
+
+                    u32 p = scene->parents[n];
+                    if (p != n && th.mark[p] == e_mark::updated)
+                        dirty = true;
+
+                    if (!dirty)
+                    {
+                        add_renderable_extents(scene, n);
+                        continue;
+                    }
+
+                    th.mark[n] = e_mark::updated;
+                    sb_push(th.updated, n);
+
+                    // world matrix is changing, so the draw call cbuffer needs uploading
+                    scene->state_flags[n] |= e_state::draw_call_dirty;
+
+                    // ancestors bounds must be regrown, stop at one which is already marked
+                    for (u32 a = p; a != n && th.mark[a] == e_mark::none; a = scene->parents[a])
+                    {
+                        th.mark[a] = e_mark::ancestor;
+                        sb_push(th.ancestors, a);
+
+                        if (scene->parents[a] == a)
+                            break;
+                    }
+                }
+            }
+            sb_push(th.updated_level_start, sb_count(th.updated));
+            th.physics_update = poses.update;
+
+            // each depth in parallel, parents are final before their children start
+            transform_job job = {scene, th.updated, poses};
+            for (u32 l = 0; l < num_levels; ++l)
+            {
+                u32 start = th.updated_level_start[l];
+                u32 count = th.updated_level_start[l + 1] - start;
+
+                job.entities = th.updated + start;
+                jobs_parallel_for(count, k_batch_size, update_entities_job, &job);
+            }
+
+            // updated entities have only updated children, grow them bottom up
+            if (num_levels > 1)
+            {
+                for (s32 l = (s32)num_levels - 1; l >= 0; --l)
+                {
+                    u32 start = th.updated_level_start[l];
+                    u32 count = th.updated_level_start[l + 1] - start;
+
+                    job.entities = th.updated + start;
+                    jobs_parallel_for(count, k_batch_size, grow_entities_job, &job);
+                }
+            }
+
+            // ancestors of updated entities recompute their own bounds and regrow, deepest first
+            u32 num_ancestors = sb_count(th.ancestors);
+            std::sort(th.ancestors, th.ancestors + num_ancestors,
+                      [&th](u32 a, u32 b) { return th.depth[a] > th.depth[b]; });
+
+            transform_aabbs(scene, th.ancestors, num_ancestors);
+
+            for (u32 i = 0; i < num_ancestors; ++i)
+            {
+                u32 a = th.ancestors[i];
+                grow_by_children(scene, th, a);
+                th.mark[a] = e_mark::none;
+            }
+
+            u32 num_updated = sb_count(th.updated);
+            for (u32 i = 0; i < num_updated; ++i)
+            {
+                u32 n = th.updated[i];
+                add_renderable_extents(scene, n);
+                th.mark[n] = e_mark::none;
+            }
+        }
+    } // namespace ecs
+} // namespace put
@@ -0,0 +1,95 @@
+// ecs_transform.h
+// Copyright 2014 - 2019 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+// Dirty tracked update of the entity transform hierarchy and bounding volumes, spread across the job workers.
+// An entity is updated when it has e_cmp::transform, its rigid body was written to the physics pose stream since the
+// last update, it is flagged with e_state::transform_dirty or its parent was updated. Everything else keeps last
+// frames matrices and bounds. Rigid body poses are read from the pose stream in place and composed in batches.
+// Entities are kept in depth order so each depth can be processed in parallel once the depth above is final, bounds
+// are then grown by children bottom up, only for updated entities and their ancestors.
+// Adding, removing or reparenting entities sets e_scene_flags::invalidate_transforms, which rebuilds the depth order
+// and updates every entity.
+
+#pragma once
+
+#include "types.h"
+
+#if __SSE__ || __AVX__
+#include <xmmintrin.h>
+#endif
+
+namespace physics
+{
+    struct pose_stream;
+}
+
+namespace put
+{
+    namespace ecs
+    {
+        struct ecs_scene;
+
+        struct transform_hierarchy
+        {
+            u32* order = nullptr;       // allocated entities sorted by depth, parents before children
+            u32* level_start = nullptr; // offset into order for each depth, plus the end
+            u32* depth = nullptr;
+            s32* first_child = nullptr; // -1 for no children
+            s32* next_sibling = nullptr;
+            u8*  mark = nullptr;
+            u32* updated = nullptr;             // entities updated by the last update_transforms, in depth order
+            u32* updated_level_start = nullptr; // offset into updated for each depth, plus the end
+            u32* ancestors = nullptr;           // entities which only had their bounds regrown by updated children
+            u32  num_entities = 0;              // scene size the order was built for
+            u32  physics_update = 0;            // pose stream update consumed by the last update_transforms
+        };
+
+        // updates local and world matrices, bounding volumes, pos_extent and the scene renderable_extents
+        void update_transforms(ecs_scene* scene);
+        void transform_hierarchy_clear(transform_hierarchy& th);
+
+        // batch kernels over a list of entity indices, xxx_scalar versions are the cross platform reference
+        // compose_trs: local_matrices from transforms
+        // rigid_body_poses: transforms and local_matrices from the physics pose stream, interpolated by its alpha
+        // multiply_parents: world_matrices from the parent world matrix and local_matrices, parents must be up to date
+        // transform_aabbs: bounding volumes and pos_extent from world_matrices, using the transformed centre and extent
+        // normal_matrices: draw_call_data world_matrix_inv_transpose from world_matrices
+        void compose_trs_scalar(ecs_scene* scene, const u32* entities, u32 count);
+        void rigid_body_poses_scalar(ecs_scene* scene, const physics::pose_stream& poses, const u32* entities,
+                                     u32 count);
+        void multiply_parents_scalar(ecs_scene* scene, const u32* entities, u32 count);
+        void transform_aabbs_scalar(ecs_scene* scene, const u32* entities, u32 count);
+        void normal_matrices_scalar(ecs_scene* scene, const u32* entities, u32 count);
+
+        // replaced by sse or avx versions from simd_init where available and fall back to scalar
+        void compose_trs(ecs_scene* scene, const u32* entities, u32 count);
+        void rigid_body_poses(ecs_scene* scene, const physics::pose_stream& poses, const u32* entities, u32 count);
+        void multiply_parents(ecs_scene* scene, const u32* entities, u32 count);
+        void transform_aabbs(ecs_scene* scene, const u32* entities, u32 count);
+        void normal_matrices(ecs_scene* scene, const u32* entities, u32 count);
+
+        // called by simd_init with what the cpu supports
+        void transform_simd_init(bool sse, bool avx2);
+
+#if __SSE__ || __AVX__
+        // out = a * b for row major 4x4 matrices, used by the parent multiply and the skinning palette
+        pen_inline void mul4x4_simd128(const f32* a, const f32* b, f32* out)
+        {
+            __m128 b0 = _mm_loadu_ps(&b[0]);
+            __m128 b1 = _mm_loadu_ps(&b[4]);
+            __m128 b2 = _mm_loadu_ps(&b[8]);
+            __m128 b3 = _mm_loadu_ps(&b[12]);
+
+            for (u32 r = 0; r < 4; ++r)
+            {
+                __m128 v = _mm_mul_ps(_mm_set1_ps(a[r * 4 + 0]), b0);
+                v = _mm_add_ps(v, _mm_mul_ps(_mm_set1_ps(a[r * 4 + 1]), b1));
+                v = _mm_add_ps(v, _mm_mul_ps(_mm_set1_ps(a[r * 4 + 2]), b2));
+                v = _mm_add_ps(v, _mm_mul_ps(_mm_set1_ps(a[r * 4 + 3]), b3));
+                _mm_storeu_ps(&out[r * 4], v);
+            }
+        }
+#endif
+    } // namespace ecs
+} // namespace put
@@ -103,6 +103,7 @@ namespace put
                 scene->entities[i] |= e_cmp::allocated;
 
             scene->free_list_head = scene->free_list[end].next;
+            scene->flags |= e_scene_flags::invalidate_transforms;
 
             if (scene->free_list[start].prev)
             {
@@ -170,6 +171,7 @@ namespace put
                 }
 
                 scene->num_entities = std::max<u32>(end, scene->num_entities);
+                scene->flags |= e_scene_flags::invalidate_transforms;
             }
         }
 
@@ -194,7 +196,7 @@ namespace put
 
             u32 i = ii;
 
-            scene->flags |= e_scene_flags::invalidate_scene_tree;
+            scene->flags |= e_scene_flags::invalidate_scene_tree | e_scene_flags::invalidate_transforms;
 
             scene->num_entities = std::max<u32>(i + 1, scene->num_entities);
 
@@ -337,6 +339,7 @@ namespace put
                 return;
 
             scene->parents[child] = parent;
+            scene->flags |= e_scene_flags::invalidate_transforms;
 
             mat4 parent_mat = scene->world_matrices[parent];
 
@@ -393,7 +393,7 @@ namespace
         }
 
         // allocate mem and copy
-        tcp.data = pen::memory_alloc(tcp.data_size);
+        tcp.data = pen::memory_alloc(tcp.data_size, pen::e_mem_tag::loader);
 
         // copy texture data into the tcp storage
         memcpy(tcp.data, top_image_start, tcp.data_size);
@@ -427,15 +427,20 @@ namespace
     };
 
     pen::ring_buffer<hot_loader_cmd> s_hot_loader_cmd_buffer;
+    pen::job*                        s_hot_loader_job = nullptr;
 
     void* hot_loader_thread(void* params)
     {
         pen::job_thread_params* job_params = (pen::job_thread_params*)params;
 
         pen::job* p_thread_info = job_params->job_info;
-        pen::semaphore_post(p_thread_info->p_sem_continue, 1);
 
+        pen::memory_set_thread_tag(pen::e_mem_tag::loader);
+        pen::thread_set_name("hot_loader");
+
+        // create before continuing so commands can be put as soon as the job is created
         s_hot_loader_cmd_buffer.create(32);
+        pen::semaphore_post(p_thread_info->p_sem_continue, 1);
 
         for (;;)
         {
@@ -461,9 +466,9 @@ namespace
 
             if(pen::semaphore_try_wait(p_thread_info->p_sem_exit))
                 break;
-                
-            // plenty of sleep
-            pen::thread_sleep_ms(16);
+
+            // sleep until a command is put or we are asked to exit
+            pen::event_wait(p_thread_info->p_wake);
         }
 
         pen::semaphore_post(p_thread_info->p_sem_continue, 1);
@@ -498,7 +503,8 @@ namespace put
 {
     void init_hot_loader()
     {
-        pen::jobs_create_job(hot_loader_thread, 1024 * 1024, nullptr, pen::e_thread_start_flags::detached);
+        s_hot_loader_job =
+            pen::jobs_create_job(hot_loader_thread, 1024 * 1024, nullptr, pen::e_thread_start_flags::detached);
 
         pen::json pmbuild_config = pen::json::load_from_file("data/pmbuild_config.json");
         s_pmbuild_cmd = pmbuild_config["pmbuild"].as_str();
@@ -521,6 +527,7 @@ namespace put
             memcpy(cmd.cmdline, cmdline.c_str(), len);
             cmd.cmdline[len] = '\0';
             s_hot_loader_cmd_buffer.put(cmd);
+            pen::event_notify(s_hot_loader_job->p_wake);
 
             // wait 10 seconds
             s_timeout = 1000.0f * 10.0f;
@@ -5,6 +5,7 @@
 #include "pen.h"
 #include "pen_string.h"
 #include "physics_bullet.h"
+#include "profiler.h"
 #include "slot_resource.h"
 #include "timer.h"
 
@@ -25,6 +26,30 @@ namespace physics
     static pen::slot_resources           s_physics_slot_resources;
     static pen::slot_resources           s_p2p_slot_resources;
 
+    // handles given to the caller are versioned, the physics thread and the output buffers are indexed by slot.
+    // null and invalid handles pass through, in debug a stale handle asserts on use
+    u32 get_physics_slot(u32 handle)
+    {
+        if (handle == 0 || !is_valid(handle))
+            return handle;
+
+#if PEN_SLOT_RESOURCES_DEBUG
+        if (!pen::slot_resources_validate(&s_physics_slot_resources, handle))
+        {
+            PEN_ASSERT_MSG(0, "physics handle used after release");
+        }
+#endif
+        return pen::slot_resources_handle_slot(handle);
+    }
+
+    u32 get_physics_handle(u32 slot)
+    {
+        if (slot == 0 || !is_valid(slot))
+            return slot;
+
+        return pen::slot_resources_get_handle(&s_physics_slot_resources, slot);
+    }
+
     void exec_cmd(const physics_cmd& cmd)
     {
         switch (cmd.command_index)
@@ -51,6 +76,7 @@ namespace physics
 
             case e_cmd::add_rigid_body:
                 add_rb_internal(cmd.add_rb, cmd.resource_slot);
+                set_entity_handle(cmd.resource_slot, cmd.resource_handle);
                 break;
 
             case e_cmd::add_ghost_rigid_body:
@@ -95,6 +121,7 @@ namespace physics
 
             case e_cmd::add_compound_rb:
                 add_compound_rb_internal(cmd.add_compound_rb, cmd.resource_slot);
+                set_entity_handle(cmd.resource_slot, cmd.resource_handle);
                 break;
 
             case e_cmd::sync_compound_to_multi:
@@ -123,6 +150,7 @@ namespace physics
 
             case e_cmd::add_compound_shape:
                 add_compound_shape_internal(cmd.add_compound_rb.params, cmd.resource_slot);
+                set_entity_handle(cmd.resource_slot, cmd.resource_handle);
                 break;
 
             case e_cmd::attach_rb_to_compound:
@@ -151,6 +179,7 @@ namespace physics
 
             case e_cmd::add_constraint:
                 add_constraint_internal(cmd.add_constraint_params, cmd.resource_slot);
+                set_entity_handle(cmd.resource_slot, cmd.resource_handle);
                 break;
 
             case e_cmd::add_central_force:
@@ -166,6 +195,21 @@ namespace physics
             case e_cmd::step:
                 physics_update(cmd.dt);
                 break;
+            case e_cmd::set_fixed_timestep:
+                set_fixed_timestep_internal(cmd.fixed_timestep);
+                break;
+            case e_cmd::set_num_threads:
+                set_num_threads_internal(cmd.num_threads);
+                break;
+            case e_cmd::cast_batch:
+                cast_batch_internal(cmd.batch);
+                break;
+            case e_cmd::take_snapshot:
+                take_snapshot_internal(cmd.snapshot);
+                break;
+            case e_cmd::restore_snapshot:
+                restore_snapshot_internal(cmd.snapshot);
+                break;
 
             default:
                 break;
@@ -178,31 +222,50 @@ namespace physics
     void physics_consume_command_buffer()
     {
         pen::semaphore_post(p_physics_job_thread_info->p_sem_consume, 1);
+        pen::event_notify(p_physics_job_thread_info->p_wake);
         pen::semaphore_wait(p_physics_job_thread_info->p_sem_continue);
     }
 
+    // the physics thread only drains after a consume, so waiting on a full buffer would never return.
+    // instead kick a consume, which blocks until the physics thread has started draining, then try again.
+    void put_cmd(const physics_cmd& pc)
+    {
+        while (!s_cmd_buffer.put(pc))
+            physics_consume_command_buffer();
+    }
+
     void* physics_thread_main(void* params)
     {
         pen::job_thread_params* job_params = (pen::job_thread_params*)params;
         pen::job*               p_thread_info = job_params->job_info;
-        pen::semaphore_post(p_thread_info->p_sem_continue, 1);
 
         p_physics_job_thread_info = p_thread_info;
 
+        pen::memory_set_thread_tag(pen::e_mem_tag::physics);
+        pen::thread_set_name("physics");
+
         pen::slot_resources_init(&s_physics_slot_resources, 1024);
         pen::slot_resources_init(&s_p2p_slot_resources, 16);
 
         physics_initialise();
 
-        // space for 8192 commands
-        s_cmd_buffer.create(8192);
+        // space for 8192 commands, producers consume early when full
+        s_cmd_buffer.create(8192, pen::e_full_policy::fail);
+
+        // producers can put as soon as the job has started, so only signal once the buffer exists
+        pen::semaphore_post(p_thread_info->p_sem_continue, 1);
 
         for (;;)
         {
+            // sleep until there is a command buffer to consume or we are asked to exit
+            pen::event_wait(p_physics_job_thread_info->p_wake);
+
             if (pen::semaphore_try_wait(p_physics_job_thread_info->p_sem_consume))
             {
                 pen::semaphore_post(p_physics_job_thread_info->p_sem_continue, 1);
 
+                PEN_PROFILE_SCOPE("physics_exec_cmds");
+
                 physics_cmd* cmd = s_cmd_buffer.get();
                 while (cmd)
                 {
@@ -226,9 +289,9 @@ namespace physics
         physics_cmd pc;
         pc.command_index = cmd;
         memcpy(&pc.set_v3.data, &v3, sizeof(vec3f));
-        pc.set_v3.object_index = entity_index;
+        pc.set_v3.object_index = get_physics_slot(entity_index);
 
-        s_cmd_buffer.put(pc);
+        put_cmd(pc);
     }
 
     void set_float(const u32& entity_index, const f32& fval, u32 cmd)
@@ -236,9 +299,9 @@ namespace physics
         physics_cmd pc;
         pc.command_index = cmd;
         memcpy(&pc.set_float.data, &fval, sizeof(f32));
-        pc.set_float.object_index = entity_index;
+        pc.set_float.object_index = get_physics_slot(entity_index);
 
-        s_cmd_buffer.put(pc);
+        put_cmd(pc);
     }
 
     void set_transform(const u32& entity_index, const vec3f& position, const quat& quaternion)
@@ -247,9 +310,9 @@ namespace physics
         pc.command_index = e_cmd::set_transform;
         memcpy(&pc.set_transform.position, &position, sizeof(vec3f));
         memcpy(&pc.set_transform.rotation, &quaternion, sizeof(quat));
-        pc.set_transform.object_index = entity_index;
+        pc.set_transform.object_index = get_physics_slot(entity_index);
 
-        s_cmd_buffer.put(pc);
+        put_cmd(pc);
     }
 
     mat4 get_rb_matrix(const u32& entity_index)
@@ -258,20 +321,56 @@ namespace physics
             return mat4::create_identity();
             
         mat4* const& fb = g_readable_data.output_matrices.frontbuffer();
-        return fb[entity_index];
+        return fb[get_physics_slot(entity_index)];
     }
 
     maths::transform get_rb_transform(const u32& entity_index)
     {
-        maths::transform* const& fb = g_readable_data.output_transforms.frontbuffer();
-        return fb[entity_index];
+        const pose_stream& poses = get_pose_stream();
+        u32                slot = get_physics_slot(entity_index);
+
+        maths::transform t;
+        t.translation = poses.translations[slot];
+        t.rotation = poses.rotations[slot];
+        t.scale = vec3f::one();
+        return t;
+    }
+
+    maths::transform get_rb_interpolated_transform(const u32& entity_index)
+    {
+        const pose_stream& poses = get_pose_stream();
+        u32                slot = get_physics_slot(entity_index);
+
+        maths::transform t;
+        t.translation = poses.translations[slot];
+        t.rotation = poses.rotations[slot];
+        t.scale = vec3f::one();
+
+        if (poses.alpha >= 1.0f)
+            return t;
+
+        // bodies at rest return the exact transform
+        const vec3f& prev_translation = poses.prev_translations[slot];
+        const quat&  prev_rotation = poses.prev_rotations[slot];
+        if (memcmp(&prev_translation, &t.translation, sizeof(vec3f)) == 0 &&
+            memcmp(&prev_rotation, &t.rotation, sizeof(quat)) == 0)
+            return t;
+
+        t.translation = lerp(prev_translation, t.translation, poses.alpha);
+        t.rotation = slerp2(prev_rotation, t.rotation, poses.alpha);
+        return t;
+    }
+
+    const pose_stream& get_pose_stream()
+    {
+        return g_readable_data.output_poses.acquire();
     }
 
     bool has_rb_matrix(const u32& entity_index)
     {
         auto&        om = g_readable_data.output_matrices;
         mat4* const& fb = om._data[om._fb];
-        if (entity_index >= sb_count(fb))
+        if (get_physics_slot(entity_index) >= (u32)sb_count(fb))
             return false;
 
         return true;
@@ -286,10 +385,11 @@ namespace physics
 
         u32 resource_slot = pen::slot_resources_get_next(&s_physics_slot_resources);
         pc.resource_slot = resource_slot;
+        pc.resource_handle = get_physics_handle(resource_slot);
 
-        s_cmd_buffer.put(pc);
+        put_cmd(pc);
 
-        return resource_slot;
+        return pc.resource_handle;
     }
 
     u32 add_ghost_rb(const rigid_body_params& rbp)
@@ -301,10 +401,11 @@ namespace physics
 
         u32 resource_slot = pen::slot_resources_get_next(&s_physics_slot_resources);
         pc.resource_slot = resource_slot;
+        pc.resource_handle = get_physics_handle(resource_slot);
 
-        s_cmd_buffer.put(pc);
+        put_cmd(pc);
 
-        return resource_slot;
+        return pc.resource_handle;
     }
 
     u32 add_multibody(const multi_body_params& mbp)
@@ -316,10 +417,11 @@ namespace physics
 
         u32 resource_slot = pen::slot_resources_get_next(&s_physics_slot_resources);
         pc.resource_slot = resource_slot;
+        pc.resource_handle = get_physics_handle(resource_slot);
 
-        s_cmd_buffer.put(pc);
+        put_cmd(pc);
 
-        return resource_slot;
+        return pc.resource_handle;
     }
 
     void set_paused(bool val)
@@ -334,10 +436,10 @@ namespace physics
         pc.command_index = cmd;
 
         memcpy(&pc.set_multi_v3.data, &v3_data, sizeof(vec3f));
-        pc.set_multi_v3.multi_index = object_index;
+        pc.set_multi_v3.multi_index = get_physics_slot(object_index);
         pc.set_multi_v3.link_index = link_index;
 
-        s_cmd_buffer.put(pc);
+        put_cmd(pc);
     }
 
     u32 add_compound_rb(const compound_rb_params& crbp, u32** child_handles_out)
@@ -349,6 +451,7 @@ namespace physics
 
         u32 resource_slot = pen::slot_resources_get_next(&s_physics_slot_resources);
         pc.resource_slot = resource_slot;
+        pc.resource_handle = get_physics_handle(resource_slot);
 
         pc.add_compound_rb.children_handles = nullptr;
         *child_handles_out = nullptr;
@@ -356,12 +459,12 @@ namespace physics
         {
             u32 cs = pen::slot_resources_get_next(&s_physics_slot_resources);
             sb_push(pc.add_compound_rb.children_handles, cs);
-            sb_push(*child_handles_out, cs);
+            sb_push(*child_handles_out, get_physics_handle(cs));
         }
 
-        s_cmd_buffer.put(pc);
+        put_cmd(pc);
 
-        return resource_slot;
+        return pc.resource_handle;
     }
 
     void sync_compound_multi(const u32& compound_index, const u32& multi_index)
@@ -370,10 +473,10 @@ namespace physics
 
         pc.command_index = e_cmd::sync_compound_to_multi;
 
-        pc.sync_compound.compound_index = compound_index;
-        pc.sync_compound.multi_index = multi_index;
+        pc.sync_compound.compound_index = get_physics_slot(compound_index);
+        pc.sync_compound.multi_index = get_physics_slot(multi_index);
 
-        s_cmd_buffer.put(pc);
+        put_cmd(pc);
     }
 
     void sync_rigid_bodies(const u32& master, const u32& slave, const s32& link_index, u32 cmd)
@@ -382,11 +485,11 @@ namespace physics
 
         pc.command_index = cmd;
 
-        pc.sync_rb.master = master;
-        pc.sync_rb.slave = slave;
+        pc.sync_rb.master = get_physics_slot(master);
+        pc.sync_rb.slave = get_physics_slot(slave);
         pc.sync_rb.link_index = link_index;
 
-        s_cmd_buffer.put(pc);
+        put_cmd(pc);
     }
 
     u32 add_constraint(const constraint_params& crbp)
@@ -395,13 +498,16 @@ namespace physics
 
         pc.command_index = e_cmd::add_constraint;
         pc.add_constraint_params = crbp;
+        for (u32 i = 0; i < 2; ++i)
+            pc.add_constraint_params.rb_indices[i] = (s32)get_physics_slot((u32)crbp.rb_indices[i]);
 
         u32 resource_slot = pen::slot_resources_get_next(&s_physics_slot_resources);
         pc.resource_slot = resource_slot;
+        pc.resource_handle = get_physics_handle(resource_slot);
 
-        s_cmd_buffer.put(pc);
+        put_cmd(pc);
 
-        return resource_slot;
+        return pc.resource_handle;
     }
 
     void set_collision_group(const u32& object_index, const u32& group, const u32& mask)
@@ -412,7 +518,7 @@ namespace physics
         pc.set_group.group = group;
         pc.set_group.mask = mask;
 
-        s_cmd_buffer.put(pc);
+        put_cmd(pc);
     }
 
     u32 add_compound_shape(const compound_rb_params& crbp)
@@ -424,10 +530,11 @@ namespace physics
 
         u32 resource_slot = pen::slot_resources_get_next(&s_physics_slot_resources);
         pc.resource_slot = resource_slot;
+        pc.resource_handle = get_physics_handle(resource_slot);
 
-        s_cmd_buffer.put(pc);
+        put_cmd(pc);
 
-        return resource_slot;
+        return pc.resource_handle;
     }
 
     u32 attach_rb_to_compound(const attach_to_compound_params& params)
@@ -436,8 +543,10 @@ namespace physics
 
         pc.command_index = e_cmd::attach_rb_to_compound;
         pc.attach_compound = params;
+        pc.attach_compound.rb = get_physics_slot(params.rb);
+        pc.attach_compound.compound = get_physics_slot(params.compound);
 
-        s_cmd_buffer.put(pc);
+        put_cmd(pc);
 
         return 0;
     }
@@ -447,9 +556,9 @@ namespace physics
         physics_cmd pc;
 
         pc.command_index = e_cmd::remove_from_world;
-        pc.entity_index = entity_index;
+        pc.entity_index = get_physics_slot(entity_index);
 
-        s_cmd_buffer.put(pc);
+        put_cmd(pc);
     }
 
     void add_to_world(const u32& entity_index)
@@ -457,22 +566,27 @@ namespace physics
         physics_cmd pc;
 
         pc.command_index = e_cmd::add_to_world;
-        pc.entity_index = entity_index;
+        pc.entity_index = get_physics_slot(entity_index);
 
-        s_cmd_buffer.put(pc);
+        put_cmd(pc);
     }
 
     void release_entity(const u32& entity_index)
     {
-        if (!pen::slot_resources_free(&s_physics_slot_resources, entity_index))
+        // releases are always validated, a stale handle would otherwise free whichever body now owns its slot
+        if (!pen::slot_resources_validate(&s_physics_slot_resources, entity_index))
+            return;
+
+        u32 slot = pen::slot_resources_handle_slot(entity_index);
+        if (!pen::slot_resources_free(&s_physics_slot_resources, slot))
             return;
 
         physics_cmd pc;
 
         pc.command_index = e_cmd::release_entity;
-        pc.entity_index = entity_index;
+        pc.entity_index = slot;
 
-        s_cmd_buffer.put(pc);
+        put_cmd(pc);
     }
 
     void cast_ray(const ray_cast_params& rcp)
@@ -483,7 +597,7 @@ namespace physics
         physics_cmd pc;
         pc.command_index = e_cmd::cast_ray;
         pc.ray_cast = rcp;
-        s_cmd_buffer.put(pc);
+        put_cmd(pc);
     }
 
     void cast_sphere(const sphere_cast_params& scp)
@@ -494,7 +608,7 @@ namespace physics
         physics_cmd pc;
         pc.command_index = e_cmd::cast_sphere;
         pc.sphere_cast = scp;
-        s_cmd_buffer.put(pc);
+        put_cmd(pc);
     }
 
     cast_result cast_ray_immediate(const ray_cast_params& rcp)
@@ -507,12 +621,59 @@ namespace physics
         return cast_sphere_internal(scp);
     }
 
+    void cast_batch(query_batch* batch)
+    {
+        batch->complete = 0;
+
+        physics_cmd pc;
+        pc.command_index = e_cmd::cast_batch;
+        pc.batch = batch;
+        put_cmd(pc);
+    }
+
+    bool is_batch_complete(const query_batch* batch)
+    {
+        return batch->complete.load() != 0;
+    }
+
+    void take_snapshot(world_snapshot* snapshot)
+    {
+        snapshot->complete = 0;
+
+        physics_cmd pc;
+        pc.command_index = e_cmd::take_snapshot;
+        pc.snapshot = snapshot;
+        put_cmd(pc);
+    }
+
+    void restore_snapshot(world_snapshot* snapshot)
+    {
+        snapshot->complete = 0;
+
+        physics_cmd pc;
+        pc.command_index = e_cmd::restore_snapshot;
+        pc.snapshot = snapshot;
+        put_cmd(pc);
+    }
+
+    bool is_snapshot_complete(const world_snapshot* snapshot)
+    {
+        return snapshot->complete.load() != 0;
+    }
+
+    void release_snapshot(world_snapshot* snapshot)
+    {
+        sb_free(snapshot->data);
+        snapshot->data = nullptr;
+    }
+
     void contact_test(const contact_test_params& ctp)
     {
         physics_cmd pc;
         pc.command_index = e_cmd::contact_test;
         pc.contact_test = ctp;
-        s_cmd_buffer.put(pc);
+        pc.contact_test.entity = get_physics_slot(ctp.entity);
+        put_cmd(pc);
     }
 
     void step(f32 dt)
@@ -520,6 +681,28 @@ namespace physics
         physics_cmd pc;
         pc.command_index = e_cmd::step;
         pc.dt = dt;
-        s_cmd_buffer.put(pc);
+        put_cmd(pc);
+    }
+
+    void set_fixed_timestep(f32 step, u32 max_substeps)
+    {
+        physics_cmd pc;
+        pc.command_index = e_cmd::set_fixed_timestep;
+        pc.fixed_timestep.step = step;
+        pc.fixed_timestep.max_substeps = max_substeps;
+        put_cmd(pc);
+    }
+
+    void set_num_threads(u32 num_threads)
+    {
+        physics_cmd pc;
+        pc.command_index = e_cmd::set_num_threads;
+        pc.num_threads = num_threads;
+        put_cmd(pc);
+    }
+
+    step_stats get_step_stats()
+    {
+        return g_readable_data.output_stats.frontbuffer();
     }
 } // namespace physics
@@ -3,6 +3,7 @@
 
 #include "maths/maths.h"
 #include "memory.h"
+#include "slot_resource.h"
 #include "threads.h"
 
 namespace physics
@@ -48,7 +49,12 @@ namespace physics
             add_central_force,
             add_central_impulse,
             contact_test,
-            step
+            step,
+            set_fixed_timestep,
+            set_num_threads,
+            cast_batch,
+            take_snapshot,
+            restore_snapshot
         };
     }
 
@@ -246,6 +252,35 @@ namespace physics
         quat  rotation;
     };
 
+    struct fixed_timestep_params
+    {
+        f32 step;
+        u32 max_substeps;
+    };
+
+    struct step_stats
+    {
+        f32 step_ms = 0.0f;  // bullet stepSimulation time for the last update
+        u32 num_steps = 0;   // fixed steps taken in the last update, 1 when variable
+        u32 num_threads = 1; // threads bullet may use, including the physics thread
+        u32 num_bodies = 0;  // collision objects in the world
+    };
+
+    // rigid body poses indexed by pose_index(physics handle) as structure of arrays, written in place by the physics
+    // thread and triple buffered so the reader can hold one while physics writes the others. stamps hold the update
+    // which last wrote each pose, a reader which keeps the update it consumed last only has to visit bodies with a
+    // newer stamp.
+    struct pose_stream
+    {
+        vec3f* translations = nullptr;
+        quat*  rotations = nullptr;
+        vec3f* prev_translations = nullptr; // before the last fixed step
+        quat*  prev_rotations = nullptr;
+        u32*   stamps = nullptr;
+        u32    update = 0;   // update which wrote this buffer
+        f32    alpha = 1.0f; // accumulator / fixed step, 1 when variable
+    };
+
     struct sync_compound_multi_params
     {
         u32 compound_index;
@@ -327,6 +362,43 @@ namespace physics
         void (*callback)(const contact_test_results& result);
     };
 
+    namespace e_query
+    {
+        enum query_t
+        {
+            ray,
+            sphere, // sweeps a sphere of radius from -> to
+            contact // deepest contact between entity and the world, from and to are unused
+        };
+    }
+    typedef e_query::query_t query_type;
+
+    struct scene_query
+    {
+        u32   type = e_query::ray;
+        vec3f from = vec3f::zero();
+        vec3f to = vec3f::zero();
+        f32   radius = 0.0f;
+        u32   entity = 0;
+        u32   mask = 0xffffffff;
+        u32   group = 0xffffffff;
+    };
+
+    struct query_batch
+    {
+        const scene_query* queries = nullptr; // caller owned, must stay valid until complete
+        cast_result*       results = nullptr; // caller owned, num_queries entries, written by the physics thread
+        u32                num_queries = 0;
+        a_u32              complete = {0};    // fence, set once every result has been written
+    };
+
+    struct world_snapshot
+    {
+        u8*   data = nullptr; // stretchy buffer owned by the snapshot, reused by later takes
+        f32   time_ms = 0.0f; // physics thread time of the last take or restore
+        a_u32 complete = {0}; // fence, the snapshot must not be touched while a take or restore is in flight
+    };
+
     struct compound_rb_cmd
     {
         compound_rb_params params;
@@ -337,6 +409,7 @@ namespace physics
     {
         u32 command_index;
         u32 resource_slot;
+        u32 resource_handle; // versioned handle given to the caller for the entity a create cmd adds
 
         union {
             add_box_params             add_box;
@@ -359,6 +432,10 @@ namespace physics
             ray_cast_params            ray_cast;
             sphere_cast_params         sphere_cast;
             contact_test_params        contact_test;
+            query_batch*               batch;
+            world_snapshot*            snapshot;
+            fixed_timestep_params      fixed_timestep;
+            u32                        num_threads;
             f32                        dt;
         };
 
@@ -390,7 +467,30 @@ namespace physics
     cast_result cast_ray_immediate(const ray_cast_params& rcp);
     cast_result cast_sphere_immediate(const sphere_cast_params& scp);
 
+    // runs every query in one command on the physics thread, rays and sweeps are split across the job workers.
+    // results[i] holds the closest hit for queries[i] once is_batch_complete returns true, there are no callbacks.
+    void cast_batch(query_batch* batch);
+    bool is_batch_complete(const query_batch* batch);
+
+    // captures transforms, velocities and activation of every rigid and multi body plus constraint impulses into a
+    // binary blob between steps. restoring drops cached contacts and re-adds broadphase pairs in a fixed order, so
+    // replaying the same commands from a snapshot is bit exact with a fixed timestep and a single physics thread.
+    void take_snapshot(world_snapshot* snapshot);
+    void restore_snapshot(world_snapshot* snapshot);
+    bool is_snapshot_complete(const world_snapshot* snapshot);
+    void release_snapshot(world_snapshot* snapshot);
+
     void step(f32 dt);
+
+    // steps the world at a fixed rate from an accumulator of frame dt, up to max_substeps per update. bodies are
+    // allowed to sleep and only moving bodies are published. a step of 0 restores one variable step per update.
+    void set_fixed_timestep(f32 step, u32 max_substeps);
+
+    // the first call with more than 1 thread moves every body and constraint into bullet's multithreaded world, which
+    // runs narrowphase, island solving and integration on the pen job workers. 0 uses every worker.
+    void       set_num_threads(u32 num_threads);
+    step_stats get_step_stats();
+
     void set_v3(const u32& entity_index, const vec3f& v3, u32 cmd);
     void set_float(const u32& entity_index, const f32& fval, u32 cmd);
     void set_transform(const u32& entity_index, const vec3f& position, const quat& quaternion);
@@ -403,7 +503,18 @@ namespace physics
     bool             has_rb_matrix(const u32& entity_index);
     mat4             get_rb_matrix(const u32& entity_index);
     maths::transform get_rb_transform(const u32& entity_index);
+    maths::transform get_rb_interpolated_transform(const u32& entity_index); // between the last two fixed steps
     void             release_entity(const u32& entity_index);
 
+    // takes the latest poses from the user thread and hands the previous ones back to physics. the stream stays
+    // valid and unchanged until the next call, or the next get_rb_transform / get_rb_interpolated_transform
+    const pose_stream& get_pose_stream();
+
+    // physics handles are versioned, poses are indexed by the slot without the generation
+    pen_inline u32 pose_index(u32 physics_handle)
+    {
+        return pen::slot_resources_handle_slot(physics_handle);
+    }
+
 } // namespace physics
 #endif
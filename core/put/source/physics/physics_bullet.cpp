@@ -44,6 +44,134 @@ namespace physics
     static bullet_systems                s_bullet_systems;
     static pen::res_pool<physics_entity> s_entities;
 
+    struct fixed_step_state
+    {
+        f32 step = 0.0f; // 0 steps the world once per update with the frame dt
+        u32 max_substeps = 1;
+        f32 accumulator = 0.0f;
+    };
+    static fixed_step_state s_fixed_step;
+
+    struct parallel_for_range
+    {
+        const btIParallelForBody* body;
+        a_u32                     next;
+        u32                       end;
+        u32                       grain_size;
+    };
+
+    // each index is one thread, which takes grain sized ranges until the loop is done so uneven work still balances
+    void parallel_for_thread(u32 start, u32 end, void* user_data)
+    {
+        parallel_for_range* range = (parallel_for_range*)user_data;
+
+        for (u32 t = start; t < end; ++t)
+        {
+            for (;;)
+            {
+                u32 b = range->next.fetch_add(range->grain_size);
+                if (b >= range->end)
+                    break;
+
+                range->body->forLoop((s32)b, (s32)min(b + range->grain_size, range->end));
+            }
+        }
+    }
+
+    // runs bullet's parallel loops on the pen job workers, the physics thread works on the loop while it waits
+    class pen_task_scheduler : public btITaskScheduler
+    {
+      public:
+        pen_task_scheduler() : btITaskScheduler("pen_jobs")
+        {
+        }
+
+        int getMaxNumThreads() const BT_OVERRIDE
+        {
+            return min<s32>((s32)pen::jobs_get_num_workers() + 1, (s32)BT_MAX_THREAD_COUNT);
+        }
+
+        int getNumThreads() const BT_OVERRIDE
+        {
+            return m_num_threads;
+        }
+
+        void setNumThreads(int num_threads) BT_OVERRIDE
+        {
+            m_num_threads = max<s32>(min<s32>(num_threads, getMaxNumThreads()), 1);
+        }
+
+        void parallelFor(int begin, int end, int grain_size, const btIParallelForBody& body) BT_OVERRIDE
+        {
+            s32 count = end - begin;
+            grain_size = max<s32>(grain_size, 1);
+
+            if (m_num_threads <= 1 || count <= grain_size)
+            {
+                body.forLoop(begin, end);
+                return;
+            }
+
+            parallel_for_range range;
+            range.body = &body;
+            range.next = (u32)begin;
+            range.end = (u32)end;
+            range.grain_size = (u32)grain_size;
+
+            // no more tasks than threads so the thread count limits how many cores bullet uses
+            u32 num_tasks = min<u32>(m_num_threads, (count + grain_size - 1) / grain_size);
+            pen::jobs_parallel_for(num_tasks, 1, parallel_for_thread, &range);
+        }
+
+      private:
+        s32 m_num_threads = 1;
+    };
+    static pen_task_scheduler s_task_scheduler;
+
+    // per handle, owned by the physics thread. a body at rest is skipped by an output buffer which already holds its
+    // resting transform, which is any buffer written at or after the update the body last changed in
+    static maths::transform* s_prev_transforms = nullptr; // world transform before the last step
+    static u32*              s_changed = nullptr;         // update which last moved, added or teleported the body
+    static u32               s_update = 0;                // last update published
+
+    void grow_publish_state(u32 capacity)
+    {
+        u32 num = sb_count(s_changed);
+        if (num >= capacity)
+            return;
+
+        sb_add(s_changed, capacity - num);
+        sb_add(s_prev_transforms, capacity - num);
+
+        for (u32 i = num; i < capacity; ++i)
+        {
+            s_changed[i] = 0;
+            s_prev_transforms[i] = maths::transform();
+        }
+    }
+
+    // for bodies which are teleported or added, there is nothing to interpolate from
+    void reset_published(u32 handle, const btTransform& world)
+    {
+        grow_publish_state(handle + 1);
+        s_prev_transforms[handle] = from_bttransform(world);
+        s_changed[handle] = s_update + 1;
+    }
+
+    pen_inline bool is_moving(const btRigidBody* rb)
+    {
+        return !rb->isStaticObject() && rb->isActive();
+    }
+
+    // dynamic bodies may only sleep with a fixed step, in variable mode every body is published each step as before
+    pen_inline s32 get_activation_state(const btRigidBody* rb)
+    {
+        if (s_fixed_step.step > 0.0f && !rb->isStaticOrKinematicObject())
+            return ACTIVE_TAG;
+
+        return DISABLE_DEACTIVATION;
+    }
+
     btTransform get_bttransform(const vec3f& p, const quat& q)
     {
         btTransform trans;
@@ -229,7 +357,7 @@ namespace physics
         }
 
         body->setContactProcessingThreshold(BT_LARGE_FLOAT);
-        body->setActivationState(DISABLE_DEACTIVATION);
+        body->forceActivationState(get_activation_state(body));
 
         if (!ghost)
         {
@@ -239,14 +367,33 @@ namespace physics
         return body;
     }
 
+    void* bullet_alloc_aligned(size_t size, int alignment)
+    {
+        return pen::memory_alloc_align(size, alignment);
+    }
+
+    void bullet_free_aligned(void* mem)
+    {
+        pen::memory_free_align(mem);
+    }
+
     void physics_initialise()
     {
+        // route bullet allocations through pen so they are tracked under the physics tag of this thread
+        btAlignedAllocSetCustomAligned(bullet_alloc_aligned, bullet_free_aligned);
+
+        // the physics thread must be the first to ask bullet for a thread index, it becomes bullet's main thread
+        btSetTaskScheduler(&s_task_scheduler);
+
         s_entities.init(1024);
 
         g_readable_data.output_matrices._data[0] = nullptr;
         g_readable_data.output_matrices._data[1] = nullptr;
-        g_readable_data.output_transforms._data[0] = nullptr;
-        g_readable_data.output_transforms._data[1] = nullptr;
+        g_readable_data.output_poses._data[0] = pose_stream();
+        g_readable_data.output_poses._data[1] = pose_stream();
+        g_readable_data.output_poses._data[2] = pose_stream();
+        g_readable_data.output_stats._data[0] = step_stats();
+        g_readable_data.output_stats._data[1] = step_stats();
 
         s_bullet_systems.collision_config = new btDefaultCollisionConfiguration();
         s_bullet_systems.dispatcher = new btCollisionDispatcher(s_bullet_systems.collision_config);
@@ -259,116 +406,342 @@ namespace physics
         s_bullet_systems.dynamics_world->setGravity(btVector3(0, -10, 0));
     }
 
+    // rows of the basis with the origin in the last column, the same layout as our row major matrices
+    pen_inline void write_matrix(mat4& out, const btTransform& bt)
+    {
+        const btMatrix3x3& basis = bt.getBasis();
+        const btVector3&   origin = bt.getOrigin();
+
+        for (u32 r = 0; r < 3; ++r)
+        {
+            out.m[r * 4 + 0] = basis[r].getX();
+            out.m[r * 4 + 1] = basis[r].getY();
+            out.m[r * 4 + 2] = basis[r].getZ();
+            out.m[r * 4 + 3] = origin[r];
+        }
+
+        out.m[12] = 0.0f;
+        out.m[13] = 0.0f;
+        out.m[14] = 0.0f;
+        out.m[15] = 1.0f;
+    }
+
+    pen_inline void write_pose(pose_stream& poses, u32 i, const btTransform& cur, const btTransform& prev)
+    {
+        poses.translations[i] = from_btvector(cur.getOrigin());
+        poses.rotations[i] = from_btquat(cur.getRotation());
+        poses.prev_translations[i] = from_btvector(prev.getOrigin());
+        poses.prev_rotations[i] = from_btquat(prev.getRotation());
+        poses.stamps[i] = poses.update;
+    }
+
     void update_output_matrices()
     {
-        mat4*&             bb_mats = g_readable_data.output_matrices.backbuffer();
-        maths::transform*& bb_transforms = g_readable_data.output_transforms.backbuffer();
+        mat4*&       bb_mats = g_readable_data.output_matrices.backbuffer();
+        pose_stream& bb_poses = g_readable_data.output_poses.backbuffer();
 
-        u32 num = sb_count(bb_mats);
+        u32 capacity = s_entities._capacity;
+        grow_publish_state(capacity);
 
-        for (u32 i = 0; i < s_entities._capacity; i++)
+        for (u32 i = sb_count(bb_mats); i < capacity; ++i)
+            sb_push(bb_mats, mat4::create_identity());
+
+        for (u32 i = sb_count(bb_poses.stamps); i < capacity; ++i)
         {
-            if (i >= num)
-            {
-                ++num;
-                sb_push(bb_mats, mat4::create_identity());
-                sb_push(bb_transforms, maths::transform());
-            }
+            sb_push(bb_poses.translations, vec3f::zero());
+            sb_push(bb_poses.rotations, quat());
+            sb_push(bb_poses.prev_translations, vec3f::zero());
+            sb_push(bb_poses.prev_rotations, quat());
+            sb_push(bb_poses.stamps, 0);
+        }
+
+        bool interpolate = s_fixed_step.step > 0.0f;
 
+        // the matrices alternate so their back buffer was written the update before last, the pose buffer handed
+        // back by the reader may have missed any number of updates while it was held
+        u32 update = ++s_update;
+        u32 mats_written = update > 2 ? update - 2 : 0;
+        u32 poses_written = bb_poses.update;
+
+        bb_poses.update = update;
+        bb_poses.alpha = interpolate ? s_fixed_step.accumulator / s_fixed_step.step : 1.0f;
+
+        for (u32 i = 0; i < capacity; i++)
+        {
             physics_entity& entity = s_entities.get(i);
 
-            switch (entity.type)
-            {
-                case ENTITY_RIGID_BODY:
-                {
-                    btRigidBody* p_rb = entity.rb.rigid_body;
-                    if (!p_rb)
-                        continue;
+            if (entity.type != ENTITY_RIGID_BODY && entity.type != ENTITY_COMPOUND_RIGID_BODY)
+                continue;
 
-                    btTransform rb_transform = p_rb->getWorldTransform();
+            btRigidBody* p_rb = entity.rb.rigid_body;
+            if (!p_rb)
+                continue;
 
-                    btScalar _mm[16];
+            // sleeping and static bodies are skipped by buffers which already hold their resting transform
+            bool moving = is_moving(p_rb);
+            if (moving)
+                s_changed[i] = update;
 
-                    rb_transform.getOpenGLMatrix(_mm);
+            bool write_mats = s_changed[i] > mats_written;
+            bool write_poses = s_changed[i] > poses_written;
+            if (!write_mats && !write_poses)
+                continue;
 
-                    for (s32 m = 0; m < 16; ++m)
-                        bb_mats[i].m[m] = _mm[m];
+            btTransform rb_transform = p_rb->getWorldTransform();
+            btTransform prev_transform = rb_transform;
 
-                    bb_mats[i].transpose();
-                    bb_transforms[i] = from_bttransform(rb_transform);
-                }
-                break;
+            // at rest there is nothing to interpolate, the next step to wake the body starts from here
+            if (moving && interpolate)
+                prev_transform = get_bttransform(s_prev_transforms[i].translation, s_prev_transforms[i].rotation);
+            else
+                s_prev_transforms[i] = from_bttransform(rb_transform);
 
-                case ENTITY_COMPOUND_RIGID_BODY:
-                {
-                    btCompoundShape* p_compound = entity.compound_shape;
-                    btRigidBody*     p_rb = entity.rb.rigid_body;
+            if (write_mats)
+                write_matrix(bb_mats[i], rb_transform);
 
-                    btTransform rb_transform = p_rb->getWorldTransform();
+            if (write_poses)
+                write_pose(bb_poses, i, rb_transform, prev_transform);
 
-                    btScalar _mm[16];
+            btCompoundShape* p_compound = entity.compound_shape;
+            if (entity.type != ENTITY_COMPOUND_RIGID_BODY || !p_compound)
+                continue;
 
-                    rb_transform.getOpenGLMatrix(_mm);
+            u32 num_shapes = p_compound->getNumChildShapes();
+            for (u32 j = 0; j < num_shapes; ++j)
+            {
+                btTransform       child = p_compound->getChildTransform(j);
+                btCollisionShape* shape = p_compound->getChildShape(j);
+                u32               ph = shape->getUserIndex();
 
-                    for (s32 m = 0; m < 16; ++m)
-                        bb_mats[i].m[m] = _mm[m];
+                if (!is_valid(ph))
+                    continue;
 
-                    bb_mats[i].transpose();
+                btTransform child_world = rb_transform * child;
 
-                    if (p_compound)
-                    {
-                        u32 num_shapes = p_compound->getNumChildShapes();
-                        for (u32 j = 0; j < num_shapes; ++j)
-                        {
-                            if (p_rb)
-                            {
-                                btTransform       base = p_rb->getWorldTransform();
-                                btTransform       child = p_compound->getChildTransform(j);
-                                btCollisionShape* shape = p_compound->getChildShape(j);
-                                u32               ph = shape->getUserIndex();
+                if (write_mats)
+                    write_matrix(bb_mats[ph], child_world);
 
-                                if (!is_valid(ph))
-                                    continue;
+                if (write_poses)
+                    write_pose(bb_poses, ph, child_world, prev_transform * child);
+            }
+        }
 
-                                btTransform child_world = base * child;
+        // matrices go last, readers check their size before reading the stats buffer
+        g_readable_data.output_stats.swap_buffers();
+        g_readable_data.output_poses.publish();
+        g_readable_data.output_matrices.swap_buffers();
+    }
 
-                                btScalar _mm[16];
+    void store_prev_transforms()
+    {
+        for (u32 i = 0; i < s_entities._capacity; i++)
+        {
+            physics_entity& entity = s_entities.get(i);
 
-                                child_world.getOpenGLMatrix(_mm);
+            if (entity.type != ENTITY_RIGID_BODY && entity.type != ENTITY_COMPOUND_RIGID_BODY)
+                continue;
 
-                                for (s32 m = 0; m < 16; ++m)
-                                    bb_mats[ph].m[m] = _mm[m];
+            // bodies at rest already hold their resting transform
+            btRigidBody* p_rb = entity.rb.rigid_body;
+            if (p_rb && is_moving(p_rb))
+                s_prev_transforms[i] = from_bttransform(p_rb->getWorldTransform());
+        }
+    }
 
-                                bb_mats[ph].transpose();
-                                bb_transforms[ph] = from_bttransform(child_world);
-                            }
-                        }
-                    }
-                }
-                break;
+    u32 fixed_update(f32 dt)
+    {
+        f32 step = s_fixed_step.step;
+        s_fixed_step.accumulator += dt;
 
-                default:
-                    break;
-            }
+        u32 num_steps = (u32)(s_fixed_step.accumulator / step);
+        if (num_steps > s_fixed_step.max_substeps)
+        {
+            // drop the time we cannot catch up on instead of falling further behind each update
+            num_steps = s_fixed_step.max_substeps;
+            s_fixed_step.accumulator = step * (f32)num_steps;
         }
 
-        g_readable_data.output_matrices.swap_buffers();
-        g_readable_data.output_transforms.swap_buffers();
+        if (num_steps == 0)
+            return 0;
+
+        grow_publish_state(s_entities._capacity);
+
+        for (u32 i = 0; i < num_steps; ++i)
+        {
+            // the output interpolates across the last step
+            if (i == num_steps - 1)
+                store_prev_transforms();
+
+            s_bullet_systems.dynamics_world->stepSimulation(step, 0, step);
+        }
+
+        s_fixed_step.accumulator = max(s_fixed_step.accumulator - step * (f32)num_steps, 0.0f);
+        return num_steps;
     }
 
     void physics_update(f32 dt)
     {
+        static pen::timer* step_timer = pen::timer_create();
+
+        step_stats stats;
+        stats.num_threads = s_bullet_systems.multithreaded ? s_task_scheduler.getNumThreads() : 1;
+        stats.num_bodies = s_bullet_systems.dynamics_world->getNumCollisionObjects();
+
         // step
         if (!g_readable_data.b_paused)
         {
-            s_bullet_systems.dynamics_world->stepSimulation(dt);
+            pen::timer_start(step_timer);
+
+            if (s_fixed_step.step > 0.0f)
+            {
+                stats.num_steps = fixed_update(dt);
+            }
+            else
+            {
+                s_bullet_systems.dynamics_world->stepSimulation(dt);
+                stats.num_steps = 1;
+            }
+
+            stats.step_ms = (f32)pen::timer_elapsed_ms(step_timer);
         }
 
+        g_readable_data.output_stats.backbuffer() = stats;
 
         // update mats
         update_output_matrices();
     }
 
+    void set_fixed_timestep_internal(const fixed_timestep_params& params)
+    {
+        s_fixed_step.step = max(params.step, 0.0f);
+        s_fixed_step.max_substeps = max<u32>(params.max_substeps, 1);
+        s_fixed_step.accumulator = 0.0f;
+
+        for (u32 i = 0; i < s_entities._capacity; i++)
+        {
+            physics_entity& entity = s_entities.get(i);
+
+            if (entity.type != ENTITY_RIGID_BODY && entity.type != ENTITY_COMPOUND_RIGID_BODY)
+                continue;
+
+            btRigidBody* p_rb = entity.rb.rigid_body;
+            if (!p_rb)
+                continue;
+
+            p_rb->forceActivationState(get_activation_state(p_rb));
+            reset_published(i, p_rb->getWorldTransform());
+        }
+    }
+
+    bool has_constraint_ref(btRigidBody& rb, btTypedConstraint* constraint)
+    {
+        for (s32 i = 0; i < rb.getNumConstraintRefs(); ++i)
+            if (rb.getConstraintRef(i) == constraint)
+                return true;
+
+        return false;
+    }
+
+    // moves everything from the single threaded world into a new multithreaded one, contact caches are rebuilt
+    void create_mt_world()
+    {
+        struct world_body
+        {
+            btRigidBody* rb;
+            s32          group;
+            s32          mask;
+            btVector3    gravity;
+        };
+
+        struct world_constraint
+        {
+            btTypedConstraint* constraint;
+            bool               disable_collisions;
+        };
+
+        btDynamicsWorld* prev_world = s_bullet_systems.dynamics_world;
+        btVector3        gravity = prev_world->getGravity();
+
+        btAlignedObjectArray<world_constraint> constraints;
+        for (s32 i = 0; i < prev_world->getNumConstraints(); ++i)
+        {
+            world_constraint wc;
+            wc.constraint = prev_world->getConstraint(i);
+            wc.disable_collisions = has_constraint_ref(wc.constraint->getRigidBodyA(), wc.constraint);
+            constraints.push_back(wc);
+        }
+
+        for (s32 i = 0; i < constraints.size(); ++i)
+            prev_world->removeConstraint(constraints[i].constraint);
+
+        // ghosts and compound children are not in the world and stay out of it
+        btAlignedObjectArray<world_body> bodies;
+        btCollisionObjectArray&          objects = prev_world->getCollisionObjectArray();
+        for (s32 i = 0; i < objects.size(); ++i)
+        {
+            world_body wb;
+            wb.rb = btRigidBody::upcast(objects[i]);
+            if (!wb.rb)
+                continue;
+
+            wb.group = objects[i]->getBroadphaseHandle()->m_collisionFilterGroup;
+            wb.mask = objects[i]->getBroadphaseHandle()->m_collisionFilterMask;
+            wb.gravity = wb.rb->getGravity();
+            bodies.push_back(wb);
+        }
+
+        for (s32 i = 0; i < bodies.size(); ++i)
+            prev_world->removeRigidBody(bodies[i].rb);
+
+        delete prev_world;
+        delete s_bullet_systems.solver;
+        delete s_bullet_systems.dispatcher;
+
+        btConstraintSolverPoolMt* solver_pool = new btConstraintSolverPoolMt(s_task_scheduler.getMaxNumThreads());
+
+        s_bullet_systems.dispatcher = new btCollisionDispatcherMt(s_bullet_systems.collision_config);
+        s_bullet_systems.solver = solver_pool;
+        s_bullet_systems.dynamics_world = new btDiscreteDynamicsWorldMt(
+            s_bullet_systems.dispatcher, s_bullet_systems.olp_cache, solver_pool, s_bullet_systems.collision_config);
+
+        s_bullet_systems.dynamics_world->setGravity(gravity);
+
+        // same order as before so the simulation stays deterministic, add overwrites per body gravity
+        for (s32 i = 0; i < bodies.size(); ++i)
+        {
+            s_bullet_systems.dynamics_world->addRigidBody(bodies[i].rb, bodies[i].group, bodies[i].mask);
+            bodies[i].rb->setGravity(bodies[i].gravity);
+        }
+
+        for (s32 i = 0; i < constraints.size(); ++i)
+        {
+            const world_constraint& wc = constraints[i];
+            s_bullet_systems.dynamics_world->addConstraint(wc.constraint, wc.disable_collisions);
+        }
+
+        s_bullet_systems.multithreaded = true;
+    }
+
+    void set_num_threads_internal(u32 num_threads)
+    {
+#if BT_THREADSAFE
+        if (num_threads == 0)
+            num_threads = s_task_scheduler.getMaxNumThreads();
+
+        s_task_scheduler.setNumThreads(num_threads);
+
+        if (num_threads > 1 && !s_bullet_systems.multithreaded)
+            create_mt_world();
+#else
+        PEN_LOG("[physics] bullet was built without BT_THREADSAFE, the world stays single threaded\n");
+#endif
+    }
+
+    void set_entity_handle(u32 resource_slot, u32 handle)
+    {
+        s_entities.get(resource_slot).handle = handle;
+    }
+
     void add_rb_internal(const rigid_body_params& params, u32 resource_slot, bool ghost)
     {
         s_entities.grow(resource_slot);
@@ -387,6 +760,8 @@ namespace physics
         PEN_ASSERT(rb);
 
         entity.type = ENTITY_RIGID_BODY;
+
+        reset_published(resource_slot, rb->getWorldTransform());
     }
 
     void add_compound_rb_internal(const compound_rb_cmd& cmd, u32 resource_slot)
@@ -416,6 +791,8 @@ namespace physics
         entity.mask = cmd.params.base.mask;
 
         entity.type = ENTITY_COMPOUND_RIGID_BODY;
+
+        reset_published(resource_slot, entity.rb.rigid_body->getWorldTransform());
     }
 
     void add_compound_shape_internal(const compound_rb_params& params, u32 resource_slot)
@@ -602,6 +979,10 @@ namespace physics
                 rb->getMotionState()->setWorldTransform(bt_trans);
                 rb->setCenterOfMassTransform(bt_trans);
             }
+
+            // wake bodies which were sleeping so they fall from the new transform
+            rb->activate();
+            reset_published(cmd.object_index, bt_trans);
         }
     }
 
@@ -870,6 +1251,7 @@ namespace physics
                 pe.type = ENTITY_RIGID_BODY;
 
                 rb.rigid_body->setWorldTransform(base * compound_child);
+                reset_published(params.rb, base * compound_child);
             }
             else
             {
@@ -910,6 +1292,9 @@ namespace physics
                 //s_bullet_systems.dynamics_world->removeRigidBody(compound.rb.rigid_body);
                 s_bullet_systems.dynamics_world->removeRigidBody(rb.rigid_body);
             }
+
+            // the set of children changed, sleeping compounds would not publish them
+            reset_published(params.compound, base);
         }
     }
 
@@ -946,74 +1331,84 @@ namespace physics
         s_bullet_systems.dynamics_world->addRigidBody(pe.rb.rigid_body, pe.group, pe.mask);
     }
 
-    cast_result cast_ray_internal(const ray_cast_params& rcp)
+    void ray_query(const vec3f& start, const vec3f& end, u32 group, u32 mask, cast_result& result)
     {
-        btVector3 from = from_vec3(rcp.start);
-        btVector3 to = from_vec3(rcp.end);
+        btVector3 from = from_vec3(start);
+        btVector3 to = from_vec3(end);
 
         btCollisionWorld::ClosestRayResultCallback ray_callback(from, to);
-        ray_callback.m_collisionFilterMask = rcp.mask;
-        ray_callback.m_collisionFilterGroup = rcp.group;
-
-        cast_result rcr;
-        rcr.user_data = rcp.user_data;
+        ray_callback.m_collisionFilterMask = mask;
+        ray_callback.m_collisionFilterGroup = group;
 
-        rcr.physics_handle = -1;
+        result.physics_handle = -1;
         s_bullet_systems.dynamics_world->rayTest(from, to, ray_callback);
         if (ray_callback.hasHit())
         {
-            rcr.point = from_btvector(ray_callback.m_hitPointWorld);
-            rcr.normal = from_btvector(ray_callback.m_hitNormalWorld);
+            result.point = from_btvector(ray_callback.m_hitPointWorld);
+            result.normal = from_btvector(ray_callback.m_hitNormalWorld);
 
             btRigidBody* body = (btRigidBody*)btRigidBody::upcast(ray_callback.m_collisionObject);
 
             if (body)
             {
-                rcr.physics_handle = body->getUserIndex();
-                rcr.set = true;
+                result.physics_handle = get_physics_handle(body->getUserIndex());
+                result.set = true;
             }
         }
-
-        if (rcp.callback)
-            rcp.callback(rcr);
-
-        return rcr;
     }
 
-    cast_result cast_sphere_internal(const sphere_cast_params& scp)
+    void sphere_query(const vec3f& start, const vec3f& end, f32 radius, u32 group, u32 mask, cast_result& result)
     {
-        btTransform from = get_bttransform(scp.from, quat());
-        btTransform to = get_bttransform(scp.to, quat());
+        btTransform from = get_bttransform(start, quat());
+        btTransform to = get_bttransform(end, quat());
 
-        btVector3 vfrom = from_vec3(scp.from);
-        btVector3 vto = from_vec3(scp.to);
+        btVector3 vfrom = from_vec3(start);
+        btVector3 vto = from_vec3(end);
 
-        btSphereShape shape = btSphereShape(btScalar(scp.dimension.x));
+        btSphereShape shape = btSphereShape(btScalar(radius));
 
         btCollisionWorld::ClosestConvexResultCallback cast_callback =
             btCollisionWorld::ClosestConvexResultCallback(vfrom, vto);
-        cast_callback.m_collisionFilterMask = scp.mask;
-        cast_callback.m_collisionFilterGroup = scp.group;
+        cast_callback.m_collisionFilterMask = mask;
+        cast_callback.m_collisionFilterGroup = group;
 
         s_bullet_systems.dynamics_world->convexSweepTest((btConvexShape*)&shape, from, to, cast_callback);
 
-        cast_result sr;
-        sr.user_data = scp.user_data;
-
-        sr.physics_handle = -1;
+        result.physics_handle = -1;
         if (cast_callback.hasHit())
         {
             btRigidBody* body = (btRigidBody*)btRigidBody::upcast(cast_callback.m_hitCollisionObject);
 
             if (body)
             {
-                sr.physics_handle = body->getUserIndex();
-                sr.set = true;
+                result.physics_handle = get_physics_handle(body->getUserIndex());
+                result.set = true;
             }
 
-            sr.point = from_btvector(cast_callback.m_hitPointWorld);
-            sr.normal = from_btvector(cast_callback.m_hitNormalWorld);
+            result.point = from_btvector(cast_callback.m_hitPointWorld);
+            result.normal = from_btvector(cast_callback.m_hitNormalWorld);
         }
+    }
+
+    cast_result cast_ray_internal(const ray_cast_params& rcp)
+    {
+        cast_result rcr;
+        rcr.user_data = rcp.user_data;
+
+        ray_query(rcp.start, rcp.end, rcp.group, rcp.mask, rcr);
+
+        if (rcp.callback)
+            rcp.callback(rcr);
+
+        return rcr;
+    }
+
+    cast_result cast_sphere_internal(const sphere_cast_params& scp)
+    {
+        cast_result sr;
+        sr.user_data = scp.user_data;
+
+        sphere_query(scp.from, scp.to, scp.dimension.x, scp.group, scp.mask, sr);
 
         if (scp.callback)
             scp.callback(sr);
@@ -1037,7 +1432,7 @@ namespace physics
             {
                 c.group = colObj1Wrap->getCollisionObject()->getBroadphaseHandle()->m_collisionFilterGroup;
                 c.mask = colObj1Wrap->getCollisionObject()->getBroadphaseHandle()->m_collisionFilterMask;
-                c.physics_handle = colObj1Wrap->getCollisionObject()->getUserIndex();
+                c.physics_handle = get_physics_handle(colObj1Wrap->getCollisionObject()->getUserIndex());
 
                 c.pos = from_btvector(cp.m_positionWorldOnB);
             }
@@ -1045,7 +1440,7 @@ namespace physics
             {
                 c.group = colObj0Wrap->getCollisionObject()->getBroadphaseHandle()->m_collisionFilterGroup;
                 c.mask = colObj0Wrap->getCollisionObject()->getBroadphaseHandle()->m_collisionFilterMask;
-                c.physics_handle = colObj1Wrap->getCollisionObject()->getUserIndex();
+                c.physics_handle = get_physics_handle(colObj1Wrap->getCollisionObject()->getUserIndex());
 
                 c.pos = from_btvector(cp.m_positionWorldOnA);
             }
@@ -1073,6 +1468,533 @@ namespace physics
 
         ctp.callback(cb.ctr);
     }
+
+    // keeps only the deepest contact so batched tests need no allocation
+    class deepest_contact_processor : public btCollisionWorld::ContactResultCallback
+    {
+      public:
+        const btCollisionObject* ref_obj;
+        cast_result*             result;
+        btScalar                 distance = BT_LARGE_FLOAT;
+
+        btScalar addSingleResult(btManifoldPoint& cp, const btCollisionObjectWrapper* colObj0Wrap, int partId0, int index0,
+                                 const btCollisionObjectWrapper* colObj1Wrap, int partId1, int index1)
+        {
+            PEN_UNUSED(partId0);
+            PEN_UNUSED(index0);
+            PEN_UNUSED(partId1);
+            PEN_UNUSED(index1);
+
+            if (cp.getDistance() >= distance)
+                return 0.0f;
+
+            distance = cp.getDistance();
+
+            // normal points from the other object towards the tested one
+            if (ref_obj == colObj0Wrap->getCollisionObject())
+            {
+                result->physics_handle = get_physics_handle(colObj1Wrap->getCollisionObject()->getUserIndex());
+                result->point = from_btvector(cp.m_positionWorldOnB);
+                result->normal = from_btvector(cp.m_normalWorldOnB);
+            }
+            else
+            {
+                result->physics_handle = get_physics_handle(colObj0Wrap->getCollisionObject()->getUserIndex());
+                result->point = from_btvector(cp.m_positionWorldOnA);
+                result->normal = from_btvector(-cp.m_normalWorldOnB);
+            }
+
+            result->set = true;
+            return 0.0f;
+        }
+    };
+
+    void contact_query(u32 entity, u32 group, u32 mask, cast_result& result)
+    {
+        result.physics_handle = -1;
+
+        if (entity >= s_entities._capacity)
+            return;
+
+        btRigidBody* rb = s_entities.get(entity).rb.rigid_body;
+        if (!rb)
+            return;
+
+        deepest_contact_processor cb;
+        cb.ref_obj = rb;
+        cb.result = &result;
+        cb.m_collisionFilterGroup = group;
+        cb.m_collisionFilterMask = mask;
+
+        s_bullet_systems.dynamics_world->contactTest(rb, cb);
+    }
+
+    void query_batch_job(u32 start, u32 end, void* user_data)
+    {
+        query_batch* batch = (query_batch*)user_data;
+
+        for (u32 i = start; i < end; ++i)
+        {
+            const scene_query& q = batch->queries[i];
+            cast_result&       r = batch->results[i];
+
+            switch (q.type)
+            {
+                case e_query::ray:
+                    ray_query(q.from, q.to, q.group, q.mask, r);
+                    break;
+
+                case e_query::sphere:
+                    sphere_query(q.from, q.to, q.radius, q.group, q.mask, r);
+                    break;
+
+                default:
+                    break;
+            }
+        }
+    }
+
+    void cast_batch_internal(query_batch* batch)
+    {
+        for (u32 i = 0; i < batch->num_queries; ++i)
+            batch->results[i] = cast_result();
+
+        // rays and sweeps only read the world so they go wide, the world is not stepped while commands execute
+        static const u32 k_queries_per_job = 32;
+        pen::jobs_parallel_for(batch->num_queries, k_queries_per_job, query_batch_job, batch);
+
+        // contact tests add manifolds to the dispatcher, which is not thread safe
+        for (u32 i = 0; i < batch->num_queries; ++i)
+        {
+            const scene_query& q = batch->queries[i];
+            if (q.type == e_query::contact)
+                contact_query(get_physics_slot(q.entity), q.group, q.mask, batch->results[i]);
+        }
+
+        batch->complete = 1;
+    }
+
+    static const u32 k_snapshot_magic = 0x70687973; // phys
+    static const u32 k_snapshot_version = 2;
+
+    struct snapshot_header
+    {
+        u32 magic;
+        u32 version;
+        u32 num_bodies;
+        u32 num_constraints;
+        u32 num_multi_bodies;
+        f32 accumulator;
+    };
+
+    // transforms keep the full basis, a round trip through a quaternion is not bit exact
+    struct rb_snapshot
+    {
+        u32      handle;
+        s32      activation_state;
+        btScalar deactivation_time;
+        btScalar transform[12]; // basis rows then origin
+        btScalar velocity[6];   // linear then angular
+    };
+
+    struct constraint_snapshot
+    {
+        u32      handle;
+        u32      enabled;
+        btScalar applied_impulse;
+    };
+
+    struct multi_body_snapshot
+    {
+        u32      handle;
+        u32      awake;
+        u32      num_scalars; // joint positions then velocities of each link follow
+        btScalar transform[12];
+        btScalar velocity[6];
+    };
+
+    pen_inline void write_bttransform(const btTransform& t, btScalar* out)
+    {
+        const btMatrix3x3& basis = t.getBasis();
+        for (u32 r = 0; r < 3; ++r)
+            for (u32 c = 0; c < 3; ++c)
+                out[r * 3 + c] = basis[r][c];
+
+        for (u32 c = 0; c < 3; ++c)
+            out[9 + c] = t.getOrigin()[c];
+    }
+
+    pen_inline btTransform read_bttransform(const btScalar* in)
+    {
+        btTransform t;
+        t.getBasis().setValue(in[0], in[1], in[2], in[3], in[4], in[5], in[6], in[7], in[8]);
+        t.setOrigin(btVector3(in[9], in[10], in[11]));
+        return t;
+    }
+
+    pen_inline void write_btvectors(const btVector3& a, const btVector3& b, btScalar* out)
+    {
+        for (u32 c = 0; c < 3; ++c)
+        {
+            out[c] = a[c];
+            out[3 + c] = b[c];
+        }
+    }
+
+    pen_inline bool is_snapshot_rb(const physics_entity& entity)
+    {
+        if (entity.type != ENTITY_RIGID_BODY && entity.type != ENTITY_COMPOUND_RIGID_BODY)
+            return false;
+
+        return entity.rb.rigid_body != nullptr;
+    }
+
+    pen_inline bool is_snapshot_constraint(const physics_entity& entity)
+    {
+        if (entity.type != ENTITY_CONSTRAINT || entity.constraint.type == e_constraint::p2p_multi)
+            return false;
+
+        return entity.constraint.generic != nullptr;
+    }
+
+    pen_inline bool is_snapshot_multi_body(const physics_entity& entity)
+    {
+        return entity.type == ENTITY_MULTI_BODY && entity.mb.multi_body;
+    }
+
+    u32 get_num_joint_scalars(const btMultiBody* mb)
+    {
+        u32 num = 0;
+        for (s32 i = 0; i < mb->getNumLinks(); ++i)
+            num += mb->getLink(i).m_posVarCount + mb->getLink(i).m_dofCount;
+
+        return num;
+    }
+
+    // cached contacts and warm starting are dropped and the overlapping pairs are re-added in a fixed order, so the
+    // world only depends on the restored state and not on what happened after the snapshot was taken
+    void reset_contacts()
+    {
+        struct pair_order
+        {
+            bool operator()(const btBroadphasePair& a, const btBroadphasePair& b) const
+            {
+                if (a.m_pProxy0->m_uniqueId != b.m_pProxy0->m_uniqueId)
+                    return a.m_pProxy0->m_uniqueId < b.m_pProxy0->m_uniqueId;
+
+                return a.m_pProxy1->m_uniqueId < b.m_pProxy1->m_uniqueId;
+            }
+        };
+
+        btDynamicsWorld*        world = s_bullet_systems.dynamics_world;
+        btDispatcher*           dispatcher = world->getDispatcher();
+        btOverlappingPairCache* pair_cache = world->getBroadphase()->getOverlappingPairCache();
+
+        // the sweep moves incrementally to the restored aabbs, rebuilding it costs O(n^2)
+        world->updateAabbs();
+
+        btAlignedObjectArray<btBroadphasePair> pairs;
+        pairs.copyFromArray(pair_cache->getOverlappingPairArray());
+
+        for (s32 i = 0; i < pairs.size(); ++i)
+            pair_cache->removeOverlappingPair(pairs[i].m_pProxy0, pairs[i].m_pProxy1, dispatcher);
+
+        pairs.quickSort(pair_order());
+
+        for (s32 i = 0; i < pairs.size(); ++i)
+            pair_cache->addOverlappingPair(pairs[i].m_pProxy0, pairs[i].m_pProxy1);
+
+        s_bullet_systems.solver->reset();
+    }
+
+    void take_snapshot_internal(world_snapshot* snapshot)
+    {
+        static pen::timer* snapshot_timer = pen::timer_create();
+        pen::timer_start(snapshot_timer);
+
+        snapshot_header header;
+        header.magic = k_snapshot_magic;
+        header.version = k_snapshot_version;
+        header.num_bodies = 0;
+        header.num_constraints = 0;
+        header.num_multi_bodies = 0;
+        header.accumulator = s_fixed_step.accumulator;
+
+        u32 size = sizeof(snapshot_header);
+        for (u32 i = 0; i < s_entities._capacity; ++i)
+        {
+            const physics_entity& entity = s_entities.get(i);
+
+            if (is_snapshot_rb(entity))
+            {
+                header.num_bodies++;
+                size += sizeof(rb_snapshot);
+            }
+            else if (is_snapshot_constraint(entity))
+            {
+                header.num_constraints++;
+                size += sizeof(constraint_snapshot);
+            }
+            else if (is_snapshot_multi_body(entity))
+            {
+                header.num_multi_bodies++;
+                size += sizeof(multi_body_snapshot) + get_num_joint_scalars(entity.mb.multi_body) * sizeof(btScalar);
+            }
+        }
+
+        // the buffer keeps its capacity so snapshots every frame do not allocate
+        if (snapshot->data)
+            stb__sbn(snapshot->data) = 0;
+
+        u8* pos = sb_add(snapshot->data, size);
+        memcpy(pos, &header, sizeof(snapshot_header));
+        pos += sizeof(snapshot_header);
+
+        // records are grouped by type, in handle order
+        for (u32 i = 0; i < s_entities._capacity; ++i)
+        {
+            const physics_entity& entity = s_entities.get(i);
+            if (!is_snapshot_rb(entity))
+                continue;
+
+            const btRigidBody* rb = entity.rb.rigid_body;
+
+            rb_snapshot rs;
+            rs.handle = entity.handle;
+            rs.activation_state = rb->getActivationState();
+            rs.deactivation_time = rb->getDeactivationTime();
+            write_bttransform(rb->getWorldTransform(), rs.transform);
+            write_btvectors(rb->getLinearVelocity(), rb->getAngularVelocity(), rs.velocity);
+
+            memcpy(pos, &rs, sizeof(rb_snapshot));
+            pos += sizeof(rb_snapshot);
+        }
+
+        for (u32 i = 0; i < s_entities._capacity; ++i)
+        {
+            const physics_entity& entity = s_entities.get(i);
+            if (!is_snapshot_constraint(entity))
+                continue;
+
+            const btTypedConstraint* constraint = entity.constraint.generic;
+
+            constraint_snapshot cs;
+            cs.handle = entity.handle;
+            cs.enabled = constraint->isEnabled() ? 1 : 0;
+            cs.applied_impulse = constraint->getAppliedImpulse();
+
+            memcpy(pos, &cs, sizeof(constraint_snapshot));
+            pos += sizeof(constraint_snapshot);
+        }
+
+        for (u32 i = 0; i < s_entities._capacity; ++i)
+        {
+            const physics_entity& entity = s_entities.get(i);
+            if (!is_snapshot_multi_body(entity))
+                continue;
+
+            const btMultiBody* mb = entity.mb.multi_body;
+
+            multi_body_snapshot ms;
+            ms.handle = entity.handle;
+            ms.awake = mb->isAwake() ? 1 : 0;
+            ms.num_scalars = get_num_joint_scalars(mb);
+            write_bttransform(mb->getBaseWorldTransform(), ms.transform);
+            write_btvectors(mb->getBaseVel(), mb->getBaseOmega(), ms.velocity);
+
+            memcpy(pos, &ms, sizeof(multi_body_snapshot));
+            pos += sizeof(multi_body_snapshot);
+
+            for (s32 l = 0; l < mb->getNumLinks(); ++l)
+            {
+                u32 num_pos = mb->getLink(l).m_posVarCount * sizeof(btScalar);
+                memcpy(pos, mb->getJointPosMultiDof(l), num_pos);
+                pos += num_pos;
+
+                u32 num_vel = mb->getLink(l).m_dofCount * sizeof(btScalar);
+                memcpy(pos, mb->getJointVelMultiDof(l), num_vel);
+                pos += num_vel;
+            }
+        }
+
+        snapshot->time_ms = (f32)pen::timer_elapsed_ms(snapshot_timer);
+        snapshot->complete = 1;
+    }
+
+    // the entity a record was taken from, or null if it has been released and its slot possibly reused since
+    physics_entity* get_snapshot_entity(u32 handle)
+    {
+        u32 slot = pen::slot_resources_handle_slot(handle);
+        if (slot >= s_entities._capacity)
+            return nullptr;
+
+        physics_entity& entity = s_entities.get(slot);
+        if (entity.type == ENTITY_NULL || entity.handle != handle)
+            return nullptr;
+
+        return &entity;
+    }
+
+    // the blob is caller owned, so every record is checked to fit before anything is restored from it
+    bool validate_snapshot(const u8* data, u32 size, const snapshot_header& header)
+    {
+        const u8* end = data + size;
+        const u8* pos = data + sizeof(snapshot_header);
+
+        u64 fixed_size = (u64)header.num_bodies * sizeof(rb_snapshot);
+        fixed_size += (u64)header.num_constraints * sizeof(constraint_snapshot);
+        if (fixed_size > (u64)(end - pos))
+            return false;
+
+        pos += fixed_size;
+
+        for (u32 i = 0; i < header.num_multi_bodies; ++i)
+        {
+            if (sizeof(multi_body_snapshot) > (size_t)(end - pos))
+                return false;
+
+            multi_body_snapshot ms;
+            memcpy(&ms, pos, sizeof(multi_body_snapshot));
+            pos += sizeof(multi_body_snapshot);
+
+            u64 joints_size = (u64)ms.num_scalars * sizeof(btScalar);
+            if (joints_size > (u64)(end - pos))
+                return false;
+
+            pos += joints_size;
+        }
+
+        return pos == end;
+    }
+
+    void restore_snapshot_internal(world_snapshot* snapshot)
+    {
+        static pen::timer* snapshot_timer = pen::timer_create();
+        pen::timer_start(snapshot_timer);
+
+        const u8* pos = snapshot->data;
+        u32       size = sb_count(snapshot->data);
+
+        snapshot_header header;
+        if (size < sizeof(snapshot_header))
+        {
+            PEN_LOG("[physics] restore snapshot: the snapshot is empty\n");
+            snapshot->complete = 1;
+            return;
+        }
+
+        memcpy(&header, pos, sizeof(snapshot_header));
+        pos += sizeof(snapshot_header);
+
+        if (header.magic != k_snapshot_magic || header.version != k_snapshot_version)
+        {
+            PEN_LOG("[physics] restore snapshot: unknown snapshot version\n");
+            snapshot->complete = 1;
+            return;
+        }
+
+        if (!validate_snapshot(snapshot->data, size, header))
+        {
+            PEN_LOG("[physics] restore snapshot: record counts do not match the snapshot size\n");
+            snapshot->complete = 1;
+            return;
+        }
+
+        // records for entities that were released, changed type, or whose slot was reused since the take are skipped
+        for (u32 i = 0; i < header.num_bodies; ++i)
+        {
+            rb_snapshot rs;
+            memcpy(&rs, pos, sizeof(rb_snapshot));
+            pos += sizeof(rb_snapshot);
+
+            physics_entity* entity = get_snapshot_entity(rs.handle);
+            if (!entity || !is_snapshot_rb(*entity))
+                continue;
+
+            btRigidBody* rb = entity->rb.rigid_body;
+            btTransform  t = read_bttransform(rs.transform);
+
+            // velocities first, setting the transform copies them into the interpolation state
+            rb->setLinearVelocity(btVector3(rs.velocity[0], rs.velocity[1], rs.velocity[2]));
+            rb->setAngularVelocity(btVector3(rs.velocity[3], rs.velocity[4], rs.velocity[5]));
+            rb->setCenterOfMassTransform(t);
+            rb->clearForces();
+
+            // kinematic bodies read their transform back from the motion state each step
+            if (rb->getMotionState())
+                rb->getMotionState()->setWorldTransform(t);
+
+            rb->forceActivationState(rs.activation_state);
+            rb->setDeactivationTime(rs.deactivation_time);
+
+            reset_published(pen::slot_resources_handle_slot(rs.handle), t);
+        }
+
+        for (u32 i = 0; i < header.num_constraints; ++i)
+        {
+            constraint_snapshot cs;
+            memcpy(&cs, pos, sizeof(constraint_snapshot));
+            pos += sizeof(constraint_snapshot);
+
+            physics_entity* entity = get_snapshot_entity(cs.handle);
+            if (!entity || !is_snapshot_constraint(*entity))
+                continue;
+
+            btTypedConstraint* constraint = entity->constraint.generic;
+            constraint->setEnabled(cs.enabled != 0);
+            constraint->internalSetAppliedImpulse(cs.applied_impulse);
+        }
+
+        for (u32 i = 0; i < header.num_multi_bodies; ++i)
+        {
+            multi_body_snapshot ms;
+            memcpy(&ms, pos, sizeof(multi_body_snapshot));
+            pos += sizeof(multi_body_snapshot);
+
+            const u8* joints = pos;
+            pos += ms.num_scalars * sizeof(btScalar);
+
+            physics_entity* entity = get_snapshot_entity(ms.handle);
+            if (!entity || !is_snapshot_multi_body(*entity))
+                continue;
+
+            btMultiBody* mb = entity->mb.multi_body;
+            if (get_num_joint_scalars(mb) != ms.num_scalars)
+                continue;
+
+            mb->setBaseWorldTransform(read_bttransform(ms.transform));
+            mb->setBaseVel(btVector3(ms.velocity[0], ms.velocity[1], ms.velocity[2]));
+            mb->setBaseOmega(btVector3(ms.velocity[3], ms.velocity[4], ms.velocity[5]));
+
+            for (s32 l = 0; l < mb->getNumLinks(); ++l)
+            {
+                // positions and velocities are at most a quaternion and 3 dofs per link
+                btScalar q[4];
+                u32      num_pos = mb->getLink(l).m_posVarCount;
+                memcpy(q, joints, num_pos * sizeof(btScalar));
+                joints += num_pos * sizeof(btScalar);
+                mb->setJointPosMultiDof(l, q);
+
+                btScalar qd[6];
+                u32      num_vel = mb->getLink(l).m_dofCount;
+                memcpy(qd, joints, num_vel * sizeof(btScalar));
+                joints += num_vel * sizeof(btScalar);
+                mb->setJointVelMultiDof(l, qd);
+            }
+
+            if (ms.awake)
+                mb->wakeUp();
+            else
+                mb->goToSleep();
+        }
+
+        s_fixed_step.accumulator = header.accumulator;
+
+        reset_contacts();
+
+        snapshot->time_ms = (f32)pen::timer_elapsed_ms(snapshot_timer);
+        snapshot->complete = 1;
+    }
 } // namespace physics
 
 #if PICKING_REFERENCE // reference
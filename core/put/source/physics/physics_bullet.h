@@ -17,6 +17,11 @@
 #include "BulletDynamics/Featherstone/btMultiBodyPoint2Point.h"
 #include "btBulletDynamicsCommon.h"
 
+// for the multithreaded world
+#include "BulletCollision/CollisionDispatch/btCollisionDispatcherMt.h"
+#include "BulletDynamics/Dynamics/btDiscreteDynamicsWorldMt.h"
+#include "LinearMath/btThreads.h"
+
 namespace physics
 {
     enum e_entity_type
@@ -83,6 +88,7 @@ namespace physics
 
         u32 group;
         u32 mask;
+        u32 handle; // versioned handle it was created with, snapshot records are matched against it
 
         physics_entity(){};
         ~physics_entity(){};
@@ -95,6 +101,7 @@ namespace physics
         btBroadphaseInterface*           olp_cache;
         btConstraintSolver*              solver;
         btDynamicsWorld*                 dynamics_world;
+        bool                             multithreaded = false;
     };
 
     struct bullet_objects
@@ -118,9 +125,10 @@ namespace physics
             b_paused = 0;
         }
 
-        a_u32                                   b_paused;
-        pen::multi_buffer<mat4*, 2>             output_matrices;
-        pen::multi_buffer<maths::transform*, 2> output_transforms;
+        a_u32                             b_paused;
+        pen::multi_buffer<mat4*, 2>       output_matrices;
+        pen::triple_buffer<pose_stream>   output_poses; // the user thread holds one while physics writes the others
+        pen::multi_buffer<step_stats, 2>  output_stats;
     };
 
     extern readable_data g_readable_data;
@@ -128,6 +136,11 @@ namespace physics
     void physics_update(f32 dt);
     void physics_initialise();
 
+    // convert between the versioned handles given to the caller and the slots used by the physics thread
+    u32 get_physics_slot(u32 handle);
+    u32 get_physics_handle(u32 slot);
+    void set_entity_handle(u32 resource_slot, u32 handle);
+
     btRigidBody* create_rb_internal(physics_entity& entity, const rigid_body_params& params, u32 ghost,
                                     btCollisionShape* p_existing_shape = NULL);
 
@@ -156,6 +169,8 @@ namespace physics
     void set_group_internal(const set_group_params& cmd);
     void set_damping_internal(const set_v3_params& cmd);
     void set_p2p_constraint_pos_internal(const set_v3_params& cmd);
+    void set_fixed_timestep_internal(const fixed_timestep_params& params);
+    void set_num_threads_internal(u32 num_threads);
 
     void sync_rigid_bodies_internal(const sync_rb_params& cmd);
     void sync_rigid_body_velocity_internal(const sync_rb_params& cmd);
@@ -171,6 +186,10 @@ namespace physics
     cast_result cast_ray_internal(const ray_cast_params& rcp);
     cast_result cast_sphere_internal(const sphere_cast_params& ccp);
     void        contact_test_internal(const contact_test_params& ctp);
+    void        cast_batch_internal(query_batch* batch);
+
+    void take_snapshot_internal(world_snapshot* snapshot);
+    void restore_snapshot_internal(world_snapshot* snapshot);
 
     void add_central_force(const set_v3_params& cmd);
     void add_central_impulse(const set_v3_params& cmd);
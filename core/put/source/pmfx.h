@@ -74,6 +74,7 @@ namespace put
         hash_id         id_technique = 0;
         u32             permutation = 0;
         ecs::ecs_scene* scene = nullptr;
+        hash_id         id_name = 0;
     };
 
     struct scene_view_renderer
@@ -326,6 +327,7 @@ namespace put
 
         void set_technique(u32 shader, u32 technique_index);
         bool set_technique_perm(u32 shader, hash_id id_technique, u32 permutation = 0);
+        void load_technique(u32 shader, u32 technique_index); // lazy loads once, so set can be called from job threads
 
         void initialise_constant_defaults(u32 shader, u32 technique_index, f32* data);
         void initialise_sampler_defaults(u32 handle, u32 technique_index, sampler_set& samplers);
@@ -340,6 +342,7 @@ namespace put
         technique_constant* get_technique_constants(u32 shader, u32 technique_index);
         technique_constant* get_technique_constant(hash_id id_constant, u32 shader, u32 technique_index);
         u32                 get_technique_cbuffer_size(u32 shader, u32 technique_index);
+        u32                 get_technique_permutation_id(u32 shader, u32 technique_index); // e_shader_permutation bits
         technique_sampler*  get_technique_samplers(u32 shader, u32 technique_index);
         technique_sampler*  get_technique_sampler(hash_id id_sampler, u32 shader, u32 technique_index);
 
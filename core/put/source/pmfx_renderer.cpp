@@ -2775,6 +2775,7 @@ namespace put
         {
             scene_view sv;
             sv.scene = v.scene;
+            sv.id_name = v.id_name;
             for (s32 rf = 0; rf < v.render_functions.size(); ++rf)
                 v.render_functions[rf](sv);
         }
@@ -2845,6 +2846,7 @@ namespace put
             {
                 scene_view sv;
                 sv.scene = v.scene;
+                sv.id_name = v.id_name;
                 sv.render_flags = v.render_flags;
                 sv.id_technique = v.id_technique;
                 sv.camera = v.camera;
@@ -2923,6 +2925,7 @@ namespace put
             // build scene view info
             scene_view sv;
             sv.scene = v.scene;
+            sv.id_name = v.id_name;
             sv.render_flags = v.render_flags;
             sv.id_technique = v.id_technique;
             sv.raster_state = v.raster_state;
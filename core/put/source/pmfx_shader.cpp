@@ -726,6 +726,25 @@ namespace put
             return s_pmfx_list[shader].techniques[technique_index].technique_constant_size;
         }
 
+        u32 get_technique_permutation_id(u32 shader, u32 technique_index)
+        {
+            if (shader >= (u32)sb_count(s_pmfx_list))
+                return 0;
+
+            if (technique_index >= (u32)sb_count(s_pmfx_list[shader].techniques))
+                return 0;
+
+            return s_pmfx_list[shader].techniques[technique_index].permutation_id;
+        }
+
+        void load_technique(u32 shader, u32 technique_index)
+        {
+            if (technique_index >= (u32)sb_count(s_pmfx_list[shader].techniques))
+                return;
+
+            lazy_load_shader_technique(s_pmfx_list[shader].techniques[technique_index], shader);
+        }
+
         void set_technique(u32 shader, u32 technique_index)
         {
             if (technique_index >= sb_count(s_pmfx_list[shader].techniques))
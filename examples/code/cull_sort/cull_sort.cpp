@@ -1,4 +1,6 @@
 #include "../example_common.h"
+#include "ecs/ecs_cull.h"
+#include "ecs/ecs_transform.h"
 
 using namespace put;
 using namespace ecs;
@@ -19,6 +21,129 @@ namespace pen
     }
 } // namespace pen
 
+namespace
+{
+    // averaged over a few runs so a single button press gives stable numbers
+    const u32 k_bench_iterations = 8;
+    const u32 k_num_kernels = 4;
+
+    typedef void (*entity_kernel)(ecs_scene*, const u32*, u32);
+    const c8*     k_kernel_names[] = {"Compose TRS", "Multiply Parents", "Transform AABBs", "Normal Matrices"};
+    entity_kernel k_scalar_kernels[] = {compose_trs_scalar, multiply_parents_scalar, transform_aabbs_scalar,
+                                        normal_matrices_scalar};
+    entity_kernel k_simd_kernels[] = {compose_trs, multiply_parents, transform_aabbs, normal_matrices};
+
+    struct benchmark_results
+    {
+        f32 linear_ms = 0.0f;
+        f32 fused_ms = 0.0f;
+        f32 bvh_ms = 0.0f;
+        u32 linear_visible = 0;
+        u32 fused_visible = 0;
+        u32 bvh_visible = 0;
+        u32 kernel_entities = 0;
+        f32 kernel_ms[k_num_kernels][2] = {};
+    };
+
+    benchmark_results s_results;
+    ecs_scene*        s_scratch = nullptr;
+
+    template <typename T>
+    void copy_components(const cmp_array<T>& src, cmp_array<T>& dst, u32 count)
+    {
+        dst.data = (T*)pen::memory_realloc(dst.data, count * sizeof(T));
+        memcpy(dst.data, src.data, count * sizeof(T));
+    }
+
+    // the transform kernels write matrices and bounds, so they run on a copy of the components they touch
+    void update_scratch_scene(const ecs_scene* scene)
+    {
+        if (!s_scratch)
+            s_scratch = new ecs_scene();
+
+        u32 count = scene->num_entities;
+        copy_components(scene->entities, s_scratch->entities, count);
+        copy_components(scene->parents, s_scratch->parents, count);
+        copy_components(scene->transforms, s_scratch->transforms, count);
+        copy_components(scene->local_matrices, s_scratch->local_matrices, count);
+        copy_components(scene->world_matrices, s_scratch->world_matrices, count);
+        copy_components(scene->bounding_volumes, s_scratch->bounding_volumes, count);
+        copy_components(scene->pos_extent, s_scratch->pos_extent, count);
+        copy_components(scene->draw_call_data, s_scratch->draw_call_data, count);
+
+        s_scratch->num_entities = count;
+        s_scratch->soa_size = count;
+    }
+
+    // culls take a const scene and only write their own output lists
+    void run_benchmarks(const ecs_scene* scene, camera& cam)
+    {
+        benchmark_results& r = s_results;
+        pen::timer*        t = pen::timer_create();
+
+        r.linear_ms = r.fused_ms = r.bvh_ms = 0.0f;
+        for (u32 i = 0; i < k_bench_iterations; ++i)
+        {
+            u32* filtered = nullptr;
+            u32* linear_culled = nullptr;
+            pen::timer_start(t);
+            filter_entities_scalar(scene, &filtered);
+            frustum_cull_aabb_scalar(scene, &cam, filtered, &linear_culled);
+            r.linear_ms += (f32)pen::timer_elapsed_ms(t);
+
+            u32* fused_culled = nullptr;
+            pen::timer_start(t);
+            filter_frustum_cull_aabb(scene, &cam, &fused_culled);
+            r.fused_ms += (f32)pen::timer_elapsed_ms(t);
+
+            u32* bvh_culled = nullptr;
+            pen::timer_start(t);
+            bvh_query_frustum(scene, cam.camera_frustum, &bvh_culled);
+            r.bvh_ms += (f32)pen::timer_elapsed_ms(t);
+
+            r.linear_visible = sb_count(linear_culled);
+            r.fused_visible = sb_count(fused_culled);
+            r.bvh_visible = sb_count(bvh_culled);
+
+            sb_free(filtered);
+            sb_free(linear_culled);
+            sb_free(fused_culled);
+            sb_free(bvh_culled);
+        }
+
+        r.linear_ms /= (f32)k_bench_iterations;
+        r.fused_ms /= (f32)k_bench_iterations;
+        r.bvh_ms /= (f32)k_bench_iterations;
+
+        // scalar against simd transform kernels over every entity
+        update_scratch_scene(scene);
+
+        u32* entities = nullptr;
+        for (u32 n = 0; n < s_scratch->num_entities; ++n)
+            if (s_scratch->entities[n] & e_cmp::allocated)
+                sb_push(entities, n);
+
+        u32 count = sb_count(entities);
+        r.kernel_entities = count;
+
+        for (u32 k = 0; k < k_num_kernels; ++k)
+        {
+            entity_kernel kernels[] = {k_scalar_kernels[k], k_simd_kernels[k]};
+            for (u32 v = 0; v < 2; ++v)
+            {
+                pen::timer_start(t);
+                for (u32 i = 0; i < k_bench_iterations; ++i)
+                    kernels[v](s_scratch, entities, count);
+
+                r.kernel_ms[k][v] = (f32)pen::timer_elapsed_ms(t) / (f32)k_bench_iterations;
+            }
+        }
+
+        sb_free(entities);
+        pen::timer_destroy(t);
+    }
+} // namespace
+
 void example_setup(ecs::ecs_scene* scene, camera& cam)
 {
     scene->view_flags &= ~e_scene_view_flags::hide_debug;
@@ -80,4 +205,91 @@ void example_setup(ecs::ecs_scene* scene, camera& cam)
 
 void example_update(ecs::ecs_scene* scene, camera& cam, f32 dt)
 {
+    // render thread cmd stream cost, to compare cmd encodings
+    pen::renderer_cmd_stats cs;
+    pen::renderer_get_cmd_stats(cs);
+
+    pen::renderer_frame_stats fs;
+    pen::renderer_get_frame_stats(fs);
+
+    ImGui::Begin("Cmd Buffer", nullptr, ImGuiWindowFlags_AlwaysAutoResize);
+    ImGui::Text("Entities: %i", (u32)scene->num_entities);
+    ImGui::Text("Cmds / Frame: %u", cs.cmds);
+    ImGui::Text("Bytes / Frame: %2.2f kb packed, %2.2f kb fixed size", (f32)cs.bytes / 1024.0f,
+                (f32)cs.fixed_bytes / 1024.0f);
+    ImGui::Text("Render Thread Consume: %2.2f ms", cs.consume_ms);
+    ImGui::Text("Draw Calls: %u (%u instances)", fs.draw_calls, fs.instances);
+    ImGui::Text("State Changes: %u", fs.state_changes);
+    ImGui::Text("Uploaded: %2.2f kb", (f32)fs.bytes_uploaded / 1024.0f);
+    ImGui::Text("CBuffer Uploads: %u draw calls, %u materials", scene->upload_stats.draw_calls,
+                scene->upload_stats.materials);
+
+    // sorted render queue per view
+    bool auto_instance = !(scene->flags & e_scene_flags::no_auto_instance);
+    if (ImGui::Checkbox("Auto Instance", &auto_instance))
+        scene->flags ^= e_scene_flags::no_auto_instance;
+
+    u32 num_views = sb_count(scene->view_stats);
+    for (u32 i = 0; i < num_views; ++i)
+    {
+        const view_render_stats& vs = scene->view_stats[i];
+        ImGui::Text("View %08x: %u entities, %u draws, %u state changes, %u instanced", vs.id_view, vs.entities,
+                    vs.draw_calls, vs.state_changes, vs.instanced);
+    }
+
+    // clustered lights, the last build is for the last forward lit view
+    bool light_clusters = !(scene->flags & e_scene_flags::no_light_clusters);
+    if (ImGui::Checkbox("Light Clusters", &light_clusters))
+        scene->flags ^= e_scene_flags::no_light_clusters;
+
+    ImGui::Text("Clustered Lights: %u (%u dropped)", scene->clustered_lights.num_visible,
+                scene->clustered_lights.num_dropped);
+
+    // component memory with large sparse components in dense arrays or chunked pools
+    bool chunked = has_chunked_storage(scene);
+    if (ImGui::Checkbox("Chunked Storage", &chunked))
+        set_chunked_storage(scene, chunked);
+
+    chunked_storage_stats css;
+    get_chunked_storage_stats(scene, css);
+    ImGui::Text("Component Memory: %2.2f mb dense, %2.2f mb pooled (%u pooled components)",
+                (f32)css.dense_bytes / (1024.0f * 1024.0f), (f32)css.pooled_bytes / (1024.0f * 1024.0f), css.live);
+    ImGui::End();
+
+    // benchmarks are costly over every entity so they only run when asked for
+    static bool run_continuous = false;
+    static bool has_results = false;
+
+    bool linear = scene->flags & e_scene_flags::linear_cull;
+
+    ImGui::Begin("Benchmarks", nullptr, ImGuiWindowFlags_AlwaysAutoResize);
+    bool run = ImGui::Button("Run");
+    ImGui::SameLine();
+    ImGui::Checkbox("Continuous", &run_continuous);
+
+    if (run || run_continuous)
+    {
+        run_benchmarks(scene, cam);
+        has_results = true;
+    }
+
+    if (ImGui::Checkbox("Linear Cull", &linear))
+        scene->flags ^= e_scene_flags::linear_cull;
+
+    ImGui::Text("BVH Leaves: %u, Reinserted: %u", scene->spatial_index.num_leaves, scene->spatial_index.num_reinserted);
+
+    if (has_results)
+    {
+        const benchmark_results& r = s_results;
+        ImGui::Separator();
+        ImGui::Text("Linear Cull: %2.3f ms (%u visible)", r.linear_ms, r.linear_visible);
+        ImGui::Text("Fused SIMD Cull: %2.3f ms (%u visible)", r.fused_ms, r.fused_visible);
+        ImGui::Text("BVH Cull: %2.3f ms (%u visible)", r.bvh_ms, r.bvh_visible);
+
+        ImGui::Separator();
+        ImGui::Text("Transform Kernels: %u entities", r.kernel_entities);
+        for (u32 k = 0; k < k_num_kernels; ++k)
+            ImGui::Text("%s: scalar %2.3f ms, simd %2.3f ms", k_kernel_names[k], r.kernel_ms[k][0], r.kernel_ms[k][1]);
+    }
+    ImGui::End();
 }
@@ -0,0 +1,364 @@
+#define CATCH_CONFIG_RUNNER
+#define CATCH_CONFIG_NO_POSIX_SIGNALS // catch 2.4.1 signal handling does not build with newer glibc
+#include "catch/catch.hpp"
+
+#include "console.h"
+#include "data_struct.h"
+#include "os.h"
+#include "pen.h"
+#include "threads.h"
+#include "timer.h"
+
+#include <atomic>
+#include <fstream>
+#include <functional>
+#include <thread>
+#include <vector>
+
+// stress and capacity tests for the lockless containers in data_struct.h, run headless with -test.
+// catch assertions are not thread safe, so worker threads only record what they saw and the test thread checks it.
+
+void* pen::user_entry(void* params);
+namespace pen
+{
+    pen_creation_params pen_entry(int argc, char** argv)
+    {
+        PEN_UNUSED(argc);
+        PEN_UNUSED(argv);
+
+        pen::pen_creation_params p;
+        p.window_width = 1280;
+        p.window_height = 720;
+        p.window_title = "data_struct_tests";
+        p.window_sample_count = 1;
+        p.user_thread_function = user_entry;
+        p.flags = pen::e_pen_create_flags::console_app;
+        return p;
+    }
+} // namespace pen
+
+namespace
+{
+    using namespace pen;
+
+    f64 items_per_ms(u32 count, timer* t)
+    {
+        return (f64)count / timer_elapsed_ms(t);
+    }
+
+    // single producer single consumer, the consumer checks every item arrives once and in order
+    bool ring_buffer_spsc(full_policy policy, bool batched)
+    {
+        // spinning producers starve the consumer when cores are scarce, so they get a smaller run
+        const u32        k_count = policy == e_full_policy::spin ? 1 << 12 : 1 << 18;
+        static const u32 k_put_batch = 7;
+        static const u32 k_get_batch = 5;
+
+        ring_buffer<u32> rb;
+        rb.create(64, policy);
+
+        timer* t = timer_create();
+        timer_start(t);
+
+        std::thread producer([&]() {
+            if (!batched)
+            {
+                for (u32 i = 0; i < k_count; ++i)
+                    rb.put(i);
+
+                return;
+            }
+
+            u32 items[k_put_batch];
+            for (u32 i = 0; i < k_count; i += k_put_batch)
+            {
+                u32 num = k_count - i < k_put_batch ? k_count - i : k_put_batch;
+                for (u32 j = 0; j < num; ++j)
+                    items[j] = i + j;
+
+                rb.put_batch(items, num);
+            }
+        });
+
+        u32  expected = 0;
+        bool in_order = true;
+        while (expected < k_count)
+        {
+            if (batched)
+            {
+                u32 items[k_get_batch];
+                u32 num = rb.get_batch(items, k_get_batch);
+                if (num == 0)
+                    std::this_thread::yield();
+
+                for (u32 i = 0; i < num; ++i)
+                    in_order &= items[i] == expected++;
+
+                continue;
+            }
+
+            u32* item = rb.get();
+            if (item)
+                in_order &= *item == expected++;
+            else
+                std::this_thread::yield();
+        }
+
+        producer.join();
+
+        PEN_LOG("ring_buffer %s%s: %.0f items/ms\n", policy == e_full_policy::wait ? "wait" : "spin",
+                batched ? " batched" : "", items_per_ms(k_count, t));
+        timer_destroy(t);
+
+        return in_order && !rb.get();
+    }
+
+    // multiple producers and consumers, every item must be consumed exactly once and each producer's items must
+    // reach any one consumer in the order they were put
+    bool mpmc_queue_mpmc(full_policy policy)
+    {
+        static const u32 k_producers = 4;
+        static const u32 k_consumers = 4;
+        const u32        k_per_producer = policy == e_full_policy::spin ? 1 << 10 : 1 << 16;
+        const u32        k_total = k_producers * k_per_producer;
+
+        mpmc_queue<u32> q;
+        q.create(64, policy);
+
+        std::atomic<u32>         consumed = {0};
+        std::vector<u32>         received[k_consumers];
+        std::vector<std::thread> threads;
+
+        timer* t = timer_create();
+        timer_start(t);
+
+        for (u32 p = 0; p < k_producers; ++p)
+        {
+            threads.emplace_back([&q, p, k_per_producer]() {
+                for (u32 i = 0; i < k_per_producer; ++i)
+                    q.put(p << 24 | i);
+            });
+        }
+
+        for (u32 c = 0; c < k_consumers; ++c)
+        {
+            threads.emplace_back([&q, &consumed, &received, c, k_total]() {
+                u32 item;
+                while (consumed < k_total)
+                {
+                    if (!q.try_get(item))
+                    {
+                        std::this_thread::yield();
+                        continue;
+                    }
+
+                    received[c].push_back(item);
+                    consumed++;
+                }
+            });
+        }
+
+        for (auto& thread : threads)
+            thread.join();
+
+        PEN_LOG("mpmc_queue %s %ux%u: %.0f items/ms\n", policy == e_full_policy::wait ? "wait" : "spin", k_producers,
+                k_consumers, items_per_ms(k_total, t));
+        timer_destroy(t);
+
+        std::vector<u32> seen(k_total, 0);
+        for (u32 c = 0; c < k_consumers; ++c)
+        {
+            s32 last[k_producers];
+            for (u32 p = 0; p < k_producers; ++p)
+                last[p] = -1;
+
+            for (u32 item : received[c])
+            {
+                u32 p = item >> 24;
+                s32 i = (s32)(item & 0xffffff);
+                if (p >= k_producers || i >= (s32)k_per_producer || i <= last[p])
+                    return false;
+
+                last[p] = i;
+                seen[p * k_per_producer + i]++;
+            }
+        }
+
+        for (u32 i = 0; i < k_total; ++i)
+            if (seen[i] != 1)
+                return false;
+
+        return q.empty();
+    }
+
+    // puts one more item than fits on another thread, which must block until the consumer makes space
+    template <typename C>
+    bool blocks_until_space(C& container, std::function<void()> make_space)
+    {
+        std::atomic<bool> done = {false};
+        std::thread       producer([&]() {
+            container.put(0xffffffff);
+            done = true;
+        });
+
+        thread_sleep_ms(50);
+        bool blocked = !done;
+
+        make_space();
+        producer.join();
+
+        return blocked && done;
+    }
+} // namespace
+
+TEST_CASE("ring_buffer spsc keeps every item in order", "[ring_buffer]")
+{
+    REQUIRE(ring_buffer_spsc(e_full_policy::wait, false));
+    REQUIRE(ring_buffer_spsc(e_full_policy::spin, false));
+    REQUIRE(ring_buffer_spsc(e_full_policy::wait, true));
+    REQUIRE(ring_buffer_spsc(e_full_policy::spin, true));
+}
+
+TEST_CASE("ring_buffer fail policy drops items at capacity", "[ring_buffer]")
+{
+    ring_buffer<u32> rb;
+    rb.create(4, e_full_policy::fail);
+
+    for (u32 i = 0; i < 4; ++i)
+        REQUIRE(rb.put(i));
+
+    REQUIRE(!rb.put(4));
+
+    // the item handed out by get is still owned by the consumer until the next get
+    u32* item = rb.get();
+    REQUIRE(*item == 0);
+    REQUIRE(!rb.put(4));
+
+    item = rb.get();
+    REQUIRE(*item == 1);
+    REQUIRE(rb.put(4));
+
+    u32 items[8] = {5, 6, 7, 8, 9, 10};
+    REQUIRE(rb.put_batch(items, 3) == 0);
+
+    u32 out[8];
+    REQUIRE(rb.get_batch(out, 8) == 3);
+    REQUIRE(out[0] == 2);
+    REQUIRE(out[1] == 3);
+    REQUIRE(out[2] == 4);
+
+    // partial batches write what fits
+    REQUIRE(rb.put_batch(items, 6) == 4);
+    REQUIRE(rb.get_batch(out, 8) == 4);
+    REQUIRE(out[3] == 8);
+    REQUIRE(!rb.get());
+}
+
+TEST_CASE("ring_buffer wait and spin policies block at capacity", "[ring_buffer]")
+{
+    full_policy policies[] = {e_full_policy::wait, e_full_policy::spin};
+    for (full_policy policy : policies)
+    {
+        ring_buffer<u32> rb;
+        rb.create(4, policy);
+
+        for (u32 i = 0; i < 4; ++i)
+            REQUIRE(rb.put(i));
+
+        // the second get releases the first item
+        REQUIRE(blocks_until_space(rb, [&]() {
+            rb.get();
+            rb.get();
+        }));
+
+        u32 out[8];
+        REQUIRE(rb.get_batch(out, 8) == 3);
+        REQUIRE(out[2] == 0xffffffff);
+    }
+}
+
+TEST_CASE("mpmc_queue multiple producers and consumers lose and duplicate nothing", "[mpmc_queue]")
+{
+    REQUIRE(mpmc_queue_mpmc(e_full_policy::wait));
+    REQUIRE(mpmc_queue_mpmc(e_full_policy::spin));
+}
+
+TEST_CASE("mpmc_queue fail policy drops items at capacity", "[mpmc_queue]")
+{
+    mpmc_queue<u32> q;
+    q.create(8, e_full_policy::fail);
+
+    for (u32 i = 0; i < 8; ++i)
+        REQUIRE(q.try_put(i));
+
+    REQUIRE(!q.try_put(8));
+    REQUIRE(!q.put(8));
+
+    u32 items[4] = {8, 9, 10, 11};
+    REQUIRE(q.put_batch(items, 4) == 0);
+
+    u32 out[16];
+    REQUIRE(q.get_batch(out, 16) == 8);
+    for (u32 i = 0; i < 8; ++i)
+        REQUIRE(out[i] == i);
+
+    REQUIRE(q.empty());
+    REQUIRE(q.put_batch(items, 4) == 4);
+    REQUIRE(q.get_batch(out, 16) == 4);
+    REQUIRE(out[3] == 11);
+}
+
+TEST_CASE("mpmc_queue wait and spin policies block at capacity", "[mpmc_queue]")
+{
+    full_policy policies[] = {e_full_policy::wait, e_full_policy::spin};
+    for (full_policy policy : policies)
+    {
+        mpmc_queue<u32> q;
+        q.create(8, policy);
+
+        for (u32 i = 0; i < 8; ++i)
+            REQUIRE(q.put(i));
+
+        u32 item;
+        REQUIRE(blocks_until_space(q, [&]() { q.try_get(item); }));
+        REQUIRE(item == 0);
+
+        u32 out[16];
+        REQUIRE(q.get_batch(out, 16) == 8);
+        REQUIRE(out[7] == 0xffffffff);
+    }
+}
+
+void* pen::user_entry(void* params)
+{
+    // unpack the params passed to the thread and signal to the engine it ok to proceed
+    pen::job_thread_params* job_params = (pen::job_thread_params*)params;
+    pen::job*               p_thread_info = job_params->job_info;
+    pen::semaphore_post(p_thread_info->p_sem_continue, 1);
+
+    Catch::Session session;
+    s32            failed = session.run();
+    u32            tested = (u32)Catch::getRegistryHub().getTestCaseRegistry().getAllTests().size();
+
+    // results are read by run_tests.py from the working directory it runs the tests in
+    std::ofstream ofs("test_results/data_struct_tests.txt");
+    ofs << "{\"diffs\": " << failed << ", \"tested\": " << tested
+        << ", \"percentage\": " << 100.0f * (f32)failed / (f32)tested << "}";
+    ofs.close();
+
+    pen::os_terminate(failed ? 1 : 0);
+
+    for (;;)
+    {
+        // msg from the engine we want to terminate
+        if (pen::semaphore_try_wait(p_thread_info->p_sem_exit))
+            break;
+
+        pen::thread_sleep_ms(16);
+    }
+
+    // signal to the engine the thread has finished
+    pen::semaphore_post(p_thread_info->p_sem_terminated, 1);
+
+    return PEN_THREAD_OK;
+}
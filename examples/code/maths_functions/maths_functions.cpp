@@ -362,6 +362,7 @@ void test_ray_vs_aabb(ecs_scene* scene, bool initialise)
         dbg::add_point(ip, 0.5f, vec4f::white());
 
     scene->draw_call_data[aabb.node].v2 = col;
+    scene->state_flags[aabb.node] |= e_state::draw_call_dirty;
 }
 
 void test_ray_vs_obb(ecs_scene* scene, bool initialise)
@@ -440,6 +441,7 @@ void test_ray_vs_obb(ecs_scene* scene, bool initialise)
         dbg::add_point(ip, 0.5f, vec4f::white());
 
     scene->draw_call_data[obb.node].v2 = col;
+    scene->state_flags[obb.node] |= e_state::draw_call_dirty;
 }
 
 void test_point_plane_distance(ecs_scene* scene, bool initialise)
@@ -533,6 +535,7 @@ void test_sphere_vs_plane(ecs_scene* scene, bool initialise)
     ImGui::Text("Classification %s", classifications[c]);
 
     scene->draw_call_data[sphere.node].v2 = vec4f(classification_colours[c]);
+    scene->state_flags[sphere.node] |= e_state::draw_call_dirty;
 
     dbg::add_plane(plane.point, plane.normal);
 }
@@ -768,6 +771,8 @@ void test_sphere_vs_sphere(ecs_scene* scene, bool initialise)
 
     scene->draw_call_data[sphere0.node].v2 = vec4f(col);
     scene->draw_call_data[sphere1.node].v2 = vec4f(col);
+    scene->state_flags[sphere0.node] |= e_state::draw_call_dirty;
+    scene->state_flags[sphere1.node] |= e_state::draw_call_dirty;
 }
 
 void test_sphere_vs_aabb(ecs_scene* scene, bool initialise)
@@ -798,6 +803,8 @@ void test_sphere_vs_aabb(ecs_scene* scene, bool initialise)
 
     scene->draw_call_data[sphere.node].v2 = vec4f(col);
     scene->draw_call_data[aabb.node].v2 = vec4f(col);
+    scene->state_flags[sphere.node] |= e_state::draw_call_dirty;
+    scene->state_flags[aabb.node] |= e_state::draw_call_dirty;
 }
 
 void test_aabb_vs_aabb(ecs_scene* scene, bool initialise)
@@ -828,6 +835,8 @@ void test_aabb_vs_aabb(ecs_scene* scene, bool initialise)
 
     scene->draw_call_data[aabb0.node].v2 = vec4f(col);
     scene->draw_call_data[aabb1.node].v2 = vec4f(col);
+    scene->state_flags[aabb0.node] |= e_state::draw_call_dirty;
+    scene->state_flags[aabb1.node] |= e_state::draw_call_dirty;
 }
 
 void test_point_sphere(ecs_scene* scene, bool initialise)
@@ -864,6 +873,7 @@ void test_point_sphere(ecs_scene* scene, bool initialise)
     dbg::add_point(point.point, 0.4f, col);
 
     scene->draw_call_data[sphere.node].v2 = vec4f(col);
+    scene->state_flags[sphere.node] |= e_state::draw_call_dirty;
 }
 
 void test_point_cone(ecs_scene* scene, bool initialise)
@@ -901,6 +911,7 @@ void test_point_cone(ecs_scene* scene, bool initialise)
     dbg::add_point(point.point, 0.4f, col);
 
     scene->draw_call_data[cone.node].v2 = vec4f(col);
+    scene->state_flags[cone.node] |= e_state::draw_call_dirty;
 }
 
 void test_line_vs_line(ecs_scene* scene, bool initialise)
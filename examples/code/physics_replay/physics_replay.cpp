@@ -0,0 +1,269 @@
+#include "../example_common.h"
+
+#include <fstream>
+
+using namespace put;
+using namespace ecs;
+
+// replays the same steps from a physics snapshot several times and checks every replay matches byte for byte,
+// then checks truncated and inflated snapshots are rejected without touching the world, and that a body which reused
+// the slot of a released one is left alone by a restore.
+// runs headless when built with the null renderer (linux-null profile).
+
+namespace pen
+{
+    pen_creation_params pen_entry(int argc, char** argv)
+    {
+        PEN_UNUSED(argc);
+        PEN_UNUSED(argv);
+
+        pen::pen_creation_params p;
+        p.window_width = 1280;
+        p.window_height = 720;
+        p.window_title = "physics_replay";
+        p.window_sample_count = 4;
+        p.user_thread_function = user_entry;
+        p.flags = pen::e_pen_create_flags::renderer;
+        return p;
+    }
+} // namespace pen
+
+namespace
+{
+    const f32 k_step = 1.0f / 60.0f;
+    const u32 k_num_bodies = 512;
+    const u32 k_warm_up_steps = 30;
+    const u32 k_replay_steps = 120;
+    const u32 k_num_replays = 3;
+
+    // the physics thread only runs commands after a consume, the snapshot is the last command so its fence means
+    // every step before it has completed
+    void wait_for_snapshot(physics::world_snapshot* snapshot)
+    {
+        physics::physics_consume_command_buffer();
+        while (!physics::is_snapshot_complete(snapshot))
+            pen::thread_sleep_ms(1);
+    }
+
+    void run_steps(u32 num_steps, physics::world_snapshot* snapshot_after)
+    {
+        for (u32 i = 0; i < num_steps; ++i)
+            physics::step(k_step);
+
+        physics::take_snapshot(snapshot_after);
+        wait_for_snapshot(snapshot_after);
+    }
+
+    u32 count_diffs(const physics::world_snapshot& a, const physics::world_snapshot& b)
+    {
+        u32 size_a = sb_count(a.data);
+        u32 size_b = sb_count(b.data);
+        u32 size = min(size_a, size_b);
+
+        u32 diffs = max(size_a, size_b) - size;
+        for (u32 i = 0; i < size; ++i)
+            if (a.data[i] != b.data[i])
+                ++diffs;
+
+        return diffs;
+    }
+
+    // restores a copy of start with bytes cut from the end or bodies added to the header count, which must be
+    // rejected and leave the world as it was
+    bool rejects_snapshot(const physics::world_snapshot& start, u32 truncate, u32 add_bodies)
+    {
+        physics::world_snapshot before;
+        physics::world_snapshot after;
+        physics::world_snapshot corrupt;
+
+        physics::take_snapshot(&before);
+        wait_for_snapshot(&before);
+
+        u32 size = sb_count(start.data) - truncate;
+        u8* data = sb_add(corrupt.data, size);
+        memcpy(data, start.data, size);
+
+        // num_bodies is the third u32 of the header
+        u32 num_bodies;
+        memcpy(&num_bodies, data + sizeof(u32) * 2, sizeof(u32));
+        num_bodies += add_bodies;
+        memcpy(data + sizeof(u32) * 2, &num_bodies, sizeof(u32));
+
+        physics::restore_snapshot(&corrupt);
+        physics::take_snapshot(&after);
+        wait_for_snapshot(&after);
+
+        bool unchanged = count_diffs(before, after) == 0;
+
+        physics::release_snapshot(&before);
+        physics::release_snapshot(&after);
+        physics::release_snapshot(&corrupt);
+
+        return unchanged;
+    }
+
+    // releases a body and adds a new one into the slot it frees. restoring a snapshot taken before the release must
+    // skip the new body rather than write the released body's state onto it
+    bool skips_reused_slots(const physics::world_snapshot& start, ecs_scene* scene, u32 entity)
+    {
+        physics::world_snapshot before;
+        physics::world_snapshot after;
+
+        physics::restore_snapshot(&start);
+
+        u32 released = scene->physics_handles[entity];
+        physics::release_entity(released);
+
+        physics::rigid_body_params rbp = scene->physics_data[entity].rigid_body;
+        rbp.position.y += 50.0f;
+
+        u32 reused = physics::add_rb(rbp);
+        scene->physics_handles[entity] = reused;
+
+        physics::take_snapshot(&before);
+        wait_for_snapshot(&before);
+
+        // the world already matches start, so restoring it again must leave every record as it was
+        physics::restore_snapshot(&start);
+        physics::take_snapshot(&after);
+        wait_for_snapshot(&after);
+
+        bool same_slot = physics::pose_index(reused) == physics::pose_index(released);
+        bool unchanged = count_diffs(before, after) == 0;
+
+        physics::release_snapshot(&before);
+        physics::release_snapshot(&after);
+
+        return same_slot && unchanged;
+    }
+} // namespace
+
+void create_bodies(ecs_scene* scene)
+{
+    material_resource* default_material = get_material_resource(PEN_HASH("default_material"));
+    geometry_resource* box = get_geometry_resource(PEN_HASH("cube"));
+
+    // add light
+    u32 light = get_new_entity(scene);
+    scene->names[light] = "front_light";
+    scene->id_name[light] = PEN_HASH("front_light");
+    scene->lights[light].colour = vec3f::one();
+    scene->lights[light].direction = vec3f::one();
+    scene->lights[light].type = e_light_type::dir;
+    scene->transforms[light].translation = vec3f::zero();
+    scene->transforms[light].rotation = quat();
+    scene->transforms[light].scale = vec3f::one();
+    scene->entities[light] |= e_cmp::light;
+    scene->entities[light] |= e_cmp::transform;
+
+    // ground
+    u32 ground = get_new_entity(scene);
+    scene->names[ground] = "ground";
+    scene->transforms[ground].translation = vec3f::zero();
+    scene->transforms[ground].rotation = quat();
+    scene->transforms[ground].scale = vec3f(50.0f, 1.0f, 50.0f);
+    scene->entities[ground] |= e_cmp::transform;
+    scene->parents[ground] = ground;
+    instantiate_geometry(box, scene, ground);
+    instantiate_material(default_material, scene, ground);
+    instantiate_model_cbuffer(scene, ground);
+
+    scene->physics_data[ground].rigid_body.shape = physics::e_shape::box;
+    scene->physics_data[ground].rigid_body.mass = 0.0f;
+    instantiate_rigid_body(scene, ground);
+
+    // offset layers so the boxes topple into each other and keep colliding through the replay
+    u32 columns = 16;
+    f32 spacing = 2.2f;
+    f32 half = (f32)(columns - 1) * spacing * 0.5f;
+
+    for (u32 i = 0; i < k_num_bodies; ++i)
+    {
+        u32 c = i % (columns * columns);
+        u32 level = i / (columns * columns);
+
+        vec3f pos;
+        pos.x = (f32)(c % columns) * spacing - half + (level % 2) * 0.5f;
+        pos.y = 2.5f + (f32)level * spacing;
+        pos.z = (f32)(c / columns) * spacing - half;
+
+        u32 b = get_new_entity(scene);
+        scene->names[b] = "box";
+        scene->names[b].appendf("%i", b);
+        scene->transforms[b].rotation = quat();
+        scene->transforms[b].scale = vec3f(0.8f);
+        scene->transforms[b].translation = pos;
+        scene->entities[b] |= e_cmp::transform;
+        scene->parents[b] = b;
+        instantiate_geometry(box, scene, b);
+        instantiate_material(default_material, scene, b);
+        instantiate_model_cbuffer(scene, b);
+
+        scene->physics_data[b].rigid_body.shape = physics::e_shape::box;
+        scene->physics_data[b].rigid_body.mass = 1.0f;
+        instantiate_rigid_body(scene, b);
+    }
+}
+
+void example_setup(ecs_scene* scene, camera& cam)
+{
+    PEN_UNUSED(cam);
+
+    // replay is only bit exact with a fixed step on a single physics thread
+    physics::set_fixed_timestep(k_step, 1);
+    physics::set_num_threads(1);
+
+    create_bodies(scene);
+
+    physics::world_snapshot start;
+    physics::world_snapshot reference;
+    physics::world_snapshot replay;
+
+    run_steps(k_warm_up_steps, &start);
+
+    // restoring drops cached contacts, so the reference is a replay too rather than the run the snapshot came from
+    physics::restore_snapshot(&start);
+    run_steps(k_replay_steps, &reference);
+
+    u32 diffs = 0;
+    u32 tested = 0;
+    for (u32 r = 0; r < k_num_replays; ++r)
+    {
+        physics::restore_snapshot(&start);
+        run_steps(k_replay_steps, &replay);
+
+        u32 replay_diffs = count_diffs(reference, replay);
+        PEN_LOG("replay %i: %i diffs in %i bytes\n", r, replay_diffs, sb_count(reference.data));
+
+        diffs += replay_diffs;
+        tested += sb_count(reference.data);
+    }
+
+    // a truncated blob, one claiming a body more than it holds and one whose count overflows the record size
+    bool rejected = rejects_snapshot(start, 1, 0);
+    rejected &= rejects_snapshot(start, 0, 1);
+    rejected &= rejects_snapshot(start, 0, 0x80000000);
+    PEN_LOG("corrupt snapshots rejected: %s\n", rejected ? "yes" : "no");
+
+    bool skipped = skips_reused_slots(start, scene, scene->num_entities - 1);
+    PEN_LOG("reused slots skipped: %s\n", skipped ? "yes" : "no");
+
+    physics::release_snapshot(&start);
+    physics::release_snapshot(&reference);
+    physics::release_snapshot(&replay);
+
+    // results are read by run_tests.py from the working directory it runs the tests in
+    f32           percentage = tested ? 100.0f * (f32)diffs / (f32)tested : 100.0f;
+    std::ofstream ofs("test_results/physics_replay.txt");
+    ofs << "{\"diffs\": " << diffs << ", \"tested\": " << tested << ", \"percentage\": " << percentage << "}";
+    ofs.close();
+
+    pen::os_terminate(diffs == 0 && rejected && skipped ? 0 : 1);
+}
+
+void example_update(ecs::ecs_scene* scene, camera& cam, f32 dt)
+{
+    PEN_UNUSED(scene);
+    PEN_UNUSED(cam);
+    PEN_UNUSED(dt);
+}
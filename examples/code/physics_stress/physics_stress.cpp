@@ -0,0 +1,218 @@
+#include "../example_common.h"
+
+using namespace put;
+using namespace ecs;
+
+namespace pen
+{
+    pen_creation_params pen_entry(int argc, char** argv)
+    {
+        PEN_UNUSED(argc);
+        PEN_UNUSED(argv);
+
+        pen::pen_creation_params p;
+        p.window_width = 1280;
+        p.window_height = 720;
+        p.window_title = "physics_stress";
+        p.window_sample_count = 4;
+        p.user_thread_function = user_entry;
+        p.flags = pen::e_pen_create_flags::renderer;
+        return p;
+    }
+} // namespace pen
+
+namespace
+{
+    const s32 k_body_counts[] = {500, 1000, 2500, 5000, 10000};
+    const c8* k_body_count_names[] = {"500", "1000", "2500", "5000", "10000"};
+
+    s32 body_count_index = 3;
+    s32 num_threads = 1;
+
+    // averaged step time for each thread count at the current body count, 0 when not measured
+    f32 step_ms[64] = {0};
+
+    // a snapshot taken each frame to measure the cost, and one saved by the user to roll back to
+    physics::world_snapshot frame_snapshot;
+    physics::world_snapshot saved_snapshot;
+    bool                    snapshot_every_frame = false;
+    bool                    frame_snapshot_pending = false;
+    bool                    saved_snapshot_pending = false;
+    bool                    has_saved_snapshot = false;
+} // namespace
+
+void create_bodies(ecs_scene* scene, u32 num_bodies)
+{
+    clear_scene(scene);
+
+    material_resource* default_material = get_material_resource(PEN_HASH("default_material"));
+    geometry_resource* box = get_geometry_resource(PEN_HASH("cube"));
+
+    // add light
+    u32 light = get_new_entity(scene);
+    scene->names[light] = "front_light";
+    scene->id_name[light] = PEN_HASH("front_light");
+    scene->lights[light].colour = vec3f::one();
+    scene->lights[light].direction = vec3f::one();
+    scene->lights[light].type = e_light_type::dir;
+    scene->transforms[light].translation = vec3f::zero();
+    scene->transforms[light].rotation = quat();
+    scene->transforms[light].scale = vec3f::one();
+    scene->entities[light] |= e_cmp::light;
+    scene->entities[light] |= e_cmp::transform;
+
+    // ground
+    u32 ground = get_new_entity(scene);
+    scene->names[ground] = "ground";
+    scene->transforms[ground].translation = vec3f::zero();
+    scene->transforms[ground].rotation = quat();
+    scene->transforms[ground].scale = vec3f(50.0f, 1.0f, 50.0f);
+    scene->entities[ground] |= e_cmp::transform;
+    scene->parents[ground] = ground;
+    instantiate_geometry(box, scene, ground);
+    instantiate_material(default_material, scene, ground);
+    instantiate_model_cbuffer(scene, ground);
+
+    scene->physics_data[ground].rigid_body.shape = physics::e_shape::box;
+    scene->physics_data[ground].rigid_body.mass = 0.0f;
+    instantiate_rigid_body(scene, ground);
+
+    // columns of slightly offset boxes so they topple into each other, kept inside the broadphase bounds
+    u32 columns = 32;
+    f32 spacing = 2.2f;
+    f32 half = (f32)(columns - 1) * spacing * 0.5f;
+
+    for (u32 i = 0; i < num_bodies; ++i)
+    {
+        u32 c = i % (columns * columns);
+        u32 level = i / (columns * columns);
+
+        vec3f pos;
+        pos.x = (f32)(c % columns) * spacing - half + (level % 2) * 0.5f;
+        pos.y = 2.5f + (f32)level * spacing;
+        pos.z = (f32)(c / columns) * spacing - half;
+
+        u32 b = get_new_entity(scene);
+        scene->names[b] = "box";
+        scene->names[b].appendf("%i", b);
+        scene->transforms[b].rotation = quat();
+        scene->transforms[b].scale = vec3f(0.8f);
+        scene->transforms[b].translation = pos;
+        scene->entities[b] |= e_cmp::transform;
+        scene->parents[b] = b;
+        instantiate_geometry(box, scene, b);
+        instantiate_material(default_material, scene, b);
+        instantiate_model_cbuffer(scene, b);
+
+        scene->physics_data[b].rigid_body.shape = physics::e_shape::box;
+        scene->physics_data[b].rigid_body.mass = 1.0f;
+        instantiate_rigid_body(scene, b);
+    }
+
+    for (u32 i = 0; i < PEN_ARRAY_SIZE(step_ms); ++i)
+        step_ms[i] = 0.0f;
+
+    // handles are reused by the new bodies
+    has_saved_snapshot = false;
+}
+
+void example_setup(ecs_scene* scene, camera& cam)
+{
+    PEN_UNUSED(cam);
+
+    scene->view_flags &= ~e_scene_view_flags::hide_debug;
+    editor_set_transform_mode(e_transform_mode::physics);
+
+    create_bodies(scene, k_body_counts[body_count_index]);
+
+    // load physics stuff before calling update
+    physics::physics_consume_command_buffer();
+    pen::thread_sleep_ms(16);
+}
+
+void example_update(ecs::ecs_scene* scene, camera& cam, f32 dt)
+{
+    PEN_UNUSED(cam);
+    PEN_UNUSED(dt);
+
+    put::dev_ui::enable(true);
+
+    physics::step_stats stats = physics::get_step_stats();
+
+    // the physics thread takes part in bullet's loops alongside the workers
+    s32 max_threads = min<s32>((s32)pen::jobs_get_num_workers() + 1, PEN_ARRAY_SIZE(step_ms));
+
+    ImGui::Begin("Physics Stress", nullptr, ImGuiWindowFlags_AlwaysAutoResize);
+
+    if (ImGui::Combo("Bodies", &body_count_index, k_body_count_names, PEN_ARRAY_SIZE(k_body_count_names)))
+        create_bodies(scene, k_body_counts[body_count_index]);
+
+    if (ImGui::SliderInt("Threads", &num_threads, 1, max_threads))
+        physics::set_num_threads(num_threads);
+
+    if (ImGui::Button("Reset"))
+        create_bodies(scene, k_body_counts[body_count_index]);
+
+    ImGui::Separator();
+    ImGui::Text("Bodies: %u", stats.num_bodies);
+    ImGui::Text("Step: %2.2f ms (%u threads)", stats.step_ms, stats.num_threads);
+
+    if (stats.num_steps && stats.num_threads <= PEN_ARRAY_SIZE(step_ms))
+    {
+        f32& avg = step_ms[stats.num_threads - 1];
+        avg = avg == 0.0f ? stats.step_ms : avg * 0.95f + stats.step_ms * 0.05f;
+    }
+
+    // bodies settle over time so compare thread counts while the scene is still busy
+    ImGui::Separator();
+    ImGui::Text("Threads | Step ms | Speed up");
+    for (s32 i = 0; i < max_threads; ++i)
+    {
+        if (step_ms[i] == 0.0f)
+            continue;
+
+        f32 speed_up = step_ms[0] > 0.0f ? step_ms[0] / step_ms[i] : 0.0f;
+        ImGui::Text("%7i | %7.2f | %2.2fx", i + 1, step_ms[i], speed_up);
+    }
+
+    // rollback, the physics thread restores between steps
+    ImGui::Separator();
+    ImGui::Checkbox("Snapshot Every Frame", &snapshot_every_frame);
+
+    if (frame_snapshot_pending && physics::is_snapshot_complete(&frame_snapshot))
+        frame_snapshot_pending = false;
+
+    if (saved_snapshot_pending && physics::is_snapshot_complete(&saved_snapshot))
+        saved_snapshot_pending = false;
+
+    if (snapshot_every_frame && !frame_snapshot_pending)
+    {
+        physics::take_snapshot(&frame_snapshot);
+        frame_snapshot_pending = true;
+    }
+
+    if (ImGui::Button("Save") && !saved_snapshot_pending)
+    {
+        physics::take_snapshot(&saved_snapshot);
+        saved_snapshot_pending = true;
+        has_saved_snapshot = true;
+    }
+
+    ImGui::SameLine();
+    if (ImGui::Button("Restore") && !saved_snapshot_pending && has_saved_snapshot)
+    {
+        physics::restore_snapshot(&saved_snapshot);
+        saved_snapshot_pending = true;
+    }
+
+    if (!frame_snapshot_pending)
+    {
+        f32 kb = (f32)sb_count(frame_snapshot.data) / 1024.0f;
+        ImGui::Text("Snapshot: %2.2f kb, %2.3f ms", kb, frame_snapshot.time_ms);
+    }
+
+    if (has_saved_snapshot && !saved_snapshot_pending)
+        ImGui::Text("Last Save / Restore: %2.3f ms", saved_snapshot.time_ms);
+
+    ImGui::End();
+}
@@ -64,6 +64,7 @@ create_app_example( "dynamic_cubemap", script_path() )
 create_app_example( "blend_modes", script_path() )
 create_app_example( "entities", script_path() )
 create_app_example( "complex_rigid_bodies", script_path() )
+create_app_example( "physics_stress", script_path() )
 create_app_example( "basic_compute", script_path() )
 create_app_example( "area_lights", script_path() )
 create_app_example( "render_target_mip_maps", script_path() )
@@ -74,4 +75,6 @@ create_app_example( "compute_demo", script_path() )
 create_app_example( "global_illumination", script_path() )
 create_app_example( "cull_sort", script_path() )
 create_app_example( "game", script_path() )
+create_app_example( "data_struct_tests", script_path() )
+create_app_example( "physics_replay", script_path() )
 
@@ -42,6 +42,8 @@ project "bullet_monolithic"
 	}
 	
 	includedirs { "include" }
+	
+	defines { bullet_defines }
 				
 	configuration "Debug"
 		defines { "DEBUG" }
@@ -49,7 +51,7 @@ project "bullet_monolithic"
 		linkoptions { link_cmd }
 		symbols "On"
 		targetdir ("lib/" .. platform_dir)
-		targetname "bullet_monolithic_d"
+		targetname (bullet_lib .. "_d")
  
 	configuration "Release"
 		defines { "NDEBUG" }
@@ -57,4 +59,4 @@ project "bullet_monolithic"
 		optimize "Speed"
 		linkoptions { link_cmd }
 		targetdir ("lib/" .. platform_dir)
-		targetname "bullet_monolithic"
+		targetname (bullet_lib)
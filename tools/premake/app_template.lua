@@ -28,10 +28,18 @@ local function setup_linux()
 	add_pmtech_links()
 	links 
 	{ 
-		"pthread",
-		"GLEW",
-		"GLU",
-		"GL",
+		"pthread"
+	}
+	if renderer_dir ~= "null" then
+		links
+		{
+			"GLEW",
+			"GLU",
+			"GL"
+		}
+	end
+	links
+	{
 		"X11",
 		"fmod",
 		"dl"
@@ -148,10 +156,10 @@ local function setup_bullet()
 	}
 	
 	configuration "Debug"
-		links { "bullet_monolithic_d" }
+		links { bullet_lib .. "_d" }
 	
 	configuration "Release"
-		links { "bullet_monolithic" }
+		links { bullet_lib }
 	
 	configuration {}
 end
@@ -8,6 +8,11 @@ sdk_version = ""
 shared_libs_dir = ""
 pmtech_dir = "../"
 
+-- bullet is built threadsafe for btDiscreteDynamicsWorldMt, which changes the layout of its headers.
+-- the define lives here so bullet and put always agree, and the lib name carries it so stale libs fail to link.
+bullet_defines = { "BT_THREADSAFE=1" }
+bullet_lib = "bullet_monolithic_mt"
+
 -- setup functions
 function setup_from_options()
     if _OPTIONS["renderer"] then